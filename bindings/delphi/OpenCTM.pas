@@ -76,6 +76,8 @@ const
   CTM_METHOD_RAW        = $0201;
   CTM_METHOD_MG1        = $0202;
   CTM_METHOD_MG2        = $0203;
+  CTM_METHOD_MG3        = $0204;
+  CTM_METHOD_MG4        = $0205;
   CTM_VERTEX_COUNT      = $0301;
   CTM_TRIANGLE_COUNT    = $0302;
   CTM_HAS_NORMALS       = $0303;
@@ -34,6 +34,10 @@ elif method == CTM_METHOD_MG1:
     methodStr = "MG1"
 elif method == CTM_METHOD_MG2:
     methodStr = "MG2"
+elif method == CTM_METHOD_MG3:
+    methodStr = "MG3"
+elif method == CTM_METHOD_MG4:
+    methodStr = "MG4"
 else:
     methodStr = "Unknown"
 
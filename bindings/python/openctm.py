@@ -59,6 +59,8 @@ CTM_EXPORT = 0x0102
 CTM_METHOD_RAW = 0x0201
 CTM_METHOD_MG1 = 0x0202
 CTM_METHOD_MG2 = 0x0203
+CTM_METHOD_MG3 = 0x0204
+CTM_METHOD_MG4 = 0x0205
 CTM_VERTEX_COUNT = 0x0301
 CTM_TRIANGLE_COUNT = 0x0302
 CTM_HAS_NORMALS = 0x0303
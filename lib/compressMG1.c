@@ -26,6 +26,7 @@
 //-----------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "openctm.h"
 #include "internal.h"
@@ -35,52 +36,6 @@
 #endif
 
 
-//-----------------------------------------------------------------------------
-// _compareTriangle() - Comparator for the triangle sorting.
-//-----------------------------------------------------------------------------
-static int _compareTriangle(const void * elem1, const void * elem2)
-{
-  CTMuint * tri1 = (CTMuint *) elem1;
-  CTMuint * tri2 = (CTMuint *) elem2;
-  if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
-}
-
-//-----------------------------------------------------------------------------
-// _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
-// compression.
-//-----------------------------------------------------------------------------
-static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
-{
-  CTMuint * tri, tmp, i;
-
-  // Step 1: Make sure that the first index of each triangle is the smallest
-  // one (rotate triangle nodes if necessary)
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    tri = &aIndices[i * 3];
-    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[1];
-      tri[1] = tri[2];
-      tri[2] = tmp;
-    }
-    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[2];
-      tri[2] = tri[1];
-      tri[1] = tmp;
-    }
-  }
-
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
-}
-
 //-----------------------------------------------------------------------------
 // _ctmMakeIndexDeltas() - Calculate various forms of derivatives in order to
 // reduce data entropy.
@@ -137,57 +92,35 @@ static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCompressMesh_MG1() - Compress the mesh that is stored in the CTM
-// context, and write it the the output stream in the CTM context.
+// _ctmWriteSections_MG1() - Write all the sections of an MG1 mesh to the
+// stream, in the order given by the file format.
 //-----------------------------------------------------------------------------
-int _ctmCompressMesh_MG1(_CTMcontext * self)
+static int _ctmWriteSections_MG1(_CTMcontext * self,
+  _CTMpackedsection ** aSections)
 {
-  CTMuint * indices;
   _CTMfloatmap * map;
   CTMuint i;
-
-#ifdef __DEBUG_
-  printf("COMPRESSION METHOD: MG1\n");
-#endif
-
-  // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    indices[i] = self->mIndices[i];
-  _ctmReArrangeTriangles(self, indices);
-
-  // Calculate index deltas (entropy-reduction)
-  _ctmMakeIndexDeltas(self, indices);
+  size_t start;
 
   // Write triangle indices
 #ifdef __DEBUG_
   printf("Inidices: ");
 #endif
+  start = self->mWritePos;
   _ctmStreamWrite(self, (void *) "INDX", 4);
-  if(!_ctmStreamWritePackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
-  {
-    free((void *) indices);
+  if(!_ctmStreamWritePackedArray(self, aSections))
     return CTM_FALSE;
-  }
-
-  // Free temporary resources
-  free((void *) indices);
+  _ctmSectionSaved(self, _CTM_OUT_INDICES, start);
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: ");
 #endif
+  start = self->mWritePos;
   _ctmStreamWrite(self, (void *) "VERT", 4);
-  if(!_ctmStreamWritePackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
-  {
-    free((void *) indices);
+  if(!_ctmStreamWritePackedArray(self, aSections))
     return CTM_FALSE;
-  }
+  _ctmSectionSaved(self, _CTM_OUT_VERTICES, start);
 
   // Write normals
   if(self->mNormals)
@@ -195,37 +128,43 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Normals: ");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "NORM", 4);
-    if(!_ctmStreamWritePackedFloats(self, self->mNormals, self->mVertexCount, 3))
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
+    _ctmSectionSaved(self, _CTM_OUT_NORMALS, start);
   }
 
   // Write UV maps
   map = self->mUVMaps;
-  while(map)
+  for(i = 0; map; ++ i)
   {
 #ifdef __DEBUG_
     printf("UV coordinates (%s): ", map->mName ? map->mName : "no name");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "TEXC", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
-    if(!_ctmStreamWritePackedFloats(self, map->mValues, self->mVertexCount, 2))
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
+    _ctmSectionSaved(self, _CTM_OUT_UV_MAP_1 + i, start);
     map = map->mNext;
   }
 
   // Write attribute maps
   map = self->mAttribMaps;
-  while(map)
+  for(i = 0; map; ++ i)
   {
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): ", map->mName ? map->mName : "no name");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "ATTR", 4);
     _ctmStreamWriteSTRING(self, map->mName);
-    if(!_ctmStreamWritePackedFloats(self, map->mValues, self->mVertexCount, 4))
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
+    _ctmSectionSaved(self, _CTM_OUT_ATTRIB_MAP_1 + i, start);
     map = map->mNext;
   }
 
@@ -233,92 +172,222 @@ int _ctmCompressMesh_MG1(_CTMcontext * self)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmUncompressMesh_MG1() - Uncmpress the mesh from the input stream in the
-// CTM context, and store the resulting mesh in the CTM context.
+// _ctmCompressMesh_MG1() - Compress the mesh that is stored in the CTM
+// context, and write it the the output stream in the CTM context.
 //-----------------------------------------------------------------------------
-int _ctmUncompressMesh_MG1(_CTMcontext * self)
+int _ctmCompressMesh_MG1(_CTMcontext * self)
 {
   CTMuint * indices;
   _CTMfloatmap * map;
-  CTMuint i;
+  _CTMpackedsection * sections, * section;
+  CTMuint i, sectionCount;
+  size_t mark;
+  int result;
+
+#ifdef __DEBUG_
+  printf("COMPRESSION METHOD: MG1\n");
+#endif
+
+  // All temporary buffers are allocated from the scratch arena
+  mark = _ctmScratchMark(self);
 
-  // Allocate memory for the indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  // Perpare (sort) indices
+  indices = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
+  for(i = 0; i < self->mTriangleCount * 3; ++ i)
+    indices[i] = self->mIndices[i];
+  if(!_ctmReArrangeTriangles(self, indices, self->mTriangleCount))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  // Calculate index deltas (entropy-reduction)
+  _ctmMakeIndexDeltas(self, indices);
+
+  // Allocate memory for the packed section descriptors
+  sectionCount = 2 + (self->mNormals ? 1 : 0) + self->mUVMapCount +
+                 self->mAttribMapCount;
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!sections)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Set up the sections (indices, vertices, normals, UV maps, attribute maps)
+  section = sections;
+  _ctmInitPackedSections(&section, indices, self->mTriangleCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, 0);
+  _ctmInitPackedSections(&section, self->mVertices, self->mVertexCount, 3, 0, _CTM_PACKED_FLOATS | _CTM_PACKED_NO_INTERLEAVE, _CTM_PARAMS_VERTICES, 0);
+  if(self->mNormals)
+    _ctmInitPackedSections(&section, self->mNormals, self->mVertexCount, 3, 0, _CTM_PACKED_FLOATS, _CTM_PARAMS_NORMALS, 0);
+  for(map = self->mUVMaps; map; map = map->mNext)
+    _ctmInitPackedSections(&section, map->mValues, self->mVertexCount, 2, 0, _CTM_PACKED_FLOATS, _CTM_PARAMS_UV_MAPS, 0);
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    _ctmInitPackedSections(&section, map->mValues, self->mVertexCount, 4, 0, _CTM_PACKED_FLOATS, _CTM_PARAMS_ATTRIB_MAPS, 0);
+
+  // Pack all sections (possibly in parallel) and write them to the stream
+  result = _ctmPackSections(self, sections, sectionCount);
+  if(result)
+  {
+    section = sections;
+    result = _ctmWriteSections_MG1(self, &section);
+  }
+
+  // Free temporary resources
+  _ctmScratchRelease(self, mark);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArrayLoaded_MG1() - With a section loaded callback, each array is
+// unpacked (and restored) as soon as it has been read, and is then reported
+// to the callback. aFirst..aEnd are the packed sections of the array (none
+// if the array was skipped).
+//-----------------------------------------------------------------------------
+static int _ctmArrayLoaded_MG1(_CTMcontext * self,
+  _CTMpackedsection * aFirst, _CTMpackedsection * aEnd, CTMenum aSection)
+{
+  if(!self->mSectionFn || (aFirst == aEnd))
+    return CTM_TRUE;
+
+  if(!_ctmUnpackSections(self, aFirst, (CTMuint) (aEnd - aFirst)))
+    return CTM_FALSE;
+  if(aSection == CTM_INDICES)
+    _ctmRestoreIndices(self, self->mIndices);
+
+  return _ctmSectionLoaded(self, aSection);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadSections_MG1() - Read all the packed data sections of an MG1 mesh
+// from the stream.
+//-----------------------------------------------------------------------------
+static int _ctmReadSections_MG1(_CTMcontext * self,
+  _CTMpackedsection ** aSections)
+{
+  _CTMfloatmap * map;
+  _CTMpackedsection * first;
+  CTMuint i;
 
   // Read triangle indices
   if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
   {
     self->mError = CTM_BAD_FORMAT;
-    free(indices);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) indices, self->mTriangleCount, 3, CTM_FALSE))
+  first = *aSections;
+  if(!_ctmStreamReadPackedArray(self, aSections, self->mIndices, self->mTriangleCount, 3, 0, _CTM_PACKED_INTS, 0) ||
+     !_ctmArrayLoaded_MG1(self, first, *aSections, CTM_INDICES))
     return CTM_FALSE;
 
-  // Restore indices
-  _ctmRestoreIndices(self, indices);
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = indices[i];
-
-  // Free temporary resources
-  free(indices);
-
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
   {
     self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedFloats(self, self->mVertices, self->mVertexCount * 3, 1))
+  first = *aSections;
+  if(!_ctmStreamReadPackedArray(self, aSections, self->mVertices, self->mVertexCount, 3, self->mVertexStride, _CTM_PACKED_FLOATS | _CTM_PACKED_NO_INTERLEAVE, 0) ||
+     !_ctmArrayLoaded_MG1(self, first, *aSections, CTM_VERTICES))
     return CTM_FALSE;
 
   // Read normals
-  if(self->mNormals)
+  if(self->mFileFlags & _CTM_HAS_NORMALS_BIT)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedFloats(self, self->mNormals, self->mVertexCount, 3))
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, self->mNormals, self->mVertexCount, 3, self->mNormalStride, _CTM_PACKED_FLOATS, 0) ||
+       !_ctmArrayLoaded_MG1(self, first, *aSections, CTM_NORMALS))
       return CTM_FALSE;
   }
 
   // Read UV maps
   map = self->mUVMaps;
+  i = CTM_UV_MAP_1;
   while(map)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
-      return 0;
+      return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 2))
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, map->mValues, self->mVertexCount, 2, map->mStride, _CTM_PACKED_FLOATS, 0) ||
+       !_ctmArrayLoaded_MG1(self, first, *aSections, (CTMenum) i))
       return CTM_FALSE;
     map = map->mNext;
+    ++ i;
   }
 
   // Read vertex attribute maps
   map = self->mAttribMaps;
+  i = CTM_ATTRIB_MAP_1;
   while(map)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
-      return 0;
+      return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    if(!_ctmStreamReadPackedFloats(self, map->mValues, self->mVertexCount, 4))
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, map->mValues, self->mVertexCount, 4, map->mStride, _CTM_PACKED_FLOATS, 0) ||
+       !_ctmArrayLoaded_MG1(self, first, *aSections, (CTMenum) i))
       return CTM_FALSE;
     map = map->mNext;
+    ++ i;
   }
 
   return CTM_TRUE;
 }
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_MG1() - Uncmpress the mesh from the input stream in the
+// CTM context, and store the resulting mesh in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_MG1(_CTMcontext * self)
+{
+  _CTMpackedsection * sections, * section;
+  CTMuint sectionCount;
+  size_t mark;
+  int result;
+
+  // Allocate memory for the packed section descriptors
+  mark = _ctmScratchMark(self);
+  sectionCount = 2 + (self->mNormals ? 1 : 0) + self->mUVMapCount +
+                 self->mAttribMapCount;
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!sections)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(sections, 0, sizeof(_CTMpackedsection) * sectionCount);
+
+  // Read all packed sections from the stream, and unpack them (possibly in
+  // parallel)
+  section = sections;
+  result = _ctmReadSections_MG1(self, &section);
+  if(result)
+    result = _ctmUnpackSections(self, sections, sectionCount);
+  _ctmScratchRelease(self, mark);
+
+  // Restore indices (unless they have already been restored progressively)
+  if(result && !self->mSectionFn && self->mIndices)
+    _ctmRestoreIndices(self, self->mIndices);
+
+  return result;
+}
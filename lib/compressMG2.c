@@ -1,7 +1,7 @@
 //-----------------------------------------------------------------------------
 // Product:     OpenCTM
 // File:        compressMG2.c
-// Description: Implementation of the MG2 compression method.
+// Description: Implementation of the MG2 and MG3 compression methods.
 //-----------------------------------------------------------------------------
 // Copyright (c) 2009-2010 Marcus Geelnard
 //
@@ -26,6 +26,8 @@
 //-----------------------------------------------------------------------------
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <math.h>
 #include "openctm.h"
 #include "internal.h"
@@ -55,20 +57,6 @@ typedef struct {
   CTMfloat mSize[3];
 } _CTMgrid;
 
-//-----------------------------------------------------------------------------
-// _CTMsortvertex - Vertex information.
-//-----------------------------------------------------------------------------
-typedef struct {
-  // Vertex X coordinate (used for sorting).
-  CTMfloat x;
-
-  // Grid index. This is the index into the 3D space subdivision grid.
-  CTMuint mGridIndex;
-
-  // Original index (before sorting).
-  CTMuint mOriginalIndex;
-} _CTMsortvertex;
-
 //-----------------------------------------------------------------------------
 // _ctmSetupGrid() - Setup the 3D space subdivision grid.
 //-----------------------------------------------------------------------------
@@ -171,28 +159,11 @@ static void _ctmGridIdxToPoint(_CTMgrid * aGrid, CTMuint aIdx, CTMfloat * aPoint
     aPoint[i] = gridIdx[i] * aGrid->mSize[i] + aGrid->mMin[i];
 }
 
-//-----------------------------------------------------------------------------
-// _compareVertex() - Comparator for the vertex sorting.
-//-----------------------------------------------------------------------------
-static int _compareVertex(const void * elem1, const void * elem2)
-{
-  _CTMsortvertex * v1 = (_CTMsortvertex *) elem1;
-  _CTMsortvertex * v2 = (_CTMsortvertex *) elem2;
-  if(v1->mGridIndex != v2->mGridIndex)
-    return v1->mGridIndex - v2->mGridIndex;
-  else if(v1->x < v2->x)
-    return -1;
-  else if(v1->x > v2->x)
-    return 1;
-  else
-    return 0;
-}
-
 //-----------------------------------------------------------------------------
 // _ctmSortVertices() - Setup the vertex array. Assign each vertex to a grid
 // box, and sort all vertices.
 //-----------------------------------------------------------------------------
-static void _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
+static int _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
   _CTMgrid * aGrid)
 {
   CTMuint i;
@@ -201,14 +172,18 @@ static void _ctmSortVertices(_CTMcontext * self, _CTMsortvertex * aSortVertices,
   for(i = 0; i < self->mVertexCount; ++ i)
   {
     // Store vertex properties in the sort vertex array
-    aSortVertices[i].x = self->mVertices[i * 3];
+    aSortVertices[i].mSortX = _ctmFloatSortKey(self->mVertices[i * 3]);
     aSortVertices[i].mGridIndex = _ctmPointToGridIdx(aGrid, &self->mVertices[i * 3]);
     aSortVertices[i].mOriginalIndex = i;
   }
 
   // Sort vertices. The elements are first sorted by their grid indices, and
-  // scondly by their x coordinates.
-  qsort((void *) aSortVertices, self->mVertexCount, sizeof(_CTMsortvertex), _compareVertex);
+  // scondly by their x coordinates (vertices with equal keys keep their
+  // original order).
+  return _ctmSortRecords(self, (CTMuint *) aSortVertices, self->mVertexCount,
+    sizeof(_CTMsortvertex) / sizeof(CTMuint),
+    offsetof(_CTMsortvertex, mGridIndex) / sizeof(CTMuint),
+    offsetof(_CTMsortvertex, mSortX) / sizeof(CTMuint));
 }
 
 //-----------------------------------------------------------------------------
@@ -218,9 +193,11 @@ static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices
   CTMuint * aIndices)
 {
   CTMuint i, * indexLUT;
+  size_t mark;
 
   // Create temporary lookup-array, O(n)
-  indexLUT = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
+  mark = _ctmScratchMark(self);
+  indexLUT = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount);
   if(!indexLUT)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -234,65 +211,20 @@ static int _ctmReIndexIndices(_CTMcontext * self, _CTMsortvertex * aSortVertices
     aIndices[i] = indexLUT[self->mIndices[i]];
 
   // Free temporary lookup-array
-  free((void *) indexLUT);
+  _ctmScratchRelease(self, mark);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _compareTriangle() - Comparator for the triangle sorting.
-//-----------------------------------------------------------------------------
-static int _compareTriangle(const void * elem1, const void * elem2)
-{
-  CTMuint * tri1 = (CTMuint *) elem1;
-  CTMuint * tri2 = (CTMuint *) elem2;
-  if(tri1[0] != tri2[0])
-    return tri1[0] - tri2[0];
-  else
-    return tri1[1] - tri2[1];
-}
-
-//-----------------------------------------------------------------------------
-// _ctmReArrangeTriangles() - Re-arrange all triangles for optimal
-// compression.
-//-----------------------------------------------------------------------------
-static void _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices)
-{
-  CTMuint * tri, tmp, i;
-
-  // Step 1: Make sure that the first index of each triangle is the smallest
-  // one (rotate triangle nodes if necessary)
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    tri = &aIndices[i * 3];
-    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[1];
-      tri[1] = tri[2];
-      tri[2] = tmp;
-    }
-    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
-    {
-      tmp = tri[0];
-      tri[0] = tri[2];
-      tri[2] = tri[1];
-      tri[1] = tmp;
-    }
-  }
-
-  // Step 2: Sort the triangles based on the first triangle index
-  qsort((void *) aIndices, self->mTriangleCount, sizeof(CTMuint) * 3, _compareTriangle);
-}
-
-//-----------------------------------------------------------------------------
-// _ctmMakeIndexDeltas() - Calculate various forms of derivatives in order to
-// reduce data entropy.
+// _ctmMakeIndexDeltas_MG2() - Calculate various forms of derivatives in order
+// to reduce data entropy (aTriangleCount triangles, sorted by
+// _ctmReArrangeTriangles()).
 //-----------------------------------------------------------------------------
-static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
+void _ctmMakeIndexDeltas_MG2(CTMuint * aIndices, CTMuint aTriangleCount)
 {
   CTMint i;
-  for(i = self->mTriangleCount - 1; i >= 0; -- i)
+  for(i = (CTMint) aTriangleCount - 1; i >= 0; -- i)
   {
     // Step 1: Calculate delta from second triangle index to the previous
     // second triangle index, if the previous triangle shares the same first
@@ -313,14 +245,14 @@ static void _ctmMakeIndexDeltas(_CTMcontext * self, CTMuint * aIndices)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmRestoreIndices() - Restore original indices (inverse derivative
+// _ctmRestoreIndices_MG2() - Restore original indices (inverse derivative
 // operation).
 //-----------------------------------------------------------------------------
-static void _ctmRestoreIndices(_CTMcontext * self, CTMuint * aIndices)
+void _ctmRestoreIndices_MG2(CTMuint * aIndices, CTMuint aTriangleCount)
 {
   CTMuint i;
 
-  for(i = 0; i < self->mTriangleCount; ++ i)
+  for(i = 0; i < aTriangleCount; ++ i)
   {
     // Step 1: Reverse derivative of the first triangle index
     if(i >= 1)
@@ -383,9 +315,11 @@ static void _ctmMakeVertexDeltas(_CTMcontext * self, CTMint * aIntVertices,
 
 //-----------------------------------------------------------------------------
 // _ctmRestoreVertices() - Calculate inverse derivatives of the vertices.
+// aStride is the distance between two vertices in aVertices (in floats).
 //-----------------------------------------------------------------------------
 static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
-  CTMuint * aGridIndices, _CTMgrid * aGrid, CTMfloat * aVertices)
+  CTMuint * aGridIndices, _CTMgrid * aGrid, CTMfloat * aVertices,
+  CTMuint aStride)
 {
   CTMuint i, gridIdx, prevGridIndex;
   CTMfloat gridOrigin[3], scale;
@@ -405,9 +339,9 @@ static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
     deltaX = aIntVertices[i * 3];
     if(gridIdx == prevGridIndex)
       deltaX += prevDeltaX;
-    aVertices[i * 3] = scale * deltaX + gridOrigin[0];
-    aVertices[i * 3 + 1] = scale * aIntVertices[i * 3 + 1] + gridOrigin[1];
-    aVertices[i * 3 + 2] = scale * aIntVertices[i * 3 + 2] + gridOrigin[2];
+    aVertices[(size_t) i * aStride] = scale * deltaX + gridOrigin[0];
+    aVertices[(size_t) i * aStride + 1] = scale * aIntVertices[i * 3 + 1] + gridOrigin[1];
+    aVertices[(size_t) i * aStride + 2] = scale * aIntVertices[i * 3 + 2] + gridOrigin[2];
 
     prevGridIndex = gridIdx;
     prevDeltaX = deltaX;
@@ -415,110 +349,663 @@ static void _ctmRestoreVertices(_CTMcontext * self, CTMint * aIntVertices,
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
-// These are used as the nominal normals for normal deltas & reconstruction.
+// Grid resolution search parameters
+//-----------------------------------------------------------------------------
+// Lowest compression level that searches for the best grid resolution
+#define _CTM_GRID_SEARCH_LEVEL  7
+
+// Candidate resolutions, in half octaves (factors of sqrt(2) in divisions per
+// axis) relative to the default resolution
+#define _CTM_GRID_MIN_STEP      -4
+#define _CTM_GRID_MAX_STEP      4
+#define _CTM_GRID_STEPS         (_CTM_GRID_MAX_STEP - _CTM_GRID_MIN_STEP + 1)
+
+// Larger meshes are searched with a sample of about this many vertices, taken
+// from _CTM_GRID_SLABS evenly spaced slabs of the mesh
+#define _CTM_GRID_SAMPLE        (_CTM_SAMPLE_RUNS * _CTM_SAMPLE_RUN)
+#define _CTM_GRID_SLABS         4
+
+// Number of histogram bins for placing the slabs
+#define _CTM_GRID_BINS          4096
+
 //-----------------------------------------------------------------------------
-static void _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
-  CTMuint * aIndices, CTMfloat * aSmoothNormals)
+// _ctmGridDivisions() - Set the grid divisions (and box sizes), with about
+// aWantedGrids divisions in total, spread over the axes by aFactor (the
+// relative bounding box size). Returns false if the grid has too many boxes
+// for 32-bit grid indices.
+//-----------------------------------------------------------------------------
+static int _ctmGridDivisions(_CTMgrid * aGrid, const CTMfloat * aFactor,
+  CTMfloat aWantedGrids)
 {
-  CTMuint i, j, k, tri[3];
-  CTMfloat len;
-  CTMfloat v1[3], v2[3], n[3];
+  CTMuint i;
+  double boxCount;
+
+  boxCount = 1.0;
+  for(i = 0; i < 3; ++ i)
+  {
+    if(aWantedGrids * aFactor[i] > 4294967295.0f)
+      return CTM_FALSE;
+    aGrid->mDivision[i] = (CTMuint) ceilf(aWantedGrids * aFactor[i]);
+    if(aGrid->mDivision[i] < 1)
+      aGrid->mDivision[i] = 1;
+    boxCount *= aGrid->mDivision[i];
+  }
+  if(boxCount > 4294967295.0)
+    return CTM_FALSE;
 
-  // Clear smooth normals array
-  for(i = 0; i < 3 * self->mVertexCount; ++ i)
-    aSmoothNormals[i] = 0.0f;
+  for(i = 0; i < 3; ++ i)
+    aGrid->mSize[i] = (aGrid->mMax[i] - aGrid->mMin[i]) / aGrid->mDivision[i];
+  return CTM_TRUE;
+}
 
-  // Calculate sums of all neigbouring triangle normals for each vertex
-  for(i = 0; i < self->mTriangleCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmGridCost() - Get the packed size of the vertices, the grid indices and
+// the triangle indices with a given grid (the grid decides both the vertex
+// deltas and the vertex order, and thereby the index deltas). The arrays are
+// prepared exactly like _ctmPrepareSections_MG2() does, and packed in full
+// (with the fast coder if mEstimate is CTM_ESTIMATE_FAST).
+//-----------------------------------------------------------------------------
+static int _ctmGridCost(_CTMcontext * self, _CTMgrid * aGrid, size_t * aCost)
+{
+  _CTMpackedsection sections[3], * section;
+  _CTMsortvertex * sortVertices;
+  CTMint * intVertices;
+  CTMuint * gridIndices, * indices, i;
+  size_t mark;
+  int result;
+
+  mark = _ctmScratchMark(self);
+  sortVertices = (_CTMsortvertex *) _ctmScratchAlloc(self, sizeof(_CTMsortvertex) * self->mVertexCount);
+  intVertices = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * (4 * (size_t) self->mVertexCount + 3 * (size_t) self->mTriangleCount));
+  if(!sortVertices || !intVertices)
   {
-    // Get triangle corner indices
-    for(j = 0; j < 3; ++ j)
-      tri[j] = aIndices[i * 3 + j];
+    self->mError = CTM_OUT_OF_MEMORY;
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  gridIndices = (CTMuint *) &intVertices[self->mVertexCount * 3];
+  indices = &gridIndices[self->mVertexCount];
 
-    // Calculate the normalized cross product of two triangle edges (i.e. the
-    // flat triangle normal)
-    for(j = 0; j < 3; ++ j)
+  // Vertices and grid indices
+  if(!_ctmSortVertices(self, sortVertices, aGrid))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  _ctmMakeVertexDeltas(self, intVertices, sortVertices, aGrid);
+  for(i = 0; i < self->mVertexCount; ++ i)
+    gridIndices[i] = sortVertices[i].mGridIndex;
+  for(i = self->mVertexCount - 1; i > 0; -- i)
+    gridIndices[i] -= gridIndices[i - 1];
+
+  // Triangle indices
+  if(!_ctmReIndexIndices(self, sortVertices, indices) ||
+     !_ctmReArrangeTriangles(self, indices, self->mTriangleCount))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  _ctmMakeIndexDeltas_MG2(indices, self->mTriangleCount);
+
+  section = sections;
+  _ctmInitPackedSections(&section, intVertices, self->mVertexCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_VERTICES, 0);
+  _ctmInitPackedSections(&section, gridIndices, self->mVertexCount, 1, 0, _CTM_PACKED_INTS, _CTM_PARAMS_VERTICES, 0);
+  _ctmInitPackedSections(&section, indices, self->mTriangleCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, 0);
+  *aCost = 0;
+  result = CTM_TRUE;
+  for(i = 0; result && (i < 3); ++ i)
+  {
+    result = _ctmMeasurePackedSize(self, &sections[i]);
+    *aCost += sections[i].mPackedSize;
+  }
+
+  _ctmScratchRelease(self, mark);
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMgridjobs - Candidate grid resolutions to try in parallel (see
+// _ctmGridJob()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  const _CTMcontext * mContext; // Context with the mesh (or mesh sample)
+  const _CTMgrid * mGrid;       // Default grid
+  const CTMfloat * mFactor;     // Relative bounding box size
+  CTMfloat mWantedGrids;        // Default number of divisions
+  const CTMint * mSteps;        // Candidate resolutions (_CTM_GRID_*_STEP)
+  CTMenum mEstimate;            // Packing mode (CTM_ESTIMATE_EXACT or _FAST)
+  size_t * mCosts;              // Packed sizes (zero for unusable candidates)
+  CTMenum * mErrors;            // Result of each candidate
+} _CTMgridjobs;
+
+//-----------------------------------------------------------------------------
+// _ctmGridJob() - Job function for getting the cost of a candidate grid
+// resolution. Each job has a context of its own, with a scratch arena of its
+// own, and packs its sections serially. With LZMA, the packed data is only
+// counted.
+//-----------------------------------------------------------------------------
+static void _ctmGridJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMgridjobs * jobs = (_CTMgridjobs *) aUserData;
+  _CTMcontext context;
+  _CTMgrid grid;
+  (void) aWorker;
+
+  jobs->mCosts[aJob] = 0;
+  jobs->mErrors[aJob] = CTM_NONE;
+  grid = *jobs->mGrid;
+  if(!_ctmGridDivisions(&grid, jobs->mFactor, jobs->mWantedGrids *
+                        powf(2.0f, 0.5f * jobs->mSteps[aJob])))
+    return;
+
+  context = *jobs->mContext;
+  memset(&context.mScratch, 0, sizeof(_CTMscratch));
+  context.mError = CTM_NONE;
+  context.mEncodeThreads = 1;
+  context.mEstimate = jobs->mEstimate;
+  if(!_ctmGridCost(&context, &grid, &jobs->mCosts[aJob]))
+  {
+    jobs->mCosts[aJob] = 0;
+    jobs->mErrors[aJob] = context.mError;
+  }
+  _ctmScratchFree(&context);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRunGridJobs() - Get the costs of aCount candidate grid resolutions, in
+// parallel (using up to mEncodeThreads threads).
+//-----------------------------------------------------------------------------
+static int _ctmRunGridJobs(_CTMcontext * self, _CTMgridjobs * aJobs,
+  CTMuint aCount)
+{
+  CTMuint i;
+
+  _ctmRunJobs(&self->mAllocator, self->mEncodeThreads, aCount, _ctmGridJob,
+              (void *) aJobs);
+
+  // Report the first error
+  for(i = 0; i < aCount; ++ i)
+  {
+    if(aJobs->mErrors[i] != CTM_NONE)
     {
-      v1[j] = aVertices[tri[1] * 3 + j] - aVertices[tri[0] * 3 + j];
-      v2[j] = aVertices[tri[2] * 3 + j] - aVertices[tri[0] * 3 + j];
+      self->mError = aJobs->mErrors[i];
+      return CTM_FALSE;
     }
-    n[0] = v1[1] * v2[2] - v1[2] * v2[1];
-    n[1] = v1[2] * v2[0] - v1[0] * v2[2];
-    n[2] = v1[0] * v2[1] - v1[1] * v2[0];
-    len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
-    if(len > 1e-10f)
-      len = 1.0f / len;
-    else
-      len = 1.0f;
-    for(j = 0; j < 3; ++ j)
-      n[j] *= len;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGridSample() - Make a mesh sample for the grid resolution search: all
+// the vertices in _CTM_GRID_SLABS evenly spaced slabs (by vertex count) of
+// about _CTM_GRID_SAMPLE / _CTM_GRID_SLABS vertices each, and the triangles
+// that only use those vertices. The slabs are cut across the outermost axis
+// of the grid index order (z, unless the mesh is flat), so within a slab the
+// sorted vertices follow the same order (and density) as in the whole mesh.
+// aSample is set to a copy of the context with the sample mesh, which is
+// allocated from the scratch arena (the caller releases it).
+//-----------------------------------------------------------------------------
+static int _ctmGridSample(_CTMcontext * self, const _CTMgrid * aGrid,
+  _CTMcontext * aSample)
+{
+  CTMuint * bins, * vertexMap, * indices, i, j, k, axis, bin, count;
+  CTMuint vertexCount, triangleCount;
+  CTMfloat * vertices, scale;
+  size_t start, center, halfSlab;
+
+  axis = 2;
+  while((axis > 0) && (aGrid->mMax[axis] <= aGrid->mMin[axis]))
+    -- axis;
+
+  bins = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (_CTM_GRID_BINS + (size_t) self->mVertexCount));
+  if(!bins)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  vertexMap = &bins[_CTM_GRID_BINS];
+
+  // Histogram of the vertices along the axis
+  memset(bins, 0, sizeof(CTMuint) * _CTM_GRID_BINS);
+  scale = 0.0f;
+  if(aGrid->mMax[axis] > aGrid->mMin[axis])
+    scale = _CTM_GRID_BINS / (aGrid->mMax[axis] - aGrid->mMin[axis]);
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    bin = (CTMuint) (scale * (self->mVertices[i * 3 + axis] - aGrid->mMin[axis]));
+    if(bin >= _CTM_GRID_BINS)
+      bin = _CTM_GRID_BINS - 1;
+    vertexMap[i] = bin;
+    ++ bins[bin];
+  }
+
+  // Select the bins that overlap a slab (bins are replaced by selection flags)
+  halfSlab = _CTM_GRID_SAMPLE / (2 * _CTM_GRID_SLABS);
+  start = 0;
+  for(i = 0; i < _CTM_GRID_BINS; ++ i)
+  {
+    count = bins[i];
+    bins[i] = 0;
+    for(k = 0; k < _CTM_GRID_SLABS; ++ k)
+    {
+      center = (size_t) self->mVertexCount * (2 * k + 1) / (2 * _CTM_GRID_SLABS);
+      if((start + count > center - halfSlab) && (start < center + halfSlab))
+        bins[i] = 1;
+    }
+    start += count;
+  }
+
+  // Map the selected vertices to sample vertices
+  vertexCount = 0;
+  for(i = 0; i < self->mVertexCount; ++ i)
+    vertexMap[i] = bins[vertexMap[i]] ? vertexCount ++ : 0xffffffff;
+  triangleCount = 0;
+  for(i = 0; i < self->mTriangleCount * 3; i += 3)
+  {
+    if((vertexMap[self->mIndices[i]] != 0xffffffff) &&
+       (vertexMap[self->mIndices[i + 1]] != 0xffffffff) &&
+       (vertexMap[self->mIndices[i + 2]] != 0xffffffff))
+      ++ triangleCount;
+  }
 
-    // Add the flat normal to all three triangle vertices
-    for(k = 0; k < 3; ++ k)
+  // Copy the sample mesh
+  vertices = (CTMfloat *) _ctmScratchAlloc(self, sizeof(CTMfloat) * 3 * (size_t) vertexCount);
+  indices = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * 3 * (size_t) triangleCount);
+  if(!vertices || !indices)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(vertexMap[i] != 0xffffffff)
+    {
       for(j = 0; j < 3; ++ j)
-        aSmoothNormals[tri[k] * 3 + j] += n[j];
+        vertices[vertexMap[i] * 3 + j] = self->mVertices[i * 3 + j];
+    }
+  }
+  for(i = 0, j = 0; i < self->mTriangleCount * 3; i += 3)
+  {
+    if((vertexMap[self->mIndices[i]] != 0xffffffff) &&
+       (vertexMap[self->mIndices[i + 1]] != 0xffffffff) &&
+       (vertexMap[self->mIndices[i + 2]] != 0xffffffff))
+    {
+      for(k = 0; k < 3; ++ k)
+        indices[j ++] = vertexMap[self->mIndices[i + k]];
+    }
+  }
+
+  *aSample = *self;
+  aSample->mVertices = vertices;
+  aSample->mVertexCount = vertexCount;
+  aSample->mIndices = indices;
+  aSample->mTriangleCount = triangleCount;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSelectGrid() - Select the grid resolution (starting with the default
+// grid from _ctmSetupGrid()). The divisions are stored in the file, so the
+// encoder is free to choose them. At compression level _CTM_GRID_SEARCH_LEVEL
+// and up, the candidate resolutions around the default one are packed with
+// the fast coder (see _ctmGridCost()), using a sample of large meshes (see
+// _ctmGridSample()). If the best candidate beats the default resolution by a
+// margin, both are packed again with the whole mesh and the actual coder
+// settings, and the best candidate is only used if it is still smaller. Size
+// estimates with CTM_ESTIMATE_SAMPLED keep the default resolution.
+//-----------------------------------------------------------------------------
+static int _ctmSelectGrid(_CTMcontext * self, _CTMgrid * aGrid)
+{
+  _CTMcontext sample;
+  _CTMgridjobs jobs;
+  size_t costs[_CTM_GRID_STEPS], mark;
+  CTMenum errors[_CTM_GRID_STEPS];
+  CTMint steps[_CTM_GRID_STEPS], bestStep;
+  CTMuint i, best;
+  CTMfloat factor[3], sum, wantedGrids;
+
+  if((self->mCompressionLevel < _CTM_GRID_SEARCH_LEVEL) ||
+     (self->mEstimate == CTM_ESTIMATE_SAMPLED) || (self->mVertexCount < 2))
+    return CTM_TRUE;
+
+  // Default resolution (see _ctmSetupGrid())
+  for(i = 0; i < 3; ++ i)
+    factor[i] = aGrid->mMax[i] - aGrid->mMin[i];
+  sum = factor[0] + factor[1] + factor[2];
+  if(sum <= 1e-30f)
+    return CTM_TRUE;
+  sum = 1.0f / sum;
+  for(i = 0; i < 3; ++ i)
+    factor[i] *= sum;
+  wantedGrids = powf(100.0f * self->mVertexCount, 1.0f / 3.0f);
+
+  // Rank all the candidates with the whole mesh, or with a sample of it
+  mark = _ctmScratchMark(self);
+  sample = *self;
+  if((self->mVertexCount > _CTM_GRID_SAMPLE) &&
+     !_ctmGridSample(self, aGrid, &sample))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  for(i = 0; i < _CTM_GRID_STEPS; ++ i)
+    steps[i] = _CTM_GRID_MIN_STEP + (CTMint) i;
+  jobs.mContext = &sample;
+  jobs.mGrid = aGrid;
+  jobs.mFactor = factor;
+  jobs.mWantedGrids = wantedGrids;
+  jobs.mSteps = steps;
+  jobs.mEstimate = CTM_ESTIMATE_FAST;
+  jobs.mCosts = costs;
+  jobs.mErrors = errors;
+  if(!_ctmRunGridJobs(self, &jobs, _CTM_GRID_STEPS))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  best = (CTMuint) -_CTM_GRID_MIN_STEP;
+  for(i = 0; i < _CTM_GRID_STEPS; ++ i)
+  {
+    if(costs[i] && (!costs[best] || (costs[i] < costs[best])))
+      best = i;
+  }
+  bestStep = steps[best];
+  if(costs[best] + costs[best] / 64 >= costs[-_CTM_GRID_MIN_STEP])
+    bestStep = 0;
+
+  // Confirm the best candidate with the whole mesh
+  if(bestStep != 0)
+  {
+    steps[0] = 0;
+    steps[1] = bestStep;
+    jobs.mContext = self;
+    jobs.mEstimate = self->mEstimate ? self->mEstimate : CTM_ESTIMATE_EXACT;
+    if(!_ctmRunGridJobs(self, &jobs, 2))
+    {
+      _ctmScratchRelease(self, mark);
+      return CTM_FALSE;
+    }
+    if(!costs[1] || (costs[0] && (costs[0] <= costs[1])))
+      bestStep = 0;
   }
+  _ctmScratchRelease(self, mark);
+
+  if(bestStep != 0)
+    _ctmGridDivisions(aGrid, factor, wantedGrids * powf(2.0f, 0.5f * bestStep));
+
+#ifdef __DEBUG_
+  printf("Selected division: (%d %d %d)\n", aGrid->mDivision[0], aGrid->mDivision[1], aGrid->mDivision[2]);
+#endif
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGridVertexError() - Calculate the error that MG2 compression with the
+// grid aGrid and the vertex precision aPrecision gives: the largest distance
+// between a vertex and its restored position (which is also an upper bound
+// of the Hausdorff distance between the original and the restored mesh), and
+// the root mean square distance. The vertices are quantized exactly like
+// _ctmMakeVertexDeltas() and _ctmRestoreVertices() do.
+//-----------------------------------------------------------------------------
+static void _ctmGridVertexError(_CTMcontext * self, _CTMgrid * aGrid,
+  CTMfloat aPrecision, CTMfloat * aMaxError, CTMfloat * aRMSError)
+{
+  CTMuint i, j;
+  CTMfloat gridOrigin[3], scale, * point;
+  CTMint delta;
+  double d, dist2, maxDist2, sumDist2;
 
-  // Normalize the normal sums, which gives the unit length smooth normals
+  scale = 1.0f / aPrecision;
+  maxDist2 = sumDist2 = 0.0;
   for(i = 0; i < self->mVertexCount; ++ i)
   {
-    len = sqrtf(aSmoothNormals[i * 3] * aSmoothNormals[i * 3] + 
-                aSmoothNormals[i * 3 + 1] * aSmoothNormals[i * 3 + 1] +
-                aSmoothNormals[i * 3 + 2] * aSmoothNormals[i * 3 + 2]);
-    if(len > 1e-10f)
-      len = 1.0f / len;
-    else
-      len = 1.0f;
+    point = &self->mVertices[i * 3];
+    _ctmGridIdxToPoint(aGrid, _ctmPointToGridIdx(aGrid, point), gridOrigin);
+    dist2 = 0.0;
     for(j = 0; j < 3; ++ j)
-      aSmoothNormals[i * 3 + j] *= len;
+    {
+      delta = (CTMint) floorf(scale * (point[j] - gridOrigin[j]) + 0.5f);
+      d = (double) (aPrecision * delta + gridOrigin[j]) - (double) point[j];
+      dist2 += d * d;
+    }
+    if(dist2 > maxDist2)
+      maxDist2 = dist2;
+    sumDist2 += dist2;
   }
+
+  *aMaxError = (CTMfloat) sqrt(maxDist2);
+  *aRMSError = self->mVertexCount > 0 ?
+               (CTMfloat) sqrt(sumDist2 / self->mVertexCount) : 0.0f;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmMakeNormalCoordSys() - Create an ortho-normalized coordinate system
-// where the Z-axis is aligned with the given normal.
-// Note 1: This function is central to how the compressed normal data is
-//  interpreted, and it can not be changed (mathematically) without making the
-//  coder/decoder incompatible with other versions of the library!
-// Note 2: Since we do this for every single normal, this routine needs to be
-//  fast. The current implementation uses: 12 MUL, 1 DIV, 1 SQRT, ~6 ADD.
+// _ctmVertexError_MG2() - Calculate the error that MG2 compression with the
+// vertex precision aPrecision would give, without compressing anything (see
+// _ctmGridVertexError()). The default grid is used, so the grid search of
+// high compression levels (see _ctmSelectGrid()) is not run. The errors with
+// the grid that is actually saved are stored in the context by each save
+// (mSavedMaxError and mSavedRMSError).
 //-----------------------------------------------------------------------------
-static void _ctmMakeNormalCoordSys(CTMfloat * aNormal, CTMfloat * aBasisAxes)
+void _ctmVertexError_MG2(_CTMcontext * self, CTMfloat aPrecision,
+  CTMfloat * aMaxError, CTMfloat * aRMSError)
 {
-  CTMfloat len, * x, * y, * z;
-  CTMuint i;
+  _CTMgrid grid;
 
-  // Pointers to the basis axes (aBasisAxes is a 3x3 matrix)
-  x = aBasisAxes;
-  y = &aBasisAxes[3];
-  z = &aBasisAxes[6];
+  _ctmSetupGrid(self, &grid);
+  _ctmGridVertexError(self, &grid, aPrecision, aMaxError, aRMSError);
+}
 
-  // Z = normal (must be unit length!)
-  for(i = 0; i < 3; ++ i)
-    z[i] = aNormal[i];
+//-----------------------------------------------------------------------------
+// Smooth normal parameters
+//-----------------------------------------------------------------------------
+// Number of flat normals per block (single threaded calculation)
+#define _CTM_NORMAL_BLOCK_SIZE  256
+
+// Smallest number of triangles (or vertices) per thread
+#define _CTM_NORMAL_MIN_CHUNK   0x00010000
+
+//-----------------------------------------------------------------------------
+// _CTMnormaljobs - Threaded smooth normal calculation. The triangles are split
+// into one chunk per job, and the vertices into one range per job. The
+// triangle corners are grouped by vertex range (in triangle order), so that
+// each job can sum the normals of its own vertices in the same order as the
+// single threaded calculation.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMfloat * mVertices;   // Vertices
+  size_t mVertexStride;         // Distance between two vertices (in floats)
+  const CTMuint * mIndices;     // Triangle indices
+  CTMuint mTriangleCount;       // Number of triangles
+  CTMuint mVertexCount;         // Number of vertices
+  CTMuint mJobCount;            // Number of triangle chunks = vertex ranges
+  CTMuint mRangeSize;           // Number of vertices per range
+  const _CTMnormalkernels * mKernels; // Flat normal and normalize kernels
+  CTMfloat * mFlatNormals;      // Unit normal of each triangle
+  CTMuint * mCorners;           // Corners (triangle * 3 + k), by vertex range
+  CTMuint * mPositions;         // Corners per range, for each chunk (and then
+                                // the positions of the chunk in mCorners)
+  CTMuint * mRangeStart;        // Position of each range in mCorners
+  CTMfloat * mSmoothNormals;    // Result
+} _CTMnormaljobs;
+
+//-----------------------------------------------------------------------------
+// _ctmChunkTriangles() - First triangle of a chunk.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmChunkTriangles(const _CTMnormaljobs * aJobs, CTMuint aChunk)
+{
+  return (CTMuint) (((size_t) aJobs->mTriangleCount * aChunk) / aJobs->mJobCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFlatNormalsJob() - Job function for calculating the flat normals of a
+// triangle chunk, and counting its corners per vertex range.
+//-----------------------------------------------------------------------------
+static void _ctmFlatNormalsJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMnormaljobs * jobs = (_CTMnormaljobs *) aUserData;
+  CTMuint * counts = &jobs->mPositions[aJob * jobs->mJobCount];
+  CTMuint i, start, end;
+  (void) aWorker;
+
+  start = _ctmChunkTriangles(jobs, aJob);
+  end = _ctmChunkTriangles(jobs, aJob + 1);
+  jobs->mKernels->mFaceNormals(jobs->mVertices, jobs->mVertexStride,
+    &jobs->mIndices[start * 3], end - start, &jobs->mFlatNormals[start * 3]);
+  for(i = 0; i < jobs->mJobCount; ++ i)
+    counts[i] = 0;
+  for(i = start * 3; i < end * 3; ++ i)
+    ++ counts[jobs->mIndices[i] / jobs->mRangeSize];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmGroupCornersJob() - Job function for moving the corners of a triangle
+// chunk to their vertex range groups.
+//-----------------------------------------------------------------------------
+static void _ctmGroupCornersJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMnormaljobs * jobs = (_CTMnormaljobs *) aUserData;
+  CTMuint * positions = &jobs->mPositions[aJob * jobs->mJobCount];
+  CTMuint i, end;
+  (void) aWorker;
+
+  end = _ctmChunkTriangles(jobs, aJob + 1) * 3;
+  for(i = _ctmChunkTriangles(jobs, aJob) * 3; i < end; ++ i)
+    jobs->mCorners[positions[jobs->mIndices[i] / jobs->mRangeSize] ++] = i;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSmoothNormalsJob() - Job function for summing and normalizing the
+// smooth normals of a vertex range.
+//-----------------------------------------------------------------------------
+static void _ctmSmoothNormalsJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMnormaljobs * jobs = (_CTMnormaljobs *) aUserData;
+  CTMuint i, j, start, end;
+  CTMfloat * n, * sum;
+  (void) aWorker;
+
+  start = aJob * jobs->mRangeSize;
+  end = start + jobs->mRangeSize;
+  if(end > jobs->mVertexCount)
+    end = jobs->mVertexCount;
+  if(start >= end)
+    return;
+
+  for(i = start * 3; i < end * 3; ++ i)
+    jobs->mSmoothNormals[i] = 0.0f;
+  for(i = jobs->mRangeStart[aJob]; i < jobs->mRangeStart[aJob + 1]; ++ i)
+  {
+    n = &jobs->mFlatNormals[(jobs->mCorners[i] / 3) * 3];
+    sum = &jobs->mSmoothNormals[jobs->mIndices[jobs->mCorners[i]] * 3];
+    for(j = 0; j < 3; ++ j)
+      sum[j] += n[j];
+  }
+  jobs->mKernels->mNormalize(&jobs->mSmoothNormals[start * 3], end - start);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCalcSmoothNormals() - Calculate the smooth normals for a given mesh.
+// These are used as the nominal normals for normal deltas & reconstruction.
+// aVertexStride is the distance between two vertices in aVertices (in floats).
+// The decoder must get exactly the same result as the encoder, so the flat
+// triangle normals are always summed in triangle order (also when the work is
+// split between several threads), and the SIMD kernels do exactly the same
+// operations as the portable ones.
+//-----------------------------------------------------------------------------
+static int _ctmCalcSmoothNormals(_CTMcontext * self, CTMfloat * aVertices,
+  CTMuint aVertexStride, CTMuint * aIndices, CTMfloat * aSmoothNormals)
+{
+  _CTMnormaljobs jobs;
+  CTMfloat flatNormals[_CTM_NORMAL_BLOCK_SIZE * 3], * sum;
+  CTMuint i, j, k, count, threads, * counts;
+  size_t mark;
+
+  // How many threads?
+  threads = (self->mMode == CTM_EXPORT) ? self->mEncodeThreads : self->mDecodeThreads;
+  jobs.mJobCount = self->mTriangleCount / _CTM_NORMAL_MIN_CHUNK;
+  if(jobs.mJobCount > threads)
+    jobs.mJobCount = threads;
+
+  if(jobs.mJobCount < 2)
+  {
+    // Clear smooth normals array
+    for(i = 0; i < 3 * self->mVertexCount; ++ i)
+      aSmoothNormals[i] = 0.0f;
 
-  // Calculate a vector that is guaranteed to be orthogonal to the normal, non-
-  // zero, and a continuous function of the normal (no discrete jumps):
-  // X = (0,0,1) x normal + (1,0,0) x normal
-  x[0] =  -aNormal[1];
-  x[1] =  aNormal[0] - aNormal[2];
-  x[2] =  aNormal[1];
+    // Calculate sums of all neigbouring triangle normals for each vertex (one
+    // block of flat normals at a time)
+    for(i = 0; i < self->mTriangleCount; i += count)
+    {
+      count = self->mTriangleCount - i;
+      if(count > _CTM_NORMAL_BLOCK_SIZE)
+        count = _CTM_NORMAL_BLOCK_SIZE;
+      self->mNormalKernels->mFaceNormals(aVertices, aVertexStride,
+        &aIndices[i * 3], count, flatNormals);
+
+      // Add the flat normals to all three triangle vertices
+      for(j = 0; j < count * 3; ++ j)
+      {
+        sum = &aSmoothNormals[aIndices[i * 3 + j] * 3];
+        for(k = 0; k < 3; ++ k)
+          sum[k] += flatNormals[(j / 3) * 3 + k];
+      }
+    }
+
+    // Normalize the normal sums, which gives the unit length smooth normals
+    self->mNormalKernels->mNormalize(aSmoothNormals, self->mVertexCount);
+    return CTM_TRUE;
+  }
 
-  // Normalize the new X axis (note: |x[2]| = |x[0]|)
-  len = sqrtf(2.0 * x[0] * x[0] + x[1] * x[1]);
-  if(len > 1.0e-20f)
+  // Allocate memory for the threaded calculation
+  mark = _ctmScratchMark(self);
+  jobs.mFlatNormals = (CTMfloat *) _ctmScratchAlloc(self, sizeof(CTMfloat) * 3 * self->mTriangleCount);
+  jobs.mCorners = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * 3 * self->mTriangleCount);
+  jobs.mPositions = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * jobs.mJobCount * jobs.mJobCount);
+  jobs.mRangeStart = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (jobs.mJobCount + 1));
+  if(!jobs.mFlatNormals || !jobs.mCorners || !jobs.mPositions || !jobs.mRangeStart)
   {
-    len = 1.0f / len;
-    x[0] *= len;
-    x[1] *= len;
-    x[2] *= len;
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  jobs.mVertices = aVertices;
+  jobs.mVertexStride = aVertexStride;
+  jobs.mIndices = aIndices;
+  jobs.mTriangleCount = self->mTriangleCount;
+  jobs.mVertexCount = self->mVertexCount;
+  jobs.mRangeSize = (self->mVertexCount + jobs.mJobCount - 1) / jobs.mJobCount;
+  jobs.mKernels = self->mNormalKernels;
+  jobs.mSmoothNormals = aSmoothNormals;
+
+  // Calculate the flat normals, and count the corners of each vertex range
+  _ctmRunJobs(&self->mAllocator, jobs.mJobCount, jobs.mJobCount,
+              _ctmFlatNormalsJob, (void *) &jobs);
+
+  // Convert the counts to positions (range by range, and chunk by chunk within
+  // each range, which keeps the corners of each range in triangle order)
+  count = 0;
+  for(i = 0; i < jobs.mJobCount; ++ i)
+  {
+    jobs.mRangeStart[i] = count;
+    for(j = 0; j < jobs.mJobCount; ++ j)
+    {
+      counts = &jobs.mPositions[j * jobs.mJobCount + i];
+      k = *counts;
+      *counts = count;
+      count += k;
+    }
   }
+  jobs.mRangeStart[jobs.mJobCount] = count;
 
-  // Let Y = Z x X  (no normalization needed, since |Z| = |X| = 1)
-  y[0] = z[1] * x[2] - z[2] * x[1];
-  y[1] = z[2] * x[0] - z[0] * x[2];
-  y[2] = z[0] * x[1] - z[1] * x[0];
+  // Group the corners by vertex range, and sum the flat normals of each range
+  _ctmRunJobs(&self->mAllocator, jobs.mJobCount, jobs.mJobCount,
+              _ctmGroupCornersJob, (void *) &jobs);
+  _ctmRunJobs(&self->mAllocator, jobs.mJobCount, jobs.mJobCount,
+              _ctmSmoothNormalsJob, (void *) &jobs);
+
+  _ctmScratchRelease(self, mark);
+  return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
@@ -531,9 +1018,11 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
   CTMuint i, j, oldIdx, intPhi;
   CTMfloat magn, phi, theta, scale, thetaScale;
   CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  size_t mark;
 
   // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
+  mark = _ctmScratchMark(self);
+  smoothNormals = (CTMfloat *) _ctmScratchAlloc(self, 3 * sizeof(CTMfloat) * self->mVertexCount);
   if(!smoothNormals)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -542,7 +1031,11 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
 
   // Calculate smooth normals (Note: aVertices and aIndices use the sorted
   // index space, so smoothNormals will too)
-  _ctmCalcSmoothNormals(self, aVertices, aIndices, smoothNormals);
+  if(!_ctmCalcSmoothNormals(self, aVertices, 3, aIndices, smoothNormals))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
 
   // Normal scaling factor
   scale = 1.0f / self->mNormalPrecision;
@@ -601,70 +1094,401 @@ static CTMint _ctmMakeNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
   }
 
   // Free temporary resources
-  free(smoothNormals);
+  _ctmScratchRelease(self, mark);
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmRestoreNormals() - Convert the normals back to cartesian coordinates.
+// Normal restore parameters
 //-----------------------------------------------------------------------------
-static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
+// Largest phi (in quantization steps) that is looked up in a table. Larger
+// values only occur with very fine normal precisions, and are converted with
+// sinf/cosf instead.
+#define _CTM_NORMAL_TABLE_MAX_PHI  1024
+
+//-----------------------------------------------------------------------------
+// _ctmThetaSteps() - Number of valid theta steps for a given phi step (see
+// _ctmMakeNormalDeltas()).
+//-----------------------------------------------------------------------------
+static CTMuint _ctmThetaSteps(CTMuint aIntPhi)
 {
-  CTMuint i, j, intPhi;
-  CTMfloat magn, phi, theta, scale, thetaScale;
-  CTMfloat * smoothNormals, n[3], n2[3], basisAxes[9];
+  if(aIntPhi == 0)
+    return 1;
+  else if(aIntPhi <= 4)
+    return 5;
+  else
+    return aIntPhi + 1;
+}
 
-  // Allocate temporary memory for the nominal vertex normals
-  smoothNormals = (CTMfloat *) malloc(3 * sizeof(CTMfloat) * self->mVertexCount);
-  if(!smoothNormals)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
+//-----------------------------------------------------------------------------
+// _ctmAnglesToNormal() - Convert a quantized angular normal (phi, theta) to
+// cartesian coordinates, in the coordinate system of the smooth normal.
+//-----------------------------------------------------------------------------
+static void _ctmAnglesToNormal(CTMuint aIntPhi, CTMint aIntTheta,
+  CTMfloat aScale, CTMfloat * aNormal)
+{
+  CTMfloat phi, theta, thetaScale;
+
+  // Get phi and theta (spherical coordinates)
+  phi = aIntPhi * (0.5f * PI) * aScale;
+  if(aIntPhi == 0)
+    thetaScale = 0.0f;
+  else if(aIntPhi <= 4)
+    thetaScale = PI / 2.0f;
+  else
+    thetaScale = (2.0f * PI) / ((CTMfloat) aIntPhi);
+  theta = aIntTheta * thetaScale - PI;
 
-  // Calculate smooth normals (nominal normals)
-  _ctmCalcSmoothNormals(self, self->mVertices, self->mIndices, smoothNormals);
+  aNormal[0] = sinf(phi) * cosf(theta);
+  aNormal[1] = sinf(phi) * sinf(theta);
+  aNormal[2] = cosf(phi);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMrestorejobs - Conversion of the normals back to cartesian coordinates.
+// Since phi and theta are quantized, the angular normals are converted with a
+// table that holds every (phi, theta) pair that occurs in the mesh. The table
+// is filled with _ctmAnglesToNormal(), so the result is bit-exact compared to
+// calling sinf/cosf for each normal.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMint * mIntNormals;   // Quantized normals (magnitude, phi, theta)
+  const CTMfloat * mSmoothNormals; // Smooth normals (nominal normals)
+  CTMfloat mScale;              // Normal precision
+  CTMuint * mRows;              // Position of each phi row in mXY (~0 = none),
+                                // or NULL if there is no table
+  CTMfloat * mZ;                // Z coordinate of each phi row
+  CTMfloat * mXY;               // X and Y coordinates of each (phi, theta)
+  CTMfloat * mNormals;          // Result
+  size_t mNormalStride;         // Distance between two normals (in floats)
+  CTMuint mVertexCount;         // Number of vertices
+  CTMuint mJobCount;            // Number of vertex chunks
+  const _CTMnormalkernels * mKernels; // Rotation kernel
+} _CTMrestorejobs;
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormalsJob() - Job function for converting a chunk of normals.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreNormalsJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMrestorejobs * jobs = (_CTMrestorejobs *) aUserData;
+  const CTMint * intNormal;
+  CTMuint i, start, end, count, intPhi, row;
+  CTMint intTheta;
+  CTMfloat angular[_CTM_NORMAL_BLOCK_SIZE * 4], * a;
+  (void) aWorker;
+
+  start = (CTMuint) (((size_t) jobs->mVertexCount * aJob) / jobs->mJobCount);
+  end = (CTMuint) (((size_t) jobs->mVertexCount * (aJob + 1)) / jobs->mJobCount);
+  for(; start < end; start += count)
+  {
+    count = end - start;
+    if(count > _CTM_NORMAL_BLOCK_SIZE)
+      count = _CTM_NORMAL_BLOCK_SIZE;
+
+    for(i = 0; i < count; ++ i)
+    {
+      intNormal = &jobs->mIntNormals[(start + i) * 3];
+      a = &angular[i * 4];
+
+      // Convert the normal from the angular representation (phi, theta) back
+      // to cartesian coordinates
+      intPhi = (CTMuint) intNormal[1];
+      intTheta = intNormal[2];
+      row = (jobs->mRows && (intPhi <= _CTM_NORMAL_TABLE_MAX_PHI)) ? jobs->mRows[intPhi] : ~0U;
+      if((row != ~0U) && (intTheta >= 0) && ((CTMuint) intTheta < _ctmThetaSteps(intPhi)))
+      {
+        row = (row + (CTMuint) intTheta) * 2;
+        a[0] = jobs->mXY[row];
+        a[1] = jobs->mXY[row + 1];
+        a[2] = jobs->mZ[intPhi];
+      }
+      else
+        _ctmAnglesToNormal(intPhi, intTheta, jobs->mScale, a);
+
+      // Get the normal magnitude from the first of the three normal elements
+      a[3] = intNormal[0] * jobs->mScale;
+    }
+
+    // Rotate the normals from the coordinate systems of the smooth normals,
+    // apply the magnitudes, and output to the normals array
+    jobs->mKernels->mRotateNormals(&jobs->mSmoothNormals[(size_t) start * 3],
+      angular, count, &jobs->mNormals[(size_t) start * jobs->mNormalStride],
+      jobs->mNormalStride);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormals() - Convert the normals back to cartesian coordinates.
+//-----------------------------------------------------------------------------
+static CTMint _ctmRestoreNormals(_CTMcontext * self, CTMint * aIntNormals)
+{
+  _CTMrestorejobs jobs;
+  CTMuint i, intPhi, intTheta, steps, tableSize;
+  CTMfloat * smoothNormals, n2[3];
+  size_t mark;
+
+  // Allocate temporary memory for the nominal vertex normals
+  mark = _ctmScratchMark(self);
+  smoothNormals = (CTMfloat *) _ctmScratchAlloc(self, 3 * sizeof(CTMfloat) * self->mVertexCount);
+  if(!smoothNormals)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  // Calculate smooth normals (nominal normals)
+  if(!_ctmCalcSmoothNormals(self, self->mVertices, self->mVertexStride, self->mIndices, smoothNormals))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  jobs.mIntNormals = aIntNormals;
+  jobs.mSmoothNormals = smoothNormals;
+  jobs.mScale = self->mNormalPrecision;
+  jobs.mNormals = self->mNormals;
+  jobs.mNormalStride = self->mNormalStride;
+  jobs.mVertexCount = self->mVertexCount;
+  jobs.mKernels = self->mNormalKernels;
+
+  // Find out which phi rows are used, and where they go in the table
+  jobs.mRows = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (_CTM_NORMAL_TABLE_MAX_PHI + 1));
+  jobs.mZ = (CTMfloat *) _ctmScratchAlloc(self, sizeof(CTMfloat) * (_CTM_NORMAL_TABLE_MAX_PHI + 1));
+  tableSize = 0;
+  if(jobs.mRows && jobs.mZ)
+  {
+    memset(jobs.mRows, 0, sizeof(CTMuint) * (_CTM_NORMAL_TABLE_MAX_PHI + 1));
+    for(i = 0; i < self->mVertexCount; ++ i)
+    {
+      intPhi = (CTMuint) aIntNormals[i * 3 + 1];
+      if(intPhi <= _CTM_NORMAL_TABLE_MAX_PHI)
+        jobs.mRows[intPhi] = 1;
+    }
+    for(intPhi = 0; intPhi <= _CTM_NORMAL_TABLE_MAX_PHI; ++ intPhi)
+    {
+      if(jobs.mRows[intPhi])
+      {
+        jobs.mRows[intPhi] = tableSize;
+        tableSize += _ctmThetaSteps(intPhi);
+      }
+      else
+        jobs.mRows[intPhi] = ~0U;
+    }
+  }
+
+  // Fill the table (unless it would be larger than the mesh, in which case
+  // it is faster to convert each normal separately)
+  jobs.mXY = (CTMfloat *) 0;
+  if(jobs.mRows && jobs.mZ && (tableSize <= self->mVertexCount))
+    jobs.mXY = (CTMfloat *) _ctmScratchAlloc(self, 2 * sizeof(CTMfloat) * tableSize);
+  if(jobs.mXY)
+  {
+    for(intPhi = 0; intPhi <= _CTM_NORMAL_TABLE_MAX_PHI; ++ intPhi)
+    {
+      if(jobs.mRows[intPhi] == ~0U)
+        continue;
+      steps = _ctmThetaSteps(intPhi);
+      for(intTheta = 0; intTheta < steps; ++ intTheta)
+      {
+        _ctmAnglesToNormal(intPhi, (CTMint) intTheta, jobs.mScale, n2);
+        jobs.mXY[(jobs.mRows[intPhi] + intTheta) * 2] = n2[0];
+        jobs.mXY[(jobs.mRows[intPhi] + intTheta) * 2 + 1] = n2[1];
+      }
+      jobs.mZ[intPhi] = n2[2];
+    }
+  }
+  else
+    jobs.mRows = (CTMuint *) 0;
+
+  // Convert the normals (one chunk of vertices per thread)
+  jobs.mJobCount = self->mVertexCount / _CTM_NORMAL_MIN_CHUNK;
+  if(jobs.mJobCount > self->mDecodeThreads)
+    jobs.mJobCount = self->mDecodeThreads;
+  if(jobs.mJobCount < 1)
+    jobs.mJobCount = 1;
+  _ctmRunJobs(&self->mAllocator, jobs.mJobCount, jobs.mJobCount,
+              _ctmRestoreNormalsJob, (void *) &jobs);
+
+  // Free temporary resources
+  _ctmScratchRelease(self, mark);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmOctToNormal() - Convert octahedral coordinates (in steps of aPrecision)
+// to a unit normal. The upper half of the octahedron (z >= 0) is projected
+// onto the square |u| + |v| <= 1, and the lower half is folded out to the
+// corners of the square [-1, 1] x [-1, 1].
+//-----------------------------------------------------------------------------
+static void _ctmOctToNormal(CTMint aU, CTMint aV, CTMfloat aPrecision,
+  CTMfloat * aNormal)
+{
+  CTMfloat u, v, z, t, len;
+
+  u = (CTMfloat) aU * aPrecision;
+  v = (CTMfloat) aV * aPrecision;
+  u = u < -1.0f ? -1.0f : (u > 1.0f ? 1.0f : u);
+  v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+  z = 1.0f - fabsf(u) - fabsf(v);
+  if(z < 0.0f)
+  {
+    t = u;
+    u = (1.0f - fabsf(v)) * (t >= 0.0f ? 1.0f : -1.0f);
+    v = (1.0f - fabsf(t)) * (v >= 0.0f ? 1.0f : -1.0f);
+  }
+
+  // |u| + |v| + |z| = 1, so the length is at least 1/sqrt(3)
+  len = 1.0f / sqrtf(u * u + v * v + z * z);
+  aNormal[0] = u * len;
+  aNormal[1] = v * len;
+  aNormal[2] = z * len;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMakeOctNormalDeltas() - Convert the normals to octahedral coordinates
+// (CTM_NORMALS_OCTAHEDRAL): magnitude, and u, v deltas (in sorted vertex
+// order).
+//-----------------------------------------------------------------------------
+static void _ctmMakeOctNormalDeltas(_CTMcontext * self, CTMint * aIntNormals,
+  _CTMsortvertex * aSortVertices)
+{
+  CTMuint i, j, k, oldIdx;
+  CTMint u, v, u0, v0, prevU, prevV;
+  CTMfloat magn, scale, fu, fv, t, dot, bestDot, n[3], d[3];
 
   // Normal scaling factor
-  scale = self->mNormalPrecision;
+  scale = 1.0f / self->mNormalPrecision;
 
+  prevU = prevV = 0;
   for(i = 0; i < self->mVertexCount; ++ i)
   {
-    // Get the normal magnitude from the first of the three normal elements
-    magn = aIntNormals[i * 3] * scale;
+    // Get old normal index (before vertex sorting)
+    oldIdx = aSortVertices[i].mOriginalIndex;
 
-    // Get phi and theta (spherical coordinates, relative to the smooth normal).
-    intPhi = aIntNormals[i * 3 + 1];
-    phi = intPhi * (0.5f * PI) * scale;
-    if(intPhi == 0)
-      thetaScale = 0.0f;
-    else if(intPhi <= 4)
-      thetaScale = PI / 2.0f;
-    else
-      thetaScale = (2.0f * PI) / ((CTMfloat) intPhi);
-    theta = aIntNormals[i * 3 + 2] * thetaScale - PI;
-
-    // Convert the normal from the angular representation (phi, theta) back to
-    // cartesian coordinates
-    n2[0] = sinf(phi) * cosf(theta);
-    n2[1] = sinf(phi) * sinf(theta);
-    n2[2] = cosf(phi);
-    _ctmMakeNormalCoordSys(&smoothNormals[i * 3], basisAxes);
+    // Calculate normal magnitude, and store it in the first element
     for(j = 0; j < 3; ++ j)
-      n[j] = basisAxes[j] * n2[0] +
-             basisAxes[3 + j] * n2[1] +
-             basisAxes[6 + j] * n2[2];
+      n[j] = self->mNormals[oldIdx * 3 + j];
+    magn = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    aIntNormals[i * 3] = (CTMint) floorf(scale * magn + 0.5f);
 
-    // Apply normal magnitude, and output to the normals array
-    for(j = 0; j < 3; ++ j)
-      self->mNormals[i * 3 + j] = n[j] * magn;
+    u = v = 0;
+    if(magn >= 1e-10f)
+    {
+      for(j = 0; j < 3; ++ j)
+        n[j] /= magn;
+
+      // Project the normal onto the octahedron |x| + |y| + |z| = 1, and fold
+      // the lower half out (see _ctmOctToNormal())
+      t = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+      fu = n[0] / t;
+      fv = n[1] / t;
+      if(n[2] < 0.0f)
+      {
+        t = fu;
+        fu = (1.0f - fabsf(fv)) * (t >= 0.0f ? 1.0f : -1.0f);
+        fv = (1.0f - fabsf(t)) * (fv >= 0.0f ? 1.0f : -1.0f);
+      }
+
+      // Of the four surrounding grid points, pick the one that is closest to
+      // the normal (rounding u and v separately is not always the best choice)
+      u0 = (CTMint) floorf(fu * scale);
+      v0 = (CTMint) floorf(fv * scale);
+      bestDot = -2.0f;
+      for(k = 0; k < 4; ++ k)
+      {
+        _ctmOctToNormal(u0 + (CTMint) (k & 1), v0 + (CTMint) (k >> 1), self->mNormalPrecision, d);
+        dot = d[0] * n[0] + d[1] * n[1] + d[2] * n[2];
+        if(dot > bestDot)
+        {
+          bestDot = dot;
+          u = u0 + (CTMint) (k & 1);
+          v = v0 + (CTMint) (k >> 1);
+        }
+      }
+    }
+
+    // Store the deltas of the octahedral coordinates (neighbouring vertices
+    // usually have similar normals, since the vertices are sorted)
+    aIntNormals[i * 3 + 1] = u - prevU;
+    aIntNormals[i * 3 + 2] = v - prevV;
+    prevU = u;
+    prevV = v;
   }
+}
 
-  // Free temporary resources
-  free(smoothNormals);
+//-----------------------------------------------------------------------------
+// _CTMoctjobs - Conversion of octahedral normals (after the deltas have been
+// restored). Each normal is converted on its own, so the vertices are simply
+// split into one chunk per job.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMint * mIntNormals;   // Quantized normals (magnitude, u, v)
+  CTMfloat mPrecision;          // Normal precision
+  CTMfloat * mNormals;          // Result
+  size_t mNormalStride;         // Distance between two normals (in floats)
+  CTMuint mVertexCount;         // Number of vertices
+  CTMuint mJobCount;            // Number of vertex chunks
+} _CTMoctjobs;
 
-  return CTM_TRUE;
+//-----------------------------------------------------------------------------
+// _ctmRestoreOctNormalsJob() - Job function for converting a chunk of
+// octahedral normals.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreOctNormalsJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMoctjobs * jobs = (_CTMoctjobs *) aUserData;
+  const CTMint * intNormal;
+  CTMuint i, end;
+  CTMfloat magn, * out;
+  (void) aWorker;
+
+  i = (CTMuint) (((size_t) jobs->mVertexCount * aJob) / jobs->mJobCount);
+  end = (CTMuint) (((size_t) jobs->mVertexCount * (aJob + 1)) / jobs->mJobCount);
+  for(; i < end; ++ i)
+  {
+    intNormal = &jobs->mIntNormals[i * 3];
+    out = &jobs->mNormals[(size_t) i * jobs->mNormalStride];
+    _ctmOctToNormal(intNormal[1], intNormal[2], jobs->mPrecision, out);
+    magn = intNormal[0] * jobs->mPrecision;
+    out[0] *= magn;
+    out[1] *= magn;
+    out[2] *= magn;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreOctNormals() - Convert octahedral normals back to cartesian
+// coordinates. Unlike _ctmRestoreNormals(), this does not need the vertices
+// and indices of the mesh.
+//-----------------------------------------------------------------------------
+static void _ctmRestoreOctNormals(_CTMcontext * self, CTMint * aIntNormals)
+{
+  _CTMoctjobs jobs;
+  CTMuint i;
+
+  // Restore the octahedral coordinates (deltas)
+  for(i = 1; i < self->mVertexCount; ++ i)
+  {
+    aIntNormals[i * 3 + 1] += aIntNormals[(i - 1) * 3 + 1];
+    aIntNormals[i * 3 + 2] += aIntNormals[(i - 1) * 3 + 2];
+  }
+
+  // Convert the normals (one chunk of vertices per thread)
+  jobs.mIntNormals = aIntNormals;
+  jobs.mPrecision = self->mNormalPrecision;
+  jobs.mNormals = self->mNormals;
+  jobs.mNormalStride = self->mNormalStride;
+  jobs.mVertexCount = self->mVertexCount;
+  jobs.mJobCount = self->mVertexCount / _CTM_NORMAL_MIN_CHUNK;
+  if(jobs.mJobCount > self->mDecodeThreads)
+    jobs.mJobCount = self->mDecodeThreads;
+  if(jobs.mJobCount < 1)
+    jobs.mJobCount = 1;
+  _ctmRunJobs(&self->mAllocator, jobs.mJobCount, jobs.mJobCount,
+              _ctmRestoreOctNormalsJob, (void *) &jobs);
 }
 
 //-----------------------------------------------------------------------------
@@ -724,8 +1548,8 @@ static void _ctmRestoreUVCoords(_CTMcontext * self, _CTMfloatmap * aMap,
     v = aIntUVCoords[i * 2 + 1] + prevV;
 
     // Convert to floating point
-    aMap->mValues[i * 2] = (CTMfloat) u * scale;
-    aMap->mValues[i * 2 + 1] = (CTMfloat) v * scale;
+    aMap->mValues[(size_t) i * aMap->mStride] = (CTMfloat) u * scale;
+    aMap->mValues[(size_t) i * aMap->mStride + 1] = (CTMfloat) v * scale;
 
     prevU = u;
     prevV = v;
@@ -791,408 +1615,407 @@ static void _ctmRestoreAttribs(_CTMcontext * self, _CTMfloatmap * aMap,
     for(j = 0; j < 4; ++ j)
     {
       value[j] = aIntAttribs[i * 4 + j] + prev[j];
-      aMap->mValues[i * 4 + j] = (CTMfloat) value[j] * scale;
+      aMap->mValues[(size_t) i * aMap->mStride + j] = (CTMfloat) value[j] * scale;
       prev[j] = value[j];
     }
   }
 }
 
 //-----------------------------------------------------------------------------
-// _ctmCompressMesh_MG2() - Compress the mesh that is stored in the CTM
-// context, and write it the the output stream in the CTM context.
+// _ctmNormalType_MG2() - Get the packed data type of the normals (the
+// octahedral coordinate deltas are signed).
 //-----------------------------------------------------------------------------
-int _ctmCompressMesh_MG2(_CTMcontext * self)
+static int _ctmNormalType_MG2(_CTMcontext * self)
 {
-  _CTMgrid grid;
-  _CTMsortvertex * sortVertices;
-  _CTMfloatmap * map;
-  CTMuint * indices, * deltaIndices, * gridIndices;
-  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
-  CTMfloat * restoredVertices;
-  CTMuint i;
-
-#ifdef __DEBUG_
-  printf("COMPRESSION METHOD: MG2\n");
-#endif
+  return (self->mNormalMode == CTM_NORMALS_OCTAHEDRAL) ?
+         _CTM_PACKED_SIGNED_INTS : _CTM_PACKED_INTS;
+}
 
-  // Setup 3D space subdivision grid
-  _ctmSetupGrid(self, &grid);
+//-----------------------------------------------------------------------------
+// _ctmSectionCount_MG2() - Get the number of packed sections of an MG2 mesh
+// (or the number of blocks of an MG3 mesh).
+//-----------------------------------------------------------------------------
+static size_t _ctmSectionCount_MG2(_CTMcontext * self, CTMuint aBlockSize)
+{
+  return (size_t) _ctmBlockCount(self->mVertexCount, aBlockSize) *
+         (2 + (self->mNormals ? 1 : 0) + (size_t) self->mUVMapCount +
+          self->mAttribMapCount) +
+         _ctmBlockCount(self->mTriangleCount, aBlockSize);
+}
 
-  // Write MG2-specific header information to the stream
-  _ctmStreamWrite(self, (void *) "MG2H", 4);
-  _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
-  _ctmStreamWriteFLOAT(self, self->mNormalPrecision);
-  _ctmStreamWriteFLOAT(self, grid.mMin[0]);
-  _ctmStreamWriteFLOAT(self, grid.mMin[1]);
-  _ctmStreamWriteFLOAT(self, grid.mMin[2]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[0]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[1]);
-  _ctmStreamWriteFLOAT(self, grid.mMax[2]);
-  _ctmStreamWriteUINT(self, grid.mDivision[0]);
-  _ctmStreamWriteUINT(self, grid.mDivision[1]);
-  _ctmStreamWriteUINT(self, grid.mDivision[2]);
+//-----------------------------------------------------------------------------
+// _ctmPrepareNormalsAndMaps_MG2() - Calculate the (entropy reduced) integer
+// data of the normals, UV maps and attribute maps, in the vertex order given
+// by aSortVertices, and set up their packed section descriptors. The smooth
+// normals are calculated from aRestoredVertices and aIndices, which must be
+// exactly the vertices and indices that the decoder will restore (this is
+// also used by MG4, which has a vertex order of its own).
+//-----------------------------------------------------------------------------
+int _ctmPrepareNormalsAndMaps_MG2(_CTMcontext * self,
+  _CTMpackedsection ** aSections, CTMuint aBlockSize,
+  _CTMsortvertex * aSortVertices, CTMfloat * aRestoredVertices,
+  CTMuint * aIndices, CTMint * aIntNormals, CTMint * aIntUVCoords,
+  CTMint * aIntAttribs)
+{
+  _CTMfloatmap * map;
 
-  // Prepare (sort) vertices
-  sortVertices = (_CTMsortvertex *) malloc(sizeof(_CTMsortvertex) * self->mVertexCount);
-  if(!sortVertices)
+  if(self->mNormals)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    // Convert normals to integers and calculate deltas (entropy-reduction)
+    if(self->mNormalMode == CTM_NORMALS_OCTAHEDRAL)
+      _ctmMakeOctNormalDeltas(self, aIntNormals, aSortVertices);
+    else if(!_ctmMakeNormalDeltas(self, aIntNormals, aRestoredVertices, aIndices, aSortVertices))
+      return CTM_FALSE;
+    _ctmInitPackedSections(aSections, aIntNormals, self->mVertexCount, 3, 0, _ctmNormalType_MG2(self), _CTM_PARAMS_NORMALS, aBlockSize);
   }
-  _ctmSortVertices(self, sortVertices, &grid);
 
-  // Convert vertices to integers and calculate vertex deltas (entropy-reduction)
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
-  if(!intVertices)
+  // Convert UV coordinates to integers and calculate deltas (entropy-reduction)
+  map = self->mUVMaps;
+  while(map)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) sortVertices);
-    return CTM_FALSE;
+    _ctmMakeUVCoordDeltas(self, map, aIntUVCoords, aSortVertices);
+    _ctmInitPackedSections(aSections, aIntUVCoords, self->mVertexCount, 2, 0, _CTM_PACKED_SIGNED_INTS, _CTM_PARAMS_UV_MAPS, aBlockSize);
+    aIntUVCoords += self->mVertexCount * 2;
+    map = map->mNext;
   }
-  _ctmMakeVertexDeltas(self, intVertices, sortVertices, &grid);
 
-  // Write vertices
-#ifdef __DEBUG_
-  printf("Vertices: ");
-#endif
-  _ctmStreamWrite(self, (void *) "VERT", 4);
-  if(!_ctmStreamWritePackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
+  // Convert vertex attributes to integers and calculate deltas (entropy-reduction)
+  map = self->mAttribMaps;
+  while(map)
   {
-    free((void *) intVertices);
-    free((void *) sortVertices);
-    return CTM_FALSE;
+    _ctmMakeAttribDeltas(self, map, aIntAttribs, aSortVertices);
+    _ctmInitPackedSections(aSections, aIntAttribs, self->mVertexCount, 4, 0, _CTM_PACKED_SIGNED_INTS, _CTM_PARAMS_ATTRIB_MAPS, aBlockSize);
+    aIntAttribs += self->mVertexCount * 4;
+    map = map->mNext;
   }
 
-  // Prepare grid indices (deltas)
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
-  if(!gridIndices)
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPrepareSections_MG2() - Calculate the (entropy reduced) integer data of
+// all the sections of an MG2 mesh, and set up the packed section descriptors.
+//-----------------------------------------------------------------------------
+static int _ctmPrepareSections_MG2(_CTMcontext * self, _CTMgrid * aGrid,
+  _CTMpackedsection * aSections, CTMuint aBlockSize, CTMint * aIntVertices,
+  CTMuint * aGridIndices, CTMuint * aDeltaIndices, CTMint * aIntNormals,
+  CTMint * aIntUVCoords, CTMint * aIntAttribs)
+{
+  _CTMsortvertex * sortVertices;
+  CTMuint * indices;
+  CTMfloat * restoredVertices;
+  CTMuint i;
+  size_t mark;
+
+  // Prepare (sort) vertices
+  mark = _ctmScratchMark(self);
+  sortVertices = (_CTMsortvertex *) _ctmScratchAlloc(self, sizeof(_CTMsortvertex) * self->mVertexCount);
+  if(!sortVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
-    free((void *) sortVertices);
     return CTM_FALSE;
   }
-  gridIndices[0] = sortVertices[0].mGridIndex;
-  for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] = sortVertices[i].mGridIndex - sortVertices[i - 1].mGridIndex;
-  
-  // Write grid indices
-#ifdef __DEBUG_
-  printf("Grid indices: ");
-#endif
-  _ctmStreamWrite(self, (void *) "GIDX", 4);
-  if(!_ctmStreamWritePackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
+  if(!_ctmSortVertices(self, sortVertices, aGrid))
   {
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
 
+  // Convert vertices to integers and calculate vertex deltas (entropy-reduction)
+  _ctmMakeVertexDeltas(self, aIntVertices, sortVertices, aGrid);
+  _ctmInitPackedSections(&aSections, aIntVertices, self->mVertexCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_VERTICES, aBlockSize);
+
   // Calculate the result of the compressed -> decompressed vertices, in order
   // to use the same vertex data for calculating nominal normals as the
   // decompression routine (i.e. compensate for the vertex error when
   // calculating the normals)
-  restoredVertices = (CTMfloat *) malloc(sizeof(CTMfloat) * 3 * self->mVertexCount);
+  restoredVertices = (CTMfloat *) _ctmScratchAlloc(self, sizeof(CTMfloat) * 3 * self->mVertexCount);
   if(!restoredVertices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
-  for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] += gridIndices[i - 1];
-  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, restoredVertices);
+  for(i = 0; i < self->mVertexCount; ++ i)
+    aGridIndices[i] = sortVertices[i].mGridIndex;
+  if(self->mNormals && (self->mNormalMode == CTM_NORMALS_SPHERICAL))
+    _ctmRestoreVertices(self, aIntVertices, aGridIndices, aGrid, restoredVertices, 3);
 
-  // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
+  // Prepare grid indices (deltas)
+  for(i = self->mVertexCount - 1; i > 0; -- i)
+    aGridIndices[i] -= aGridIndices[i - 1];
+  _ctmInitPackedSections(&aSections, aGridIndices, self->mVertexCount, 1, 0, _CTM_PACKED_INTS, _CTM_PARAMS_VERTICES, aBlockSize);
 
   // Perpare (sort) indices
-  indices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
+  indices = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
   if(!indices)
   {
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
   if(!_ctmReIndexIndices(self, sortVertices, indices))
   {
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
-  _ctmReArrangeTriangles(self, indices);
-
-  // Calculate index deltas (entropy-reduction)
-  deltaIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mTriangleCount * 3);
-  if(!indices)
+  if(!_ctmReArrangeTriangles(self, indices, self->mTriangleCount))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
+
+  // Calculate index deltas (entropy-reduction)
   for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    deltaIndices[i] = indices[i];
-  _ctmMakeIndexDeltas(self, deltaIndices);
+    aDeltaIndices[i] = indices[i];
+  _ctmMakeIndexDeltas_MG2(aDeltaIndices, self->mTriangleCount);
+  _ctmInitPackedSections(&aSections, aDeltaIndices, self->mTriangleCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, aBlockSize);
 
-  // Write triangle indices
-#ifdef __DEBUG_
-  printf("Indices: ");
-#endif
-  _ctmStreamWrite(self, (void *) "INDX", 4);
-  if(!_ctmStreamWritePackedInts(self, (CTMint *) deltaIndices, self->mTriangleCount, 3, CTM_FALSE))
+  // Prepare normals, UV maps and attribute maps
+  if(!_ctmPrepareNormalsAndMaps_MG2(self, &aSections, aBlockSize, sortVertices,
+       restoredVertices, indices, aIntNormals, aIntUVCoords, aIntAttribs))
   {
-    free((void *) deltaIndices);
-    free((void *) indices);
-    free((void *) restoredVertices);
-    free((void *) sortVertices);
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
 
-  // Free temporary data for the indices
-  free((void *) deltaIndices);
+  // Free temporary data
+  _ctmScratchRelease(self, mark);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmWriteNormalsAndMaps_MG2() - Write the normals, UV maps and attribute
+// maps sections of an MG2, MG3 or MG4 mesh to the stream.
+//-----------------------------------------------------------------------------
+int _ctmWriteNormalsAndMaps_MG2(_CTMcontext * self,
+  _CTMpackedsection ** aSections)
+{
+  _CTMfloatmap * map;
+  CTMuint i;
+  size_t start;
 
+  // Write normals
   if(self->mNormals)
   {
-    // Convert normals to integers and calculate deltas (entropy-reduction)
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * 3 * self->mVertexCount);
-    if(!intNormals)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) indices);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
-      return CTM_FALSE;
-    }
-    if(!_ctmMakeNormalDeltas(self, intNormals, restoredVertices, indices, sortVertices))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
-      return CTM_FALSE;
-    }
-
-    // Write normals
 #ifdef __DEBUG_
     printf("Normals: ");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "NORM", 4);
-    if(!_ctmStreamWritePackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) indices);
-      free((void *) intNormals);
-      free((void *) restoredVertices);
-      free((void *) sortVertices);
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
-    }
-
-    // Free temporary normal data
-    free((void *) intNormals);
+    _ctmSectionSaved(self, _CTM_OUT_NORMALS, start);
   }
 
-  // Free restored indices and vertices
-  free((void *) indices);
-  free((void *) restoredVertices);
-
   // Write UV maps
   map = self->mUVMaps;
-  while(map)
+  for(i = 0; map; ++ i)
   {
-    // Convert UV coordinates to integers and calculate deltas (entropy-reduction)
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * 2 * self->mVertexCount);
-    if(!intUVCoords)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
-      return CTM_FALSE;
-    }
-    _ctmMakeUVCoordDeltas(self, map, intUVCoords, sortVertices);
-
-    // Write UV coordinates
 #ifdef __DEBUG_
     printf("Texture coordinates (%s): ", map->mName ? map->mName : "no name");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "TEXC", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
-    if(!_ctmStreamWritePackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
-      free((void *) sortVertices);
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
-    }
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
-
+    _ctmSectionSaved(self, _CTM_OUT_UV_MAP_1 + i, start);
     map = map->mNext;
   }
 
   // Write vertex attribute maps
   map = self->mAttribMaps;
-  while(map)
+  for(i = 0; map; ++ i)
   {
-    // Convert vertex attributes to integers and calculate deltas (entropy-reduction)
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * 4 * self->mVertexCount);
-    if(!intAttribs)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      free((void *) sortVertices);
-      return CTM_FALSE;
-    }
-    _ctmMakeAttribDeltas(self, map, intAttribs, sortVertices);
-
-    // Write vertex attributes
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): ", map->mName ? map->mName : "no name");
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "ATTR", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteFLOAT(self, map->mPrecision);
-    if(!_ctmStreamWritePackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
-      free((void *) sortVertices);
+    if(!_ctmStreamWritePackedArray(self, aSections))
       return CTM_FALSE;
-    }
-
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
-
+    _ctmSectionSaved(self, _CTM_OUT_ATTRIB_MAP_1 + i, start);
     map = map->mNext;
   }
 
-  // Free temporary data
-  free((void *) sortVertices);
-
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmUncompressMesh_MG2() - Uncmpress the mesh from the input stream in the
-// CTM context, and store the resulting mesh in the CTM context.
+// _ctmWriteSections_MG2() - Write all the sections of an MG2 (or MG3) mesh to
+// the stream, in the order given by the file format.
 //-----------------------------------------------------------------------------
-int _ctmUncompressMesh_MG2(_CTMcontext * self)
+static int _ctmWriteSections_MG2(_CTMcontext * self,
+  _CTMpackedsection ** aSections)
 {
-  CTMuint * gridIndices, i;
-  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
-  _CTMfloatmap * map;
-  _CTMgrid grid;
+  size_t start;
 
-  // Read MG2-specific header information from the stream
-  if(_ctmStreamReadUINT(self) != FOURCC("MG2H"))
-  {
-    self->mError = CTM_BAD_FORMAT;
+  // Write vertices
+#ifdef __DEBUG_
+  printf("Vertices: ");
+#endif
+  start = self->mWritePos;
+  _ctmStreamWrite(self, (void *) "VERT", 4);
+  if(!_ctmStreamWritePackedArray(self, aSections))
     return CTM_FALSE;
-  }
-  self->mVertexPrecision = _ctmStreamReadFLOAT(self);
-  if(self->mVertexPrecision <= 0.0f)
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return CTM_FALSE;
-  }
-  self->mNormalPrecision = _ctmStreamReadFLOAT(self);
-  if(self->mNormalPrecision <= 0.0f)
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return CTM_FALSE;
-  }
-  grid.mMin[0] = _ctmStreamReadFLOAT(self);
-  grid.mMin[1] = _ctmStreamReadFLOAT(self);
-  grid.mMin[2] = _ctmStreamReadFLOAT(self);
-  grid.mMax[0] = _ctmStreamReadFLOAT(self);
-  grid.mMax[1] = _ctmStreamReadFLOAT(self);
-  grid.mMax[2] = _ctmStreamReadFLOAT(self);
-  if((grid.mMax[0] < grid.mMin[0]) ||
-     (grid.mMax[1] < grid.mMin[1]) ||
-     (grid.mMax[2] < grid.mMin[2]))
-  {
-    self->mError = CTM_BAD_FORMAT;
+  _ctmSectionSaved(self, _CTM_OUT_VERTICES, start);
+
+  // Write grid indices
+#ifdef __DEBUG_
+  printf("Grid indices: ");
+#endif
+  start = self->mWritePos;
+  _ctmStreamWrite(self, (void *) "GIDX", 4);
+  if(!_ctmStreamWritePackedArray(self, aSections))
     return CTM_FALSE;
-  }
-  grid.mDivision[0] = _ctmStreamReadUINT(self);
-  grid.mDivision[1] = _ctmStreamReadUINT(self);
-  grid.mDivision[2] = _ctmStreamReadUINT(self);
-  if((grid.mDivision[0] < 1) || (grid.mDivision[1] < 1) || (grid.mDivision[2] < 1))
-  {
-    self->mError = CTM_BAD_FORMAT;
+  _ctmSectionSaved(self, _CTM_OUT_VERTICES, start);
+
+  // Write triangle indices
+#ifdef __DEBUG_
+  printf("Indices: ");
+#endif
+  start = self->mWritePos;
+  _ctmStreamWrite(self, (void *) "INDX", 4);
+  if(!_ctmStreamWritePackedArray(self, aSections))
     return CTM_FALSE;
-  }
+  _ctmSectionSaved(self, _CTM_OUT_INDICES, start);
 
-  // Initialize 3D space subdivision grid
-  for(i = 0; i < 3; ++ i)
-    grid.mSize[i] = (grid.mMax[i] - grid.mMin[i]) / grid.mDivision[i];
+  // Write normals, UV maps and attribute maps
+  return _ctmWriteNormalsAndMaps_MG2(self, aSections);
+}
 
-  // Read vertices
-  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return CTM_FALSE;
-  }
-  intVertices = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
-  if(!intVertices)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
-  }
-  if(!_ctmStreamReadPackedInts(self, intVertices, self->mVertexCount, 3, CTM_FALSE))
-  {
-    free((void *) intVertices);
+//-----------------------------------------------------------------------------
+// _ctmCompressMesh_MG2() - Compress the mesh that is stored in the CTM
+// context, and write it the the output stream in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_MG2(_CTMcontext * self)
+{
+  _CTMgrid grid;
+  _CTMpackedsection * sections, * section;
+  CTMuint * gridIndices, * deltaIndices, blockSize;
+  CTMint * intData, * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  size_t intCount, sectionCount, mark;
+  int result;
+
+#ifdef __DEBUG_
+  printf("COMPRESSION METHOD: %s\n", self->mMethod == CTM_METHOD_MG3 ? "MG3" : "MG2");
+#endif
+
+  // The MG3 method splits all packed arrays into independent blocks
+  blockSize = (self->mMethod == CTM_METHOD_MG3) ? _CTM_MG3_BLOCK_SIZE : 0;
+
+  // Setup 3D space subdivision grid
+  _ctmSetupGrid(self, &grid);
+  if(!_ctmSelectGrid(self, &grid))
     return CTM_FALSE;
-  }
+  _ctmGridVertexError(self, &grid, self->mVertexPrecision,
+                      &self->mSavedMaxError, &self->mSavedRMSError);
 
-  // Read grid indices
-  if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
+  // Write MG2-specific header information to the stream
+  _ctmStreamWrite(self, (void *) (blockSize ? "MG3H" : "MG2H"), 4);
+  _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
+  // A negative normal precision means octahedral normals (older readers
+  // reject the file instead of decoding garbage normals)
+  _ctmStreamWriteFLOAT(self, (self->mNormalMode == CTM_NORMALS_OCTAHEDRAL) ?
+                       -self->mNormalPrecision : self->mNormalPrecision);
+  _ctmStreamWriteFLOAT(self, grid.mMin[0]);
+  _ctmStreamWriteFLOAT(self, grid.mMin[1]);
+  _ctmStreamWriteFLOAT(self, grid.mMin[2]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[0]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[1]);
+  _ctmStreamWriteFLOAT(self, grid.mMax[2]);
+  _ctmStreamWriteUINT(self, grid.mDivision[0]);
+  _ctmStreamWriteUINT(self, grid.mDivision[1]);
+  _ctmStreamWriteUINT(self, grid.mDivision[2]);
+  if(blockSize)
+    _ctmStreamWriteUINT(self, blockSize);
+
+  // Allocate memory for the integer arrays of all sections (vertices, grid
+  // indices, triangle indices, normals, UV maps and attribute maps are stored
+  // in one block)
+  intCount = (size_t) self->mVertexCount * (3 + 1 + (self->mNormals ? 3 : 0) +
+             2 * (size_t) self->mUVMapCount + 4 * (size_t) self->mAttribMapCount) +
+             (size_t) self->mTriangleCount * 3;
+  mark = _ctmScratchMark(self);
+  intData = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * intCount);
+  if(!intData)
   {
-    free((void *) intVertices);
-    self->mError = CTM_BAD_FORMAT;
+    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-  gridIndices = (CTMuint *) malloc(sizeof(CTMuint) * self->mVertexCount);
-  if(!gridIndices)
+  intVertices = intData;
+  gridIndices = (CTMuint *) &intVertices[self->mVertexCount * 3];
+  deltaIndices = &gridIndices[self->mVertexCount];
+  intNormals = (CTMint *) &deltaIndices[self->mTriangleCount * 3];
+  intUVCoords = self->mNormals ? &intNormals[self->mVertexCount * 3] : intNormals;
+  intAttribs = &intUVCoords[(size_t) self->mVertexCount * 2 * self->mUVMapCount];
+
+  // Allocate memory for the packed section descriptors
+  sectionCount = _ctmSectionCount_MG2(self, blockSize);
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!sections)
   {
+    _ctmScratchRelease(self, mark);
     self->mError = CTM_OUT_OF_MEMORY;
-    free((void *) intVertices);
     return CTM_FALSE;
   }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) gridIndices, self->mVertexCount, 1, CTM_FALSE))
+
+  // Prepare all sections, pack them (possibly in parallel) and write them to
+  // the stream
+  result = _ctmPrepareSections_MG2(self, &grid, sections, blockSize,
+             intVertices, gridIndices, deltaIndices, intNormals, intUVCoords,
+             intAttribs);
+  if(result)
   {
-    free((void *) gridIndices);
-    free((void *) intVertices);
-    return CTM_FALSE;
+    result = _ctmPackSections(self, sections, (CTMuint) sectionCount);
+    if(result)
+    {
+      section = sections;
+      result = _ctmWriteSections_MG2(self, &section);
+    }
   }
 
+  // Free temporary data (including the packed data)
+  _ctmScratchRelease(self, mark);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreVertexArray_MG2() - Restore the vertices from the unpacked
+// integer vertices and grid index deltas.
+//-----------------------------------------------------------------------------
+static int _ctmRestoreVertexArray_MG2(_CTMcontext * self, _CTMgrid * aGrid,
+  CTMint * aIntVertices, CTMuint * aGridIndices)
+{
+  CTMuint i;
+
   // Restore grid indices (deltas)
   for(i = 1; i < self->mVertexCount; ++ i)
-    gridIndices[i] += gridIndices[i - 1];
+    aGridIndices[i] += aGridIndices[i - 1];
 
   // Restore vertices
-  _ctmRestoreVertices(self, intVertices, gridIndices, &grid, self->mVertices);
+  _ctmRestoreVertices(self, aIntVertices, aGridIndices, aGrid, self->mVertices, self->mVertexStride);
 
-  // Free temporary resources
-  free((void *) gridIndices);
-  free((void *) intVertices);
+  return _ctmSectionLoaded(self, CTM_VERTICES);
+}
 
-  // Read triangle indices
-  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
-  {
-    self->mError = CTM_BAD_FORMAT;
-    return CTM_FALSE;
-  }
-  if(!_ctmStreamReadPackedInts(self, (CTMint *) self->mIndices, self->mTriangleCount, 3, CTM_FALSE))
-    return CTM_FALSE;
+//-----------------------------------------------------------------------------
+// _ctmRestoreIndexArray_MG2() - Restore the triangle indices from the
+// unpacked index deltas.
+//-----------------------------------------------------------------------------
+static int _ctmRestoreIndexArray_MG2(_CTMcontext * self)
+{
+  CTMuint i;
 
   // Restore indices
-  _ctmRestoreIndices(self, self->mIndices);
+  _ctmRestoreIndices_MG2(self->mIndices, self->mTriangleCount);
 
   // Check that all indices are within range
   for(i = 0; i < (self->mTriangleCount * 3); ++ i)
@@ -1204,52 +2027,67 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     }
   }
 
+  return _ctmSectionLoaded(self, CTM_INDICES);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormalArray_MG2() - Restore the normals from the unpacked
+// integer normals (requires the vertices and indices to be restored).
+//-----------------------------------------------------------------------------
+static int _ctmRestoreNormalArray_MG2(_CTMcontext * self, CTMint * aIntNormals)
+{
+  if(self->mNormalMode == CTM_NORMALS_OCTAHEDRAL)
+    _ctmRestoreOctNormals(self, aIntNormals);
+  else if(!_ctmRestoreNormals(self, aIntNormals))
+    return CTM_FALSE;
+
+  return _ctmSectionLoaded(self, CTM_NORMALS);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadNormalsAndMaps_MG2() - Read the packed normals, UV maps and
+// attribute maps sections of an MG2, MG3 or MG4 mesh from the stream. With a
+// section loaded callback, each array is also unpacked and restored (which
+// requires that the vertices and indices have already been restored).
+//-----------------------------------------------------------------------------
+int _ctmReadNormalsAndMaps_MG2(_CTMcontext * self,
+  _CTMpackedsection ** aSections, CTMuint aBlockSize, CTMint * aIntNormals,
+  CTMint * aIntUVCoords, CTMint * aIntAttribs)
+{
+  _CTMfloatmap * map;
+  _CTMpackedsection * first;
+  CTMuint i;
+  int progressive;
+
+  progressive = (self->mSectionFn && !self->mHeaderOnly) ? CTM_TRUE : CTM_FALSE;
+
   // Read normals
-  if(self->mNormals)
+  if(self->mFileFlags & _CTM_HAS_NORMALS_BIT)
   {
-    intNormals = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 3);
-    if(!intNormals)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intNormals);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intNormals, self->mVertexCount, 3, CTM_FALSE))
-    {
-      free((void *) intNormals);
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, self->mNormals ? aIntNormals : (CTMint *) 0, self->mVertexCount, 3, 0, _ctmNormalType_MG2(self), aBlockSize))
       return CTM_FALSE;
-    }
-
-    // Restore normals
-    if(!_ctmRestoreNormals(self, intNormals))
+    if(progressive && self->mNormals)
     {
-      free((void *) intNormals);
-      return CTM_FALSE;
+      if(!_ctmUnpackSections(self, first, (CTMuint) (*aSections - first)) ||
+         !_ctmRestoreNormalArray_MG2(self, aIntNormals))
+        return CTM_FALSE;
     }
-
-    // Free temporary normals data
-    free((void *) intNormals);
   }
 
   // Read UV maps
   map = self->mUVMaps;
+  i = CTM_UV_MAP_1;
   while(map)
   {
-    intUVCoords = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 2);
-    if(!intUVCoords)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1258,38 +2096,36 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intUVCoords);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intUVCoords, self->mVertexCount, 2, CTM_TRUE))
-    {
-      free((void *) intUVCoords);
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, map->mValues ? aIntUVCoords : (CTMint *) 0, self->mVertexCount, 2, 0, _CTM_PACKED_SIGNED_INTS, aBlockSize))
       return CTM_FALSE;
+    if(map->mValues)
+    {
+      if(progressive)
+      {
+        if(!_ctmUnpackSections(self, first, (CTMuint) (*aSections - first)))
+          return CTM_FALSE;
+        _ctmRestoreUVCoords(self, map, aIntUVCoords);
+        if(!_ctmSectionLoaded(self, (CTMenum) i))
+          return CTM_FALSE;
+      }
+      aIntUVCoords += self->mVertexCount * 2;
     }
 
-    // Restore UV coordinates
-    _ctmRestoreUVCoords(self, map, intUVCoords);
-
-    // Free temporary UV coordinate data
-    free((void *) intUVCoords);
-
     map = map->mNext;
+    ++ i;
   }
 
   // Read vertex attribute maps
   map = self->mAttribMaps;
+  i = CTM_ATTRIB_MAP_1;
   while(map)
   {
-    intAttribs = (CTMint *) malloc(sizeof(CTMint) * self->mVertexCount * 4);
-    if(!intAttribs)
-    {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
-    }
     if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
     _ctmStreamReadSTRING(self, &map->mName);
@@ -1297,23 +2133,302 @@ int _ctmUncompressMesh_MG2(_CTMcontext * self)
     if(map->mPrecision <= 0.0f)
     {
       self->mError = CTM_BAD_FORMAT;
-      free((void *) intAttribs);
       return CTM_FALSE;
     }
-    if(!_ctmStreamReadPackedInts(self, intAttribs, self->mVertexCount, 4, CTM_TRUE))
-    {
-      free((void *) intAttribs);
+    first = *aSections;
+    if(!_ctmStreamReadPackedArray(self, aSections, map->mValues ? aIntAttribs : (CTMint *) 0, self->mVertexCount, 4, 0, _CTM_PACKED_SIGNED_INTS, aBlockSize))
       return CTM_FALSE;
+    if(map->mValues)
+    {
+      if(progressive)
+      {
+        if(!_ctmUnpackSections(self, first, (CTMuint) (*aSections - first)))
+          return CTM_FALSE;
+        _ctmRestoreAttribs(self, map, aIntAttribs);
+        if(!_ctmSectionLoaded(self, (CTMenum) i))
+          return CTM_FALSE;
+      }
+      aIntAttribs += self->mVertexCount * 4;
     }
 
-    // Restore vertex attributes
-    _ctmRestoreAttribs(self, map, intAttribs);
+    map = map->mNext;
+    ++ i;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadSections_MG2() - Read all the packed data sections of an MG2 (or
+// MG3) mesh from the stream.
+//-----------------------------------------------------------------------------
+static int _ctmReadSections_MG2(_CTMcontext * self,
+  _CTMpackedsection ** aSections, CTMuint aBlockSize, _CTMgrid * aGrid,
+  CTMint * aIntVertices, CTMuint * aGridIndices, CTMint * aIntNormals,
+  CTMint * aIntUVCoords, CTMint * aIntAttribs)
+{
+  _CTMpackedsection * first;
+  int progressive;
+
+  // With a section loaded callback, each array is unpacked and restored as
+  // soon as it has been read (otherwise it is done by _ctmRestoreMesh_MG2()).
+  // Arrays with a NULL destination are skipped.
+  progressive = (self->mSectionFn && !self->mHeaderOnly) ? CTM_TRUE : CTM_FALSE;
+
+  // Read vertices
+  if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  first = *aSections;
+  if(!_ctmStreamReadPackedArray(self, aSections, aIntVertices, self->mVertexCount, 3, 0, _CTM_PACKED_INTS, aBlockSize))
+    return CTM_FALSE;
+
+  // Read grid indices
+  if(_ctmStreamReadUINT(self) != FOURCC("GIDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  if(!_ctmStreamReadPackedArray(self, aSections, aGridIndices, self->mVertexCount, 1, 0, _CTM_PACKED_INTS, aBlockSize))
+    return CTM_FALSE;
+  if(progressive)
+  {
+    if(!_ctmUnpackSections(self, first, (CTMuint) (*aSections - first)) ||
+       !_ctmRestoreVertexArray_MG2(self, aGrid, aIntVertices, aGridIndices))
+      return CTM_FALSE;
+  }
+
+  // Read triangle indices
+  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  first = *aSections;
+  if(!_ctmStreamReadPackedArray(self, aSections, self->mIndices, self->mTriangleCount, 3, 0, _CTM_PACKED_INTS, aBlockSize))
+    return CTM_FALSE;
+  if(progressive)
+  {
+    if(!_ctmUnpackSections(self, first, (CTMuint) (*aSections - first)) ||
+       !_ctmRestoreIndexArray_MG2(self))
+      return CTM_FALSE;
+  }
+
+  // Read normals, UV maps and attribute maps
+  return _ctmReadNormalsAndMaps_MG2(self, aSections, aBlockSize, aIntNormals,
+           aIntUVCoords, aIntAttribs);
+}
 
-    // Free temporary vertex attribute data
-    free((void *) intAttribs);
+//-----------------------------------------------------------------------------
+// _ctmRestoreNormalsAndMaps_MG2() - Restore the normals, UV maps and
+// attribute maps from the unpacked MG2 (MG3, MG4) data (requires the vertices
+// and indices to be restored).
+//-----------------------------------------------------------------------------
+int _ctmRestoreNormalsAndMaps_MG2(_CTMcontext * self, CTMint * aIntNormals,
+  CTMint * aIntUVCoords, CTMint * aIntAttribs)
+{
+  CTMuint i;
+  _CTMfloatmap * map;
 
+  // Restore normals
+  if(self->mNormals)
+  {
+    if(!_ctmRestoreNormalArray_MG2(self, aIntNormals))
+      return CTM_FALSE;
+  }
+
+  // Restore UV coordinates
+  map = self->mUVMaps;
+  i = CTM_UV_MAP_1;
+  while(map)
+  {
+    if(map->mValues)
+    {
+      _ctmRestoreUVCoords(self, map, aIntUVCoords);
+      if(!_ctmSectionLoaded(self, (CTMenum) i))
+        return CTM_FALSE;
+      aIntUVCoords += self->mVertexCount * 2;
+    }
     map = map->mNext;
+    ++ i;
+  }
+
+  // Restore vertex attributes
+  map = self->mAttribMaps;
+  i = CTM_ATTRIB_MAP_1;
+  while(map)
+  {
+    if(map->mValues)
+    {
+      _ctmRestoreAttribs(self, map, aIntAttribs);
+      if(!_ctmSectionLoaded(self, (CTMenum) i))
+        return CTM_FALSE;
+      aIntAttribs += self->mVertexCount * 4;
+    }
+    map = map->mNext;
+    ++ i;
   }
 
   return CTM_TRUE;
 }
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreMesh_MG2() - Restore the mesh from the unpacked MG2 data.
+//-----------------------------------------------------------------------------
+static int _ctmRestoreMesh_MG2(_CTMcontext * self, _CTMgrid * aGrid,
+  CTMint * aIntVertices, CTMuint * aGridIndices, CTMint * aIntNormals,
+  CTMint * aIntUVCoords, CTMint * aIntAttribs)
+{
+  // Restore vertices and indices
+  if(!_ctmRestoreVertexArray_MG2(self, aGrid, aIntVertices, aGridIndices) ||
+     !_ctmRestoreIndexArray_MG2(self))
+    return CTM_FALSE;
+
+  // Restore normals, UV maps and attribute maps
+  return _ctmRestoreNormalsAndMaps_MG2(self, aIntNormals, aIntUVCoords,
+           aIntAttribs);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_MG2() - Uncmpress the mesh from the input stream in the
+// CTM context, and store the resulting mesh in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_MG2(_CTMcontext * self)
+{
+  CTMuint * gridIndices, i, blockSize, uvMapCount, attribMapCount;
+  CTMint * intData, * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  size_t intCount, sectionCount, mark, sectionMark;
+  _CTMpackedsection * sections, * section;
+  _CTMfloatmap * map;
+  _CTMgrid grid;
+  int result;
+
+  // Read MG2-specific header information from the stream
+  if(_ctmStreamReadUINT(self) != ((self->mMethod == CTM_METHOD_MG3) ?
+                                  FOURCC("MG3H") : FOURCC("MG2H")))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  self->mVertexPrecision = _ctmStreamReadFLOAT(self);
+  if(self->mVertexPrecision <= 0.0f)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  self->mNormalPrecision = _ctmStreamReadFLOAT(self);
+  self->mNormalMode = CTM_NORMALS_SPHERICAL;
+  if(self->mNormalPrecision < 0.0f)
+  {
+    self->mNormalMode = CTM_NORMALS_OCTAHEDRAL;
+    self->mNormalPrecision = -self->mNormalPrecision;
+  }
+  if(self->mNormalPrecision <= 0.0f)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  grid.mMin[0] = _ctmStreamReadFLOAT(self);
+  grid.mMin[1] = _ctmStreamReadFLOAT(self);
+  grid.mMin[2] = _ctmStreamReadFLOAT(self);
+  grid.mMax[0] = _ctmStreamReadFLOAT(self);
+  grid.mMax[1] = _ctmStreamReadFLOAT(self);
+  grid.mMax[2] = _ctmStreamReadFLOAT(self);
+  if((grid.mMax[0] < grid.mMin[0]) ||
+     (grid.mMax[1] < grid.mMin[1]) ||
+     (grid.mMax[2] < grid.mMin[2]))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  grid.mDivision[0] = _ctmStreamReadUINT(self);
+  grid.mDivision[1] = _ctmStreamReadUINT(self);
+  grid.mDivision[2] = _ctmStreamReadUINT(self);
+  if((grid.mDivision[0] < 1) || (grid.mDivision[1] < 1) || (grid.mDivision[2] < 1))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  blockSize = 0;
+  if(self->mMethod == CTM_METHOD_MG3)
+  {
+    blockSize = _ctmStreamReadUINT(self);
+    if(blockSize < 1)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
+
+  // Initialize 3D space subdivision grid
+  for(i = 0; i < 3; ++ i)
+    grid.mSize[i] = (grid.mMax[i] - grid.mMin[i]) / grid.mDivision[i];
+
+  // Header only? Then skip all the packed arrays (only the map information
+  // is read)
+  if(self->mHeaderOnly)
+  {
+    section = (_CTMpackedsection *) 0;
+    return _ctmReadSections_MG2(self, &section, blockSize, &grid,
+             (CTMint *) 0, (CTMuint *) 0, (CTMint *) 0, (CTMint *) 0,
+             (CTMint *) 0);
+  }
+
+  // Count the UV and attribute maps that are to be loaded (skipped maps have
+  // no value arrays)
+  uvMapCount = attribMapCount = 0;
+  for(map = self->mUVMaps; map; map = map->mNext)
+    uvMapCount += map->mValues ? 1 : 0;
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    attribMapCount += map->mValues ? 1 : 0;
+
+  // Allocate memory for the temporary integer arrays (vertices, grid indices,
+  // normals, UV maps and attribute maps are stored in one block)
+  intCount = (size_t) self->mVertexCount * (3 + 1 + (self->mNormals ? 3 : 0) +
+             2 * (size_t) uvMapCount + 4 * (size_t) attribMapCount);
+  mark = _ctmScratchMark(self);
+  intData = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * intCount);
+  if(!intData)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  intVertices = intData;
+  gridIndices = (CTMuint *) &intVertices[self->mVertexCount * 3];
+  intNormals = (CTMint *) &gridIndices[self->mVertexCount];
+  intUVCoords = self->mNormals ? &intNormals[self->mVertexCount * 3] : intNormals;
+  intAttribs = &intUVCoords[(size_t) self->mVertexCount * 2 * uvMapCount];
+
+  // Allocate memory for the packed section descriptors
+  sectionCount = _ctmSectionCount_MG2(self, blockSize);
+  sectionMark = _ctmScratchMark(self);
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!sections)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(sections, 0, sizeof(_CTMpackedsection) * sectionCount);
+
+  // Read all packed sections from the stream, and unpack them (possibly in
+  // parallel)
+  section = sections;
+  result = _ctmReadSections_MG2(self, &section, blockSize, &grid, intVertices,
+             gridIndices, intNormals, intUVCoords, intAttribs);
+  if(result)
+    result = _ctmUnpackSections(self, sections, (CTMuint) sectionCount);
+  _ctmScratchRelease(self, sectionMark);
+
+  // Restore the mesh (unless it has already been restored progressively)
+  if(result && !self->mSectionFn)
+    result = _ctmRestoreMesh_MG2(self, &grid, intVertices, gridIndices,
+               intNormals, intUVCoords, intAttribs);
+
+  // Free temporary resources
+  _ctmScratchRelease(self, mark);
+
+  return result;
+}
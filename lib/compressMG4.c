@@ -0,0 +1,1275 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        compressMG4.c
+// Description: Implementation of the MG4 compression method (connectivity
+//              coding by mesh traversal).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "openctm.h"
+#include "internal.h"
+
+#ifdef __DEBUG_
+#include <stdio.h>
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Traversal symbols. A gate is a directed edge a -> b of a decoded triangle.
+// The triangle on the other side of the gate is (b, a, c), and its third
+// vertex c is either a new vertex (C), the start of the boundary edge c -> a
+// (L), the end of the boundary edge b -> c (R) or any other decoded vertex
+// (S, which is coded explicitly in the reference array). B means that there
+// is no triangle on the other side of the gate. The three vertices of the
+// first triangle of each component are coded as C or S.
+//-----------------------------------------------------------------------------
+#define _CTM_MG4_C  0
+#define _CTM_MG4_L  1
+#define _CTM_MG4_R  2
+#define _CTM_MG4_S  3
+#define _CTM_MG4_B  4
+
+// Max number of boundary edges that are tried when looking for the L and R
+// vertices (keeps the traversal linear for vertices with a huge valence)
+#define _CTM_MG4_MAX_SEARCH  8
+
+// Vertices with more edges than this have their edges in an edge hash (short
+// edge lists are faster to search, but long ones make the traversal quadratic)
+#define _CTM_MG4_HASH_VALENCE  16
+
+// Vertex predictors
+#define _CTM_MG4_PREDICT_DELTA          0  // Previous vertex
+#define _CTM_MG4_PREDICT_PARALLELOGRAM  1  // Parallelogram over the gate
+
+// Triangle states (encoder)
+#define _CTM_MG4_UNVISITED  0
+#define _CTM_MG4_VISITED    1
+#define _CTM_MG4_FALLBACK   2
+
+//-----------------------------------------------------------------------------
+// _CTMedgehash - Hash table of directed edges (open addressing with linear
+// probing). Each slot holds a corner, and the edge of corner k goes from
+// vertex mIndices[k] to the vertex of the next corner of the same triangle.
+// Each directed edge is stored only once.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMuint * mIndices;  // Triangles that the corners belong to
+  CTMuint * mSlots;          // Corner of each slot (~0 = empty)
+  CTMuint mMask;             // Number of slots - 1
+} _CTMedgehash;
+
+//-----------------------------------------------------------------------------
+// _CTMtraversal - The decoded triangles, with the directed edges of each
+// vertex as linked lists of corners (the edges of vertices with a huge valence
+// are also in a hash), and the stack of gates (corners) that remain to be
+// visited. The encoder and the decoder build exactly the same structure, so
+// all traversal decisions are made by the same functions on both sides.
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMuint * mIndices;        // Decoded triangles
+  CTMuint mTriangleCount;    // Number of decoded triangles
+  size_t mCornerCount;       // Max number of corners (decoded triangles * 3)
+  CTMuint * mOutHead;        // First edge that starts in each vertex
+  CTMuint * mInHead;         // First edge that ends in each vertex
+  CTMuint * mOutNext;        // Next edge that starts in the same vertex
+  CTMuint * mInNext;         // Next edge that ends in the same vertex
+  CTMuint * mOutCount;       // Number of edges that start in each vertex
+  _CTMedgehash mEdges;       // Edges of vertices with a huge valence
+  CTMuint * mGates;          // Stack of gates (corners)
+  CTMuint mGateCount;        // Number of gates on the stack
+} _CTMtraversal;
+
+//-----------------------------------------------------------------------------
+// _ctmNextCorner() - Get the next corner of the same triangle.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmNextCorner(CTMuint aCorner)
+{
+  return (aCorner % 3 == 2) ? aCorner - 2 : aCorner + 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmInitEdgeHash() - Allocate and clear an edge hash for up to aCorners
+// edges of the triangles in aIndices.
+//-----------------------------------------------------------------------------
+static int _ctmInitEdgeHash(_CTMcontext * self, _CTMedgehash * aHash,
+  const CTMuint * aIndices, size_t aCorners)
+{
+  size_t slots;
+
+  // Use at least twice as many slots as edges, to keep the probes short
+  slots = 16;
+  while(slots < aCorners * 2)
+    slots *= 2;
+  aHash->mIndices = aIndices;
+  aHash->mMask = (CTMuint) (slots - 1);
+  aHash->mSlots = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * slots);
+  if(!aHash->mSlots)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(aHash->mSlots, 0xff, sizeof(CTMuint) * slots);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmEdgeSlot() - Get the first slot to probe for the edge aFrom -> aTo.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmEdgeSlot(const _CTMedgehash * aHash, CTMuint aFrom,
+  CTMuint aTo)
+{
+  CTMuint h;
+
+  h = aFrom * 0x9e3779b1U + aTo;
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  return h & aHash->mMask;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFindEdge() - Get the corner that holds the directed edge aFrom -> aTo
+// in the hash, or ~0 if there is none.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFindEdge(const _CTMedgehash * aHash, CTMuint aFrom,
+  CTMuint aTo)
+{
+  CTMuint slot, corner;
+
+  slot = _ctmEdgeSlot(aHash, aFrom, aTo);
+  while((corner = aHash->mSlots[slot]) != ~0U)
+  {
+    if((aHash->mIndices[corner] == aFrom) &&
+       (aHash->mIndices[_ctmNextCorner(corner)] == aTo))
+      return corner;
+    slot = (slot + 1) & aHash->mMask;
+  }
+  return ~0U;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAddEdge() - Add the edge of aCorner to the hash, unless the hash already
+// holds the same directed edge. Returns the corner that holds the edge.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmAddEdge(_CTMedgehash * aHash, CTMuint aCorner)
+{
+  CTMuint from, to, slot, corner;
+
+  from = aHash->mIndices[aCorner];
+  to = aHash->mIndices[_ctmNextCorner(aCorner)];
+  slot = _ctmEdgeSlot(aHash, from, to);
+  while((corner = aHash->mSlots[slot]) != ~0U)
+  {
+    if((aHash->mIndices[corner] == from) &&
+       (aHash->mIndices[_ctmNextCorner(corner)] == to))
+      return corner;
+    slot = (slot + 1) & aHash->mMask;
+  }
+  aHash->mSlots[slot] = aCorner;
+  return aCorner;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmInitTraversal() - Allocate and clear the traversal structure. aIndices
+// is the array of decoded triangles (aTriangleCount triangles).
+//-----------------------------------------------------------------------------
+static int _ctmInitTraversal(_CTMcontext * self, _CTMtraversal * aTraversal,
+  CTMuint * aIndices, CTMuint aTriangleCount)
+{
+  size_t corners;
+
+  corners = (size_t) aTriangleCount * 3;
+  aTraversal->mIndices = aIndices;
+  aTraversal->mTriangleCount = 0;
+  aTraversal->mCornerCount = corners;
+  aTraversal->mGateCount = 0;
+  aTraversal->mEdges.mSlots = (CTMuint *) 0;
+  aTraversal->mOutHead = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount);
+  aTraversal->mInHead = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount);
+  aTraversal->mOutNext = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (corners + 1));
+  aTraversal->mInNext = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (corners + 1));
+  aTraversal->mOutCount = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount);
+  aTraversal->mGates = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (corners + 1));
+  if(!aTraversal->mOutHead || !aTraversal->mInHead || !aTraversal->mOutNext ||
+     !aTraversal->mInNext || !aTraversal->mOutCount || !aTraversal->mGates)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(aTraversal->mOutHead, 0xff, sizeof(CTMuint) * self->mVertexCount);
+  memset(aTraversal->mInHead, 0xff, sizeof(CTMuint) * self->mVertexCount);
+  memset(aTraversal->mOutCount, 0, sizeof(CTMuint) * self->mVertexCount);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmHasEdge() - Check if the directed edge aFrom -> aTo is part of a decoded
+// triangle.
+//-----------------------------------------------------------------------------
+static int _ctmHasEdge(const _CTMtraversal * aTraversal, CTMuint aFrom,
+  CTMuint aTo)
+{
+  CTMuint corner;
+
+  if(aTraversal->mOutCount[aFrom] > _CTM_MG4_HASH_VALENCE)
+    return _ctmFindEdge(&aTraversal->mEdges, aFrom, aTo) != ~0U;
+  for(corner = aTraversal->mOutHead[aFrom]; corner != ~0U;
+      corner = aTraversal->mOutNext[corner])
+  {
+    if(aTraversal->mIndices[_ctmNextCorner(corner)] == aTo)
+      return CTM_TRUE;
+  }
+  return CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLeftVertex() - Get the start x of a boundary edge x -> aA (a decoded
+// edge that has no decoded twin), or ~0 if there is none. The most recently
+// decoded edges are tried first.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmLeftVertex(const _CTMtraversal * aTraversal, CTMuint aA)
+{
+  CTMuint corner, x, i;
+
+  corner = aTraversal->mInHead[aA];
+  for(i = 0; (i < _CTM_MG4_MAX_SEARCH) && (corner != ~0U); ++ i)
+  {
+    x = aTraversal->mIndices[corner];
+    if(!_ctmHasEdge(aTraversal, aA, x))
+      return x;
+    corner = aTraversal->mInNext[corner];
+  }
+  return ~0U;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRightVertex() - Get the end y of a boundary edge aB -> y, or ~0 if
+// there is none.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmRightVertex(const _CTMtraversal * aTraversal, CTMuint aB)
+{
+  CTMuint corner, y, i;
+
+  corner = aTraversal->mOutHead[aB];
+  for(i = 0; (i < _CTM_MG4_MAX_SEARCH) && (corner != ~0U); ++ i)
+  {
+    y = aTraversal->mIndices[_ctmNextCorner(corner)];
+    if(!_ctmHasEdge(aTraversal, y, aB))
+      return y;
+    corner = aTraversal->mOutNext[corner];
+  }
+  return ~0U;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAddTriangle() - Add the triangle (aV0, aV1, aV2) to the decoded
+// triangles, and push its gates. The first triangle of a component has three
+// gates. Other triangles were attached to the gate aV1 -> aV0, so only the
+// two new edges are gates (the edge aV1 -> aV2 is visited first).
+//-----------------------------------------------------------------------------
+static int _ctmAddTriangle(_CTMcontext * self, _CTMtraversal * aTraversal,
+  CTMuint aV0, CTMuint aV1, CTMuint aV2, int aFirst)
+{
+  CTMuint corner, edge, count, k, * tri;
+
+  corner = aTraversal->mTriangleCount * 3;
+  tri = &aTraversal->mIndices[corner];
+  tri[0] = aV0;
+  tri[1] = aV1;
+  tri[2] = aV2;
+  for(k = 0; k < 3; ++ k)
+  {
+    aTraversal->mOutNext[corner + k] = aTraversal->mOutHead[tri[k]];
+    aTraversal->mOutHead[tri[k]] = corner + k;
+    aTraversal->mInNext[corner + k] = aTraversal->mInHead[tri[(k + 1) % 3]];
+    aTraversal->mInHead[tri[(k + 1) % 3]] = corner + k;
+
+    // Hash all edges of the vertex once its valence gets too large (the hash
+    // is only allocated when it is first needed)
+    count = ++ aTraversal->mOutCount[tri[k]];
+    if(count > _CTM_MG4_HASH_VALENCE)
+    {
+      if(!aTraversal->mEdges.mSlots &&
+         !_ctmInitEdgeHash(self, &aTraversal->mEdges, aTraversal->mIndices,
+                           aTraversal->mCornerCount))
+        return CTM_FALSE;
+      if(count == _CTM_MG4_HASH_VALENCE + 1)
+      {
+        for(edge = corner + k; edge != ~0U; edge = aTraversal->mOutNext[edge])
+          _ctmAddEdge(&aTraversal->mEdges, edge);
+      }
+      else
+        _ctmAddEdge(&aTraversal->mEdges, corner + k);
+    }
+  }
+  ++ aTraversal->mTriangleCount;
+
+  aTraversal->mGates[aTraversal->mGateCount ++] = corner + 2;
+  aTraversal->mGates[aTraversal->mGateCount ++] = corner + 1;
+  if(aFirst)
+    aTraversal->mGates[aTraversal->mGateCount ++] = corner;
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmNextGate() - Pop gates until one is found that has no decoded triangle
+// on the other side (aA and aB are the vertices of the gate aA -> aB, and
+// aO is the third vertex of the triangle that the gate belongs to).
+// Returns CTM_FALSE if the stack is empty.
+//-----------------------------------------------------------------------------
+static int _ctmNextGate(_CTMtraversal * aTraversal, CTMuint * aA, CTMuint * aB,
+  CTMuint * aO)
+{
+  CTMuint corner;
+
+  while(aTraversal->mGateCount > 0)
+  {
+    corner = aTraversal->mGates[-- aTraversal->mGateCount];
+    *aA = aTraversal->mIndices[corner];
+    *aB = aTraversal->mIndices[_ctmNextCorner(corner)];
+    *aO = aTraversal->mIndices[_ctmNextCorner(_ctmNextCorner(corner))];
+    if(!_ctmHasEdge(aTraversal, *aB, *aA))
+      return CTM_TRUE;
+  }
+  return CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMmg4encoder - Encoder state for the connectivity coding.
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMuint * mCornerStart;    // First corner of each original vertex
+  CTMuint * mCorners;        // Corners of the original triangles, by vertex
+  _CTMedgehash mEdges;       // Edges of vertices with a huge valence
+  unsigned char * mShared;   // Hashed edges that more triangles have (by corner)
+  unsigned char * mState;    // State of each original triangle
+  CTMuint * mNewIndex;       // New index of each original vertex (~0 = none)
+  _CTMsortvertex * mOrder;   // Original index of each new vertex
+  CTMuint * mPredictors;     // Gate (a, b, o) of each new vertex (~0 = none)
+  CTMuint mVertexCount;      // Number of new vertices
+  unsigned char * mOps;      // Traversal symbols
+  CTMuint mOpCount;          // Number of traversal symbols
+  CTMuint * mRefs;           // Vertex references (for S symbols)
+  CTMuint mRefCount;         // Number of vertex references
+} _CTMmg4encoder;
+
+//-----------------------------------------------------------------------------
+// _ctmFindOriginalEdge() - Find a corner of an original triangle whose edge is
+// aFrom -> aTo. Returns ~0 if there is none. aShared is set if more than one
+// triangle has the edge.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFindOriginalEdge(_CTMcontext * self,
+  const _CTMmg4encoder * aEnc, CTMuint aFrom, CTMuint aTo, int * aShared)
+{
+  CTMuint i, corner, result;
+
+  if(aEnc->mCornerStart[aFrom + 1] - aEnc->mCornerStart[aFrom] >
+     _CTM_MG4_HASH_VALENCE)
+  {
+    result = _ctmFindEdge(&aEnc->mEdges, aFrom, aTo);
+    *aShared = (result != ~0U) && aEnc->mShared[result];
+    return result;
+  }
+
+  result = ~0U;
+  *aShared = CTM_FALSE;
+  for(i = aEnc->mCornerStart[aFrom]; i < aEnc->mCornerStart[aFrom + 1]; ++ i)
+  {
+    corner = aEnc->mCorners[i];
+    if(self->mIndices[_ctmNextCorner(corner)] == aTo)
+    {
+      if(result != ~0U)
+      {
+        *aShared = CTM_TRUE;
+        break;
+      }
+      result = corner;
+    }
+  }
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFindTwinCorner() - Find the corner of an unvisited original triangle
+// whose edge is aFrom -> aTo. Returns ~0 if there is none.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmFindTwinCorner(_CTMcontext * self,
+  const _CTMmg4encoder * aEnc, CTMuint aFrom, CTMuint aTo)
+{
+  CTMuint corner;
+  int shared;
+
+  corner = _ctmFindOriginalEdge(self, aEnc, aFrom, aTo, &shared);
+  if((corner != ~0U) && (aEnc->mState[corner / 3] != _CTM_MG4_UNVISITED))
+    return ~0U;
+  return corner;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmEncodeVertex() - Code a vertex of the first triangle of a component (C
+// or S), and get its new index.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmEncodeVertex(_CTMmg4encoder * aEnc, CTMuint aOldIdx)
+{
+  CTMuint idx;
+
+  idx = aEnc->mNewIndex[aOldIdx];
+  if(idx == ~0U)
+  {
+    idx = aEnc->mVertexCount ++;
+    aEnc->mNewIndex[aOldIdx] = idx;
+    aEnc->mOrder[idx].mOriginalIndex = aOldIdx;
+    aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_C;
+  }
+  else
+  {
+    aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_S;
+    aEnc->mRefs[aEnc->mRefCount ++] = aEnc->mVertexCount - 1 - idx;
+  }
+  return idx;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmEncodeConnectivity() - Traverse the mesh, and code the triangles as
+// traversal symbols. Triangles that have no neighbour with a consistently
+// oriented shared edge (e.g. triangle soups), and triangles with an edge that
+// more than one other triangle has in the opposite direction (non-manifold
+// edges), are not traversed, but are stored as fallback triangles (MG2 style
+// index deltas) after the traversed triangles. aIndices receives the
+// triangles in the new vertex order (in the order that the decoder restores
+// them), and aFallbackCount the number of fallback triangles.
+//-----------------------------------------------------------------------------
+static int _ctmEncodeConnectivity(_CTMcontext * self, _CTMmg4encoder * aEnc,
+  CTMuint * aIndices, CTMuint * aFallbackCount)
+{
+  _CTMtraversal traversal;
+  CTMuint i, k, t, a, b, c, o, corner, next, twins, fallbackCount,
+          traversedCount, * tri;
+  size_t mark, hashCount;
+  int shared;
+
+  // Make a list of the corners of each vertex
+  aEnc->mCornerStart = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (self->mVertexCount + 1));
+  aEnc->mCorners = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
+  aEnc->mShared = (unsigned char *) _ctmScratchAlloc(self, (size_t) self->mTriangleCount * 3);
+  aEnc->mState = (unsigned char *) _ctmScratchAlloc(self, self->mTriangleCount);
+  if(!aEnc->mCornerStart || !aEnc->mCorners || !aEnc->mShared || !aEnc->mState)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(aEnc->mCornerStart, 0, sizeof(CTMuint) * (self->mVertexCount + 1));
+  for(i = 0; i < self->mTriangleCount * 3; ++ i)
+    ++ aEnc->mCornerStart[self->mIndices[i] + 1];
+  for(i = 0; i < self->mVertexCount; ++ i)
+    aEnc->mCornerStart[i + 1] += aEnc->mCornerStart[i];
+  for(i = 0; i < self->mTriangleCount * 3; ++ i)
+    aEnc->mCorners[aEnc->mCornerStart[self->mIndices[i]] ++] = i;
+  for(i = self->mVertexCount; i > 0; -- i)
+    aEnc->mCornerStart[i] = aEnc->mCornerStart[i - 1];
+  aEnc->mCornerStart[0] = 0;
+
+  // Hash the edges of the vertices with a huge valence (mShared is set for the
+  // corner that holds an edge that is used more than once in one direction)
+  hashCount = 0;
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(aEnc->mCornerStart[i + 1] - aEnc->mCornerStart[i] > _CTM_MG4_HASH_VALENCE)
+      hashCount += aEnc->mCornerStart[i + 1] - aEnc->mCornerStart[i];
+  }
+  if(!_ctmInitEdgeHash(self, &aEnc->mEdges, self->mIndices, hashCount))
+    return CTM_FALSE;
+  memset(aEnc->mShared, 0, (size_t) self->mTriangleCount * 3);
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(aEnc->mCornerStart[i + 1] - aEnc->mCornerStart[i] <= _CTM_MG4_HASH_VALENCE)
+      continue;
+    for(k = aEnc->mCornerStart[i]; k < aEnc->mCornerStart[i + 1]; ++ k)
+    {
+      corner = _ctmAddEdge(&aEnc->mEdges, aEnc->mCorners[k]);
+      if(corner != aEnc->mCorners[k])
+        aEnc->mShared[corner] = 1;
+    }
+  }
+
+  // Find the fallback triangles (an edge is non-manifold, i.e. it has more
+  // than one twin candidate, or no edge has a twin in another triangle)
+  memset(aEnc->mState, _CTM_MG4_UNVISITED, self->mTriangleCount);
+  fallbackCount = 0;
+  for(t = 0; t < self->mTriangleCount; ++ t)
+  {
+    tri = &self->mIndices[t * 3];
+    twins = 0;
+    for(k = 0; k < 3; ++ k)
+    {
+      corner = _ctmFindOriginalEdge(self, aEnc, tri[(k + 1) % 3], tri[k], &shared);
+      if(corner != ~0U)
+      {
+        if(shared)
+          break;
+        if(corner / 3 != t)
+          ++ twins;
+      }
+    }
+    if((k < 3) || (twins == 0))
+    {
+      aEnc->mState[t] = _CTM_MG4_FALLBACK;
+      ++ fallbackCount;
+    }
+  }
+  traversedCount = self->mTriangleCount - fallbackCount;
+
+  // Allocate the traversal symbols and vertex references (each triangle pops
+  // at most three gates, and codes at most three vertices)
+  aEnc->mOps = (unsigned char *) _ctmScratchAlloc(self, (size_t) traversedCount * 6);
+  aEnc->mRefs = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * traversedCount * 3);
+  if((traversedCount > 0) && (!aEnc->mOps || !aEnc->mRefs))
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  aEnc->mOpCount = aEnc->mRefCount = 0;
+  mark = _ctmScratchMark(self);
+  if(!_ctmInitTraversal(self, &traversal, aIndices, traversedCount))
+    return CTM_FALSE;
+
+  // Traverse all components
+  t = 0;
+  while(traversal.mTriangleCount < traversedCount)
+  {
+    if(!_ctmNextGate(&traversal, &a, &b, &o))
+    {
+      // Start a new component at the next unvisited triangle
+      while(aEnc->mState[t] != _CTM_MG4_UNVISITED)
+        ++ t;
+      aEnc->mState[t] = _CTM_MG4_VISITED;
+      tri = &self->mIndices[t * 3];
+      a = _ctmEncodeVertex(aEnc, tri[0]);
+      b = _ctmEncodeVertex(aEnc, tri[1]);
+      c = _ctmEncodeVertex(aEnc, tri[2]);
+      if(!_ctmAddTriangle(self, &traversal, a, b, c, CTM_TRUE))
+        return CTM_FALSE;
+      continue;
+    }
+
+    // Find the triangle on the other side of the gate (it has the edge b -> a)
+    corner = _ctmFindTwinCorner(self, aEnc, aEnc->mOrder[b].mOriginalIndex,
+                                aEnc->mOrder[a].mOriginalIndex);
+    if(corner == ~0U)
+    {
+      aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_B;
+      continue;
+    }
+    aEnc->mState[corner / 3] = _CTM_MG4_VISITED;
+
+    // Code the third vertex
+    next = self->mIndices[_ctmNextCorner(_ctmNextCorner(corner))];
+    c = aEnc->mNewIndex[next];
+    if(c == ~0U)
+    {
+      c = aEnc->mVertexCount ++;
+      aEnc->mNewIndex[next] = c;
+      aEnc->mOrder[c].mOriginalIndex = next;
+      aEnc->mPredictors[c * 3] = a;
+      aEnc->mPredictors[c * 3 + 1] = b;
+      aEnc->mPredictors[c * 3 + 2] = o;
+      aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_C;
+    }
+    else if(c == _ctmLeftVertex(&traversal, a))
+      aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_L;
+    else if(c == _ctmRightVertex(&traversal, b))
+      aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_R;
+    else
+    {
+      aEnc->mOps[aEnc->mOpCount ++] = _CTM_MG4_S;
+      aEnc->mRefs[aEnc->mRefCount ++] = aEnc->mVertexCount - 1 - c;
+    }
+    if(!_ctmAddTriangle(self, &traversal, b, a, c, CTM_FALSE))
+      return CTM_FALSE;
+  }
+  _ctmScratchRelease(self, mark);
+
+  // Vertices that are not used by any traversed triangle follow in their
+  // original order
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    if(aEnc->mNewIndex[i] == ~0U)
+    {
+      aEnc->mNewIndex[i] = aEnc->mVertexCount;
+      aEnc->mOrder[aEnc->mVertexCount ++].mOriginalIndex = i;
+    }
+  }
+
+  // Fallback triangles (in the new vertex order, sorted like MG2 triangles)
+  tri = &aIndices[traversedCount * 3];
+  for(t = 0; t < self->mTriangleCount; ++ t)
+  {
+    if(aEnc->mState[t] == _CTM_MG4_FALLBACK)
+    {
+      for(k = 0; k < 3; ++ k)
+        tri[k] = aEnc->mNewIndex[self->mIndices[t * 3 + k]];
+      tri += 3;
+    }
+  }
+  *aFallbackCount = fallbackCount;
+  return _ctmReArrangeTriangles(self, &aIndices[traversedCount * 3], fallbackCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmDecodeConnectivity() - Restore the triangles from the traversal symbols
+// and the fallback triangles (which must already have been restored from
+// their deltas, and placed after the traversed triangles in aIndices).
+// aPredictors receives the gate of each new vertex, as for the encoder.
+//-----------------------------------------------------------------------------
+static int _ctmDecodeConnectivity(_CTMcontext * self, CTMuint * aIndices,
+  CTMuint aFallbackCount, const CTMuint * aOps, CTMuint aOpCount,
+  const CTMuint * aRefs, CTMuint aRefCount, CTMuint * aPredictors)
+{
+  _CTMtraversal traversal;
+  CTMuint i, k, a, b, c, o, v[3], op, opIdx, refIdx, vertexCount, traversedCount;
+  size_t mark;
+
+  traversedCount = self->mTriangleCount - aFallbackCount;
+  mark = _ctmScratchMark(self);
+  if(!_ctmInitTraversal(self, &traversal, aIndices, traversedCount))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+
+  opIdx = refIdx = vertexCount = 0;
+  while(traversal.mTriangleCount < traversedCount)
+  {
+    if(!_ctmNextGate(&traversal, &a, &b, &o))
+    {
+      // Start a new component (three vertices, coded as C or S)
+      for(k = 0; k < 3; ++ k)
+      {
+        op = (opIdx < aOpCount) ? aOps[opIdx ++] : _CTM_MG4_B;
+        if((op == _CTM_MG4_C) && (vertexCount < self->mVertexCount))
+          v[k] = vertexCount ++;
+        else if((op == _CTM_MG4_S) && (refIdx < aRefCount) &&
+                (aRefs[refIdx] < vertexCount))
+          v[k] = vertexCount - 1 - aRefs[refIdx ++];
+        else
+          break;
+      }
+      if(k < 3)
+        break;
+      if(!_ctmAddTriangle(self, &traversal, v[0], v[1], v[2], CTM_TRUE))
+      {
+        _ctmScratchRelease(self, mark);
+        return CTM_FALSE;
+      }
+      continue;
+    }
+
+    // Get the third vertex of the triangle on the other side of the gate
+    if(opIdx >= aOpCount)
+      break;
+    op = aOps[opIdx ++];
+    if(op == _CTM_MG4_B)
+      continue;
+    c = ~0U;
+    if(op == _CTM_MG4_C)
+    {
+      if(vertexCount < self->mVertexCount)
+      {
+        c = vertexCount ++;
+        aPredictors[c * 3] = a;
+        aPredictors[c * 3 + 1] = b;
+        aPredictors[c * 3 + 2] = o;
+      }
+    }
+    else if(op == _CTM_MG4_L)
+      c = _ctmLeftVertex(&traversal, a);
+    else if(op == _CTM_MG4_R)
+      c = _ctmRightVertex(&traversal, b);
+    else if((op == _CTM_MG4_S) && (refIdx < aRefCount) &&
+            (aRefs[refIdx] < vertexCount))
+      c = vertexCount - 1 - aRefs[refIdx ++];
+    if(c == ~0U)
+      break;
+    if(!_ctmAddTriangle(self, &traversal, b, a, c, CTM_FALSE))
+    {
+      _ctmScratchRelease(self, mark);
+      return CTM_FALSE;
+    }
+  }
+  _ctmScratchRelease(self, mark);
+
+  // Did we get all the triangles?
+  if(traversal.mTriangleCount < traversedCount)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  // Check the fallback triangles
+  for(i = traversedCount * 3; i < self->mTriangleCount * 3; ++ i)
+  {
+    if(aIndices[i] >= self->mVertexCount)
+    {
+      self->mError = CTM_INVALID_MESH;
+      return CTM_FALSE;
+    }
+  }
+
+  return _ctmSectionLoaded(self, CTM_INDICES);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPredictVertex_MG4() - Predict coordinate aComp of vertex aIdx (in the
+// integer domain) from the vertices before it. The parallelogram predictor
+// completes the triangle on the other side of the gate that the vertex was
+// attached to (a + b - o), and is only used for vertices that have a gate.
+// The arithmetic wraps around (corrupt data must not overflow).
+//-----------------------------------------------------------------------------
+static CTMint _ctmPredictVertex_MG4(const CTMint * aValues,
+  const CTMuint * aPredictors, CTMuint aIdx, CTMuint aComp, CTMuint aPredictor)
+{
+  const CTMuint * gate;
+
+  if(aIdx == 0)
+    return 0;
+  gate = &aPredictors[aIdx * 3];
+  if((aPredictor == _CTM_MG4_PREDICT_PARALLELOGRAM) && (gate[0] != ~0U))
+    return (CTMint) ((CTMuint) aValues[gate[0] * 3 + aComp] +
+                     (CTMuint) aValues[gate[1] * 3 + aComp] -
+                     (CTMuint) aValues[gate[2] * 3 + aComp]);
+  return aValues[(aIdx - 1) * 3 + aComp];
+}
+
+//-----------------------------------------------------------------------------
+// _ctmMakeVertexDeltas_MG4() - Convert the vertices to integers (relative to
+// the origin, in the new vertex order), and replace them with the difference
+// to their predicted values. Both predictors are tried, and the one whose
+// residuals pack best (estimated from a sample) is used, and returned in
+// aPredictor. aRestoredVertices receives the vertices exactly as the decoder
+// will restore them.
+//-----------------------------------------------------------------------------
+static int _ctmMakeVertexDeltas_MG4(_CTMcontext * self, CTMint * aIntVertices,
+  _CTMsortvertex * aOrder, const CTMuint * aPredictors, const CTMfloat * aOrigin,
+  CTMfloat * aRestoredVertices, CTMuint * aPredictor)
+{
+  _CTMpackedsection candidates[2], * section;
+  CTMuint i, j, oldIdx, gateCount;
+  CTMint value, * residuals;
+  CTMfloat scale;
+  size_t mark;
+
+  // Convert the vertices to integers
+  scale = 1.0f / self->mVertexPrecision;
+  gateCount = 0;
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    oldIdx = aOrder[i].mOriginalIndex;
+    for(j = 0; j < 3; ++ j)
+    {
+      value = (CTMint) floorf(scale * (self->mVertices[oldIdx * 3 + j] - aOrigin[j]) + 0.5f);
+      aRestoredVertices[i * 3 + j] = self->mVertexPrecision * value + aOrigin[j];
+      aIntVertices[i * 3 + j] = value;
+    }
+    if(aPredictors[i * 3] != ~0U)
+      ++ gateCount;
+  }
+
+  // Calculate the parallelogram residuals (unless no vertex has a gate)
+  mark = _ctmScratchMark(self);
+  residuals = (CTMint *) 0;
+  if(gateCount > 0)
+  {
+    residuals = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * self->mVertexCount * 3);
+    if(!residuals)
+    {
+      _ctmScratchRelease(self, mark);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    for(i = 0; i < self->mVertexCount; ++ i)
+    {
+      for(j = 0; j < 3; ++ j)
+      {
+        residuals[i * 3 + j] = (CTMint) ((CTMuint) aIntVertices[i * 3 + j] -
+          (CTMuint) _ctmPredictVertex_MG4(aIntVertices, aPredictors, i, j, _CTM_MG4_PREDICT_PARALLELOGRAM));
+      }
+    }
+  }
+
+  // Calculate the deltas in place (backwards, since the predictions use the
+  // values of the previous vertices)
+  for(i = self->mVertexCount; i > 0; -- i)
+  {
+    for(j = 0; j < 3; ++ j)
+    {
+      aIntVertices[(i - 1) * 3 + j] = (CTMint) ((CTMuint) aIntVertices[(i - 1) * 3 + j] -
+        (CTMuint) _ctmPredictVertex_MG4(aIntVertices, aPredictors, i - 1, j, _CTM_MG4_PREDICT_DELTA));
+    }
+  }
+
+  // Select the predictor that packs best. Small residuals do not always pack
+  // best: the deltas of regularly sampled surfaces are very repetitive. The
+  // parallelogram predictor must win by a margin, since the sample misses
+  // the long repetitions that favour the deltas.
+  *aPredictor = _CTM_MG4_PREDICT_DELTA;
+  if(residuals)
+  {
+    section = candidates;
+    _ctmInitPackedSections(&section, aIntVertices, self->mVertexCount, 3, 0, _CTM_PACKED_SIGNED_INTS, _CTM_PARAMS_VERTICES, 0);
+    _ctmInitPackedSections(&section, residuals, self->mVertexCount, 3, 0, _CTM_PACKED_SIGNED_INTS, _CTM_PARAMS_VERTICES, 0);
+    if(!_ctmEstimatePackedSize(self, &candidates[0]) ||
+       !_ctmEstimatePackedSize(self, &candidates[1]))
+    {
+      _ctmScratchRelease(self, mark);
+      return CTM_FALSE;
+    }
+    if(candidates[1].mPackedSize + candidates[1].mPackedSize / 16 <
+       candidates[0].mPackedSize)
+    {
+      *aPredictor = _CTM_MG4_PREDICT_PARALLELOGRAM;
+      memcpy(aIntVertices, residuals, sizeof(CTMint) * self->mVertexCount * 3);
+    }
+  }
+  _ctmScratchRelease(self, mark);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreVertices_MG4() - Restore the vertices from the residuals (the
+// integer values are restored in place).
+//-----------------------------------------------------------------------------
+static int _ctmRestoreVertices_MG4(_CTMcontext * self, CTMint * aIntVertices,
+  const CTMuint * aPredictors, CTMuint aPredictor, const CTMfloat * aOrigin)
+{
+  CTMuint i, j;
+  CTMfloat * vertex;
+
+  for(i = 0; i < self->mVertexCount; ++ i)
+  {
+    vertex = &self->mVertices[(size_t) i * self->mVertexStride];
+    for(j = 0; j < 3; ++ j)
+    {
+      aIntVertices[i * 3 + j] = (CTMint) ((CTMuint) aIntVertices[i * 3 + j] +
+        (CTMuint) _ctmPredictVertex_MG4(aIntVertices, aPredictors, i, j, aPredictor));
+      vertex[j] = self->mVertexPrecision * aIntVertices[i * 3 + j] + aOrigin[j];
+    }
+  }
+
+  return _ctmSectionLoaded(self, CTM_VERTICES);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCompressMesh_MG4() - Compress the mesh that is stored in the CTM
+// context, and write it the the output stream in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_MG4(_CTMcontext * self)
+{
+  _CTMmg4encoder enc;
+  _CTMpackedsection * sections, * section;
+  CTMuint * indices, * fallback, * ops, fallbackCount, traversedCount, i,
+          predictor;
+  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  CTMfloat origin[3], * restoredVertices;
+  size_t mark, sectionCount, start;
+  int result;
+
+#ifdef __DEBUG_
+  printf("COMPRESSION METHOD: MG4\n");
+#endif
+
+  // The vertices are stored relative to the bounding box minimum
+  origin[0] = self->mVertices[0];
+  origin[1] = self->mVertices[1];
+  origin[2] = self->mVertices[2];
+  for(i = 1; i < self->mVertexCount; ++ i)
+  {
+    if(self->mVertices[i * 3] < origin[0])
+      origin[0] = self->mVertices[i * 3];
+    if(self->mVertices[i * 3 + 1] < origin[1])
+      origin[1] = self->mVertices[i * 3 + 1];
+    if(self->mVertices[i * 3 + 2] < origin[2])
+      origin[2] = self->mVertices[i * 3 + 2];
+  }
+
+  // Allocate memory for the new vertex order, the vertex predictors and the
+  // restored triangles
+  mark = _ctmScratchMark(self);
+  enc.mNewIndex = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount);
+  enc.mOrder = (_CTMsortvertex *) _ctmScratchAlloc(self, sizeof(_CTMsortvertex) * self->mVertexCount);
+  enc.mPredictors = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount * 3);
+  indices = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mTriangleCount * 3);
+  if(!enc.mNewIndex || !enc.mOrder || !enc.mPredictors || !indices)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(enc.mNewIndex, 0xff, sizeof(CTMuint) * self->mVertexCount);
+  memset(enc.mOrder, 0, sizeof(_CTMsortvertex) * self->mVertexCount);
+  memset(enc.mPredictors, 0xff, sizeof(CTMuint) * self->mVertexCount * 3);
+  enc.mVertexCount = 0;
+
+  // Code the connectivity
+  if(!_ctmEncodeConnectivity(self, &enc, indices, &fallbackCount))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  traversedCount = self->mTriangleCount - fallbackCount;
+
+  // Allocate memory for the integer arrays of all sections
+  ops = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (enc.mOpCount + 1));
+  fallback = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * (fallbackCount * 3 + 1));
+  intVertices = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * self->mVertexCount *
+                (3 + (self->mNormals ? 3 : 0) + 2 * (size_t) self->mUVMapCount +
+                 4 * (size_t) self->mAttribMapCount));
+  restoredVertices = (CTMfloat *) _ctmScratchAlloc(self, sizeof(CTMfloat) * self->mVertexCount * 3);
+  sectionCount = 4 + (self->mNormals ? 1 : 0) + self->mUVMapCount + self->mAttribMapCount;
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!ops || !fallback || !intVertices || !restoredVertices || !sections)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  intNormals = &intVertices[self->mVertexCount * 3];
+  intUVCoords = self->mNormals ? &intNormals[self->mVertexCount * 3] : intNormals;
+  intAttribs = &intUVCoords[(size_t) self->mVertexCount * 2 * self->mUVMapCount];
+
+  // Set up the index sections (traversal symbols, vertex references and
+  // fallback triangle deltas - empty arrays are not stored)
+  section = sections;
+  for(i = 0; i < enc.mOpCount; ++ i)
+    ops[i] = enc.mOps[i];
+  if(enc.mOpCount > 0)
+    _ctmInitPackedSections(&section, ops, enc.mOpCount, 1, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, 0);
+  if(enc.mRefCount > 0)
+    _ctmInitPackedSections(&section, enc.mRefs, enc.mRefCount, 1, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, 0);
+  for(i = 0; i < fallbackCount * 3; ++ i)
+    fallback[i] = indices[traversedCount * 3 + i];
+  _ctmMakeIndexDeltas_MG2(fallback, fallbackCount);
+  if(fallbackCount > 0)
+    _ctmInitPackedSections(&section, fallback, fallbackCount, 3, 0, _CTM_PACKED_INTS, _CTM_PARAMS_INDICES, 0);
+
+  // Convert the vertices to integers and calculate the prediction residuals
+  if(!_ctmMakeVertexDeltas_MG4(self, intVertices, enc.mOrder, enc.mPredictors,
+        origin, restoredVertices, &predictor))
+  {
+    _ctmScratchRelease(self, mark);
+    return CTM_FALSE;
+  }
+  _ctmInitPackedSections(&section, intVertices, self->mVertexCount, 3, 0, _CTM_PACKED_SIGNED_INTS, _CTM_PARAMS_VERTICES, 0);
+
+  // Normals, UV maps and attribute maps are coded as for MG2 (but in the new
+  // vertex order)
+  result = _ctmPrepareNormalsAndMaps_MG2(self, &section, 0, enc.mOrder,
+             restoredVertices, indices, intNormals, intUVCoords, intAttribs);
+  sectionCount = (size_t) (section - sections);
+
+  // Pack all sections (possibly in parallel) and write them to the stream
+  if(result)
+    result = _ctmPackSections(self, sections, (CTMuint) sectionCount);
+  if(result)
+  {
+    section = sections;
+
+    // Write MG4-specific header information to the stream (a negative normal
+    // precision means octahedral normals, as for MG2)
+    _ctmStreamWrite(self, (void *) "MG4H", 4);
+    _ctmStreamWriteFLOAT(self, self->mVertexPrecision);
+    _ctmStreamWriteFLOAT(self, (self->mNormalMode == CTM_NORMALS_OCTAHEDRAL) ?
+                         -self->mNormalPrecision : self->mNormalPrecision);
+    _ctmStreamWriteFLOAT(self, origin[0]);
+    _ctmStreamWriteFLOAT(self, origin[1]);
+    _ctmStreamWriteFLOAT(self, origin[2]);
+    _ctmStreamWriteUINT(self, predictor);
+
+    // Write triangle indices
+#ifdef __DEBUG_
+    printf("Indices: %d symbols, %d references, %d fallback triangles\n", enc.mOpCount, enc.mRefCount, fallbackCount);
+#endif
+    start = self->mWritePos;
+    _ctmStreamWrite(self, (void *) "INDX", 4);
+    _ctmStreamWriteUINT(self, enc.mOpCount);
+    _ctmStreamWriteUINT(self, enc.mRefCount);
+    _ctmStreamWriteUINT(self, fallbackCount);
+    if(result && (enc.mOpCount > 0))
+      result = _ctmStreamWritePackedArray(self, &section);
+    if(result && (enc.mRefCount > 0))
+      result = _ctmStreamWritePackedArray(self, &section);
+    if(result && (fallbackCount > 0))
+      result = _ctmStreamWritePackedArray(self, &section);
+    _ctmSectionSaved(self, _CTM_OUT_INDICES, start);
+
+    // Write vertices
+#ifdef __DEBUG_
+    printf("Vertices: ");
+#endif
+    if(result)
+    {
+      start = self->mWritePos;
+      _ctmStreamWrite(self, (void *) "VERT", 4);
+      result = _ctmStreamWritePackedArray(self, &section);
+      _ctmSectionSaved(self, _CTM_OUT_VERTICES, start);
+    }
+
+    // Write normals, UV maps and attribute maps
+    if(result)
+      result = _ctmWriteNormalsAndMaps_MG2(self, &section);
+  }
+
+  // Free temporary data (including the packed data)
+  _ctmScratchRelease(self, mark);
+
+  return result;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadIndexArrays_MG4() - Read the packed index arrays (traversal symbols,
+// vertex references and fallback triangles) from the stream. If aSections is
+// NULL, the arrays are skipped. The symbol and reference arrays are allocated
+// from the scratch arena.
+//-----------------------------------------------------------------------------
+static int _ctmReadIndexArrays_MG4(_CTMcontext * self,
+  _CTMpackedsection ** aSections, CTMuint ** aOps, CTMuint * aOpCount,
+  CTMuint ** aRefs, CTMuint * aRefCount, CTMuint * aFallbackCount)
+{
+  CTMuint i, count, size, * data;
+
+  if(_ctmStreamReadUINT(self) != FOURCC("INDX"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  *aOpCount = _ctmStreamReadUINT(self);
+  *aRefCount = _ctmStreamReadUINT(self);
+  *aFallbackCount = _ctmStreamReadUINT(self);
+
+  // Each traversed triangle has at most six symbols (three vertices and three
+  // gates) and three references
+  if((*aFallbackCount > self->mTriangleCount) ||
+     ((size_t) *aOpCount > (size_t) (self->mTriangleCount - *aFallbackCount) * 6) ||
+     ((size_t) *aRefCount > (size_t) (self->mTriangleCount - *aFallbackCount) * 3))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  *aOps = *aRefs = (CTMuint *) 0;
+  for(i = 0; i < 3; ++ i)
+  {
+    count = (i == 0) ? *aOpCount : ((i == 1) ? *aRefCount : *aFallbackCount);
+    size = (i == 2) ? 3 : 1;
+    if(count == 0)
+      continue;
+    data = (CTMuint *) 0;
+    if(aSections)
+    {
+      if(i == 2)
+        data = &self->mIndices[(self->mTriangleCount - count) * 3];
+      else
+      {
+        data = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * count);
+        if(!data)
+        {
+          self->mError = CTM_OUT_OF_MEMORY;
+          return CTM_FALSE;
+        }
+        if(i == 0)
+          *aOps = data;
+        else
+          *aRefs = data;
+      }
+    }
+    if(!_ctmStreamReadPackedArray(self, aSections, data, count, size, 0, _CTM_PACKED_INTS, 0))
+      return CTM_FALSE;
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRestoreIndexArray_MG4() - Restore the triangle indices from the
+// unpacked index arrays (and the vertex predictors).
+//-----------------------------------------------------------------------------
+static int _ctmRestoreIndexArray_MG4(_CTMcontext * self, CTMuint * aOps,
+  CTMuint aOpCount, CTMuint * aRefs, CTMuint aRefCount, CTMuint aFallbackCount,
+  CTMuint * aPredictors)
+{
+  _ctmRestoreIndices_MG2(&self->mIndices[(self->mTriangleCount - aFallbackCount) * 3],
+                         aFallbackCount);
+  return _ctmDecodeConnectivity(self, self->mIndices, aFallbackCount, aOps,
+           aOpCount, aRefs, aRefCount, aPredictors);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUncompressMesh_MG4() - Uncompress the mesh from the input stream in the
+// CTM context, and store the resulting mesh in the CTM context.
+//-----------------------------------------------------------------------------
+int _ctmUncompressMesh_MG4(_CTMcontext * self)
+{
+  CTMuint * ops, * refs, * predictors, opCount, refCount, fallbackCount,
+          uvMapCount, attribMapCount, predictor;
+  CTMint * intVertices, * intNormals, * intUVCoords, * intAttribs;
+  CTMfloat origin[3];
+  size_t mark, sectionCount;
+  _CTMpackedsection * sections, * section, * first;
+  _CTMfloatmap * map;
+  int result, progressive;
+
+  // Read MG4-specific header information from the stream
+  if(_ctmStreamReadUINT(self) != FOURCC("MG4H"))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  self->mVertexPrecision = _ctmStreamReadFLOAT(self);
+  if(self->mVertexPrecision <= 0.0f)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  self->mNormalPrecision = _ctmStreamReadFLOAT(self);
+  self->mNormalMode = CTM_NORMALS_SPHERICAL;
+  if(self->mNormalPrecision < 0.0f)
+  {
+    self->mNormalMode = CTM_NORMALS_OCTAHEDRAL;
+    self->mNormalPrecision = -self->mNormalPrecision;
+  }
+  if(self->mNormalPrecision <= 0.0f)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+  origin[0] = _ctmStreamReadFLOAT(self);
+  origin[1] = _ctmStreamReadFLOAT(self);
+  origin[2] = _ctmStreamReadFLOAT(self);
+  predictor = _ctmStreamReadUINT(self);
+  if(predictor > _CTM_MG4_PREDICT_PARALLELOGRAM)
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return CTM_FALSE;
+  }
+
+  // Header only? Then skip all the packed arrays (only the map information
+  // is read)
+  if(self->mHeaderOnly)
+  {
+    section = (_CTMpackedsection *) 0;
+    if(!_ctmReadIndexArrays_MG4(self, (_CTMpackedsection **) 0, &ops, &opCount,
+          &refs, &refCount, &fallbackCount))
+      return CTM_FALSE;
+    if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    if(!_ctmStreamReadPackedArray(self, &section, (void *) 0, self->mVertexCount, 3, 0, _CTM_PACKED_SIGNED_INTS, 0))
+      return CTM_FALSE;
+    return _ctmReadNormalsAndMaps_MG2(self, &section, 0, (CTMint *) 0,
+             (CTMint *) 0, (CTMint *) 0);
+  }
+
+  // Count the UV and attribute maps that are to be loaded (skipped maps have
+  // no value arrays)
+  uvMapCount = attribMapCount = 0;
+  for(map = self->mUVMaps; map; map = map->mNext)
+    uvMapCount += map->mValues ? 1 : 0;
+  for(map = self->mAttribMaps; map; map = map->mNext)
+    attribMapCount += map->mValues ? 1 : 0;
+
+  // Allocate memory for the temporary integer arrays, the vertex predictors
+  // and the packed section descriptors
+  mark = _ctmScratchMark(self);
+  intVertices = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * self->mVertexCount *
+                (3 + (self->mNormals ? 3 : 0) + 2 * (size_t) uvMapCount +
+                 4 * (size_t) attribMapCount));
+  predictors = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * self->mVertexCount * 3);
+  sectionCount = 4 + (self->mNormals ? 1 : 0) + self->mUVMapCount + self->mAttribMapCount;
+  sections = (_CTMpackedsection *) _ctmScratchAlloc(self, sizeof(_CTMpackedsection) * sectionCount);
+  if(!intVertices || !predictors || !sections)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  memset(predictors, 0xff, sizeof(CTMuint) * self->mVertexCount * 3);
+  memset(sections, 0, sizeof(_CTMpackedsection) * sectionCount);
+  intNormals = &intVertices[self->mVertexCount * 3];
+  intUVCoords = self->mNormals ? &intNormals[self->mVertexCount * 3] : intNormals;
+  intAttribs = &intUVCoords[(size_t) self->mVertexCount * 2 * uvMapCount];
+
+  // With a section loaded callback, each array is unpacked and restored as
+  // soon as it has been read
+  progressive = self->mSectionFn ? CTM_TRUE : CTM_FALSE;
+
+  // Read triangle indices
+  section = sections;
+  result = _ctmReadIndexArrays_MG4(self, &section, &ops, &opCount, &refs,
+             &refCount, &fallbackCount);
+  if(result && progressive)
+    result = _ctmUnpackSections(self, sections, (CTMuint) (section - sections)) &&
+             _ctmRestoreIndexArray_MG4(self, ops, opCount, refs, refCount,
+                                       fallbackCount, predictors);
+
+  // Read vertices
+  if(result && (_ctmStreamReadUINT(self) != FOURCC("VERT")))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    result = CTM_FALSE;
+  }
+  first = section;
+  if(result)
+    result = _ctmStreamReadPackedArray(self, &section, intVertices, self->mVertexCount, 3, 0, _CTM_PACKED_SIGNED_INTS, 0);
+  if(result && progressive)
+    result = _ctmUnpackSections(self, first, (CTMuint) (section - first)) &&
+             _ctmRestoreVertices_MG4(self, intVertices, predictors, predictor, origin);
+
+  // Read normals, UV maps and attribute maps
+  if(result)
+    result = _ctmReadNormalsAndMaps_MG2(self, &section, 0, intNormals,
+               intUVCoords, intAttribs);
+
+  // Unpack all sections (possibly in parallel), and restore the mesh (unless
+  // it has already been restored progressively)
+  if(result && !progressive)
+  {
+    result = _ctmUnpackSections(self, sections, (CTMuint) (section - sections)) &&
+             _ctmRestoreIndexArray_MG4(self, ops, opCount, refs, refCount,
+                                       fallbackCount, predictors) &&
+             _ctmRestoreVertices_MG4(self, intVertices, predictors, predictor, origin) &&
+             _ctmRestoreNormalsAndMaps_MG2(self, intNormals, intUVCoords, intAttribs);
+  }
+
+  // Free temporary resources
+  _ctmScratchRelease(self, mark);
+
+  return result;
+}
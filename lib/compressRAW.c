@@ -40,8 +40,9 @@
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
+  CTMuint i, j;
   _CTMfloatmap * map;
+  size_t start;
 
 #ifdef __DEBUG_
   printf("COMPRESSION METHOD: RAW\n");
@@ -51,17 +52,21 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
   printf("Inidices: %d bytes\n", (CTMuint)(self->mTriangleCount * 3 * sizeof(CTMuint)));
 #endif
+  start = self->mWritePos;
   _ctmStreamWrite(self, (void *) "INDX", 4);
   for(i = 0; i < self->mTriangleCount * 3; ++ i)
     _ctmStreamWriteUINT(self, self->mIndices[i]);
+  _ctmSectionSaved(self, _CTM_OUT_INDICES, start);
 
   // Write vertices
 #ifdef __DEBUG_
   printf("Vertices: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
+  start = self->mWritePos;
   _ctmStreamWrite(self, (void *) "VERT", 4);
   for(i = 0; i < self->mVertexCount * 3; ++ i)
     _ctmStreamWriteFLOAT(self, self->mVertices[i]);
+  _ctmSectionSaved(self, _CTM_OUT_VERTICES, start);
 
   // Write normals
   if(self->mNormals)
@@ -69,43 +74,80 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 #ifdef __DEBUG_
     printf("Normals: %d bytes\n", (CTMuint)(self->mVertexCount * 3 * sizeof(CTMfloat)));
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "NORM", 4);
     for(i = 0; i < self->mVertexCount * 3; ++ i)
       _ctmStreamWriteFLOAT(self, self->mNormals[i]);
+    _ctmSectionSaved(self, _CTM_OUT_NORMALS, start);
   }
 
   // Write UV maps
   map = self->mUVMaps;
-  while(map)
+  for(j = 0; map; ++ j)
   {
 #ifdef __DEBUG_
     printf("UV coordinates (%s): %d bytes\n", map->mName ? map->mName : "no name", (CTMuint)(self->mVertexCount * 2 * sizeof(CTMfloat)));
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "TEXC", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     _ctmStreamWriteSTRING(self, map->mFileName);
     for(i = 0; i < self->mVertexCount * 2; ++ i)
       _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmSectionSaved(self, _CTM_OUT_UV_MAP_1 + j, start);
     map = map->mNext;
   }
 
   // Write attribute maps
   map = self->mAttribMaps;
-  while(map)
+  for(j = 0; map; ++ j)
   {
 #ifdef __DEBUG_
     printf("Vertex attributes (%s): %d bytes\n", map->mName ? map->mName : "no name", (CTMuint)(self->mVertexCount * 4 * sizeof(CTMfloat)));
 #endif
+    start = self->mWritePos;
     _ctmStreamWrite(self, (void *) "ATTR", 4);
     _ctmStreamWriteSTRING(self, map->mName);
     for(i = 0; i < self->mVertexCount * 4; ++ i)
       _ctmStreamWriteFLOAT(self, map->mValues[i]);
+    _ctmSectionSaved(self, _CTM_OUT_ATTRIB_MAP_1 + j, start);
     map = map->mNext;
   }
 
   return 1;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmSkipArray_RAW() - Skip an array of aCount elements with aSize
+// components per element (for mesh data that is not loaded).
+//-----------------------------------------------------------------------------
+static int _ctmSkipArray_RAW(_CTMcontext * self, CTMuint aCount,
+  CTMuint aSize)
+{
+  if(!_ctmStreamSkip(self, (size_t) aCount * aSize * 4))
+  {
+    self->mError = CTM_BAD_FORMAT;
+    return 0;
+  }
+  return 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReadFloatArray_RAW() - Read an array of aCount elements with aSize
+// components per element into aData, with aStride floats between the
+// elements.
+//-----------------------------------------------------------------------------
+static void _ctmReadFloatArray_RAW(_CTMcontext * self, CTMfloat * aData,
+  CTMuint aCount, CTMuint aSize, CTMuint aStride)
+{
+  CTMuint i, j;
+  for(i = 0; i < aCount; ++ i)
+  {
+    for(j = 0; j < aSize; ++ j)
+      aData[(size_t) i * aStride + j] = _ctmStreamReadFLOAT(self);
+  }
+}
+
 //-----------------------------------------------------------------------------
 // _ctmUncompressMesh_RAW() - Uncmpress the mesh from the input stream in the
 // CTM context using the RAW method, and store the resulting mesh in the CTM
@@ -113,7 +155,7 @@ int _ctmCompressMesh_RAW(_CTMcontext * self)
 //-----------------------------------------------------------------------------
 int _ctmUncompressMesh_RAW(_CTMcontext * self)
 {
-  CTMuint i;
+  CTMuint i, section;
   _CTMfloatmap * map;
 
   // Read triangle indices
@@ -122,8 +164,18 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mTriangleCount * 3; ++ i)
-    self->mIndices[i] = _ctmStreamReadUINT(self);
+  if(!self->mIndices)
+  {
+    if(!_ctmSkipArray_RAW(self, self->mTriangleCount, 3))
+      return 0;
+  }
+  else
+  {
+    for(i = 0; i < self->mTriangleCount * 3; ++ i)
+      self->mIndices[i] = _ctmStreamReadUINT(self);
+    if(!_ctmSectionLoaded(self, CTM_INDICES))
+      return 0;
+  }
 
   // Read vertices
   if(_ctmStreamReadUINT(self) != FOURCC("VERT"))
@@ -131,23 +183,42 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     self->mError = CTM_BAD_FORMAT;
     return 0;
   }
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
-    self->mVertices[i] = _ctmStreamReadFLOAT(self);
+  if(!self->mVertices)
+  {
+    if(!_ctmSkipArray_RAW(self, self->mVertexCount, 3))
+      return 0;
+  }
+  else
+  {
+    _ctmReadFloatArray_RAW(self, self->mVertices, self->mVertexCount, 3, self->mVertexStride);
+    if(!_ctmSectionLoaded(self, CTM_VERTICES))
+      return 0;
+  }
 
   // Read normals
-  if(self->mNormals)
+  if(self->mFileFlags & _CTM_HAS_NORMALS_BIT)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("NORM"))
     {
       self->mError = CTM_BAD_FORMAT;
       return 0;
     }
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
-      self->mNormals[i] = _ctmStreamReadFLOAT(self);
+    if(!self->mNormals)
+    {
+      if(!_ctmSkipArray_RAW(self, self->mVertexCount, 3))
+        return 0;
+    }
+    else
+    {
+      _ctmReadFloatArray_RAW(self, self->mNormals, self->mVertexCount, 3, self->mNormalStride);
+      if(!_ctmSectionLoaded(self, CTM_NORMALS))
+        return 0;
+    }
   }
 
   // Read UV maps
   map = self->mUVMaps;
+  section = CTM_UV_MAP_1;
   while(map)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("TEXC"))
@@ -157,13 +228,24 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
     }
     _ctmStreamReadSTRING(self, &map->mName);
     _ctmStreamReadSTRING(self, &map->mFileName);
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(!map->mValues)
+    {
+      if(!_ctmSkipArray_RAW(self, self->mVertexCount, 2))
+        return 0;
+    }
+    else
+    {
+      _ctmReadFloatArray_RAW(self, map->mValues, self->mVertexCount, 2, map->mStride);
+      if(!_ctmSectionLoaded(self, (CTMenum) section))
+        return 0;
+    }
     map = map->mNext;
+    ++ section;
   }
 
   // Read attribute maps
   map = self->mAttribMaps;
+  section = CTM_ATTRIB_MAP_1;
   while(map)
   {
     if(_ctmStreamReadUINT(self) != FOURCC("ATTR"))
@@ -172,9 +254,19 @@ int _ctmUncompressMesh_RAW(_CTMcontext * self)
       return 0;
     }
     _ctmStreamReadSTRING(self, &map->mName);
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
-      map->mValues[i] = _ctmStreamReadFLOAT(self);
+    if(!map->mValues)
+    {
+      if(!_ctmSkipArray_RAW(self, self->mVertexCount, 4))
+        return 0;
+    }
+    else
+    {
+      _ctmReadFloatArray_RAW(self, map->mValues, self->mVertexCount, 4, map->mStride);
+      if(!_ctmSectionLoaded(self, (CTMenum) section))
+        return 0;
+    }
     map = map->mNext;
+    ++ section;
   }
 
   return 1;
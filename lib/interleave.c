@@ -0,0 +1,549 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        interleave.c
+// Description: Byte plane kernels for packed arrays (splitting 32-bit words
+//              into byte planes and back, and signed magnitude conversion),
+//              with SIMD versions that are selected at runtime.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+// Which SIMD kernels can be built? (x86 kernels are compiled for their target
+// instruction set with function attributes, and are only used if the CPU
+// supports them; NEON is always available when the compiler targets it)
+#if !defined(OPENCTM_NO_SIMD)
+  #if (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+    #include <immintrin.h>
+    #include <cpuid.h>
+    #define _CTM_HAVE_SSE2
+    #define _CTM_HAVE_AVX2
+    #define _CTM_TARGET(x) __attribute__((target(x)))
+  #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #include <immintrin.h>
+    #define _CTM_HAVE_SSE2
+    #if _MSC_VER >= 1800
+      #define _CTM_HAVE_AVX2
+    #endif
+    #define _CTM_TARGET(x)
+  #elif (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+        (!defined(__BYTE_ORDER__) || (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+    #include <arm_neon.h>
+    #define _CTM_HAVE_NEON
+  #endif
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Portable (scalar) kernels. The word arrays are accessed byte wise (with
+// memcpy), since they may hold floats.
+//-----------------------------------------------------------------------------
+static void _ctmSplitPlanes_C(const void * aWords, size_t aCount,
+  unsigned char * aBytes, size_t aPlaneSize)
+{
+  const unsigned char * src = (const unsigned char *) aWords;
+  unsigned char * p0 = aBytes, * p1 = p0 + aPlaneSize, * p2 = p1 + aPlaneSize,
+    * p3 = p2 + aPlaneSize;
+  CTMuint w;
+  size_t i;
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    memcpy(&w, &src[i * 4], 4);
+    p0[i] = (unsigned char) (w >> 24);
+    p1[i] = (unsigned char) (w >> 16);
+    p2[i] = (unsigned char) (w >> 8);
+    p3[i] = (unsigned char) w;
+  }
+}
+
+static void _ctmJoinPlanes_C(const unsigned char * aBytes, size_t aPlaneSize,
+  void * aWords, size_t aCount)
+{
+  unsigned char * dst = (unsigned char *) aWords;
+  const unsigned char * p0 = aBytes, * p1 = p0 + aPlaneSize,
+    * p2 = p1 + aPlaneSize, * p3 = p2 + aPlaneSize;
+  CTMuint w;
+  size_t i;
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    w = (((CTMuint) p0[i]) << 24) | (((CTMuint) p1[i]) << 16) |
+        (((CTMuint) p2[i]) << 8) | ((CTMuint) p3[i]);
+    memcpy(&dst[i * 4], &w, 4);
+  }
+}
+
+static void _ctmToSignedMagnitude_C(CTMuint * aWords, size_t aCount)
+{
+  size_t i;
+  for(i = 0; i < aCount; ++ i)
+    aWords[i] = (aWords[i] << 1) ^ (0u - (aWords[i] >> 31));
+}
+
+static void _ctmFromSignedMagnitude_C(CTMuint * aWords, size_t aCount)
+{
+  size_t i;
+  for(i = 0; i < aCount; ++ i)
+    aWords[i] = (aWords[i] >> 1) ^ (0u - (aWords[i] & 1));
+}
+
+static const _CTMplanekernels _ctmPlaneKernels_C = {
+  "C",
+  _ctmSplitPlanes_C,
+  _ctmJoinPlanes_C,
+  _ctmToSignedMagnitude_C,
+  _ctmFromSignedMagnitude_C,
+  };
+
+
+#if defined(_CTM_HAVE_SSE2)
+
+//-----------------------------------------------------------------------------
+// SSE2 kernels (16 words per iteration). The byte planes are extracted with
+// shifts, masks and saturating packs (SSE2 has no byte shuffle).
+//-----------------------------------------------------------------------------
+_CTM_TARGET("sse2")
+static void _ctmSplitPlanes_SSE2(const void * aWords, size_t aCount,
+  unsigned char * aBytes, size_t aPlaneSize)
+{
+  const unsigned char * src = (const unsigned char *) aWords;
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i a, b, c, d;
+  size_t i;
+
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    a = _mm_loadu_si128((const __m128i *) &src[i * 4]);
+    b = _mm_loadu_si128((const __m128i *) &src[i * 4 + 16]);
+    c = _mm_loadu_si128((const __m128i *) &src[i * 4 + 32]);
+    d = _mm_loadu_si128((const __m128i *) &src[i * 4 + 48]);
+    _mm_storeu_si128((__m128i *) &aBytes[i + 3 * aPlaneSize], _mm_packus_epi16(
+      _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask)),
+      _mm_packs_epi32(_mm_and_si128(c, mask), _mm_and_si128(d, mask))));
+    _mm_storeu_si128((__m128i *) &aBytes[i + 2 * aPlaneSize], _mm_packus_epi16(
+      _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+                      _mm_and_si128(_mm_srli_epi32(b, 8), mask)),
+      _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(c, 8), mask),
+                      _mm_and_si128(_mm_srli_epi32(d, 8), mask))));
+    _mm_storeu_si128((__m128i *) &aBytes[i + aPlaneSize], _mm_packus_epi16(
+      _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+                      _mm_and_si128(_mm_srli_epi32(b, 16), mask)),
+      _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(c, 16), mask),
+                      _mm_and_si128(_mm_srli_epi32(d, 16), mask))));
+    _mm_storeu_si128((__m128i *) &aBytes[i], _mm_packus_epi16(
+      _mm_packs_epi32(_mm_srli_epi32(a, 24), _mm_srli_epi32(b, 24)),
+      _mm_packs_epi32(_mm_srli_epi32(c, 24), _mm_srli_epi32(d, 24))));
+  }
+
+  _ctmSplitPlanes_C(&src[i * 4], aCount - i, &aBytes[i], aPlaneSize);
+}
+
+_CTM_TARGET("sse2")
+static void _ctmJoinPlanes_SSE2(const unsigned char * aBytes,
+  size_t aPlaneSize, void * aWords, size_t aCount)
+{
+  unsigned char * dst = (unsigned char *) aWords;
+  __m128i b0, b1, b2, b3, lo, hi;
+  size_t i;
+
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    b0 = _mm_loadu_si128((const __m128i *) &aBytes[i + 3 * aPlaneSize]);
+    b1 = _mm_loadu_si128((const __m128i *) &aBytes[i + 2 * aPlaneSize]);
+    b2 = _mm_loadu_si128((const __m128i *) &aBytes[i + aPlaneSize]);
+    b3 = _mm_loadu_si128((const __m128i *) &aBytes[i]);
+    lo = _mm_unpacklo_epi8(b0, b1);
+    hi = _mm_unpacklo_epi8(b2, b3);
+    _mm_storeu_si128((__m128i *) &dst[i * 4], _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *) &dst[i * 4 + 16], _mm_unpackhi_epi16(lo, hi));
+    lo = _mm_unpackhi_epi8(b0, b1);
+    hi = _mm_unpackhi_epi8(b2, b3);
+    _mm_storeu_si128((__m128i *) &dst[i * 4 + 32], _mm_unpacklo_epi16(lo, hi));
+    _mm_storeu_si128((__m128i *) &dst[i * 4 + 48], _mm_unpackhi_epi16(lo, hi));
+  }
+
+  _ctmJoinPlanes_C(&aBytes[i], aPlaneSize, &dst[i * 4], aCount - i);
+}
+
+_CTM_TARGET("sse2")
+static void _ctmToSignedMagnitude_SSE2(CTMuint * aWords, size_t aCount)
+{
+  __m128i v;
+  size_t i;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    v = _mm_loadu_si128((const __m128i *) &aWords[i]);
+    v = _mm_xor_si128(_mm_slli_epi32(v, 1), _mm_srai_epi32(v, 31));
+    _mm_storeu_si128((__m128i *) &aWords[i], v);
+  }
+
+  _ctmToSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+_CTM_TARGET("sse2")
+static void _ctmFromSignedMagnitude_SSE2(CTMuint * aWords, size_t aCount)
+{
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i v;
+  size_t i;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    v = _mm_loadu_si128((const __m128i *) &aWords[i]);
+    v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+          _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, one)));
+    _mm_storeu_si128((__m128i *) &aWords[i], v);
+  }
+
+  _ctmFromSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+static const _CTMplanekernels _ctmPlaneKernels_SSE2 = {
+  "SSE2",
+  _ctmSplitPlanes_SSE2,
+  _ctmJoinPlanes_SSE2,
+  _ctmToSignedMagnitude_SSE2,
+  _ctmFromSignedMagnitude_SSE2,
+  };
+
+#endif // _CTM_HAVE_SSE2
+
+
+#if defined(_CTM_HAVE_AVX2)
+
+//-----------------------------------------------------------------------------
+// AVX2 kernels (32 words per iteration). For splitting, each 128-bit lane is
+// transposed as a 4x4 byte matrix (bytes grouped by plane), and the 32-bit
+// groups are then gathered across the lanes and registers. The upper register
+// halves are cleared explicitly before the scalar tail, since compilers do not
+// always do that for tail calls (and mixing with non-VEX code is then very
+// slow).
+//-----------------------------------------------------------------------------
+_CTM_TARGET("avx2")
+static void _ctmSplitPlanes_AVX2(const void * aWords, size_t aCount,
+  unsigned char * aBytes, size_t aPlaneSize)
+{
+  const unsigned char * src = (const unsigned char *) aWords;
+  const __m256i shuf = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+    2, 6, 10, 14, 3, 7, 11, 15, 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14,
+    3, 7, 11, 15);
+  const __m256i perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i v0, v1, v2, v3, l01, h01, l23, h23;
+  size_t i;
+
+  for(i = 0; i + 32 <= aCount; i += 32)
+  {
+    // Each register: 8 bytes of plane 0, 1, 2 and 3 (as 64-bit groups)
+    v0 = _mm256_loadu_si256((const __m256i *) &src[i * 4]);
+    v1 = _mm256_loadu_si256((const __m256i *) &src[i * 4 + 32]);
+    v2 = _mm256_loadu_si256((const __m256i *) &src[i * 4 + 64]);
+    v3 = _mm256_loadu_si256((const __m256i *) &src[i * 4 + 96]);
+    v0 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v0, shuf), perm);
+    v1 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v1, shuf), perm);
+    v2 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v2, shuf), perm);
+    v3 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v3, shuf), perm);
+
+    // Combine: l = planes 0 | 2, h = planes 1 | 3
+    l01 = _mm256_unpacklo_epi64(v0, v1);
+    h01 = _mm256_unpackhi_epi64(v0, v1);
+    l23 = _mm256_unpacklo_epi64(v2, v3);
+    h23 = _mm256_unpackhi_epi64(v2, v3);
+    _mm256_storeu_si256((__m256i *) &aBytes[i + 3 * aPlaneSize],
+                        _mm256_permute2x128_si256(l01, l23, 0x20));
+    _mm256_storeu_si256((__m256i *) &aBytes[i + 2 * aPlaneSize],
+                        _mm256_permute2x128_si256(h01, h23, 0x20));
+    _mm256_storeu_si256((__m256i *) &aBytes[i + aPlaneSize],
+                        _mm256_permute2x128_si256(l01, l23, 0x31));
+    _mm256_storeu_si256((__m256i *) &aBytes[i],
+                        _mm256_permute2x128_si256(h01, h23, 0x31));
+  }
+
+  _mm256_zeroupper();
+  _ctmSplitPlanes_C(&src[i * 4], aCount - i, &aBytes[i], aPlaneSize);
+}
+
+_CTM_TARGET("avx2")
+static void _ctmJoinPlanes_AVX2(const unsigned char * aBytes,
+  size_t aPlaneSize, void * aWords, size_t aCount)
+{
+  unsigned char * dst = (unsigned char *) aWords;
+  __m256i b0, b1, b2, b3, lo, hi, w0, w1, w2, w3;
+  size_t i;
+
+  for(i = 0; i + 32 <= aCount; i += 32)
+  {
+    b0 = _mm256_loadu_si256((const __m256i *) &aBytes[i + 3 * aPlaneSize]);
+    b1 = _mm256_loadu_si256((const __m256i *) &aBytes[i + 2 * aPlaneSize]);
+    b2 = _mm256_loadu_si256((const __m256i *) &aBytes[i + aPlaneSize]);
+    b3 = _mm256_loadu_si256((const __m256i *) &aBytes[i]);
+
+    // Same as the SSE2 version within each lane (w0 = words 0-3 | 16-19,
+    // w1 = 4-7 | 20-23, w2 = 8-11 | 24-27, w3 = 12-15 | 28-31)
+    lo = _mm256_unpacklo_epi8(b0, b1);
+    hi = _mm256_unpacklo_epi8(b2, b3);
+    w0 = _mm256_unpacklo_epi16(lo, hi);
+    w1 = _mm256_unpackhi_epi16(lo, hi);
+    lo = _mm256_unpackhi_epi8(b0, b1);
+    hi = _mm256_unpackhi_epi8(b2, b3);
+    w2 = _mm256_unpacklo_epi16(lo, hi);
+    w3 = _mm256_unpackhi_epi16(lo, hi);
+    _mm256_storeu_si256((__m256i *) &dst[i * 4], _mm256_permute2x128_si256(w0, w1, 0x20));
+    _mm256_storeu_si256((__m256i *) &dst[i * 4 + 32], _mm256_permute2x128_si256(w2, w3, 0x20));
+    _mm256_storeu_si256((__m256i *) &dst[i * 4 + 64], _mm256_permute2x128_si256(w0, w1, 0x31));
+    _mm256_storeu_si256((__m256i *) &dst[i * 4 + 96], _mm256_permute2x128_si256(w2, w3, 0x31));
+  }
+
+  _mm256_zeroupper();
+  _ctmJoinPlanes_C(&aBytes[i], aPlaneSize, &dst[i * 4], aCount - i);
+}
+
+_CTM_TARGET("avx2")
+static void _ctmToSignedMagnitude_AVX2(CTMuint * aWords, size_t aCount)
+{
+  __m256i v;
+  size_t i;
+
+  for(i = 0; i + 8 <= aCount; i += 8)
+  {
+    v = _mm256_loadu_si256((const __m256i *) &aWords[i]);
+    v = _mm256_xor_si256(_mm256_slli_epi32(v, 1), _mm256_srai_epi32(v, 31));
+    _mm256_storeu_si256((__m256i *) &aWords[i], v);
+  }
+
+  _mm256_zeroupper();
+  _ctmToSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+_CTM_TARGET("avx2")
+static void _ctmFromSignedMagnitude_AVX2(CTMuint * aWords, size_t aCount)
+{
+  const __m256i one = _mm256_set1_epi32(1);
+  __m256i v;
+  size_t i;
+
+  for(i = 0; i + 8 <= aCount; i += 8)
+  {
+    v = _mm256_loadu_si256((const __m256i *) &aWords[i]);
+    v = _mm256_xor_si256(_mm256_srli_epi32(v, 1),
+          _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(v, one)));
+    _mm256_storeu_si256((__m256i *) &aWords[i], v);
+  }
+
+  _mm256_zeroupper();
+  _ctmFromSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+static const _CTMplanekernels _ctmPlaneKernels_AVX2 = {
+  "AVX2",
+  _ctmSplitPlanes_AVX2,
+  _ctmJoinPlanes_AVX2,
+  _ctmToSignedMagnitude_AVX2,
+  _ctmFromSignedMagnitude_AVX2,
+  };
+
+#endif // _CTM_HAVE_AVX2
+
+
+#if defined(_CTM_HAVE_NEON)
+
+//-----------------------------------------------------------------------------
+// NEON kernels (16 words per iteration). The de-interleaving loads and
+// interleaving stores do all the work.
+//-----------------------------------------------------------------------------
+static void _ctmSplitPlanes_NEON(const void * aWords, size_t aCount,
+  unsigned char * aBytes, size_t aPlaneSize)
+{
+  const unsigned char * src = (const unsigned char *) aWords;
+  uint8x16x4_t v;
+  size_t i;
+
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    v = vld4q_u8(&src[i * 4]);
+    vst1q_u8(&aBytes[i + 3 * aPlaneSize], v.val[0]);
+    vst1q_u8(&aBytes[i + 2 * aPlaneSize], v.val[1]);
+    vst1q_u8(&aBytes[i + aPlaneSize], v.val[2]);
+    vst1q_u8(&aBytes[i], v.val[3]);
+  }
+
+  _ctmSplitPlanes_C(&src[i * 4], aCount - i, &aBytes[i], aPlaneSize);
+}
+
+static void _ctmJoinPlanes_NEON(const unsigned char * aBytes,
+  size_t aPlaneSize, void * aWords, size_t aCount)
+{
+  unsigned char * dst = (unsigned char *) aWords;
+  uint8x16x4_t v;
+  size_t i;
+
+  for(i = 0; i + 16 <= aCount; i += 16)
+  {
+    v.val[0] = vld1q_u8(&aBytes[i + 3 * aPlaneSize]);
+    v.val[1] = vld1q_u8(&aBytes[i + 2 * aPlaneSize]);
+    v.val[2] = vld1q_u8(&aBytes[i + aPlaneSize]);
+    v.val[3] = vld1q_u8(&aBytes[i]);
+    vst4q_u8(&dst[i * 4], v);
+  }
+
+  _ctmJoinPlanes_C(&aBytes[i], aPlaneSize, &dst[i * 4], aCount - i);
+}
+
+static void _ctmToSignedMagnitude_NEON(CTMuint * aWords, size_t aCount)
+{
+  uint32x4_t v;
+  size_t i;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    v = vld1q_u32(&aWords[i]);
+    v = veorq_u32(vshlq_n_u32(v, 1),
+          vreinterpretq_u32_s32(vshrq_n_s32(vreinterpretq_s32_u32(v), 31)));
+    vst1q_u32(&aWords[i], v);
+  }
+
+  _ctmToSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+static void _ctmFromSignedMagnitude_NEON(CTMuint * aWords, size_t aCount)
+{
+  const uint32x4_t one = vdupq_n_u32(1);
+  uint32x4_t v;
+  size_t i;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    v = vld1q_u32(&aWords[i]);
+    v = veorq_u32(vshrq_n_u32(v, 1), vreinterpretq_u32_s32(
+          vnegq_s32(vreinterpretq_s32_u32(vandq_u32(v, one)))));
+    vst1q_u32(&aWords[i], v);
+  }
+
+  _ctmFromSignedMagnitude_C(&aWords[i], aCount - i);
+}
+
+static const _CTMplanekernels _ctmPlaneKernels_NEON = {
+  "NEON",
+  _ctmSplitPlanes_NEON,
+  _ctmJoinPlanes_NEON,
+  _ctmToSignedMagnitude_NEON,
+  _ctmFromSignedMagnitude_NEON,
+  };
+
+#endif // _CTM_HAVE_NEON
+
+
+#if defined(_CTM_HAVE_SSE2)
+
+//-----------------------------------------------------------------------------
+// _ctmCPUID() - Get CPUID leaf aLeaf (sub-leaf aSubLeaf) as eax, ebx, ecx and
+// edx. Returns CTM_FALSE if the leaf is not supported.
+//-----------------------------------------------------------------------------
+static int _ctmCPUID(unsigned int aLeaf, unsigned int aSubLeaf,
+  unsigned int aRegs[4])
+{
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuid(regs, 0);
+  if((unsigned int) regs[0] < aLeaf)
+    return CTM_FALSE;
+  __cpuidex(regs, (int) aLeaf, (int) aSubLeaf);
+  aRegs[0] = (unsigned int) regs[0];
+  aRegs[1] = (unsigned int) regs[1];
+  aRegs[2] = (unsigned int) regs[2];
+  aRegs[3] = (unsigned int) regs[3];
+#else
+  if(__get_cpuid_max(0, (unsigned int *) 0) < aLeaf)
+    return CTM_FALSE;
+  __cpuid_count(aLeaf, aSubLeaf, aRegs[0], aRegs[1], aRegs[2], aRegs[3]);
+#endif
+  return CTM_TRUE;
+}
+
+#if defined(_CTM_HAVE_AVX2)
+//-----------------------------------------------------------------------------
+// _ctmHaveAVX2() - Check if the CPU and the OS support AVX2.
+//-----------------------------------------------------------------------------
+static int _ctmHaveAVX2(void)
+{
+  unsigned int regs[4], xcr0;
+
+  // AVX and OSXSAVE (the OS saves the YMM registers)?
+  if(!_ctmCPUID(1, 0, regs) || ((regs[2] & 0x18000000) != 0x18000000))
+    return CTM_FALSE;
+#if defined(_MSC_VER)
+  xcr0 = (unsigned int) _xgetbv(0);
+#else
+  {
+    unsigned int edx;
+    __asm__ __volatile__("xgetbv" : "=a" (xcr0), "=d" (edx) : "c" (0));
+    (void) edx;
+  }
+#endif
+  if((xcr0 & 6) != 6)
+    return CTM_FALSE;
+
+  // AVX2?
+  return _ctmCPUID(7, 0, regs) && (regs[1] & 0x00000020);
+}
+#endif
+
+#endif // _CTM_HAVE_SSE2
+
+//-----------------------------------------------------------------------------
+// _ctmHaveSSE2() - Check if the CPU supports SSE2 (always false if the SSE2
+// kernels can not be built).
+//-----------------------------------------------------------------------------
+int _ctmHaveSSE2(void)
+{
+#if defined(_CTM_HAVE_SSE2)
+  unsigned int regs[4];
+  return _ctmCPUID(1, 0, regs) && (regs[3] & 0x04000000);
+#else
+  return CTM_FALSE;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPlaneKernels() - Select the fastest byte plane kernels that are
+// supported by the CPU.
+//-----------------------------------------------------------------------------
+const _CTMplanekernels * _ctmPlaneKernels(void)
+{
+#if defined(_CTM_HAVE_SSE2)
+#if defined(_CTM_HAVE_AVX2)
+  if(_ctmHaveAVX2())
+    return &_ctmPlaneKernels_AVX2;
+#endif
+  if(_ctmHaveSSE2())
+    return &_ctmPlaneKernels_SSE2;
+#elif defined(_CTM_HAVE_NEON)
+  return &_ctmPlaneKernels_NEON;
+#endif
+  return &_ctmPlaneKernels_C;
+}
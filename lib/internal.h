@@ -37,6 +37,31 @@
 // Flags for the Mesh flags field of the file header
 #define _CTM_HAS_NORMALS_BIT 0x00000001
 
+// Number of array elements per block in packed arrays (MG3)
+#define _CTM_MG3_BLOCK_SIZE  0x00040000
+
+// Slots for per array data: caller provided output buffers (see
+// ctmLoadBuffer()) and saved array sizes (see ctmGetSectionSize())
+#define _CTM_OUT_INDICES     0
+#define _CTM_OUT_VERTICES    1
+#define _CTM_OUT_NORMALS     2
+#define _CTM_OUT_UV_MAP_1    3
+#define _CTM_OUT_ATTRIB_MAP_1 11
+#define _CTM_OUT_COUNT       19
+
+// Sampling for size estimation (see ctmEstimateSize()): number of runs, and
+// number of elements per run
+#define _CTM_SAMPLE_RUNS     8
+#define _CTM_SAMPLE_RUN      8192
+
+// Array classes for LZMA tuning parameters (see ctmCompressionParams())
+#define _CTM_PARAMS_INDICES     0
+#define _CTM_PARAMS_VERTICES    1
+#define _CTM_PARAMS_NORMALS     2
+#define _CTM_PARAMS_UV_MAPS     3
+#define _CTM_PARAMS_ATTRIB_MAPS 4
+#define _CTM_PARAMS_COUNT       5
+
 //-----------------------------------------------------------------------------
 // _CTMfloatmap - Internal representation of a floating point based vertex map
 // (used for UV maps and attribute maps).
@@ -47,9 +72,106 @@ struct _CTMfloatmap_struct {
   char * mFileName;     // File name reference (used only for UV maps)
   CTMfloat mPrecision;  // Precision for this map
   CTMfloat * mValues;   // Attribute/UV coordinate values (per vertex)
+  CTMuint mStride;      // Distance between the values of two vertices (floats)
+  int mExternal;        // mValues is a caller provided buffer (not freed)
   _CTMfloatmap * mNext; // Pointer to the next map in the list (linked list)
 };
 
+//-----------------------------------------------------------------------------
+// _CTMlzmaparams - LZMA tuning parameters for one class of arrays. A value of
+// -1 means that the LZMA default for the compression level is used. A
+// dictionary size of 0 means that the dictionary is sized to each section.
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMint mDictSize;     // Dictionary size (in bytes)
+  CTMint mLC;           // Number of literal context bits (0-8)
+  CTMint mLP;           // Number of literal position bits (0-4)
+  CTMint mPB;           // Number of position bits (0-4)
+  CTMint mFB;           // Number of fast bytes (5-273)
+} _CTMlzmaparams;
+
+//-----------------------------------------------------------------------------
+// _CTMoutbuffer - A caller provided output buffer for loading.
+//-----------------------------------------------------------------------------
+typedef struct {
+  void * mBuffer;       // Buffer (NULL if not set)
+  size_t mSize;         // Size of the buffer (in bytes)
+  CTMuint mStride;      // Distance between two elements (in floats/integers)
+} _CTMoutbuffer;
+
+//-----------------------------------------------------------------------------
+// _CTMallocator - Memory allocation functions (see ctmSetAllocator()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMallocfn mAllocFn;  // Allocation function
+  CTMfreefn mFreeFn;    // Free function
+  void * mUserData;     // User data for the allocation functions
+} _CTMallocator;
+
+//-----------------------------------------------------------------------------
+// _CTMscratch - Scratch arena for temporary buffers (see _ctmScratchAlloc()).
+// Buffers are carved from a single block in stack order. Requests that do not
+// fit in the block are allocated separately, and the block is grown to the
+// high water mark by _ctmScratchReset(), so that later saves and loads with
+// the same context do not need to allocate any temporary memory.
+//-----------------------------------------------------------------------------
+typedef struct _CTMscratchbuf_struct _CTMscratchbuf;
+struct _CTMscratchbuf_struct {
+  _CTMscratchbuf * mNext; // Next (older) overflow buffer
+  size_t mMark;           // Arena position of the buffer
+};
+
+typedef struct {
+  unsigned char * mBlock;     // Arena block (or NULL)
+  size_t mSize;               // Size of the arena block (in bytes)
+  size_t mUsed;               // Current arena position (in bytes)
+  size_t mHighWater;          // Highest position since the last reset
+  _CTMscratchbuf * mOverflow; // Buffers that did not fit in the block
+} _CTMscratch;
+
+//-----------------------------------------------------------------------------
+// _CTMplanekernels - Byte plane kernels for packed arrays (see interleave.c).
+// mSplit splits aCount 32-bit words into four byte planes of aPlaneSize bytes
+// each, starting with the most significant byte plane at aBytes, and mJoin
+// does the opposite. The signed magnitude functions convert words in place.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const char * mName;
+  void (* mSplit)(const void * aWords, size_t aCount, unsigned char * aBytes, size_t aPlaneSize);
+  void (* mJoin)(const unsigned char * aBytes, size_t aPlaneSize, void * aWords, size_t aCount);
+  void (* mToSignedMagnitude)(CTMuint * aWords, size_t aCount);
+  void (* mFromSignedMagnitude)(CTMuint * aWords, size_t aCount);
+} _CTMplanekernels;
+
+//-----------------------------------------------------------------------------
+// _CTMnormalkernels - Smooth normal kernels (see normals.c). mFaceNormals
+// calculates the unit normals of aCount triangles, and mNormalize scales
+// aCount 3D vectors to unit length. All versions of these must give exactly
+// the same result, since the decoder must reproduce the smooth normals of the
+// encoder. mRotateNormals converts aCount decoded normals (x, y, z and
+// magnitude in aAngular, relative to the smooth normals) to the coordinate
+// system of the mesh, exactly as _ctmMakeNormalCoordSys() does.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const char * mName;
+  void (* mFaceNormals)(const CTMfloat * aVertices, size_t aVertexStride, const CTMuint * aIndices, size_t aCount, CTMfloat * aNormals);
+  void (* mNormalize)(CTMfloat * aVectors, size_t aCount);
+  void (* mRotateNormals)(const CTMfloat * aSmoothNormals, const CTMfloat * aAngular, size_t aCount, CTMfloat * aNormals, size_t aNormalStride);
+} _CTMnormalkernels;
+
+//-----------------------------------------------------------------------------
+// _CTMskipfn - Stream skip function (for seekable input streams). Returns
+// CTM_TRUE if aCount bytes could be skipped.
+//-----------------------------------------------------------------------------
+typedef int (* _CTMskipfn)(CTMuint aCount, void * aUserData);
+
+//-----------------------------------------------------------------------------
+// _CTMseekfn - Stream seek function (for seekable output streams). Moves the
+// write position aOffset bytes (backwards if aOffset is negative). Returns
+// CTM_TRUE on success.
+//-----------------------------------------------------------------------------
+typedef int (* _CTMseekfn)(long aOffset, void * aUserData);
+
 //-----------------------------------------------------------------------------
 // _CTMcontext - Internal CTM context structure.
 //-----------------------------------------------------------------------------
@@ -57,9 +179,22 @@ typedef struct {
   // Context mode (import or export)
   CTMenum mMode;
 
+  // Memory allocation functions
+  _CTMallocator mAllocator;
+
+  // Scratch arena for temporary buffers (kept between saves/loads)
+  _CTMscratch mScratch;
+
+  // Byte plane kernels for packing/unpacking (selected for the CPU)
+  const _CTMplanekernels * mPlaneKernels;
+
+  // Smooth normal kernels (selected for the CPU)
+  const _CTMnormalkernels * mNormalKernels;
+
   // Vertices
   CTMfloat * mVertices;
   CTMuint mVertexCount;
+  CTMuint mVertexStride; // Distance between two vertices (in floats)
 
   // Indices
   CTMuint * mIndices;
@@ -67,6 +202,10 @@ typedef struct {
 
   // Normals (optional)
   CTMfloat * mNormals;
+  CTMuint mNormalStride; // Distance between two normals (in floats)
+
+  // Mesh flags of the loaded file (_CTM_HAS_NORMALS_BIT etc)
+  CTMuint mFileFlags;
 
   // Multiple sets of UV coordinate maps (optional)
   CTMuint mUVMapCount;
@@ -85,46 +224,216 @@ typedef struct {
   // The selected compression level
   CTMuint mCompressionLevel;
 
+  // The selected entropy backend for packed sections (CTM_BACKEND_*). When
+  // loading, this is the backend of the last packed section that was read
+  CTMenum mBackend;
+
+  // LZMA tuning parameters per array class (_CTM_PARAMS_*)
+  _CTMlzmaparams mLzmaParams[_CTM_PARAMS_COUNT];
+
+  // Max number of threads to use for decoding/encoding packed sections
+  CTMuint mDecodeThreads;
+  CTMuint mEncodeThreads;
+
   // Vertex coordinate precision
   CTMfloat mVertexPrecision;
 
+  // Vertex error of the settings chosen by ctmOptimize()
+  CTMfloat mVertexError;
+
   // Normal precision (angular + magnitude)
   CTMfloat mNormalPrecision;
 
+  // Normal coding mode (CTM_NORMALS_*, MG2, MG3 and MG4)
+  CTMenum mNormalMode;
+
   // File comment
   char * mFileComment;
 
   // Read() function pointer
   CTMreadfn mReadFn;
 
+  // Skip() function pointer (NULL if the input stream is not seekable)
+  _CTMskipfn mSkipFn;
+
   // Write() function pointer
   CTMwritefn mWriteFn;
 
+  // Seek() function pointer (NULL if the output stream is not seekable)
+  _CTMseekfn mSeekFn;
+
   // User data (for stream read/write - usually the stream handle)
   void * mUserData;
+
+  // Number of bytes written to the output stream, and the number of bytes
+  // written for each array (_CTM_OUT_* slots) by the last save
+  size_t mWritePos;
+  size_t mSectionSizes[_CTM_OUT_COUNT];
+
+  // Vertex errors (max and RMS) of the last MG2/MG3 save, with the grid that
+  // was actually used (see _ctmVertexError_MG2())
+  CTMfloat mSavedMaxError;
+  CTMfloat mSavedRMSError;
+
+  // Size estimation mode while estimating (CTM_ESTIMATE_*), otherwise
+  // CTM_NONE. When estimating, packed data is counted but not written
+  CTMenum mEstimate;
+
+  // Section loaded callback (progressive loading) and its user data
+  CTMsectionfn mSectionFn;
+  void * mSectionUserData;
+
+  // Only load the file header and map information (no mesh data)?
+  int mHeaderOnly;
+
+  // Mesh arrays to skip when loading (CTM_SKIP_* flags)
+  CTMuint mLoadFilter;
+
+  // Caller provided output buffers for loading (_CTM_OUT_* slots), and which
+  // of the indices, vertices and normals arrays are caller provided buffers
+  // (bit 1 << _CTM_OUT_*), which must not be freed
+  _CTMoutbuffer mOutBuffers[_CTM_OUT_COUNT];
+  CTMuint mExternalArrays;
+
+  // In-memory input stream (used instead of mReadFn when loading from memory
+  // or from a memory mapped file)
+  const unsigned char * mInBuf;
+  size_t mInBufSize;
+  size_t mInBufPos;
 } _CTMcontext;
 
+//-----------------------------------------------------------------------------
+// _CTMmappedfile - A read only memory mapped file.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const unsigned char * mData; // File contents
+  size_t mSize;                // File size (in bytes)
+  void * mHandle[2];           // System specific handles
+} _CTMmappedfile;
+
+//-----------------------------------------------------------------------------
+// _CTMpackedchunk - One chunk of packed data that has been packed as a
+// stream (see _ctmStreamWritePackedArray()). The data follows the header.
+//-----------------------------------------------------------------------------
+typedef struct _CTMpackedchunk_struct _CTMpackedchunk;
+struct _CTMpackedchunk_struct {
+  _CTMpackedchunk * mNext; // Next chunk (or NULL)
+  size_t mSize;            // Number of bytes in the chunk
+};
+
+//-----------------------------------------------------------------------------
+// _CTMpackedsection - A packed (entropy coded) integer or float array, or
+// one block of a blocked array (MG3). The packed data is read from (written
+// to) the stream separately from unpacking (packing) it, so that several
+// sections can be processed concurrently.
+//-----------------------------------------------------------------------------
+#define _CTM_PACKED_INTS        0  // Unsigned integers
+#define _CTM_PACKED_SIGNED_INTS 1  // Signed integers (signed magnitude coded)
+#define _CTM_PACKED_FLOATS      2  // Floats
+#define _CTM_PACKED_NO_INTERLEAVE 0x10 // Type flag: the components of each
+                                       // element are stored together
+
+
+typedef struct {
+  void * mData;                  // Unpacked data (CTMint or CTMfloat array)
+  CTMuint mCount;                // Number of elements
+  CTMuint mSize;                 // Number of components per element
+  CTMuint mStride;               // Distance between two elements in mData
+  int mType;                     // Data type (_CTM_PACKED_*)
+  int mInterleaved;              // Are the element components interleaved?
+  int mParams;                   // Array class for LZMA tuning (_CTM_PARAMS_*)
+  CTMuint mBlockCount;           // Number of blocks in the array (0 = not blocked)
+  const unsigned char * mPacked; // Packed data (or NULL)
+  unsigned char * mPackedBuf;    // Output buffer for packing (scratch)
+  _CTMpackedchunk * mChunks;     // Packed data as scratch chunks (or NULL)
+  size_t mPackedSize;            // Size of the packed data
+  unsigned char mProps[5];       // LZMA compression props (or backend tag)
+  CTMenum mError;                // Result of the packing/unpacking
+} _CTMpackedsection;
+
+//-----------------------------------------------------------------------------
+// _CTMsortvertex - Vertex information for the MG2 (and MG4) vertex order. The
+// fields are all 32-bit words, so that the array can be sorted with
+// _ctmSortRecords().
+//-----------------------------------------------------------------------------
+typedef struct {
+  // Vertex X coordinate, as a sort key (see _ctmFloatSortKey()).
+  CTMuint mSortX;
+
+  // Grid index. This is the index into the 3D space subdivision grid.
+  CTMuint mGridIndex;
+
+  // Original index (before sorting).
+  CTMuint mOriginalIndex;
+} _CTMsortvertex;
+
+//-----------------------------------------------------------------------------
+// _CTMjobfn - Job function for _ctmRunJobs().
+//-----------------------------------------------------------------------------
+typedef void (* _CTMjobfn)(void * aUserData, CTMuint aJob, CTMuint aWorker);
+
 //-----------------------------------------------------------------------------
 // Macros
 //-----------------------------------------------------------------------------
 #define FOURCC(str) (((CTMuint) str[0]) | (((CTMuint) str[1]) << 8) | \
                     (((CTMuint) str[2]) << 16) | (((CTMuint) str[3]) << 24))
 
+//-----------------------------------------------------------------------------
+// Funcion prototypes for openctm.c
+//-----------------------------------------------------------------------------
+void * _ctmAlloc(const _CTMallocator * aAllocator, size_t aSize);
+void _ctmFree(const _CTMallocator * aAllocator, void * aPtr);
+void * _ctmScratchAlloc(_CTMcontext * self, size_t aSize);
+size_t _ctmScratchMark(_CTMcontext * self);
+void _ctmScratchRelease(_CTMcontext * self, size_t aMark);
+void _ctmScratchReset(_CTMcontext * self);
+void _ctmScratchFree(_CTMcontext * self);
+int _ctmSectionLoaded(_CTMcontext * self, CTMenum aSection);
+void _ctmSectionSaved(_CTMcontext * self, CTMuint aSlot, size_t aStart);
+
 //-----------------------------------------------------------------------------
 // Funcion prototypes for stream.c
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount);
 CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount);
+const unsigned char * _ctmStreamReadDirect(_CTMcontext * self, CTMuint aCount);
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount);
 CTMuint _ctmStreamReadUINT(_CTMcontext * self);
 void _ctmStreamWriteUINT(_CTMcontext * self, CTMuint aValue);
 CTMfloat _ctmStreamReadFLOAT(_CTMcontext * self);
 void _ctmStreamWriteFLOAT(_CTMcontext * self, CTMfloat aValue);
 void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue);
 void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue);
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
-int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData, CTMuint aCount, CTMuint aSize, CTMint aSignedInts);
-int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
-int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData, CTMuint aCount, CTMuint aSize);
+CTMuint _ctmBlockCount(CTMuint aCount, CTMuint aBlockSize);
+void _ctmInitPackedSections(_CTMpackedsection ** aSections, void * aData, CTMuint aCount, CTMuint aSize, CTMuint aStride, int aType, int aParams, CTMuint aBlockSize);
+int _ctmStreamReadPackedArray(_CTMcontext * self, _CTMpackedsection ** aSections, void * aData, CTMuint aCount, CTMuint aSize, CTMuint aStride, int aType, CTMuint aBlockSize);
+int _ctmStreamWritePackedArray(_CTMcontext * self, _CTMpackedsection ** aSections);
+int _ctmUnpackSections(_CTMcontext * self, _CTMpackedsection * aSections, CTMuint aCount);
+int _ctmPackSections(_CTMcontext * self, _CTMpackedsection * aSections, CTMuint aCount);
+int _ctmEstimatePackedSize(_CTMcontext * self, _CTMpackedsection * aSection);
+int _ctmMeasurePackedSize(_CTMcontext * self, _CTMpackedsection * aSection);
+int _ctmHaveBackend(CTMenum aBackend);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for system.c
+//-----------------------------------------------------------------------------
+int _ctmMapFile(const char * aFileName, _CTMmappedfile * aMap);
+void _ctmUnmapFile(_CTMmappedfile * aMap);
+CTMuint _ctmProcessorCount(void);
+void _ctmRunJobs(const _CTMallocator * aAllocator, CTMuint aThreadCount, CTMuint aJobCount, _CTMjobfn aJobFn, void * aUserData);
+double _ctmTime(void);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for interleave.c
+//-----------------------------------------------------------------------------
+int _ctmHaveSSE2(void);
+const _CTMplanekernels * _ctmPlaneKernels(void);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for normals.c
+//-----------------------------------------------------------------------------
+const _CTMnormalkernels * _ctmNormalKernels(void);
+void _ctmMakeNormalCoordSys(const CTMfloat * aNormal, CTMfloat * aBasisAxes);
 
 //-----------------------------------------------------------------------------
 // Funcion prototypes for compressRAW.c
@@ -143,5 +452,30 @@ int _ctmUncompressMesh_MG1(_CTMcontext * self);
 //-----------------------------------------------------------------------------
 int _ctmCompressMesh_MG2(_CTMcontext * self);
 int _ctmUncompressMesh_MG2(_CTMcontext * self);
+void _ctmVertexError_MG2(_CTMcontext * self, CTMfloat aPrecision, CTMfloat * aMaxError, CTMfloat * aRMSError);
+void _ctmMakeIndexDeltas_MG2(CTMuint * aIndices, CTMuint aTriangleCount);
+void _ctmRestoreIndices_MG2(CTMuint * aIndices, CTMuint aTriangleCount);
+int _ctmPrepareNormalsAndMaps_MG2(_CTMcontext * self, _CTMpackedsection ** aSections, CTMuint aBlockSize, _CTMsortvertex * aSortVertices, CTMfloat * aRestoredVertices, CTMuint * aIndices, CTMint * aIntNormals, CTMint * aIntUVCoords, CTMint * aIntAttribs);
+int _ctmWriteNormalsAndMaps_MG2(_CTMcontext * self, _CTMpackedsection ** aSections);
+int _ctmReadNormalsAndMaps_MG2(_CTMcontext * self, _CTMpackedsection ** aSections, CTMuint aBlockSize, CTMint * aIntNormals, CTMint * aIntUVCoords, CTMint * aIntAttribs);
+int _ctmRestoreNormalsAndMaps_MG2(_CTMcontext * self, CTMint * aIntNormals, CTMint * aIntUVCoords, CTMint * aIntAttribs);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for compressMG4.c
+//-----------------------------------------------------------------------------
+int _ctmCompressMesh_MG4(_CTMcontext * self);
+int _ctmUncompressMesh_MG4(_CTMcontext * self);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for sort.c
+//-----------------------------------------------------------------------------
+int _ctmSortRecords(_CTMcontext * self, CTMuint * aRecords, CTMuint aCount, CTMuint aRecordWords, CTMuint aMajorKey, CTMuint aMinorKey);
+CTMuint _ctmFloatSortKey(CTMfloat aValue);
+int _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices, CTMuint aTriangleCount);
+
+//-----------------------------------------------------------------------------
+// Funcion prototypes for optimize.c
+//-----------------------------------------------------------------------------
+size_t _ctmOptimize(_CTMcontext * self, CTMenum aTarget, CTMenum aErrorMetric, CTMfloat aMaxError);
 
 #endif // __OPENCTM_INTERNAL_H_
@@ -0,0 +1,264 @@
+/* LzFindMt.c -- multithreaded Match finder for LZ algorithms
+Public domain */
+
+#include <string.h>
+
+#include "LzFindMt.h"
+
+/* The LZ side holds cs whenever it is not waiting for the next block, so the
+   helper thread can only move the window or read the stream while the LZ
+   side is between blocks. Before each block the helper makes sure that the
+   whole block can be processed without the base match finder moving or
+   reading on its own. */
+
+static void MtFillWindow(CMatchFinderMt *p)
+{
+  CMatchFinder *mf = p->MatchFinder;
+  UInt32 needed = mf->keepSizeAfter + kMtBlockPositions + 1;
+  if (mf->streamEndWasReached || Inline_MatchFinder_GetNumAvailableBytes(mf) >= needed)
+    return;
+  CriticalSection_Enter(&p->cs);
+  if ((size_t)(mf->bufferBase + mf->blockSize - mf->buffer) < needed)
+  {
+    const Byte *beforePtr = mf->buffer;
+    MatchFinder_MoveBlock(mf);
+    p->pointerToCurPos -= beforePtr - mf->buffer;
+  }
+  while (Inline_MatchFinder_GetNumAvailableBytes(mf) < needed)
+  {
+    Byte *dest = mf->buffer + (mf->streamPos - mf->pos);
+    size_t size = (size_t)(mf->bufferBase + mf->blockSize - dest);
+    mf->result = mf->stream->Read(mf->stream, dest, &size);
+    if (mf->result != SZ_OK || size == 0)
+    {
+      mf->streamEndWasReached = 1;
+      break;
+    }
+    mf->streamPos += (UInt32)size;
+  }
+  CriticalSection_Leave(&p->cs);
+}
+
+static THREAD_FUNC_RET_TYPE THREAD_FUNC_CALL_TYPE MtThreadFunc(void *pp)
+{
+  CMatchFinderMt *p = (CMatchFinderMt *)pp;
+  CMatchFinder *mf = p->MatchFinder;
+  for (;;)
+  {
+    UInt32 *block, *cur, *limit;
+    UInt32 numPositions = 0, numAvail;
+    Semaphore_Wait(&p->freeSemaphore);
+    if (p->stopWriting)
+      break;
+    block = p->btBuf + p->writeBlockIndex * kMtBlockSize;
+    MtFillWindow(p);
+    numAvail = Inline_MatchFinder_GetNumAvailableBytes(mf);
+    cur = block + 2;
+    limit = block + kMtBlockSize - (1 + 2 * p->matchMaxLen);
+    while (numPositions < kMtBlockPositions && numPositions < numAvail && cur <= limit)
+    {
+      UInt32 n = p->baseVTable.GetMatches(mf, cur + 1);
+      *cur = n;
+      cur += n + 1;
+      numPositions++;
+    }
+    block[0] = numPositions;
+    block[1] = numAvail;
+    p->writeBlockIndex = (p->writeBlockIndex + 1) & (kMtNumBlocks - 1);
+    Semaphore_Release1(&p->filledSemaphore);
+  }
+  return 0;
+}
+
+static void MatchFinderMt_GetNextBlock(CMatchFinderMt *p)
+{
+  UInt32 *block;
+  if (p->blockIsValid)
+  {
+    Semaphore_Release1(&p->freeSemaphore);
+    p->readBlockIndex = (p->readBlockIndex + 1) & (kMtNumBlocks - 1);
+  }
+  CriticalSection_Leave(&p->cs);
+  Semaphore_Wait(&p->filledSemaphore);
+  CriticalSection_Enter(&p->cs);
+  block = p->btBuf + p->readBlockIndex * kMtBlockSize;
+  p->btNumPositions = block[0];
+  p->btNumAvailBytes = block[1];
+  p->btBufPos = block + 2;
+  p->blockIsValid = 1;
+  if (p->btNumPositions == 0)
+    p->endOfStream = 1;
+}
+
+#define MT_PREPARE(p) \
+  if ((p)->btNumPositions == 0 && !(p)->endOfStream) \
+    MatchFinderMt_GetNextBlock(p);
+
+void MatchFinderMt_Construct(CMatchFinderMt *p)
+{
+  p->btBuf = 0;
+  p->threadWasCreated = 0;
+  p->semaphoresWereCreated = 0;
+  p->csWasCreated = 0;
+  p->csIsLocked = 0;
+}
+
+void MatchFinderMt_ReleaseStream(CMatchFinderMt *p)
+{
+  if (p->threadWasCreated)
+  {
+    p->stopWriting = 1;
+    if (p->csIsLocked)
+    {
+      CriticalSection_Leave(&p->cs);
+      p->csIsLocked = 0;
+    }
+    Semaphore_Release1(&p->freeSemaphore);
+    Thread_Wait(&p->thread);
+    p->threadWasCreated = 0;
+  }
+  if (p->csIsLocked)
+  {
+    CriticalSection_Leave(&p->cs);
+    p->csIsLocked = 0;
+  }
+  if (p->semaphoresWereCreated)
+  {
+    Semaphore_Close(&p->freeSemaphore);
+    Semaphore_Close(&p->filledSemaphore);
+    p->semaphoresWereCreated = 0;
+  }
+}
+
+void MatchFinderMt_Destruct(CMatchFinderMt *p, ISzAlloc *alloc)
+{
+  MatchFinderMt_ReleaseStream(p);
+  if (p->csWasCreated)
+  {
+    CriticalSection_Delete(&p->cs);
+    p->csWasCreated = 0;
+  }
+  alloc->Free(alloc, p->btBuf);
+  p->btBuf = 0;
+  MatchFinder_Free(p->MatchFinder, alloc);
+}
+
+SRes MatchFinderMt_Create(CMatchFinderMt *p, UInt32 historySize, UInt32 keepAddBufferBefore,
+    UInt32 matchMaxLen, UInt32 keepAddBufferAfter, ISzAlloc *alloc)
+{
+  CMatchFinder *mf = p->MatchFinder;
+  p->matchMaxLen = matchMaxLen;
+  if (p->btBuf == 0)
+  {
+    p->btBuf = (UInt32 *)alloc->Alloc(alloc, (size_t)kMtNumBlocks * kMtBlockSize * sizeof(UInt32));
+    if (p->btBuf == 0)
+      return SZ_ERROR_MEM;
+  }
+  if (!p->csWasCreated)
+  {
+    if (CriticalSection_Init(&p->cs) != 0)
+      return SZ_ERROR_THREAD;
+    p->csWasCreated = 1;
+  }
+  /* the LZ side may lag up to all blocks behind the helper thread */
+  keepAddBufferBefore += (kMtNumBlocks + 1) * kMtBlockPositions;
+  if (!MatchFinder_Create(mf, historySize, keepAddBufferBefore, matchMaxLen, keepAddBufferAfter, alloc))
+    return SZ_ERROR_MEM;
+  MatchFinder_CreateVTable(mf, &p->baseVTable);
+  return SZ_OK;
+}
+
+static void MatchFinderMt_Init(CMatchFinderMt *p)
+{
+  CMatchFinder *mf = p->MatchFinder;
+  MatchFinderMt_ReleaseStream(p);
+  MatchFinder_Init(mf);
+  p->pointerToCurPos = Inline_MatchFinder_GetPointerToCurrentPos(mf);
+  p->btNumPositions = 0;
+  p->btNumAvailBytes = 0;
+  p->readBlockIndex = 0;
+  p->writeBlockIndex = 0;
+  p->blockIsValid = 0;
+  p->endOfStream = 0;
+  p->stopWriting = 0;
+
+  if (Semaphore_Create(&p->freeSemaphore, kMtNumBlocks, kMtNumBlocks + 1) == 0)
+  {
+    if (Semaphore_Create(&p->filledSemaphore, 0, kMtNumBlocks) == 0)
+      p->semaphoresWereCreated = 1;
+    else
+      Semaphore_Close(&p->freeSemaphore);
+  }
+  if (p->semaphoresWereCreated)
+  {
+    CriticalSection_Enter(&p->cs);
+    p->csIsLocked = 1;
+    if (Thread_Create(&p->thread, MtThreadFunc, p) == 0)
+      p->threadWasCreated = 1;
+  }
+  if (!p->threadWasCreated)
+  {
+    /* report the failure through the stream result and end the stream */
+    MatchFinderMt_ReleaseStream(p);
+    mf->result = SZ_ERROR_THREAD;
+    p->endOfStream = 1;
+  }
+}
+
+static Byte MatchFinderMt_GetIndexByte(CMatchFinderMt *p, Int32 index)
+{
+  return p->pointerToCurPos[index];
+}
+
+static UInt32 MatchFinderMt_GetNumAvailableBytes(CMatchFinderMt *p)
+{
+  MT_PREPARE(p);
+  return p->btNumAvailBytes;
+}
+
+static const Byte * MatchFinderMt_GetPointerToCurrentPos(CMatchFinderMt *p)
+{
+  return p->pointerToCurPos;
+}
+
+static UInt32 MatchFinderMt_GetMatches(CMatchFinderMt *p, UInt32 *distances)
+{
+  UInt32 n;
+  MT_PREPARE(p);
+  p->pointerToCurPos++;
+  if (p->endOfStream)
+    return 0;
+  n = *p->btBufPos++;
+  memcpy(distances, p->btBufPos, (size_t)n * sizeof(UInt32));
+  p->btBufPos += n;
+  p->btNumPositions--;
+  p->btNumAvailBytes--;
+  return n;
+}
+
+static void MatchFinderMt_Skip(CMatchFinderMt *p, UInt32 num)
+{
+  do
+  {
+    MT_PREPARE(p);
+    p->pointerToCurPos++;
+    if (!p->endOfStream)
+    {
+      p->btBufPos += *p->btBufPos + 1;
+      p->btNumPositions--;
+      p->btNumAvailBytes--;
+    }
+  }
+  while (--num != 0);
+}
+
+void MatchFinderMt_CreateVTable(CMatchFinderMt *p, IMatchFinder *vTable)
+{
+  vTable->Init = (Mf_Init_Func)MatchFinderMt_Init;
+  vTable->GetIndexByte = (Mf_GetIndexByte_Func)MatchFinderMt_GetIndexByte;
+  vTable->GetNumAvailableBytes = (Mf_GetNumAvailableBytes_Func)MatchFinderMt_GetNumAvailableBytes;
+  vTable->GetPointerToCurrentPos = (Mf_GetPointerToCurrentPos_Func)MatchFinderMt_GetPointerToCurrentPos;
+  vTable->GetMatches = (Mf_GetMatches_Func)MatchFinderMt_GetMatches;
+  vTable->Skip = (Mf_Skip_Func)MatchFinderMt_Skip;
+  (void)p;
+}
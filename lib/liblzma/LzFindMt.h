@@ -0,0 +1,56 @@
+/* LzFindMt.h -- multithreaded Match finder for LZ algorithms
+Public domain */
+
+#ifndef __LZFINDMT_H
+#define __LZFINDMT_H
+
+#include "Threads.h"
+#include "LzFind.h"
+
+/* The helper thread runs the binary tree match finder one position after
+   the other and hands the match lists over in a ring of blocks. Each block
+   starts with [numPositions, numAvailableBytes] followed by one record
+   [n, n distance values] per position. An empty block marks end of stream. */
+
+#define kMtNumBlocks (1 << 3)
+#define kMtBlockSize (1 << 15)
+#define kMtBlockPositions (1 << 12)
+
+typedef struct _CMatchFinderMt
+{
+  /* LZ (consumer) side */
+  const Byte *pointerToCurPos;
+  UInt32 *btBuf;
+  UInt32 *btBufPos;
+  UInt32 btNumPositions;
+  UInt32 btNumAvailBytes;
+  UInt32 readBlockIndex;
+  int blockIsValid;
+  int endOfStream;
+  int csIsLocked;
+
+  /* helper thread side */
+  UInt32 writeBlockIndex;
+  UInt32 matchMaxLen;
+  int stopWriting;
+
+  CThread thread;
+  CSemaphore freeSemaphore;
+  CSemaphore filledSemaphore;
+  CCriticalSection cs;
+  int threadWasCreated;
+  int semaphoresWereCreated;
+  int csWasCreated;
+
+  CMatchFinder *MatchFinder;
+  IMatchFinder baseVTable;
+} CMatchFinderMt;
+
+void MatchFinderMt_Construct(CMatchFinderMt *p);
+void MatchFinderMt_Destruct(CMatchFinderMt *p, ISzAlloc *alloc);
+SRes MatchFinderMt_Create(CMatchFinderMt *p, UInt32 historySize, UInt32 keepAddBufferBefore,
+    UInt32 matchMaxLen, UInt32 keepAddBufferAfter, ISzAlloc *alloc);
+void MatchFinderMt_CreateVTable(CMatchFinderMt *p, IMatchFinder *vTable);
+void MatchFinderMt_ReleaseStream(CMatchFinderMt *p);
+
+#endif
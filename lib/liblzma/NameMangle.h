@@ -37,6 +37,13 @@
 #define Hc3Zip_MatchFinder_Skip _ctm_Hc3Zip_MatchFinder_Skip
 #define MatchFinder_CreateVTable _ctm_MatchFinder_CreateVTable
 
+/* LzFindMt.c */
+#define MatchFinderMt_Construct _ctm_MatchFinderMt_Construct
+#define MatchFinderMt_Destruct _ctm_MatchFinderMt_Destruct
+#define MatchFinderMt_Create _ctm_MatchFinderMt_Create
+#define MatchFinderMt_CreateVTable _ctm_MatchFinderMt_CreateVTable
+#define MatchFinderMt_ReleaseStream _ctm_MatchFinderMt_ReleaseStream
+
 /* LzmaDec.c */
 #define LzmaDec_InitDicAndState _ctm_LzmaDec_InitDicAndState
 #define LzmaDec_Init _ctm_LzmaDec_Init
@@ -74,11 +81,24 @@
 #define LzmaEnc_Encode _ctm_LzmaEnc_Encode
 #define LzmaEnc_WriteProperties _ctm_LzmaEnc_WriteProperties
 #define LzmaEnc_MemEncode _ctm_LzmaEnc_MemEncode
+#define LzmaEncode _ctm_LzmaEncode
 
 /* LzmaLib.c */
 #define LzmaCompress _ctm_LzmaCompress
 #define LzmaUncompress _ctm_LzmaUncompress
 
+/* Threads.c */
+#define Thread_Create _ctm_Thread_Create
+#define Thread_Wait _ctm_Thread_Wait
+#define Semaphore_Create _ctm_Semaphore_Create
+#define Semaphore_Release1 _ctm_Semaphore_Release1
+#define Semaphore_Wait _ctm_Semaphore_Wait
+#define Semaphore_Close _ctm_Semaphore_Close
+#define CriticalSection_Init _ctm_CriticalSection_Init
+#define CriticalSection_Delete _ctm_CriticalSection_Delete
+#define CriticalSection_Enter _ctm_CriticalSection_Enter
+#define CriticalSection_Leave _ctm_CriticalSection_Leave
+
 #endif /* LZMA_PREFIX_CTM */
 
 #endif /* __7Z_NAMEMANGLE_H */
@@ -0,0 +1,129 @@
+/* Threads.c -- multithreading library (Win32 and pthread versions)
+Public domain */
+
+#include "Threads.h"
+
+#ifdef _WIN32
+
+static WRes GetError()
+{
+  DWORD res = GetLastError();
+  return (res) ? (WRes)(res) : 1;
+}
+
+WRes Thread_Create(CThread *thread, THREAD_FUNC_TYPE startAddress, void *parameter)
+{
+  DWORD threadId;
+  *thread = CreateThread(0, 0, startAddress, parameter, 0, &threadId);
+  return (*thread != 0) ? 0 : GetError();
+}
+
+WRes Thread_Wait(CThread *thread)
+{
+  WRes res = 0;
+  if (WaitForSingleObject(*thread, INFINITE) != WAIT_OBJECT_0)
+    res = GetError();
+  CloseHandle(*thread);
+  return res;
+}
+
+WRes Semaphore_Create(CSemaphore *p, UInt32 initiallyCount, UInt32 maxCount)
+{
+  *p = CreateSemaphore(NULL, (LONG)initiallyCount, (LONG)maxCount, NULL);
+  return (*p != 0) ? 0 : GetError();
+}
+
+WRes Semaphore_Release1(CSemaphore *p)
+{
+  return ReleaseSemaphore(*p, 1, NULL) ? 0 : GetError();
+}
+
+WRes Semaphore_Wait(CSemaphore *p)
+{
+  return (WaitForSingleObject(*p, INFINITE) == WAIT_OBJECT_0) ? 0 : GetError();
+}
+
+void Semaphore_Close(CSemaphore *p)
+{
+  CloseHandle(*p);
+}
+
+WRes CriticalSection_Init(CCriticalSection *p)
+{
+  InitializeCriticalSection(p);
+  return 0;
+}
+
+void CriticalSection_Delete(CCriticalSection *p) { DeleteCriticalSection(p); }
+void CriticalSection_Enter(CCriticalSection *p) { EnterCriticalSection(p); }
+void CriticalSection_Leave(CCriticalSection *p) { LeaveCriticalSection(p); }
+
+#else
+
+WRes Thread_Create(CThread *thread, THREAD_FUNC_TYPE startAddress, void *parameter)
+{
+  return pthread_create(thread, NULL, startAddress, parameter);
+}
+
+WRes Thread_Wait(CThread *thread)
+{
+  return pthread_join(*thread, NULL);
+}
+
+WRes Semaphore_Create(CSemaphore *p, UInt32 initiallyCount, UInt32 maxCount)
+{
+  WRes res = pthread_mutex_init(&p->mutex, NULL);
+  if (res != 0)
+    return res;
+  res = pthread_cond_init(&p->cond, NULL);
+  if (res != 0)
+  {
+    pthread_mutex_destroy(&p->mutex);
+    return res;
+  }
+  p->count = initiallyCount;
+  p->maxCount = maxCount;
+  return 0;
+}
+
+WRes Semaphore_Release1(CSemaphore *p)
+{
+  WRes res = 0;
+  pthread_mutex_lock(&p->mutex);
+  if (p->count < p->maxCount)
+  {
+    p->count++;
+    pthread_cond_signal(&p->cond);
+  }
+  else
+    res = SZ_ERROR_THREAD;
+  pthread_mutex_unlock(&p->mutex);
+  return res;
+}
+
+WRes Semaphore_Wait(CSemaphore *p)
+{
+  pthread_mutex_lock(&p->mutex);
+  while (p->count == 0)
+    pthread_cond_wait(&p->cond, &p->mutex);
+  p->count--;
+  pthread_mutex_unlock(&p->mutex);
+  return 0;
+}
+
+void Semaphore_Close(CSemaphore *p)
+{
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->mutex);
+}
+
+WRes CriticalSection_Init(CCriticalSection *p)
+{
+  return pthread_mutex_init(p, NULL);
+}
+
+void CriticalSection_Delete(CCriticalSection *p) { pthread_mutex_destroy(p); }
+void CriticalSection_Enter(CCriticalSection *p) { pthread_mutex_lock(p); }
+void CriticalSection_Leave(CCriticalSection *p) { pthread_mutex_unlock(p); }
+
+#endif
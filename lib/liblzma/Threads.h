@@ -0,0 +1,54 @@
+/* Threads.h -- multithreading library (Win32 and pthread versions)
+Public domain */
+
+#ifndef __7Z_THRESDS_H
+#define __7Z_THRESDS_H
+
+#include "Types.h"
+
+#ifdef _WIN32
+
+typedef HANDLE CThread;
+typedef HANDLE CSemaphore;
+typedef CRITICAL_SECTION CCriticalSection;
+
+#define THREAD_FUNC_RET_TYPE DWORD
+#define THREAD_FUNC_CALL_TYPE WINAPI
+
+#else
+
+#include <pthread.h>
+
+typedef pthread_t CThread;
+typedef pthread_mutex_t CCriticalSection;
+
+/* Counting semaphore (unnamed POSIX semaphores are not available everywhere) */
+typedef struct _CSemaphore
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UInt32 count;
+  UInt32 maxCount;
+} CSemaphore;
+
+#define THREAD_FUNC_RET_TYPE void *
+#define THREAD_FUNC_CALL_TYPE
+
+#endif
+
+typedef THREAD_FUNC_RET_TYPE (THREAD_FUNC_CALL_TYPE * THREAD_FUNC_TYPE)(void *);
+
+WRes Thread_Create(CThread *thread, THREAD_FUNC_TYPE startAddress, void *parameter);
+WRes Thread_Wait(CThread *thread);
+
+WRes Semaphore_Create(CSemaphore *p, UInt32 initiallyCount, UInt32 maxCount);
+WRes Semaphore_Release1(CSemaphore *p);
+WRes Semaphore_Wait(CSemaphore *p);
+void Semaphore_Close(CSemaphore *p);
+
+WRes CriticalSection_Init(CCriticalSection *p);
+void CriticalSection_Delete(CCriticalSection *p);
+void CriticalSection_Enter(CCriticalSection *p);
+void CriticalSection_Leave(CCriticalSection *p);
+
+#endif
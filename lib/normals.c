@@ -0,0 +1,395 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        normals.c
+// Description: Smooth normal kernels for the MG2, MG3 and MG4 methods (flat
+//              triangle normals, normalization, and rotation of the decoded
+//              normals to the mesh coordinate system), with SIMD versions
+//              that are selected at runtime.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+// The smooth normal kernels must round every operation the same way, so the
+// compiler must not fuse multiplications and additions (which it may do when
+// FMA instructions are enabled, e.g. with -march=native). This must come
+// before the includes, since GCC does not apply it to the SIMD kernels
+// otherwise.
+#if defined(__clang__)
+  #pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 6)))
+  #pragma GCC optimize ("fp-contract=off")
+#endif
+
+#include <math.h>
+#include "openctm.h"
+#include "internal.h"
+
+// Can the SSE2 kernels be built? (they are compiled for SSE2 with function
+// attributes, and are only used if the CPU supports SSE2, see interleave.c)
+#if !defined(OPENCTM_NO_SIMD)
+  #if (defined(__x86_64__) || defined(__i386__)) && \
+      (defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+    #include <immintrin.h>
+    #define _CTM_HAVE_SSE2
+    #define _CTM_TARGET(x) __attribute__((target(x)))
+  #elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <immintrin.h>
+    #define _CTM_HAVE_SSE2
+    #define _CTM_TARGET(x)
+  #endif
+#endif
+
+
+//-----------------------------------------------------------------------------
+// _ctmMakeNormalCoordSys() - Create an ortho-normalized coordinate system
+// where the Z-axis is aligned with the given normal.
+// Note 1: This function is central to how the compressed normal data is
+//  interpreted, and it can not be changed (mathematically) without making the
+//  coder/decoder incompatible with other versions of the library!
+// Note 2: Since we do this for every single normal, this routine needs to be
+//  fast. The current implementation uses: 12 MUL, 1 DIV, 1 SQRT, ~6 ADD.
+//-----------------------------------------------------------------------------
+void _ctmMakeNormalCoordSys(const CTMfloat * aNormal, CTMfloat * aBasisAxes)
+{
+  CTMfloat len, * x, * y, * z;
+  CTMuint i;
+
+  // Pointers to the basis axes (aBasisAxes is a 3x3 matrix)
+  x = aBasisAxes;
+  y = &aBasisAxes[3];
+  z = &aBasisAxes[6];
+
+  // Z = normal (must be unit length!)
+  for(i = 0; i < 3; ++ i)
+    z[i] = aNormal[i];
+
+  // Calculate a vector that is guaranteed to be orthogonal to the normal, non-
+  // zero, and a continuous function of the normal (no discrete jumps):
+  // X = (0,0,1) x normal + (1,0,0) x normal
+  x[0] =  -aNormal[1];
+  x[1] =  aNormal[0] - aNormal[2];
+  x[2] =  aNormal[1];
+
+  // Normalize the new X axis (note: |x[2]| = |x[0]|)
+  len = sqrtf(2.0 * x[0] * x[0] + x[1] * x[1]);
+  if(len > 1.0e-20f)
+  {
+    len = 1.0f / len;
+    x[0] *= len;
+    x[1] *= len;
+    x[2] *= len;
+  }
+
+  // Let Y = Z x X  (no normalization needed, since |Z| = |X| = 1)
+  y[0] = z[1] * x[2] - z[2] * x[1];
+  y[1] = z[2] * x[0] - z[0] * x[2];
+  y[2] = z[0] * x[1] - z[1] * x[0];
+}
+
+//-----------------------------------------------------------------------------
+// Portable kernels. The operations (and their order) are the reference for
+// the SIMD versions, which must give bit identical results.
+//-----------------------------------------------------------------------------
+static void _ctmFaceNormals_C(const CTMfloat * aVertices, size_t aVertexStride,
+  const CTMuint * aIndices, size_t aCount, CTMfloat * aNormals)
+{
+  size_t i, j;
+  CTMfloat len;
+  CTMfloat v1[3], v2[3], n[3];
+  const CTMfloat * p[3];
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    // Get triangle corner vertices
+    for(j = 0; j < 3; ++ j)
+      p[j] = &aVertices[(size_t) aIndices[i * 3 + j] * aVertexStride];
+
+    // Calculate the normalized cross product of two triangle edges (i.e. the
+    // flat triangle normal)
+    for(j = 0; j < 3; ++ j)
+    {
+      v1[j] = p[1][j] - p[0][j];
+      v2[j] = p[2][j] - p[0][j];
+    }
+    n[0] = v1[1] * v2[2] - v1[2] * v2[1];
+    n[1] = v1[2] * v2[0] - v1[0] * v2[2];
+    n[2] = v1[0] * v2[1] - v1[1] * v2[0];
+    len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if(len > 1e-10f)
+      len = 1.0f / len;
+    else
+      len = 1.0f;
+    for(j = 0; j < 3; ++ j)
+      aNormals[i * 3 + j] = n[j] * len;
+  }
+}
+
+static void _ctmNormalize_C(CTMfloat * aVectors, size_t aCount)
+{
+  size_t i;
+  CTMfloat len;
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    len = sqrtf(aVectors[i * 3] * aVectors[i * 3] +
+                aVectors[i * 3 + 1] * aVectors[i * 3 + 1] +
+                aVectors[i * 3 + 2] * aVectors[i * 3 + 2]);
+    if(len > 1e-10f)
+      len = 1.0f / len;
+    else
+      len = 1.0f;
+    aVectors[i * 3] *= len;
+    aVectors[i * 3 + 1] *= len;
+    aVectors[i * 3 + 2] *= len;
+  }
+}
+
+static void _ctmRotateNormals_C(const CTMfloat * aSmoothNormals,
+  const CTMfloat * aAngular, size_t aCount, CTMfloat * aNormals,
+  size_t aNormalStride)
+{
+  size_t i, j;
+  CTMfloat n[3], basisAxes[9];
+  const CTMfloat * a;
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    // Rotate the normal from the coordinate system of the smooth normal, and
+    // apply the normal magnitude
+    a = &aAngular[i * 4];
+    _ctmMakeNormalCoordSys(&aSmoothNormals[i * 3], basisAxes);
+    for(j = 0; j < 3; ++ j)
+      n[j] = basisAxes[j] * a[0] +
+             basisAxes[3 + j] * a[1] +
+             basisAxes[6 + j] * a[2];
+    for(j = 0; j < 3; ++ j)
+      aNormals[i * aNormalStride + j] = n[j] * a[3];
+  }
+}
+
+static const _CTMnormalkernels _ctmNormalKernels_C = {
+  "C",
+  _ctmFaceNormals_C,
+  _ctmNormalize_C,
+  _ctmRotateNormals_C
+};
+
+
+#if defined(_CTM_HAVE_SSE2)
+
+//-----------------------------------------------------------------------------
+// SSE2 kernels (four vectors per iteration). The vectors are
+// transposed to one register per component, so that each lane does exactly
+// the same operations as the portable kernels (SSE2 has exactly rounded
+// square roots and divisions).
+//-----------------------------------------------------------------------------
+_CTM_TARGET("sse2")
+static __m128 _ctmLoadPoint_SSE2(const CTMfloat * aPoint)
+{
+  // Load x, y and z (without reading past the point)
+  return _mm_movelh_ps(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *) aPoint)),
+                       _mm_load_ss(&aPoint[2]));
+}
+
+_CTM_TARGET("sse2")
+static __m128 _ctmInvLength_SSE2(__m128 aX, __m128 aY, __m128 aZ)
+{
+  __m128 len, mask, one;
+  one = _mm_set1_ps(1.0f);
+  len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(aX, aX),
+                                          _mm_mul_ps(aY, aY)),
+                               _mm_mul_ps(aZ, aZ)));
+  mask = _mm_cmpgt_ps(len, _mm_set1_ps(1e-10f));
+  return _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, len)),
+                   _mm_andnot_ps(mask, one));
+}
+
+_CTM_TARGET("sse2")
+static void _ctmFaceNormals_SSE2(const CTMfloat * aVertices,
+  size_t aVertexStride, const CTMuint * aIndices, size_t aCount,
+  CTMfloat * aNormals)
+{
+  size_t i;
+  int j, k;
+  __m128 p[3][4], x1, y1, z1, x2, y2, z2, nx, ny, nz, s, t, u;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    // Get the corners of four triangles, as x, y and z registers
+    for(k = 0; k < 3; ++ k)
+    {
+      for(j = 0; j < 4; ++ j)
+        p[k][j] = _ctmLoadPoint_SSE2(&aVertices[(size_t) aIndices[(i + j) * 3 + k] * aVertexStride]);
+      _MM_TRANSPOSE4_PS(p[k][0], p[k][1], p[k][2], p[k][3]);
+    }
+
+    // Normalized cross product of the triangle edges
+    x1 = _mm_sub_ps(p[1][0], p[0][0]);
+    y1 = _mm_sub_ps(p[1][1], p[0][1]);
+    z1 = _mm_sub_ps(p[1][2], p[0][2]);
+    x2 = _mm_sub_ps(p[2][0], p[0][0]);
+    y2 = _mm_sub_ps(p[2][1], p[0][1]);
+    z2 = _mm_sub_ps(p[2][2], p[0][2]);
+    nx = _mm_sub_ps(_mm_mul_ps(y1, z2), _mm_mul_ps(z1, y2));
+    ny = _mm_sub_ps(_mm_mul_ps(z1, x2), _mm_mul_ps(x1, z2));
+    nz = _mm_sub_ps(_mm_mul_ps(x1, y2), _mm_mul_ps(y1, x2));
+    s = _ctmInvLength_SSE2(nx, ny, nz);
+    nx = _mm_mul_ps(nx, s);
+    ny = _mm_mul_ps(ny, s);
+    nz = _mm_mul_ps(nz, s);
+
+    // Store as x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+    t = _mm_unpacklo_ps(nx, ny);
+    u = _mm_shuffle_ps(nz, nx, _MM_SHUFFLE(1, 1, 0, 0));
+    _mm_storeu_ps(&aNormals[i * 3], _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 1, 0)));
+    t = _mm_shuffle_ps(ny, nz, _MM_SHUFFLE(1, 1, 1, 1));
+    u = _mm_unpackhi_ps(nx, ny);
+    _mm_storeu_ps(&aNormals[i * 3 + 4], _mm_shuffle_ps(t, u, _MM_SHUFFLE(1, 0, 2, 0)));
+    t = _mm_shuffle_ps(nz, nx, _MM_SHUFFLE(3, 3, 2, 2));
+    u = _mm_shuffle_ps(ny, nz, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(&aNormals[i * 3 + 8], _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0)));
+  }
+
+  _ctmFaceNormals_C(aVertices, aVertexStride, &aIndices[i * 3], aCount - i, &aNormals[i * 3]);
+}
+
+_CTM_TARGET("sse2")
+static void _ctmNormalize_SSE2(CTMfloat * aVectors, size_t aCount)
+{
+  size_t i;
+  __m128 a, b, c, x, y, z, s, t, u;
+
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    // Load x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3, and transpose
+    a = _mm_loadu_ps(&aVectors[i * 3]);
+    b = _mm_loadu_ps(&aVectors[i * 3 + 4]);
+    c = _mm_loadu_ps(&aVectors[i * 3 + 8]);
+    t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+    x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2, 0, 3, 0));
+    t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+    u = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+    y = _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0));
+    t = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+    u = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+    z = _mm_shuffle_ps(t, u, _MM_SHUFFLE(2, 0, 2, 0));
+
+    // Scale each vector by its inverse length (spread to the vector layout)
+    s = _ctmInvLength_SSE2(x, y, z);
+    _mm_storeu_ps(&aVectors[i * 3], _mm_mul_ps(a, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 0, 0))));
+    _mm_storeu_ps(&aVectors[i * 3 + 4], _mm_mul_ps(b, _mm_shuffle_ps(s, s, _MM_SHUFFLE(2, 2, 1, 1))));
+    _mm_storeu_ps(&aVectors[i * 3 + 8], _mm_mul_ps(c, _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 2))));
+  }
+
+  _ctmNormalize_C(&aVectors[i * 3], aCount - i);
+}
+
+_CTM_TARGET("sse2")
+static void _ctmRotateNormals_SSE2(const CTMfloat * aSmoothNormals,
+  const CTMfloat * aAngular, size_t aCount, CTMfloat * aNormals,
+  size_t aNormalStride)
+{
+  size_t i;
+  int j;
+  __m128 z[4], a[4], x[3], y[3], n[4], s, mask, one;
+  __m128d lo, hi, two;
+  CTMfloat * out;
+
+  one = _mm_set1_ps(1.0f);
+  two = _mm_set1_pd(2.0);
+  for(i = 0; i + 4 <= aCount; i += 4)
+  {
+    // Get the smooth normals (Z axes) and the angular normals (x, y, z and
+    // magnitude), as x, y and z registers
+    for(j = 0; j < 4; ++ j)
+    {
+      z[j] = _ctmLoadPoint_SSE2(&aSmoothNormals[(i + j) * 3]);
+      a[j] = _mm_loadu_ps(&aAngular[(i + j) * 4]);
+    }
+    _MM_TRANSPOSE4_PS(z[0], z[1], z[2], z[3]);
+    _MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+
+    // X = (0,0,1) x Z + (1,0,0) x Z, normalized. The squared length is
+    // calculated in double precision, as in _ctmMakeNormalCoordSys().
+    x[0] = _mm_xor_ps(z[1], _mm_set1_ps(-0.0f));
+    x[1] = _mm_sub_ps(z[0], z[2]);
+    x[2] = z[1];
+    s = _mm_mul_ps(x[1], x[1]);
+    lo = _mm_cvtps_pd(x[0]);
+    hi = _mm_cvtps_pd(_mm_movehl_ps(x[0], x[0]));
+    lo = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, lo), lo), _mm_cvtps_pd(s));
+    hi = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, hi), hi),
+                    _mm_cvtps_pd(_mm_movehl_ps(s, s)));
+    s = _mm_sqrt_ps(_mm_movelh_ps(_mm_cvtpd_ps(lo), _mm_cvtpd_ps(hi)));
+    mask = _mm_cmpgt_ps(s, _mm_set1_ps(1.0e-20f));
+    s = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(one, s)),
+                  _mm_andnot_ps(mask, one));
+    for(j = 0; j < 3; ++ j)
+      x[j] = _mm_mul_ps(x[j], s);
+
+    // Y = Z x X
+    y[0] = _mm_sub_ps(_mm_mul_ps(z[1], x[2]), _mm_mul_ps(z[2], x[1]));
+    y[1] = _mm_sub_ps(_mm_mul_ps(z[2], x[0]), _mm_mul_ps(z[0], x[2]));
+    y[2] = _mm_sub_ps(_mm_mul_ps(z[0], x[1]), _mm_mul_ps(z[1], x[0]));
+
+    // Rotate, and apply the normal magnitudes
+    for(j = 0; j < 3; ++ j)
+      n[j] = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x[j], a[0]),
+                                              _mm_mul_ps(y[j], a[1])),
+                                   _mm_mul_ps(z[j], a[2])), a[3]);
+    n[3] = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(n[0], n[1], n[2], n[3]);
+
+    // Store x, y and z (without writing past the normal)
+    for(j = 0; j < 4; ++ j)
+    {
+      out = &aNormals[(i + j) * aNormalStride];
+      _mm_storel_epi64((__m128i *) out, _mm_castps_si128(n[j]));
+      _mm_store_ss(&out[2], _mm_movehl_ps(n[j], n[j]));
+    }
+  }
+
+  _ctmRotateNormals_C(&aSmoothNormals[i * 3], &aAngular[i * 4], aCount - i,
+                      &aNormals[i * aNormalStride], aNormalStride);
+}
+
+static const _CTMnormalkernels _ctmNormalKernels_SSE2 = {
+  "SSE2",
+  _ctmFaceNormals_SSE2,
+  _ctmNormalize_SSE2,
+  _ctmRotateNormals_SSE2
+};
+
+#endif // _CTM_HAVE_SSE2
+
+//-----------------------------------------------------------------------------
+// _ctmNormalKernels() - Select the fastest smooth normal kernels that are
+// supported by the CPU.
+//-----------------------------------------------------------------------------
+const _CTMnormalkernels * _ctmNormalKernels(void)
+{
+#if defined(_CTM_HAVE_SSE2)
+  if(_ctmHaveSSE2())
+    return &_ctmNormalKernels_SSE2;
+#endif
+  return &_ctmNormalKernels_C;
+}
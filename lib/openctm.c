@@ -41,6 +41,145 @@
 #endif
 
 
+//-----------------------------------------------------------------------------
+// _ctmDefaultAlloc(), _ctmDefaultFree() - Default memory allocation functions.
+//-----------------------------------------------------------------------------
+static void * CTMCALL _ctmDefaultAlloc(size_t aSize, void * aUserData)
+{
+  (void) aUserData;
+  return malloc(aSize);
+}
+
+static void CTMCALL _ctmDefaultFree(void * aPtr, void * aUserData)
+{
+  (void) aUserData;
+  free(aPtr);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAlloc() - Allocate memory using the allocation functions of a context.
+//-----------------------------------------------------------------------------
+void * _ctmAlloc(const _CTMallocator * aAllocator, size_t aSize)
+{
+  return aAllocator->mAllocFn(aSize, aAllocator->mUserData);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFree() - Free memory that was allocated by _ctmAlloc() (NULL pointers
+// are ignored).
+//-----------------------------------------------------------------------------
+void _ctmFree(const _CTMallocator * aAllocator, void * aPtr)
+{
+  if(aPtr)
+    aAllocator->mFreeFn(aPtr, aAllocator->mUserData);
+}
+
+//-----------------------------------------------------------------------------
+// Scratch arena buffers are aligned to 16 bytes. Overflow buffers start with
+// a _CTMscratchbuf header (padded to keep the buffer aligned).
+//-----------------------------------------------------------------------------
+#define _CTM_SCRATCH_ALIGN(x) (((x) + 15) & ~((size_t) 15))
+#define _CTM_SCRATCH_HEADER _CTM_SCRATCH_ALIGN(sizeof(_CTMscratchbuf))
+
+//-----------------------------------------------------------------------------
+// _ctmScratchAlloc() - Allocate a temporary buffer from the scratch arena of
+// a context. The buffer stays valid until the arena is released to a mark
+// that was taken before the buffer was allocated (see _ctmScratchMark()), or
+// until the arena is reset. Returns NULL if there is not enough memory. The
+// scratch arena must only be used by the calling thread (not by jobs).
+//-----------------------------------------------------------------------------
+void * _ctmScratchAlloc(_CTMcontext * self, size_t aSize)
+{
+  _CTMscratch * scratch = &self->mScratch;
+  _CTMscratchbuf * buf;
+  unsigned char * ptr;
+  size_t pos;
+
+  // Never hand out zero sized buffers (NULL means out of memory)
+  aSize = aSize ? _CTM_SCRATCH_ALIGN(aSize) : 16;
+  pos = scratch->mUsed;
+  if((aSize < 16) || (aSize > ((size_t) -1) - _CTM_SCRATCH_HEADER - pos))
+    return (void *) 0;
+
+  if(pos + aSize <= scratch->mSize)
+    ptr = scratch->mBlock + pos;
+  else
+  {
+    // The buffer does not fit in the arena block
+    buf = (_CTMscratchbuf *) _ctmAlloc(&self->mAllocator, _CTM_SCRATCH_HEADER + aSize);
+    if(!buf)
+      return (void *) 0;
+    buf->mNext = scratch->mOverflow;
+    buf->mMark = pos;
+    scratch->mOverflow = buf;
+    ptr = ((unsigned char *) buf) + _CTM_SCRATCH_HEADER;
+  }
+
+  scratch->mUsed = pos + aSize;
+  if(scratch->mUsed > scratch->mHighWater)
+    scratch->mHighWater = scratch->mUsed;
+  return (void *) ptr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScratchMark() - Get the current position of the scratch arena.
+//-----------------------------------------------------------------------------
+size_t _ctmScratchMark(_CTMcontext * self)
+{
+  return self->mScratch.mUsed;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScratchRelease() - Release all scratch buffers that were allocated
+// after aMark was taken.
+//-----------------------------------------------------------------------------
+void _ctmScratchRelease(_CTMcontext * self, size_t aMark)
+{
+  _CTMscratch * scratch = &self->mScratch;
+  _CTMscratchbuf * buf;
+
+  while(scratch->mOverflow && (scratch->mOverflow->mMark >= aMark))
+  {
+    buf = scratch->mOverflow;
+    scratch->mOverflow = buf->mNext;
+    _ctmFree(&self->mAllocator, buf);
+  }
+  if(aMark < scratch->mUsed)
+    scratch->mUsed = aMark;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScratchReset() - Release all scratch buffers, and grow the arena block
+// so that it can hold everything that was needed since the last reset.
+//-----------------------------------------------------------------------------
+void _ctmScratchReset(_CTMcontext * self)
+{
+  _CTMscratch * scratch = &self->mScratch;
+
+  _ctmScratchRelease(self, 0);
+  if(scratch->mHighWater > scratch->mSize)
+  {
+    _ctmFree(&self->mAllocator, scratch->mBlock);
+    scratch->mBlock = (unsigned char *) _ctmAlloc(&self->mAllocator, scratch->mHighWater);
+    scratch->mSize = scratch->mBlock ? scratch->mHighWater : 0;
+  }
+  scratch->mHighWater = 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmScratchFree() - Free all memory that is held by the scratch arena.
+//-----------------------------------------------------------------------------
+void _ctmScratchFree(_CTMcontext * self)
+{
+  _CTMscratch * scratch = &self->mScratch;
+
+  _ctmScratchRelease(self, 0);
+  _ctmFree(&self->mAllocator, scratch->mBlock);
+  scratch->mBlock = (unsigned char *) 0;
+  scratch->mSize = 0;
+  scratch->mHighWater = 0;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmFreeMapList() - Free a float map list.
 //-----------------------------------------------------------------------------
@@ -50,20 +189,21 @@ static void _ctmFreeMapList(_CTMcontext * self, _CTMfloatmap * aMapList)
   map = aMapList;
   while(map)
   {
-    // Free internally allocated array (if we are in import mode)
-    if((self->mMode == CTM_IMPORT) && map->mValues)
-      free(map->mValues);
+    // Free internally allocated array (if we are in import mode, and the
+    // array is not a caller provided buffer)
+    if((self->mMode == CTM_IMPORT) && map->mValues && !map->mExternal)
+      _ctmFree(&self->mAllocator, map->mValues);
 
     // Free map name
     if(map->mName)
-      free(map->mName);
+      _ctmFree(&self->mAllocator, map->mName);
 
     // Free file name
     if(map->mFileName)
-      free(map->mFileName);
+      _ctmFree(&self->mAllocator, map->mFileName);
 
     nextMap = map->mNext;
-    free(map);
+    _ctmFree(&self->mAllocator, map);
     map = nextMap;
   }
 }
@@ -73,23 +213,28 @@ static void _ctmFreeMapList(_CTMcontext * self, _CTMfloatmap * aMapList)
 //-----------------------------------------------------------------------------
 static void _ctmClearMesh(_CTMcontext * self)
 {
-  // Free internally allocated mesh arrays
+  // Free internally allocated mesh arrays (caller provided buffers, see
+  // ctmLoadBuffer(), are left alone)
   if(self->mMode == CTM_IMPORT)
   {
-    if(self->mVertices)
-      free(self->mVertices);
-    if(self->mIndices)
-      free(self->mIndices);
-    if(self->mNormals)
-      free(self->mNormals);
+    if(self->mVertices && !(self->mExternalArrays & (1 << _CTM_OUT_VERTICES)))
+      _ctmFree(&self->mAllocator, self->mVertices);
+    if(self->mIndices && !(self->mExternalArrays & (1 << _CTM_OUT_INDICES)))
+      _ctmFree(&self->mAllocator, self->mIndices);
+    if(self->mNormals && !(self->mExternalArrays & (1 << _CTM_OUT_NORMALS)))
+      _ctmFree(&self->mAllocator, self->mNormals);
   }
 
   // Clear externally assigned mesh arrays
   self->mVertices = (CTMfloat *) 0;
   self->mVertexCount = 0;
+  self->mVertexStride = 3;
   self->mIndices = (CTMuint *) 0;
   self->mTriangleCount = 0;
   self->mNormals = (CTMfloat *) 0;
+  self->mNormalStride = 3;
+  self->mFileFlags = 0;
+  self->mExternalArrays = 0;
 
   // Free UV coordinate map list
   _ctmFreeMapList(self, self->mUVMaps);
@@ -102,6 +247,48 @@ static void _ctmClearMesh(_CTMcontext * self)
   self->mAttribMapCount = 0;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmCheckIndices() - Check that all triangle indices are within range.
+//-----------------------------------------------------------------------------
+static CTMint _ctmCheckIndices(_CTMcontext * self)
+{
+  CTMuint i;
+
+  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  {
+    if(self->mIndices[i] >= self->mVertexCount)
+    {
+      return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckFloats() - Check that all values of a float array (aCount elements
+// of aSize components, with aStride floats between the elements) are finite
+// (non-NaN, non-inf).
+//-----------------------------------------------------------------------------
+static CTMint _ctmCheckFloats(const CTMfloat * aValues, CTMuint aCount,
+  CTMuint aSize, CTMuint aStride)
+{
+  CTMuint i, j;
+
+  for(i = 0; i < aCount; ++ i)
+  {
+    for(j = 0; j < aSize; ++ j)
+    {
+      if(!isfinite(aValues[(size_t) i * aStride + j]))
+      {
+        return CTM_FALSE;
+      }
+    }
+  }
+
+  return CTM_TRUE;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmCheckMeshIntegrity() - Check if a mesh is valid (i.e. is non-empty, and
 // contains valid data).
@@ -109,7 +296,6 @@ static void _ctmClearMesh(_CTMcontext * self)
 
 static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
 {
-  CTMuint i;
   _CTMfloatmap * map;
 
   // Check that we have all the mandatory data
@@ -120,45 +306,34 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   }
 
   // Check that all indices are within range
-  for(i = 0; i < (self->mTriangleCount * 3); ++ i)
+  if(!_ctmCheckIndices(self))
   {
-    if(self->mIndices[i] >= self->mVertexCount)
-    {
-      return CTM_FALSE;
-    }
+    return CTM_FALSE;
   }
 
   // Check that all vertices are finite (non-NaN, non-inf)
-  for(i = 0; i < self->mVertexCount * 3; ++ i)
+  if(!_ctmCheckFloats(self->mVertices, self->mVertexCount, 3, self->mVertexStride))
   {
-    if(!isfinite(self->mVertices[i]))
-    {
-      return CTM_FALSE;
-    }
+    return CTM_FALSE;
   }
 
   // Check that all normals are finite (non-NaN, non-inf)
   if(self->mNormals)
   {
-    for(i = 0; i < self->mVertexCount * 3; ++ i)
+    if(!_ctmCheckFloats(self->mNormals, self->mVertexCount, 3, self->mNormalStride))
     {
-      if(!isfinite(self->mNormals[i]))
-      {
-        return CTM_FALSE;
-      }
+      return CTM_FALSE;
     }
   }
 
-  // Check that all UV maps are finite (non-NaN, non-inf)
+  // Check that all UV maps are finite (non-NaN, non-inf) - skipped maps
+  // (see ctmLoadFilter()) have no values
   map = self->mUVMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 2; ++ i)
+    if(map->mValues && !_ctmCheckFloats(map->mValues, self->mVertexCount, 2, map->mStride))
     {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
+      return CTM_FALSE;
     }
     map = map->mNext;
   }
@@ -167,12 +342,9 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   map = self->mAttribMaps;
   while(map)
   {
-    for(i = 0; i < self->mVertexCount * 4; ++ i)
+    if(map->mValues && !_ctmCheckFloats(map->mValues, self->mVertexCount, 4, map->mStride))
     {
-      if(!isfinite(map->mValues[i]))
-      {
-        return CTM_FALSE;
-      }
+      return CTM_FALSE;
     }
     map = map->mNext;
   }
@@ -180,12 +352,147 @@ static CTMint _ctmCheckMeshIntegrity(_CTMcontext * self)
   return CTM_TRUE;
 }
 
+//-----------------------------------------------------------------------------
+// _ctmSectionLoaded() - Called by the mesh decoders when a mesh array
+// (aSection = CTM_INDICES, CTM_VERTICES, CTM_NORMALS, CTM_UV_MAP_n or
+// CTM_ATTRIB_MAP_n) has been completely loaded. The array is checked and
+// passed on to the section loaded callback (if any).
+//-----------------------------------------------------------------------------
+int _ctmSectionLoaded(_CTMcontext * self, CTMenum aSection)
+{
+  _CTMfloatmap * map;
+  const void * data;
+  CTMuint i, count, size, stride;
+  int valid;
+
+  // Progressive loading disabled?
+  if(!self->mSectionFn)
+    return CTM_TRUE;
+
+  // Check the array before handing it out
+  count = self->mVertexCount;
+  if(aSection == CTM_INDICES)
+  {
+    data = (const void *) self->mIndices;
+    count = self->mTriangleCount;
+    valid = _ctmCheckIndices(self);
+  }
+  else
+  {
+    if((aSection >= CTM_UV_MAP_1) &&
+       ((CTMuint)(aSection - CTM_UV_MAP_1) < self->mUVMapCount))
+    {
+      map = self->mUVMaps;
+      for(i = CTM_UV_MAP_1; map && (i != aSection); ++ i)
+        map = map->mNext;
+      size = 2;
+    }
+    else if((aSection >= CTM_ATTRIB_MAP_1) &&
+            ((CTMuint)(aSection - CTM_ATTRIB_MAP_1) < self->mAttribMapCount))
+    {
+      map = self->mAttribMaps;
+      for(i = CTM_ATTRIB_MAP_1; map && (i != aSection); ++ i)
+        map = map->mNext;
+      size = 4;
+    }
+    else
+    {
+      map = (_CTMfloatmap *) 0;
+      size = 3;
+    }
+    stride = 0;
+    if(map)
+    {
+      data = (const void *) map->mValues;
+      stride = map->mStride;
+    }
+    else if(aSection == CTM_VERTICES)
+    {
+      data = (const void *) self->mVertices;
+      stride = self->mVertexStride;
+    }
+    else if(aSection == CTM_NORMALS)
+    {
+      data = (const void *) self->mNormals;
+      stride = self->mNormalStride;
+    }
+    else
+      data = (const void *) 0;
+    if(!data)
+    {
+      self->mError = CTM_INTERNAL_ERROR;
+      return CTM_FALSE;
+    }
+    valid = _ctmCheckFloats((const CTMfloat *) data, count, size, stride);
+  }
+  if(!valid)
+  {
+    self->mError = CTM_INVALID_MESH;
+    return CTM_FALSE;
+  }
+
+  // Report the array
+  self->mSectionFn(aSection, data, count, self->mSectionUserData);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSectionSaved() - Called by the mesh encoders when a mesh array has been
+// written to the stream, starting at stream position aStart. The size of the
+// array is added to the array size slot aSlot (_CTM_OUT_*).
+//-----------------------------------------------------------------------------
+void _ctmSectionSaved(_CTMcontext * self, CTMuint aSlot, size_t aStart)
+{
+  self->mSectionSizes[aSlot] += self->mWritePos - aStart;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmArraySlot() - Get the per array slot (_CTM_OUT_*) and the number of
+// components per element of a mesh array (CTM_INDICES, CTM_VERTICES,
+// CTM_NORMALS, CTM_UV_MAP_n or CTM_ATTRIB_MAP_n). Returns CTM_FALSE if
+// aArray is not a mesh array.
+//-----------------------------------------------------------------------------
+static int _ctmArraySlot(CTMenum aArray, CTMuint * aSlot, CTMuint * aSize)
+{
+  if(aArray == CTM_INDICES)
+  {
+    *aSlot = _CTM_OUT_INDICES;
+    *aSize = 3;
+  }
+  else if(aArray == CTM_VERTICES)
+  {
+    *aSlot = _CTM_OUT_VERTICES;
+    *aSize = 3;
+  }
+  else if(aArray == CTM_NORMALS)
+  {
+    *aSlot = _CTM_OUT_NORMALS;
+    *aSize = 3;
+  }
+  else if((aArray >= CTM_UV_MAP_1) && (aArray <= CTM_UV_MAP_8))
+  {
+    *aSlot = _CTM_OUT_UV_MAP_1 + (aArray - CTM_UV_MAP_1);
+    *aSize = 2;
+  }
+  else if((aArray >= CTM_ATTRIB_MAP_1) && (aArray <= CTM_ATTRIB_MAP_8))
+  {
+    *aSlot = _CTM_OUT_ATTRIB_MAP_1 + (aArray - CTM_ATTRIB_MAP_1);
+    *aSize = 4;
+  }
+  else
+    return CTM_FALSE;
+
+  return CTM_TRUE;
+}
+
 //-----------------------------------------------------------------------------
 // ctmNewContext()
 //-----------------------------------------------------------------------------
 CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
 {
   _CTMcontext * self;
+  int i;
 
   // Allocate memory for the new structure
   self = (_CTMcontext *) malloc(sizeof(_CTMcontext));
@@ -196,8 +503,26 @@ CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode)
   self->mError = CTM_NONE;
   self->mMethod = CTM_METHOD_MG1;
   self->mCompressionLevel = 1;
+  self->mBackend = CTM_BACKEND_LZMA;
+  for(i = 0; i < _CTM_PARAMS_COUNT; ++ i)
+  {
+    self->mLzmaParams[i].mDictSize = 0;
+    self->mLzmaParams[i].mLC = -1;
+    self->mLzmaParams[i].mLP = -1;
+    self->mLzmaParams[i].mPB = -1;
+    self->mLzmaParams[i].mFB = -1;
+  }
+  self->mDecodeThreads = 1;
+  self->mEncodeThreads = 1;
   self->mVertexPrecision = 1.0f / 1024.0f;
   self->mNormalPrecision = 1.0f / 256.0f;
+  self->mNormalMode = CTM_NORMALS_SPHERICAL;
+  self->mVertexStride = 3;
+  self->mNormalStride = 3;
+  self->mAllocator.mAllocFn = _ctmDefaultAlloc;
+  self->mAllocator.mFreeFn = _ctmDefaultFree;
+  self->mPlaneKernels = _ctmPlaneKernels();
+  self->mNormalKernels = _ctmNormalKernels();
 
   return (CTMcontext) self;
 }
@@ -215,12 +540,50 @@ CTMEXPORT void CTMCALL ctmFreeContext(CTMcontext aContext)
 
   // Free the file comment
   if(self->mFileComment)
-    free(self->mFileComment);
+    _ctmFree(&self->mAllocator, self->mFileComment);
+
+  // Free the scratch arena
+  _ctmScratchFree(self);
 
   // Free the context
   free(self);
 }
 
+//-----------------------------------------------------------------------------
+// ctmSetAllocator()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmSetAllocator(CTMcontext aContext,
+  CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // Check arguments
+  if((aAllocFn ? 1 : 0) != (aFreeFn ? 1 : 0))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // The allocator can not be changed while the context holds memory that was
+  // allocated with the old allocator
+  if(((self->mMode == CTM_IMPORT) &&
+      (self->mVertices || self->mIndices || self->mNormals)) ||
+     self->mUVMaps || self->mAttribMaps || self->mFileComment)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // The scratch arena is empty between calls, so just give it back
+  _ctmScratchFree(self);
+
+  // Set the allocator (or restore the default allocator)
+  self->mAllocator.mAllocFn = aAllocFn ? aAllocFn : _ctmDefaultAlloc;
+  self->mAllocator.mFreeFn = aFreeFn ? aFreeFn : _ctmDefaultFree;
+  self->mAllocator.mUserData = aUserData;
+}
+
 //-----------------------------------------------------------------------------
 // ctmGetError()
 //-----------------------------------------------------------------------------
@@ -264,6 +627,8 @@ CTMEXPORT const char * CTMCALL ctmErrorString(CTMenum aError)
       return "CTM_INTERNAL_ERROR";
     case CTM_UNSUPPORTED_FORMAT_VERSION:
       return "CTM_UNSUPPORTED_FORMAT_VERSION";
+    case CTM_UNSUPPORTED_BACKEND:
+      return "CTM_UNSUPPORTED_BACKEND";
     default:
       return "Unknown error code";
   }
@@ -292,11 +657,21 @@ CTMEXPORT CTMuint CTMCALL ctmGetInteger(CTMcontext aContext, CTMenum aProperty)
       return self->mAttribMapCount;
 
     case CTM_HAS_NORMALS:
-      return self->mNormals ? CTM_TRUE : CTM_FALSE;
+      return (self->mNormals || (self->mFileFlags & _CTM_HAS_NORMALS_BIT)) ?
+             CTM_TRUE : CTM_FALSE;
 
     case CTM_COMPRESSION_METHOD:
       return (CTMuint) self->mMethod;
 
+    case CTM_COMPRESSION_BACKEND:
+      return (CTMuint) self->mBackend;
+
+    case CTM_COMPRESSION_LEVEL:
+      return self->mCompressionLevel;
+
+    case CTM_NORMAL_MODE:
+      return (CTMuint) self->mNormalMode;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -320,6 +695,9 @@ CTMEXPORT CTMfloat CTMCALL ctmGetFloat(CTMcontext aContext, CTMenum aProperty)
     case CTM_NORMAL_PRECISION:
       return self->mNormalPrecision;
 
+    case CTM_VERTEX_ERROR:
+      return self->mVertexError;
+
     default:
       self->mError = CTM_INVALID_ARGUMENT;
   }
@@ -656,7 +1034,8 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 
   // Check arguments
   if((aMethod != CTM_METHOD_RAW) && (aMethod != CTM_METHOD_MG1) &&
-     (aMethod != CTM_METHOD_MG2))
+     (aMethod != CTM_METHOD_MG2) && (aMethod != CTM_METHOD_MG3) &&
+     (aMethod != CTM_METHOD_MG4))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
@@ -694,10 +1073,10 @@ CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
 }
 
 //-----------------------------------------------------------------------------
-// ctmVertexPrecision()
+// ctmCompressionBackend()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
-  CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmCompressionBackend(CTMcontext aContext,
+  CTMenum aBackend)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return;
@@ -709,26 +1088,26 @@ CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
     return;
   }
 
-  // Check arguments
-  if(aPrecision <= 0.0f)
+  // Check arguments (the backend must be supported by this build)
+  if(!_ctmHaveBackend(aBackend))
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Set precision
-  self->mVertexPrecision = aPrecision;
+  // Set the entropy backend
+  self->mBackend = aBackend;
 }
 
 //-----------------------------------------------------------------------------
-// ctmVertexPrecisionRel()
+// ctmCompressionParams()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
-  CTMfloat aRelPrecision)
+CTMEXPORT void CTMCALL ctmCompressionParams(CTMcontext aContext,
+  CTMenum aArray, CTMint aDictSize, CTMint aLiteralContextBits,
+  CTMint aLiteralPosBits, CTMint aPosBits, CTMint aFastBytes)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMfloat avgEdgeLength, * p1, * p2;
-  CTMuint edgeCount, i, j;
+  int first, last, i;
   if(!self) return;
 
   // You are only allowed to change compression attributes in export mode
@@ -738,46 +1117,56 @@ CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
     return;
   }
 
-  // Check arguments
-  if(aRelPrecision <= 0.0f)
+  // Which array class(es)?
+  if(aArray == CTM_NONE)
+  {
+    first = 0;
+    last = _CTM_PARAMS_COUNT - 1;
+  }
+  else if(aArray == CTM_INDICES)
+    first = last = _CTM_PARAMS_INDICES;
+  else if(aArray == CTM_VERTICES)
+    first = last = _CTM_PARAMS_VERTICES;
+  else if(aArray == CTM_NORMALS)
+    first = last = _CTM_PARAMS_NORMALS;
+  else if((aArray >= CTM_UV_MAP_1) && (aArray <= CTM_UV_MAP_8))
+    first = last = _CTM_PARAMS_UV_MAPS;
+  else if((aArray >= CTM_ATTRIB_MAP_1) && (aArray <= CTM_ATTRIB_MAP_8))
+    first = last = _CTM_PARAMS_ATTRIB_MAPS;
+  else
   {
     self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
 
-  // Calculate the average edge length (Note: we actually sum up all the half-
-  // edges, so in a proper solid mesh all connected edges are counted twice)
-  avgEdgeLength = 0.0f;
-  edgeCount = 0;
-  for(i = 0; i < self->mTriangleCount; ++ i)
-  {
-    p1 = &self->mVertices[self->mIndices[i * 3 + 2] * 3];
-    for(j = 0; j < 3; ++ j)
-    {
-      p2 = &self->mVertices[self->mIndices[i * 3 + j] * 3];
-      avgEdgeLength += sqrtf((p2[0] - p1[0]) * (p2[0] - p1[0]) +
-                             (p2[1] - p1[1]) * (p2[1] - p1[1]) +
-                             (p2[2] - p1[2]) * (p2[2] - p1[2]));
-      p1 = p2;
-      ++ edgeCount;
-    }
-  }
-  if(edgeCount == 0)
+  // Check arguments (-1 means the default for the compression level)
+  if(((aDictSize != -1) && (aDictSize != 0) &&
+      ((aDictSize < (1 << 12)) || (aDictSize > (1 << 27)))) ||
+     (aLiteralContextBits < -1) || (aLiteralContextBits > 8) ||
+     (aLiteralPosBits < -1) || (aLiteralPosBits > 4) ||
+     (aPosBits < -1) || (aPosBits > 4) ||
+     ((aFastBytes != -1) && ((aFastBytes < 5) || (aFastBytes > 273))))
   {
-    self->mError = CTM_INVALID_MESH;
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
-  avgEdgeLength /= (CTMfloat) edgeCount;
 
-  // Set precision
-  self->mVertexPrecision = aRelPrecision * avgEdgeLength;
+  // Set the parameters
+  for(i = first; i <= last; ++ i)
+  {
+    self->mLzmaParams[i].mDictSize = aDictSize;
+    self->mLzmaParams[i].mLC = aLiteralContextBits;
+    self->mLzmaParams[i].mLP = aLiteralPosBits;
+    self->mLzmaParams[i].mPB = aPosBits;
+    self->mLzmaParams[i].mFB = aFastBytes;
+  }
 }
 
 //-----------------------------------------------------------------------------
-// ctmNormalPrecision()
+// ctmEncodeThreads()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
-  CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmEncodeThreads(CTMcontext aContext,
+  CTMuint aThreadCount)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
   if(!self) return;
@@ -789,25 +1178,179 @@ CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
     return;
   }
 
-  // Check arguments
-  if(aPrecision <= 0.0f)
-  {
-    self->mError = CTM_INVALID_ARGUMENT;
-    return;
-  }
+  // Zero means "one thread per processor"
+  if(aThreadCount == 0)
+    aThreadCount = _ctmProcessorCount();
 
-  // Set precision
-  self->mNormalPrecision = aPrecision;
+  // Set the max number of encoding threads
+  self->mEncodeThreads = aThreadCount;
 }
 
 //-----------------------------------------------------------------------------
-// ctmUVCoordPrecision()
+// ctmDecodeThreads()
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
-  CTMenum aUVMap, CTMfloat aPrecision)
+CTMEXPORT void CTMCALL ctmDecodeThreads(CTMcontext aContext,
+  CTMuint aThreadCount)
 {
   _CTMcontext * self = (_CTMcontext *) aContext;
-  _CTMfloatmap * map;
+  if(!self) return;
+
+  // You are only allowed to change decoding attributes in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Zero means "one thread per processor"
+  if(aThreadCount == 0)
+    aThreadCount = _ctmProcessorCount();
+
+  // Set the max number of decoding threads
+  self->mDecodeThreads = aThreadCount;
+}
+
+//-----------------------------------------------------------------------------
+// ctmVertexPrecision()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
+  CTMfloat aPrecision)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set precision
+  self->mVertexPrecision = aPrecision;
+}
+
+//-----------------------------------------------------------------------------
+// ctmVertexPrecisionRel()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
+  CTMfloat aRelPrecision)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMfloat avgEdgeLength, * p1, * p2;
+  CTMuint edgeCount, i, j;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aRelPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Calculate the average edge length (Note: we actually sum up all the half-
+  // edges, so in a proper solid mesh all connected edges are counted twice)
+  avgEdgeLength = 0.0f;
+  edgeCount = 0;
+  for(i = 0; i < self->mTriangleCount; ++ i)
+  {
+    p1 = &self->mVertices[self->mIndices[i * 3 + 2] * 3];
+    for(j = 0; j < 3; ++ j)
+    {
+      p2 = &self->mVertices[self->mIndices[i * 3 + j] * 3];
+      avgEdgeLength += sqrtf((p2[0] - p1[0]) * (p2[0] - p1[0]) +
+                             (p2[1] - p1[1]) * (p2[1] - p1[1]) +
+                             (p2[2] - p1[2]) * (p2[2] - p1[2]));
+      p1 = p2;
+      ++ edgeCount;
+    }
+  }
+  if(edgeCount == 0)
+  {
+    self->mError = CTM_INVALID_MESH;
+    return;
+  }
+  avgEdgeLength /= (CTMfloat) edgeCount;
+
+  // Set precision
+  self->mVertexPrecision = aRelPrecision * avgEdgeLength;
+}
+
+//-----------------------------------------------------------------------------
+// ctmNormalPrecision()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
+  CTMfloat aPrecision)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aPrecision <= 0.0f)
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set precision
+  self->mNormalPrecision = aPrecision;
+}
+
+//-----------------------------------------------------------------------------
+// ctmNormalMode()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmNormalMode(CTMcontext aContext, CTMenum aMode)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change compression attributes in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if((aMode != CTM_NORMALS_SPHERICAL) && (aMode != CTM_NORMALS_OCTAHEDRAL))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the normal coding mode
+  self->mNormalMode = aMode;
+}
+
+//-----------------------------------------------------------------------------
+// ctmUVCoordPrecision()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
+  CTMenum aUVMap, CTMfloat aPrecision)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMfloatmap * map;
   CTMuint i;
   if(!self) return;
 
@@ -906,7 +1449,7 @@ CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
   // Free the old comment string, if necessary
   if(self->mFileComment)
   {
-    free(self->mFileComment);
+    _ctmFree(&self->mAllocator, self->mFileComment);
     self->mFileComment = (char *) 0;
   }
 
@@ -918,7 +1461,7 @@ CTMEXPORT void CTMCALL ctmFileComment(CTMcontext aContext,
     return;
 
   // Copy the string
-  self->mFileComment = (char *) malloc(len + 1);
+  self->mFileComment = (char *) _ctmAlloc(&self->mAllocator, len + 1);
   if(!self->mFileComment)
   {
     self->mError = CTM_OUT_OF_MEMORY;
@@ -979,7 +1522,7 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
   // Allocate memory for a new map list item and append it to the list
   if(!*aList)
   {
-    *aList = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
+    *aList = (_CTMfloatmap *) _ctmAlloc(&self->mAllocator, sizeof(_CTMfloatmap));
     map = *aList;
   }
   else
@@ -987,7 +1530,7 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
     map = *aList;
     while(map->mNext)
       map = map->mNext;
-    map->mNext = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
+    map->mNext = (_CTMfloatmap *) _ctmAlloc(&self->mAllocator, sizeof(_CTMfloatmap));
     map = map->mNext;
   }
   if(!map)
@@ -1009,11 +1552,11 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
     if(len)
     {
       // Copy the string
-      map->mName = (char *) malloc(len + 1);
+      map->mName = (char *) _ctmAlloc(&self->mAllocator, len + 1);
       if(!map->mName)
       {
         self->mError = CTM_OUT_OF_MEMORY;
-        free(map);
+        _ctmFree(&self->mAllocator, map);
         return (_CTMfloatmap *) 0;
       }
       strcpy(map->mName, aName);
@@ -1028,13 +1571,13 @@ static _CTMfloatmap * _ctmAddFloatMap(_CTMcontext * self,
     if(len)
     {
       // Copy the string
-      map->mFileName = (char *) malloc(len + 1);
+      map->mFileName = (char *) _ctmAlloc(&self->mAllocator, len + 1);
       if(!map->mFileName)
       {
         self->mError = CTM_OUT_OF_MEMORY;
         if(map->mName)
-          free(map->mName);
-        free(map);
+          _ctmFree(&self->mAllocator, map->mName);
+        _ctmFree(&self->mAllocator, map);
         return (_CTMfloatmap *) 0;
       }
       strcpy(map->mFileName, aFileName);
@@ -1062,6 +1605,7 @@ CTMEXPORT CTMenum CTMCALL ctmAddUVMap(CTMcontext aContext,
   {
     // The default UV coordinate precision is 2^-12
     map->mPrecision = 1.0f / 4096.0f;
+    map->mStride = 2;
     ++ self->mUVMapCount;
     return CTM_UV_MAP_1 + self->mUVMapCount - 1;
   }
@@ -1086,6 +1630,7 @@ CTMEXPORT CTMenum CTMCALL ctmAddAttribMap(CTMcontext aContext,
   {
     // The default vertex attribute precision is 2^-8
     map->mPrecision = 1.0f / 256.0f;
+    map->mStride = 4;
     ++ self->mAttribMapCount;
     return CTM_ATTRIB_MAP_1 + self->mAttribMapCount - 1;
   }
@@ -1100,6 +1645,15 @@ static CTMuint CTMCALL _ctmDefaultRead(void * aBuf, CTMuint aCount,
   return (CTMuint) fread(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmDefaultSkip()
+//-----------------------------------------------------------------------------
+static int _ctmDefaultSkip(CTMuint aCount, void * aUserData)
+{
+  return fseek((FILE *) aUserData, (long) aCount, SEEK_CUR) == 0 ?
+         CTM_TRUE : CTM_FALSE;
+}
+
 //-----------------------------------------------------------------------------
 // ctmLoad()
 //-----------------------------------------------------------------------------
@@ -1124,7 +1678,8 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
     return;
   }
 
-  // Load the file
+  // Load the file (file streams are seekable)
+  self->mSkipFn = _ctmDefaultSkip;
   ctmLoadCustom(self, _ctmDefaultRead, (void *) f);
 
   // Close file stream
@@ -1132,19 +1687,66 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmAllocateFloatMaps()
+// _ctmGetOutputArray() - Get the array that a mesh array of aCount elements
+// with aSize components per element is loaded into: the caller provided
+// buffer of output buffer slot aSlot (see ctmLoadBuffer()), if any, or else
+// a newly allocated array. The distance between two elements is returned in
+// *aStride, and *aExternal tells if the array is a caller provided buffer.
+//-----------------------------------------------------------------------------
+static void * _ctmGetOutputArray(_CTMcontext * self, CTMuint aSlot,
+  CTMuint aCount, CTMuint aSize, CTMuint * aStride, int * aExternal)
+{
+  _CTMoutbuffer * out;
+  void * array;
+
+  // Use the caller provided buffer?
+  if(aSlot < _CTM_OUT_COUNT)
+  {
+    out = &self->mOutBuffers[aSlot];
+    if(out->mBuffer)
+    {
+      // Is the buffer large enough?
+      if((out->mSize / sizeof(CTMfloat)) <
+         ((size_t) aCount - 1) * out->mStride + aSize)
+      {
+        self->mError = CTM_INVALID_ARGUMENT;
+        return (void *) 0;
+      }
+      *aStride = out->mStride;
+      *aExternal = CTM_TRUE;
+      return out->mBuffer;
+    }
+  }
+
+  // Allocate a new array
+  array = _ctmAlloc(&self->mAllocator, (size_t) aCount * aSize * sizeof(CTMfloat));
+  if(!array)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return (void *) 0;
+  }
+  *aStride = aSize;
+  *aExternal = CTM_FALSE;
+  return array;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmAllocateFloatMaps() - Allocate a list of aCount maps. If aValues is
+// CTM_FALSE, the value arrays of the maps are not allocated. The values of
+// the n:th map are loaded into output buffer slot aFirstSlot + n, if set.
 //-----------------------------------------------------------------------------
 static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
-  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels)
+  _CTMfloatmap ** aMapListPtr, CTMuint aCount, CTMuint aChannels, int aValues,
+  CTMuint aFirstSlot)
 {
   _CTMfloatmap ** mapListPtr;
-  CTMuint i, size;
+  CTMuint i;
 
   mapListPtr = aMapListPtr;
   for(i = 0; i < aCount; ++ i)
   {
     // Allocate & clear memory for this map
-    *mapListPtr = (_CTMfloatmap *) malloc(sizeof(_CTMfloatmap));
+    *mapListPtr = (_CTMfloatmap *) _ctmAlloc(&self->mAllocator, sizeof(_CTMfloatmap));
     if(!*mapListPtr)
     {
       self->mError = CTM_OUT_OF_MEMORY;
@@ -1152,15 +1754,18 @@ static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
     }
     memset(*mapListPtr, 0, sizeof(_CTMfloatmap));
 
-    // Allocate & clear memory for the float array
-    size = aChannels * sizeof(CTMfloat) * self->mVertexCount;
-    (*mapListPtr)->mValues = (CTMfloat *) malloc(size);
-    if(!(*mapListPtr)->mValues)
+    // Get (and clear) the memory for the float array
+    (*mapListPtr)->mStride = aChannels;
+    if(aValues)
     {
-      self->mError = CTM_OUT_OF_MEMORY;
-      return CTM_FALSE;
+      (*mapListPtr)->mValues = (CTMfloat *) _ctmGetOutputArray(self,
+        i < 8 ? aFirstSlot + i : _CTM_OUT_COUNT, self->mVertexCount,
+        aChannels, &(*mapListPtr)->mStride, &(*mapListPtr)->mExternal);
+      if(!(*mapListPtr)->mValues)
+        return CTM_FALSE;
+      if(!(*mapListPtr)->mExternal)
+        memset((*mapListPtr)->mValues, 0, aChannels * sizeof(CTMfloat) * self->mVertexCount);
     }
-    memset((*mapListPtr)->mValues, 0, size);
 
     // Next map...
     mapListPtr = &(*mapListPtr)->mNext;
@@ -1170,25 +1775,45 @@ static CTMuint _ctmAllocateFloatMaps(_CTMcontext * self,
 }
 
 //-----------------------------------------------------------------------------
-// ctmLoadCustom()
+// _ctmUncompressStream() - Uncompress the file body, according to the
+// compression method of the file.
 //-----------------------------------------------------------------------------
-CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
-  void * aUserData)
+static void _ctmUncompressStream(_CTMcontext * self)
 {
-  _CTMcontext * self = (_CTMcontext *) aContext;
-  CTMuint formatVersion, flags, method;
-  if(!self) return;
-
-  // You are only allowed to load data in import mode
-  if(self->mMode != CTM_IMPORT)
+  switch(self->mMethod)
   {
-    self->mError = CTM_INVALID_OPERATION;
-    return;
+    case CTM_METHOD_RAW:
+      _ctmUncompressMesh_RAW(self);
+      break;
+
+    case CTM_METHOD_MG1:
+      _ctmUncompressMesh_MG1(self);
+      break;
+
+    case CTM_METHOD_MG2:
+    case CTM_METHOD_MG3:
+      _ctmUncompressMesh_MG2(self);
+      break;
+
+    case CTM_METHOD_MG4:
+      _ctmUncompressMesh_MG4(self);
+      break;
+
+    default:
+      self->mError = CTM_INTERNAL_ERROR;
   }
 
-  // Initialize stream
-  self->mReadFn = aReadFn;
-  self->mUserData = aUserData;
+  // Keep the scratch memory for the next load
+  _ctmScratchReset(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmLoadStream() - Load a mesh from the (already initialized) input stream.
+//-----------------------------------------------------------------------------
+static void _ctmLoadStream(_CTMcontext * self)
+{
+  CTMuint formatVersion, flags, method, stride;
+  int external;
 
   // Clear any old mesh arrays
   _ctmClearMesh(self);
@@ -1212,11 +1837,17 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
     self->mMethod = CTM_METHOD_MG1;
   else if(method == FOURCC("MG2\0"))
     self->mMethod = CTM_METHOD_MG2;
+  else if(method == FOURCC("MG3\0"))
+    self->mMethod = CTM_METHOD_MG3;
+  else if(method == FOURCC("MG4\0"))
+    self->mMethod = CTM_METHOD_MG4;
   else
   {
     self->mError = CTM_BAD_FORMAT;
     return;
   }
+  self->mBackend = CTM_BACKEND_LZMA;
+  self->mNormalMode = CTM_NORMALS_SPHERICAL;
   self->mVertexCount = _ctmStreamReadUINT(self);
   if(self->mVertexCount == 0)
   {
@@ -1234,70 +1865,280 @@ CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   flags = _ctmStreamReadUINT(self);
   _ctmStreamReadSTRING(self, &self->mFileComment);
 
-  // Allocate memory for the mesh arrays
-  self->mVertices = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
+  // Header only? Then only the map information is read from the body, and
+  // all the mesh data is skipped
+  if(self->mHeaderOnly)
+  {
+    if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2, CTM_FALSE, _CTM_OUT_UV_MAP_1) ||
+       !_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4, CTM_FALSE, _CTM_OUT_ATTRIB_MAP_1))
+    {
+      _ctmClearMesh(self);
+      return;
+    }
+    self->mFileFlags = flags;
+    _ctmUncompressStream(self);
+    return;
+  }
+
+  // Allocate memory for the mesh arrays (or use the caller provided output
+  // buffers)
+  self->mVertices = (CTMfloat *) _ctmGetOutputArray(self, _CTM_OUT_VERTICES,
+    self->mVertexCount, 3, &self->mVertexStride, &external);
   if(!self->mVertices)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
+    _ctmClearMesh(self);
     return;
   }
-  self->mIndices = (CTMuint *) malloc(self->mTriangleCount * sizeof(CTMuint) * 3);
+  if(external)
+    self->mExternalArrays |= 1 << _CTM_OUT_VERTICES;
+  self->mIndices = (CTMuint *) _ctmGetOutputArray(self, _CTM_OUT_INDICES,
+    self->mTriangleCount, 3, &stride, &external);
   if(!self->mIndices)
   {
     _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
     return;
   }
-  if(flags & _CTM_HAS_NORMALS_BIT)
+  if(external)
+    self->mExternalArrays |= 1 << _CTM_OUT_INDICES;
+  if((flags & _CTM_HAS_NORMALS_BIT) && !(self->mLoadFilter & CTM_SKIP_NORMALS))
   {
-    self->mNormals = (CTMfloat *) malloc(self->mVertexCount * sizeof(CTMfloat) * 3);
+    self->mNormals = (CTMfloat *) _ctmGetOutputArray(self, _CTM_OUT_NORMALS,
+      self->mVertexCount, 3, &self->mNormalStride, &external);
     if(!self->mNormals)
     {
       _ctmClearMesh(self);
-      self->mError = CTM_OUT_OF_MEMORY;
       return;
     }
+    if(external)
+      self->mExternalArrays |= 1 << _CTM_OUT_NORMALS;
   }
 
   // Allocate memory for the UV and attribute maps (if any)
-  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2))
+  if(!_ctmAllocateFloatMaps(self, &self->mUVMaps, self->mUVMapCount, 2,
+                            !(self->mLoadFilter & CTM_SKIP_UV_MAPS),
+                            _CTM_OUT_UV_MAP_1))
   {
     _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
     return;
   }
-  if(!_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4))
+  if(!_ctmAllocateFloatMaps(self, &self->mAttribMaps, self->mAttribMapCount, 4,
+                            !(self->mLoadFilter & CTM_SKIP_ATTRIBS),
+                            _CTM_OUT_ATTRIB_MAP_1))
   {
     _ctmClearMesh(self);
-    self->mError = CTM_OUT_OF_MEMORY;
     return;
   }
 
+  self->mFileFlags = flags;
+
   // Uncompress from stream
-  switch(self->mMethod)
+  _ctmUncompressStream(self);
+
+  // Check mesh integrity
+  if(!_ctmCheckMeshIntegrity(self))
   {
-    case CTM_METHOD_RAW:
-      _ctmUncompressMesh_RAW(self);
-      break;
+    self->mError = CTM_INVALID_MESH;
+    return;
+  }
+}
 
-    case CTM_METHOD_MG1:
-      _ctmUncompressMesh_MG1(self);
-      break;
+//-----------------------------------------------------------------------------
+// ctmLoadCustom()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
+  void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
 
-    case CTM_METHOD_MG2:
-      _ctmUncompressMesh_MG2(self);
-      break;
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
 
-    default:
-      self->mError = CTM_INTERNAL_ERROR;
+  // Initialize stream (the skip function, if any, is set up by ctmLoad())
+  self->mReadFn = aReadFn;
+  self->mUserData = aUserData;
+  self->mInBuf = (const unsigned char *) 0;
+
+  // Load the mesh
+  _ctmLoadStream(self);
+
+  // The skip function is only valid for this stream
+  self->mSkipFn = (_CTMskipfn) 0;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadCallback()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadCallback(CTMcontext aContext,
+  CTMsectionfn aSectionFn, void * aUserData)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change loading attributes in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
   }
 
-  // Check mesh integrity
-  if(!_ctmCheckMeshIntegrity(self))
+  // Set the section loaded callback
+  self->mSectionFn = aSectionFn;
+  self->mSectionUserData = aUserData;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadHeader()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext, CTMuint aHeaderOnly)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change loading attributes in import mode
+  if(self->mMode != CTM_IMPORT)
   {
-    self->mError = CTM_INVALID_MESH;
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Set the header only mode
+  self->mHeaderOnly = aHeaderOnly ? CTM_TRUE : CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadFilter()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadFilter(CTMcontext aContext, CTMuint aSkipMask)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to change loading attributes in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Check arguments
+  if(aSkipMask & ~(CTM_SKIP_NORMALS | CTM_SKIP_UV_MAPS | CTM_SKIP_ATTRIBS))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Set the load filter
+  self->mLoadFilter = aSkipMask;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadBuffer()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadBuffer(CTMcontext aContext, CTMenum aArray,
+  void * aBuffer, size_t aBufferSize, CTMuint aStride)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMoutbuffer * out;
+  CTMuint slot, size;
+  if(!self) return;
+
+  // You are only allowed to change loading attributes in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Which array (output buffer slot), and what size are its elements?
+  if(!_ctmArraySlot(aArray, &slot, &size))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return;
+  }
+
+  // Check the stride (in bytes, zero means tightly packed elements). The
+  // triangle indices must always be tightly packed.
+  if(aStride == 0)
+    aStride = size * 4;
+  if((aStride < size * 4) || (aStride % 4) ||
+     ((slot == _CTM_OUT_INDICES) && (aStride != size * 4)))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
     return;
   }
+
+  // Set (or clear) the output buffer
+  out = &self->mOutBuffers[slot];
+  out->mBuffer = aBuffer;
+  out->mSize = aBuffer ? aBufferSize : 0;
+  out->mStride = aStride / 4;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadFromMemory()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aBuffer, size_t aBufferSize)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Initialize stream (packed data is decoded straight from the buffer)
+  self->mReadFn = (CTMreadfn) 0;
+  self->mUserData = (void *) 0;
+  self->mInBuf = (const unsigned char *) aBuffer;
+  self->mInBufSize = aBuffer ? aBufferSize : 0;
+  self->mInBufPos = 0;
+
+  // Load the mesh
+  _ctmLoadStream(self);
+
+  // The buffer is owned by the caller, so forget about it
+  self->mInBuf = (const unsigned char *) 0;
+  self->mInBufSize = self->mInBufPos = 0;
+}
+
+//-----------------------------------------------------------------------------
+// ctmLoadMapped()
+//-----------------------------------------------------------------------------
+CTMEXPORT void CTMCALL ctmLoadMapped(CTMcontext aContext, const char * aFileName)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  _CTMmappedfile map;
+  if(!self) return;
+
+  // You are only allowed to load data in import mode
+  if(self->mMode != CTM_IMPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return;
+  }
+
+  // Map the file into memory (fall back to regular file I/O if the platform
+  // or the file does not support memory mapping)
+  if(!_ctmMapFile(aFileName, &map))
+  {
+    ctmLoad(self, aFileName);
+    return;
+  }
+
+  // Load the mesh from the mapped memory
+  ctmLoadFromMemory(self, (const void *) map.mData, map.mSize);
+
+  // Unmap the file
+  _ctmUnmapFile(&map);
 }
 
 //-----------------------------------------------------------------------------
@@ -1309,6 +2150,15 @@ static CTMuint CTMCALL _ctmDefaultWrite(const void * aBuf, CTMuint aCount,
   return (CTMuint) fwrite(aBuf, 1, (size_t) aCount, (FILE *) aUserData);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmDefaultSeek()
+//-----------------------------------------------------------------------------
+static int _ctmDefaultSeek(long aOffset, void * aUserData)
+{
+  return fseek((FILE *) aUserData, aOffset, SEEK_CUR) == 0 ?
+         CTM_TRUE : CTM_FALSE;
+}
+
 //-----------------------------------------------------------------------------
 // ctmSave()
 //-----------------------------------------------------------------------------
@@ -1333,8 +2183,11 @@ CTMEXPORT void CTMCALL ctmSave(CTMcontext aContext, const char * aFileName)
     return;
   }
 
-  // Save the file
+  // Save the file (file streams are seekable, and the seek function is only
+  // valid for this stream)
+  self->mSeekFn = _ctmDefaultSeek;
   ctmSaveCustom(self, _ctmDefaultWrite, (void *) f);
+  self->mSeekFn = (_CTMseekfn) 0;
 
   // Close file stream
   fclose(f);
@@ -1435,6 +2288,10 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   // Initialize stream
   self->mWriteFn = aWriteFn;
   self->mUserData = aUserData;
+  self->mWritePos = 0;
+  memset(self->mSectionSizes, 0, sizeof(self->mSectionSizes));
+  self->mSavedMaxError = 0.0f;
+  self->mSavedRMSError = 0.0f;
 
   // Determine flags
   flags = 0;
@@ -1458,6 +2315,14 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
       _ctmStreamWrite(self, (void *) "MG2\0", 4);
       break;
 
+    case CTM_METHOD_MG3:
+      _ctmStreamWrite(self, (void *) "MG3\0", 4);
+      break;
+
+    case CTM_METHOD_MG4:
+      _ctmStreamWrite(self, (void *) "MG4\0", 4);
+      break;
+
     default:
       self->mError = CTM_INTERNAL_ERROR;
       return;
@@ -1481,11 +2346,129 @@ void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
       break;
 
     case CTM_METHOD_MG2:
+    case CTM_METHOD_MG3:
       _ctmCompressMesh_MG2(self);
       break;
 
+    case CTM_METHOD_MG4:
+      _ctmCompressMesh_MG4(self);
+      break;
+
     default:
       self->mError = CTM_INTERNAL_ERROR;
-      return;
   }
+
+  // Keep the scratch memory for the next save
+  _ctmScratchReset(self);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCountWrite() - Stream write function for size estimation. The data is
+// discarded (the stream position is counted by _ctmStreamWrite()).
+//-----------------------------------------------------------------------------
+static CTMuint CTMCALL _ctmCountWrite(const void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  (void) aBuf;
+  (void) aUserData;
+  return aCount;
+}
+
+//-----------------------------------------------------------------------------
+// ctmEstimateSize()
+//-----------------------------------------------------------------------------
+CTMEXPORT size_t CTMCALL ctmEstimateSize(CTMcontext aContext, CTMenum aMode)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMenum lastError;
+  if(!self) return 0;
+
+  // You are only allowed to save data in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return 0;
+  }
+
+  // Check mode
+  if((aMode != CTM_ESTIMATE_EXACT) && (aMode != CTM_ESTIMATE_FAST) &&
+     (aMode != CTM_ESTIMATE_SAMPLED))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return 0;
+  }
+
+  // Save to a counting stream (keep any earlier error code, so that we can
+  // tell if the save failed)
+  lastError = self->mError;
+  self->mError = CTM_NONE;
+  self->mEstimate = aMode;
+  ctmSaveCustom(self, _ctmCountWrite, (void *) self);
+  self->mEstimate = CTM_NONE;
+  if(self->mError != CTM_NONE)
+    return 0;
+  self->mError = lastError;
+
+  return self->mWritePos;
+}
+
+//-----------------------------------------------------------------------------
+// ctmGetSectionSize()
+//-----------------------------------------------------------------------------
+CTMEXPORT size_t CTMCALL ctmGetSectionSize(CTMcontext aContext,
+  CTMenum aArray)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  CTMuint slot, size;
+  if(!self) return 0;
+
+  // Array sizes are only known in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return 0;
+  }
+
+  if(!_ctmArraySlot(aArray, &slot, &size))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return 0;
+  }
+
+  return self->mSectionSizes[slot];
+}
+
+//-----------------------------------------------------------------------------
+// ctmOptimize()
+//-----------------------------------------------------------------------------
+CTMEXPORT size_t CTMCALL ctmOptimize(CTMcontext aContext, CTMenum aTarget,
+  CTMenum aErrorMetric, CTMfloat aMaxError)
+{
+  _CTMcontext * self = (_CTMcontext *) aContext;
+  if(!self) return 0;
+
+  // You are only allowed to save data in export mode
+  if(self->mMode != CTM_EXPORT)
+  {
+    self->mError = CTM_INVALID_OPERATION;
+    return 0;
+  }
+
+  // Check arguments
+  if(((aTarget != CTM_OPTIMIZE_SIZE) && (aTarget != CTM_OPTIMIZE_DECODE)) ||
+     ((aErrorMetric != CTM_ERROR_MAX) && (aErrorMetric != CTM_ERROR_RMS)) ||
+     !(aMaxError >= 0.0f))
+  {
+    self->mError = CTM_INVALID_ARGUMENT;
+    return 0;
+  }
+
+  // Is there a mesh?
+  if(!self->mVertices || !self->mIndices)
+  {
+    self->mError = CTM_INVALID_MESH;
+    return 0;
+  }
+
+  return _ctmOptimize(self, aTarget, aErrorMetric, aMaxError);
 }
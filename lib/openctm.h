@@ -174,6 +174,15 @@ extern "C" {
 /// Boolean FALSE.
 #define CTM_FALSE 0
 
+/// Load filter flag: do not load normals (see ctmLoadFilter()).
+#define CTM_SKIP_NORMALS 0x0001
+
+/// Load filter flag: do not load UV maps (see ctmLoadFilter()).
+#define CTM_SKIP_UV_MAPS 0x0002
+
+/// Load filter flag: do not load attribute maps (see ctmLoadFilter()).
+#define CTM_SKIP_ATTRIBS 0x0004
+
 /// Single precision floating point type (IEEE 754 32 bits wide).
 typedef float CTMfloat;
 
@@ -203,9 +212,10 @@ typedef enum {
   CTM_OUT_OF_MEMORY     = 0x0005, ///< Not enough memory to proceed.
   CTM_FILE_ERROR        = 0x0006, ///< File I/O error.
   CTM_BAD_FORMAT        = 0x0007, ///< File format error (e.g. unrecognized format or corrupted file).
-  CTM_LZMA_ERROR        = 0x0008, ///< An error occured within the LZMA library.
+  CTM_LZMA_ERROR        = 0x0008, ///< An error occured within the LZMA library (or another entropy backend).
   CTM_INTERNAL_ERROR    = 0x0009, ///< An internal error occured (indicates a bug).
   CTM_UNSUPPORTED_FORMAT_VERSION = 0x000A, ///< Unsupported file format version.
+  CTM_UNSUPPORTED_BACKEND = 0x000B, ///< The file uses an entropy backend that is not supported by this build.
 
   // OpenCTM context modes
   CTM_IMPORT            = 0x0101, ///< The OpenCTM context will be used for importing data.
@@ -215,6 +225,8 @@ typedef enum {
   CTM_METHOD_RAW        = 0x0201, ///< Just store the raw data.
   CTM_METHOD_MG1        = 0x0202, ///< Lossless compression (floating point).
   CTM_METHOD_MG2        = 0x0203, ///< Lossless compression (fixed point).
+  CTM_METHOD_MG3        = 0x0204, ///< Same as MG2, but with blocked arrays (for parallel coding of large meshes).
+  CTM_METHOD_MG4        = 0x0205, ///< Fixed point compression, with the triangles coded by mesh traversal.
 
   // Context queries
   CTM_VERTEX_COUNT      = 0x0301, ///< Number of vertices in the mesh (integer).
@@ -222,10 +234,14 @@ typedef enum {
   CTM_HAS_NORMALS       = 0x0303, ///< CTM_TRUE if the mesh has normals (integer).
   CTM_UV_MAP_COUNT      = 0x0304, ///< Number of UV coordinate sets (integer).
   CTM_ATTRIB_MAP_COUNT  = 0x0305, ///< Number of custom attribute sets (integer).
-  CTM_VERTEX_PRECISION  = 0x0306, ///< Vertex precision - for MG2 (float).
-  CTM_NORMAL_PRECISION  = 0x0307, ///< Normal precision - for MG2 (float).
+  CTM_VERTEX_PRECISION  = 0x0306, ///< Vertex precision - for MG2/MG3/MG4 (float).
+  CTM_NORMAL_PRECISION  = 0x0307, ///< Normal precision - for MG2/MG3/MG4 (float).
   CTM_COMPRESSION_METHOD = 0x0308, ///< Compression method (integer).
   CTM_FILE_COMMENT      = 0x0309, ///< File comment (string).
+  CTM_COMPRESSION_BACKEND = 0x030A, ///< Entropy backend for packed data (integer).
+  CTM_COMPRESSION_LEVEL = 0x030B, ///< Compression level (integer).
+  CTM_VERTEX_ERROR      = 0x030C, ///< Vertex error of the settings chosen by ctmOptimize() (float).
+  CTM_NORMAL_MODE       = 0x030D, ///< Normal coding mode - for MG2/MG3/MG4 (integer).
 
   // UV/attribute map queries
   CTM_NAME              = 0x0501, ///< Unique name (UV/attrib map string).
@@ -251,7 +267,30 @@ typedef enum {
   CTM_ATTRIB_MAP_5      = 0x0804, ///< Per vertex attribute map 5 (float array).
   CTM_ATTRIB_MAP_6      = 0x0805, ///< Per vertex attribute map 6 (float array).
   CTM_ATTRIB_MAP_7      = 0x0806, ///< Per vertex attribute map 7 (float array).
-  CTM_ATTRIB_MAP_8      = 0x0807  ///< Per vertex attribute map 8 (float array).
+  CTM_ATTRIB_MAP_8      = 0x0807, ///< Per vertex attribute map 8 (float array).
+
+  // Entropy backends (see ctmCompressionBackend())
+  CTM_BACKEND_LZMA      = 0x0901, ///< LZMA (the default, best compression).
+  CTM_BACKEND_STORED    = 0x0902, ///< No entropy coding (fastest decoding, largest files).
+  CTM_BACKEND_ZSTD      = 0x0903, ///< Zstandard (fast decoding, needs a build with zstd support).
+  CTM_BACKEND_LZ4       = 0x0904, ///< LZ4 (very fast decoding, needs a build with LZ4 support).
+
+  // Size estimation modes (see ctmEstimateSize())
+  CTM_ESTIMATE_EXACT    = 0x0A01, ///< Compress everything as when saving (exact size).
+  CTM_ESTIMATE_FAST     = 0x0A02, ///< Compress everything with the fastest coder of the backend.
+  CTM_ESTIMATE_SAMPLED  = 0x0A03, ///< Compress a sample of each large array and extrapolate.
+
+  // Optimization targets (see ctmOptimize())
+  CTM_OPTIMIZE_SIZE     = 0x0B01, ///< Smallest file.
+  CTM_OPTIMIZE_DECODE   = 0x0B02, ///< Fastest decoding.
+
+  // Vertex error metrics (see ctmOptimize())
+  CTM_ERROR_MAX         = 0x0C01, ///< Largest vertex displacement (bounds the Hausdorff distance).
+  CTM_ERROR_RMS         = 0x0C02, ///< Root mean square of the vertex displacements.
+
+  // Normal coding modes (see ctmNormalMode())
+  CTM_NORMALS_SPHERICAL = 0x0D01, ///< Angles relative to the smooth normal of the mesh (the default).
+  CTM_NORMALS_OCTAHEDRAL = 0x0D02 ///< Octahedral coordinates, delta coded (faster decoding).
 } CTMenum;
 
 /// Stream read() function pointer.
@@ -273,6 +312,33 @@ typedef CTMuint (CTMCALL * CTMreadfn)(void * aBuf, CTMuint aCount, void * aUserD
 ///         indicates that an error occured).
 typedef CTMuint (CTMCALL * CTMwritefn)(const void * aBuf, CTMuint aCount, void * aUserData);
 
+/// Section loaded function pointer (progressive loading).
+/// @param[in] aSection Which mesh array has been loaded: CTM_INDICES,
+///            CTM_VERTICES, CTM_NORMALS, CTM_UV_MAP_n or CTM_ATTRIB_MAP_n.
+/// @param[in] aData Pointer to the loaded array (a CTMuint array for
+///            CTM_INDICES, otherwise a CTMfloat array). This is the same
+///            array as returned by ctmGetIntegerArray() or ctmGetFloatArray().
+/// @param[in] aCount The number of elements in the array (the number of
+///            triangles for CTM_INDICES, otherwise the number of vertices).
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmLoadCallback() function.
+typedef void (CTMCALL * CTMsectionfn)(CTMenum aSection, const void * aData, CTMuint aCount, void * aUserData);
+
+/// Memory allocation function pointer (see ctmSetAllocator()).
+/// @param[in] aSize The number of bytes to allocate.
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmSetAllocator() function.
+/// @return A pointer to the allocated memory (suitably aligned for any type),
+///         or NULL if the memory could not be allocated.
+typedef void * (CTMCALL * CTMallocfn)(size_t aSize, void * aUserData);
+
+/// Memory free function pointer (see ctmSetAllocator()).
+/// @param[in] aPtr Pointer to memory that was allocated by the corresponding
+///            CTMallocfn function (never NULL).
+/// @param[in] aUserData The custom user data that was passed to the
+///            ctmSetAllocator() function.
+typedef void (CTMCALL * CTMfreefn)(void * aPtr, void * aUserData);
+
 /// Create a new OpenCTM context. The context is used for all subsequent
 /// OpenCTM function calls. Several contexts can coexist at the same time.
 /// @param[in] aMode An OpenCTM context mode. Set this to CTM_IMPORT if the
@@ -284,9 +350,37 @@ CTMEXPORT CTMcontext CTMCALL ctmNewContext(CTMenum aMode);
 /// Free an OpenCTM context.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
+/// @note A context keeps the temporary work memory that is needed for saving
+///       and loading meshes between calls, so that saving or loading many
+///       meshes with the same context does not have to allocate it again.
+///       This memory is released when the context is freed.
 /// @see ctmNewContext()
 CTMEXPORT void CTMCALL ctmFreeContext(CTMcontext aContext);
 
+/// Set the memory allocation functions of a context. All memory that OpenCTM
+/// allocates on behalf of the context (mesh arrays, map information, strings,
+/// temporary buffers and the LZMA coder state) is then allocated and freed
+/// through these functions instead of malloc() and free().
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aAllocFn The allocation function, or NULL to use malloc().
+/// @param[in] aFreeFn The free function, or NULL to use free(). Either both or
+///            none of aAllocFn and aFreeFn must be NULL.
+/// @param[in] aUserData A custom pointer that is passed on to the functions.
+/// @note The allocator can only be changed while the context holds no
+///       allocated memory, i.e. before any mesh is loaded or defined, and
+///       before a file comment is set. Otherwise the function fails with
+///       CTM_INVALID_OPERATION.
+/// @note With threaded encoding or decoding (see ctmEncodeThreads() and
+///       ctmDecodeThreads()), the functions are called from several threads
+///       at once, so they must be thread safe.
+/// @note The context itself, the buffer that is returned by
+///       ctmSaveToBuffer() (which is released with ctmFreeBuffer()) and the
+///       coder state of the zstd backend (see ctmCompressionBackend()) are
+///       not allocated through these functions.
+CTMEXPORT void CTMCALL ctmSetAllocator(CTMcontext aContext,
+  CTMallocfn aAllocFn, CTMfreefn aFreeFn, void * aUserData);
+
 /// Returns the latest error. Calling this function will return the last
 /// produced error code, or CTM_NO_ERROR (zero) if no error has occured since
 /// the last call to ctmGetError(). When this function is called, the internal
@@ -456,9 +550,14 @@ CTMEXPORT const char * CTMCALL ctmGetString(CTMcontext aContext,
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aMethod Which compression method to use: CTM_METHOD_RAW,
-///            CTM_METHOD_MG1 or CTM_METHOD_MG2 (the default method is
-///            CTM_METHOD_MG1).
-/// @see CTM_METHOD_RAW, CTM_METHOD_MG1, CTM_METHOD_MG2
+///            CTM_METHOD_MG1, CTM_METHOD_MG2, CTM_METHOD_MG3 or CTM_METHOD_MG4
+///            (the default method is CTM_METHOD_MG1).
+/// @note CTM_METHOD_MG4 uses the same vertex, normal and map precisions as
+///       CTM_METHOD_MG2, but codes the triangles by traversing the mesh
+///       (which usually gives a much smaller index array for manifold
+///       meshes), and stores the vertices in the traversal order.
+/// @see CTM_METHOD_RAW, CTM_METHOD_MG1, CTM_METHOD_MG2, CTM_METHOD_MG3,
+///      CTM_METHOD_MG4
 CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
   CTMenum aMethod);
 
@@ -469,11 +568,66 @@ CTMEXPORT void CTMCALL ctmCompressionMethod(CTMcontext aContext,
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aLevel Which compression level to use (0 to 9).
+/// @note At levels 7 to 9, the MG2 and MG3 methods also search for the vertex
+///       grid resolution that gives the smallest file, which makes saving
+///       slower. Lower levels use the default grid resolution.
 CTMEXPORT void CTMCALL ctmCompressionLevel(CTMcontext aContext,
   CTMuint aLevel);
 
-/// Set the vertex coordinate precision (only used by the MG2 compression
-/// method).
+/// Set which entropy backend to use for the packed (compressed) arrays of the
+/// MG1, MG2, MG3 and MG4 compression methods. LZMA gives the smallest files,
+/// while the other backends trade file size for (much) faster decoding. The
+/// backend is stored with each packed array, so files are always decoded with
+/// the right backend, but files that use other backends than LZMA can not be
+/// read by older versions of OpenCTM. The compression level (see
+/// ctmCompressionLevel()) is mapped to the level range of the selected backend.
+/// The default backend is CTM_BACKEND_LZMA. When loading a file, the backend
+/// of the file can be queried with ctmGetInteger(CTM_COMPRESSION_BACKEND).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aBackend Which backend to use: CTM_BACKEND_LZMA,
+///            CTM_BACKEND_STORED, CTM_BACKEND_ZSTD or CTM_BACKEND_LZ4 (the
+///            last two are only available if OpenCTM was built with zstd and
+///            LZ4 support, respectively, otherwise CTM_INVALID_ARGUMENT is
+///            reported).
+/// @see CTM_BACKEND_LZMA, CTM_BACKEND_STORED, CTM_BACKEND_ZSTD, CTM_BACKEND_LZ4
+CTMEXPORT void CTMCALL ctmCompressionBackend(CTMcontext aContext,
+  CTMenum aBackend);
+
+/// Set the LZMA tuning parameters for a class of arrays (only used by the MG1,
+/// MG2, MG3 and MG4 compression methods with the LZMA backend). Normally the
+/// parameters are given by the compression level (see ctmCompressionLevel()),
+/// and the dictionary is sized automatically, but they can be tuned for
+/// special kinds of data. All values must be set at once, and -1 selects the
+/// default for the compression level.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aArray Which arrays to tune: CTM_INDICES, CTM_VERTICES,
+///            CTM_NORMALS, CTM_UV_MAP_1 (any UV map enum selects all UV maps),
+///            CTM_ATTRIB_MAP_1 (any attribute map enum selects all attribute
+///            maps), or CTM_NONE for all arrays. For MG2/MG3, the vertex grid
+///            indices are tuned with the vertices.
+/// @param[in] aDictSize Dictionary size in bytes (4096 to 2^27), 0 for
+///            automatic sizing (the default: the dictionary is no larger than
+///            the packed array, which saves encoder memory for small meshes
+///            at high compression levels, but no larger than the default size
+///            for the level either), or -1 for the default size for the level
+///            (up to 64 MB at level 9).
+/// @param[in] aLiteralContextBits Number of literal context bits, lc (0 to 8).
+/// @param[in] aLiteralPosBits Number of literal position bits, lp (0 to 4).
+/// @param[in] aPosBits Number of position bits, pb (0 to 4).
+/// @param[in] aFastBytes Number of fast bytes, fb (5 to 273). Higher values
+///            give slightly better compression but slower encoding.
+/// @note The packed arrays are split into byte planes before they are packed,
+///       so settings for word aligned data (e.g. lp = 2) do not help. For
+///       typical meshes the defaults are within one percent of the best
+///       settings, while fb = 64 can give a small gain at low levels.
+CTMEXPORT void CTMCALL ctmCompressionParams(CTMcontext aContext,
+  CTMenum aArray, CTMint aDictSize, CTMint aLiteralContextBits,
+  CTMint aLiteralPosBits, CTMint aPosBits, CTMint aFastBytes);
+
+/// Set the vertex coordinate precision (only used by the MG2, MG3 and MG4
+/// compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aPrecision Fixed point precision. For instance, if this value is
@@ -483,7 +637,7 @@ CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
   CTMfloat aPrecision);
 
 /// Set the vertex coordinate precision, relative to the mesh dimensions (only
-/// used by the MG2 compression method).
+/// used by the MG2, MG3 and MG4 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aRelPrecision Relative precision. This factor is multiplied by the
@@ -497,22 +651,48 @@ CTMEXPORT void CTMCALL ctmVertexPrecision(CTMcontext aContext,
 CTMEXPORT void CTMCALL ctmVertexPrecisionRel(CTMcontext aContext,
   CTMfloat aRelPrecision);
 
-/// Set the normal precision (only used by the MG2 compression method). The
-/// normal is represented in spherical coordinates in the MG2 compression
-/// method, and the normal precision controls the angular and radial resolution.
+/// Set the normal precision (only used by the MG2, MG3 and MG4 compression
+/// methods). What the precision controls depends on the normal coding mode
+/// (see ctmNormalMode()). With CTM_NORMALS_SPHERICAL, the normal is
+/// represented in spherical coordinates, and the normal precision controls
+/// the angular and radial resolution. With CTM_NORMALS_OCTAHEDRAL, the
+/// normal direction is represented in octahedral coordinates (a square from
+/// -1 to 1 on each axis), and the normal precision is the grid step of these
+/// coordinates, and the linear resolution of the normal magnitude.
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
-/// @param[in] aPrecision Fixed point precision. For the angular information,
-///            this value represents the angular precision. For the radial
-///            information, this value is the linear resolution. For instance,
-///            0.01 means that the circle is divided into 100 steps, and the
-///            normal magnitude is rounded to 2 decimals. The default normal
-///            precision is 2^-8 ~= 0.0039.
+/// @param[in] aPrecision Fixed point precision. For spherical normals, this
+///            value represents the angular precision of the direction, and
+///            the linear resolution of the magnitude. For instance, 0.01
+///            means that the circle is divided into 100 steps, and the
+///            normal magnitude is rounded to 2 decimals. For octahedral
+///            normals, 0.01 means that the octahedral square is divided into
+///            200 x 200 steps. The default normal precision is
+///            2^-8 ~= 0.0039.
 CTMEXPORT void CTMCALL ctmNormalPrecision(CTMcontext aContext,
   CTMfloat aPrecision);
 
+/// Set how normals are coded (only used by the MG2, MG3 and MG4 compression
+/// methods). CTM_NORMALS_SPHERICAL stores each normal as angles relative to
+/// a smooth normal that is calculated from the mesh, which gives the smallest
+/// files for smooth meshes. CTM_NORMALS_OCTAHEDRAL stores each normal as
+/// octahedral coordinates (a square grid with a step of the normal precision,
+/// see ctmNormalPrecision()) that are delta coded in the order of the sorted
+/// vertices. The octahedral normals can be decoded without the vertices and
+/// triangles of the mesh, which makes loading faster, but files are usually
+/// somewhat larger. Octahedral normals can not be read by older versions of
+/// OpenCTM. When loading a file, the mode of the file can be queried with
+/// ctmGetInteger(CTM_NORMAL_MODE).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aMode Which normal coding mode to use: CTM_NORMALS_SPHERICAL
+///            or CTM_NORMALS_OCTAHEDRAL (the default mode is
+///            CTM_NORMALS_SPHERICAL).
+/// @see CTM_NORMALS_SPHERICAL, CTM_NORMALS_OCTAHEDRAL
+CTMEXPORT void CTMCALL ctmNormalMode(CTMcontext aContext, CTMenum aMode);
+
 /// Set the coordinate precision for the specified UV map (only used by the
-/// MG2 compression method).
+/// MG2, MG3 and MG4 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aUVMap A UV map specifier for a defined UV map
@@ -525,7 +705,7 @@ CTMEXPORT void CTMCALL ctmUVCoordPrecision(CTMcontext aContext,
   CTMenum aUVMap, CTMfloat aPrecision);
 
 /// Set the attribute value precision for the specified attribute map (only
-/// used by the MG2 compression method).
+/// used by the MG2, MG3 and MG4 compression methods).
 /// @param[in] aContext An OpenCTM context that has been created by
 ///            ctmNewContext().
 /// @param[in] aAttribMap An attribute map specifier for a defined attribute map
@@ -623,6 +803,148 @@ CTMEXPORT void CTMCALL ctmLoad(CTMcontext aContext, const char * aFileName);
 CTMEXPORT void CTMCALL ctmLoadCustom(CTMcontext aContext, CTMreadfn aReadFn,
   void * aUserData);
 
+/// Set the maximum number of threads to use when saving a file. The packed
+/// data sections of MG1, MG2, MG3 and MG4 files (vertices, indices, normals,
+/// maps etc) are independent, and are compressed in parallel when more than one
+/// thread is allowed. In MG3 files, each block of a section is compressed
+/// independently. When there are at least twice as many threads as sections
+/// being compressed at once, each LZMA encoder also runs its match finder in
+/// a thread of its own (if the library was built with COMPRESS_MF_MT, which is
+/// the default for the CMake build on non-Windows systems, see WITH_LZMA_MT).
+/// The output is identical to the single threaded output, but all sections
+/// are held in memory until they have been written. The default is one
+/// thread (no threading).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreadCount Max number of threads (including the calling
+///            thread), or zero for one thread per processor.
+/// @note This function is only valid in export mode.
+CTMEXPORT void CTMCALL ctmEncodeThreads(CTMcontext aContext,
+  CTMuint aThreadCount);
+
+/// Set the maximum number of threads to use when loading a file. The packed
+/// data sections of MG1, MG2, MG3 and MG4 files (vertices, indices, normals,
+/// maps etc) are independent, and are decompressed in parallel when more than
+/// one thread is allowed. In MG3 files, each block of a section is
+/// decompressed independently. The default is one thread (no threading).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aThreadCount Max number of threads (including the calling
+///            thread), or zero for one thread per processor.
+/// @note This function is only valid in import mode.
+CTMEXPORT void CTMCALL ctmDecodeThreads(CTMcontext aContext,
+  CTMuint aThreadCount);
+
+/// Load an OpenCTM format file from a memory buffer. The compressed mesh data
+/// is decoded directly from the buffer (no intermediate copies are made). The
+/// mesh data can be retrieved with the various ctmGet functions.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aBuffer Pointer to the memory buffer that holds the file data.
+///            The buffer is only accessed during the call, and is not freed.
+/// @param[in] aBufferSize The size of the buffer, in bytes.
+CTMEXPORT void CTMCALL ctmLoadFromMemory(CTMcontext aContext,
+  const void * aBuffer, size_t aBufferSize);
+
+/// Load an OpenCTM format file into the context by mapping the file into
+/// memory. This is usually faster than ctmLoad() for large files, since the
+/// compressed data is decoded directly from the file mapping. If the file can
+/// not be mapped, the function falls back to ordinary file I/O (ctmLoad()).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aFileName The name of the file to be loaded.
+/// @see ctmLoadFromMemory().
+CTMEXPORT void CTMCALL ctmLoadMapped(CTMcontext aContext, const char * aFileName);
+
+/// Set a function that is called for each mesh array (indices, vertices,
+/// normals, UV maps and attribute maps) as soon as it has been loaded, while
+/// the rest of the file is still being read and decoded. This makes it
+/// possible to start processing the mesh (e.g. uploading it to the GPU)
+/// before the load function returns. The arrays are reported in file order,
+/// and each reported array has passed the same validity checks as a
+/// completely loaded mesh. The arrays are owned by the context, and are only
+/// valid until the next load or until the context is freed. If the load
+/// fails, all reported data must be discarded.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aSectionFn Pointer to a section loaded function, or NULL to
+///            disable progressive loading.
+/// @param[in] aUserData Custom user data that is passed to the section
+///            loaded function.
+/// @note The section loaded function may query the context (e.g. the vertex
+///       count or UV map names), but must not modify it.
+/// @note When a section loaded function is set, the arrays are decoded one
+///       at a time, so threaded decoding (see ctmDecodeThreads()) is only
+///       used for the blocks of MG3 files.
+/// @note This function is only valid in import mode.
+/// @see CTMsectionfn.
+CTMEXPORT void CTMCALL ctmLoadCallback(CTMcontext aContext,
+  CTMsectionfn aSectionFn, void * aUserData);
+
+/// Select header only loading. In this mode the load functions only read the
+/// file header and the map information (names, file names and precisions),
+/// and skip past all the mesh data without decoding it. This makes it very
+/// fast to probe a file for its properties (e.g. vertex and triangle counts,
+/// compression method, file comment and map names). After loading, the
+/// context can be queried with the ctmGet functions, except that all the mesh
+/// arrays (indices, vertices, normals, UV maps and attribute maps) are NULL.
+/// CTM_HAS_NORMALS tells whether the file contains normals.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aHeaderOnly CTM_TRUE for header only loading, or CTM_FALSE for
+///            normal loading (the default).
+/// @note Files that are loaded with ctmLoad(), ctmLoadMapped() or
+///       ctmLoadFromMemory() are skipped without reading the mesh data. Custom
+///       streams (ctmLoadCustom()) are not seekable, so the mesh data is read
+///       (but not decoded).
+/// @note This function is only valid in import mode.
+CTMEXPORT void CTMCALL ctmLoadHeader(CTMcontext aContext, CTMuint aHeaderOnly);
+
+/// Select which optional mesh arrays to skip when loading a file. Skipped
+/// arrays are neither decoded nor allocated (compressed data is skipped
+/// without being unpacked), which saves both time and memory when only part
+/// of the mesh is needed (e.g. only the vertices and indices for collision
+/// detection). For skipped UV and attribute maps, the map information (names,
+/// file names and precisions) is still available, but ctmGetFloatArray()
+/// returns NULL. Likewise, CTM_HAS_NORMALS tells whether the file contains
+/// normals even if they are skipped.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aSkipMask A combination of CTM_SKIP_NORMALS, CTM_SKIP_UV_MAPS
+///            and CTM_SKIP_ATTRIBS, or zero to load all arrays (the default).
+/// @note This function is only valid in import mode.
+CTMEXPORT void CTMCALL ctmLoadFilter(CTMcontext aContext, CTMuint aSkipMask);
+
+/// Set a caller provided output buffer for one of the mesh arrays. When a
+/// file is loaded, the array is decoded straight into the buffer instead of
+/// into memory that is allocated by OpenCTM, which avoids an extra copy when
+/// the mesh is to be stored in the caller's own data structures (e.g. an
+/// interleaved vertex buffer). The buffer stays registered for all following
+/// loads, until it is cleared (by passing a NULL buffer).
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aArray Which array to set the buffer for: CTM_INDICES,
+///            CTM_VERTICES, CTM_NORMALS, CTM_UV_MAP_1..CTM_UV_MAP_8 or
+///            CTM_ATTRIB_MAP_1..CTM_ATTRIB_MAP_8.
+/// @param[in] aBuffer The buffer, or NULL to let OpenCTM allocate the array
+///            (the default).
+/// @param[in] aBufferSize The size of the buffer, in bytes. If the buffer is
+///            too small for the loaded mesh, loading fails with
+///            CTM_INVALID_ARGUMENT.
+/// @param[in] aStride The distance between two consecutive elements (e.g.
+///            vertices) in the buffer, in bytes. It must be a multiple of four,
+///            and at least as large as one element. Zero means tightly packed
+///            elements. The triangle indices must always be tightly packed.
+/// @note The buffer is owned by the caller, and must remain valid for as long
+///       as the array is accessed through the context. ctmGetFloatArray(),
+///       ctmGetIntegerArray() and the section loaded callback (see
+///       ctmLoadCallback()) return the buffer itself, using the given stride.
+/// @note Arrays that are skipped (see ctmLoadFilter() and ctmLoadHeader())
+///       are not written to the buffer.
+/// @note This function is only valid in import mode.
+CTMEXPORT void CTMCALL ctmLoadBuffer(CTMcontext aContext, CTMenum aArray,
+  void * aBuffer, size_t aBufferSize, CTMuint aStride);
+
 /// Save an OpenCTM format file. The mesh must have been defined by
 /// ctmDefineMesh().
 /// @param[in] aContext An OpenCTM context that has been created by
@@ -654,6 +976,66 @@ CTMEXPORT void CTMCALL ctmFreeBuffer(void *buffer);
 CTMEXPORT void CTMCALL ctmSaveCustom(CTMcontext aContext, CTMwritefn aWriteFn,
   void * aUserData);
 
+/// Estimate the size of an OpenCTM format file, without writing it anywhere.
+/// The mesh is compressed with the current settings, but the packed data is
+/// only counted, which makes this much cheaper than saving to a buffer when
+/// comparing several precisions or compression methods. The size of each
+/// array can then be queried with ctmGetSectionSize().
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aMode How to estimate the size: CTM_ESTIMATE_EXACT gives the
+///            exact file size. CTM_ESTIMATE_FAST uses the fastest coder of
+///            the selected backend (for LZMA, the fast algorithm with the
+///            same dictionary and literal settings), which usually
+///            overestimates the size by a few percent. CTM_ESTIMATE_SAMPLED
+///            only compresses a sample of each large array (a number of
+///            evenly spaced runs), and scales the result to the whole array.
+/// @return The (estimated) file size in bytes, or zero if an error occured.
+/// @see CTM_ESTIMATE_EXACT, CTM_ESTIMATE_FAST, CTM_ESTIMATE_SAMPLED
+CTMEXPORT size_t CTMCALL ctmEstimateSize(CTMcontext aContext, CTMenum aMode);
+
+/// Get the number of bytes that an array took up in the last saved file, or
+/// in the last size estimate (see ctmEstimateSize()). The size includes the
+/// chunk header and map information of the array. For the MG2 and MG3
+/// methods, the grid indices are counted as part of the vertices.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aArray Which array: CTM_INDICES, CTM_VERTICES, CTM_NORMALS,
+///            CTM_UV_MAP_n or CTM_ATTRIB_MAP_n.
+/// @return The size of the array in bytes (zero if the array was not saved).
+CTMEXPORT size_t CTMCALL ctmGetSectionSize(CTMcontext aContext,
+  CTMenum aArray);
+
+/// Choose the compression settings for the current mesh automatically. The
+/// compression method, compression level and vertex precision that give the
+/// smallest file (or the fastest decoding) are selected, such that no vertex
+/// moves more than the given error budget. The budget only decides the vertex
+/// precision of the MG2 and MG3 methods; the other precisions, the entropy
+/// backend and the number of threads are left as they are. The candidates are
+/// compared with sampled size estimates (see ctmEstimateSize()), and the best
+/// few are then compressed in full (or, for CTM_OPTIMIZE_DECODE, saved and
+/// loaded from memory, with as many threads as set by ctmEncodeThreads()).
+/// The chosen settings can be queried with ctmGetInteger()
+/// (CTM_COMPRESSION_METHOD and CTM_COMPRESSION_LEVEL) and ctmGetFloat()
+/// (CTM_VERTEX_PRECISION and CTM_VERTEX_ERROR), and are used by the next
+/// save.
+/// @param[in] aContext An OpenCTM context that has been created by
+///            ctmNewContext().
+/// @param[in] aTarget What to optimize for: CTM_OPTIMIZE_SIZE (smallest file)
+///            or CTM_OPTIMIZE_DECODE (fastest decoding).
+/// @param[in] aErrorMetric How the vertex error is measured: CTM_ERROR_MAX
+///            (the largest distance between an original and a decoded
+///            vertex, which is an upper bound of the Hausdorff distance
+///            between the meshes) or CTM_ERROR_RMS (the root mean square of
+///            the distances).
+/// @param[in] aMaxError The largest allowed vertex error, in the units of the
+///            vertex coordinates. Zero only allows lossless methods.
+/// @return The file size with the chosen settings in bytes, or zero if an
+///         error occured.
+/// @see CTM_OPTIMIZE_SIZE, CTM_OPTIMIZE_DECODE, CTM_ERROR_MAX, CTM_ERROR_RMS
+CTMEXPORT size_t CTMCALL ctmOptimize(CTMcontext aContext, CTMenum aTarget,
+  CTMenum aErrorMetric, CTMfloat aMaxError);
+
 #ifdef __cplusplus
 }
 #endif
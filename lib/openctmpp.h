@@ -111,6 +111,14 @@ class CTMimporter {
       ctmFreeContext(mContext);
     }
 
+    /// Wrapper for ctmSetAllocator()
+    void SetAllocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn,
+      void * aUserData = 0)
+    {
+      ctmSetAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
     /// Wrapper for ctmGetInteger()
     CTMuint GetInteger(CTMenum aProperty)
     {
@@ -213,6 +221,56 @@ class CTMimporter {
       CheckError();
     }
 
+    /// Wrapper for ctmDecodeThreads()
+    void DecodeThreads(CTMuint aThreadCount)
+    {
+      ctmDecodeThreads(mContext, aThreadCount);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadFromMemory()
+    void LoadFromMemory(const void * aBuffer, size_t aBufferSize)
+    {
+      ctmLoadFromMemory(mContext, aBuffer, aBufferSize);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadMapped()
+    void LoadMapped(const char * aFileName)
+    {
+      ctmLoadMapped(mContext, aFileName);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadCallback()
+    void LoadCallback(CTMsectionfn aSectionFn, void * aUserData)
+    {
+      ctmLoadCallback(mContext, aSectionFn, aUserData);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadHeader()
+    void LoadHeader(CTMuint aHeaderOnly)
+    {
+      ctmLoadHeader(mContext, aHeaderOnly);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadFilter()
+    void LoadFilter(CTMuint aSkipMask)
+    {
+      ctmLoadFilter(mContext, aSkipMask);
+      CheckError();
+    }
+
+    /// Wrapper for ctmLoadBuffer()
+    void LoadBuffer(CTMenum aArray, void * aBuffer, size_t aBufferSize,
+      CTMuint aStride = 0)
+    {
+      ctmLoadBuffer(mContext, aArray, aBuffer, aBufferSize, aStride);
+      CheckError();
+    }
+
     // You can not copy nor assign from one CTMimporter object to another, since
     // the object contains hidden state. By declaring these dummy prototypes
     // without an implementation, you will at least get linker errors if you try
@@ -267,6 +325,14 @@ class CTMexporter {
       ctmFreeContext(mContext);
     }
 
+    /// Wrapper for ctmSetAllocator()
+    void SetAllocator(CTMallocfn aAllocFn, CTMfreefn aFreeFn,
+      void * aUserData = 0)
+    {
+      ctmSetAllocator(mContext, aAllocFn, aFreeFn, aUserData);
+      CheckError();
+    }
+
     /// Wrapper for ctmCompressionMethod()
     void CompressionMethod(CTMenum aMethod)
     {
@@ -281,6 +347,23 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmCompressionBackend()
+    void CompressionBackend(CTMenum aBackend)
+    {
+      ctmCompressionBackend(mContext, aBackend);
+      CheckError();
+    }
+
+    /// Wrapper for ctmCompressionParams()
+    void CompressionParams(CTMenum aArray, CTMint aDictSize,
+      CTMint aLiteralContextBits = -1, CTMint aLiteralPosBits = -1,
+      CTMint aPosBits = -1, CTMint aFastBytes = -1)
+    {
+      ctmCompressionParams(mContext, aArray, aDictSize, aLiteralContextBits,
+        aLiteralPosBits, aPosBits, aFastBytes);
+      CheckError();
+    }
+
     /// Wrapper for ctmVertexPrecision()
     void VertexPrecision(CTMfloat aPrecision)
     {
@@ -302,6 +385,13 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmNormalMode()
+    void NormalMode(CTMenum aMode)
+    {
+      ctmNormalMode(mContext, aMode);
+      CheckError();
+    }
+
     /// Wrapper for ctmUVCoordPrecision()
     void UVCoordPrecision(CTMenum aUVMap, CTMfloat aPrecision)
     {
@@ -350,6 +440,13 @@ class CTMexporter {
       return res;
     }
 
+    /// Wrapper for ctmEncodeThreads()
+    void EncodeThreads(CTMuint aThreadCount)
+    {
+      ctmEncodeThreads(mContext, aThreadCount);
+      CheckError();
+    }
+
     /// Wrapper for ctmSave()
     void Save(const char * aFileName)
     {
@@ -364,6 +461,30 @@ class CTMexporter {
       CheckError();
     }
 
+    /// Wrapper for ctmEstimateSize()
+    size_t EstimateSize(CTMenum aMode = CTM_ESTIMATE_EXACT)
+    {
+      size_t res = ctmEstimateSize(mContext, aMode);
+      CheckError();
+      return res;
+    }
+
+    /// Wrapper for ctmGetSectionSize()
+    size_t GetSectionSize(CTMenum aArray)
+    {
+      size_t res = ctmGetSectionSize(mContext, aArray);
+      CheckError();
+      return res;
+    }
+
+    /// Wrapper for ctmOptimize()
+    size_t Optimize(CTMenum aTarget, CTMenum aErrorMetric, CTMfloat aMaxError)
+    {
+      size_t res = ctmOptimize(mContext, aTarget, aErrorMetric, aMaxError);
+      CheckError();
+      return res;
+    }
+
     // You can not copy nor assign from one CTMexporter object to another, since
     // the object contains hidden state. By declaring these dummy prototypes
     // without an implementation, you will at least get linker errors if you try
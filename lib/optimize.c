@@ -0,0 +1,445 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        optimize.c
+// Description: Search for the compression settings that give the smallest
+//              file or the fastest decoding within a vertex error budget
+//              (see ctmOptimize()).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include <math.h>
+#include "openctm.h"
+#include "internal.h"
+
+
+//-----------------------------------------------------------------------------
+// Search parameters
+//-----------------------------------------------------------------------------
+// Compression levels to try
+static const CTMuint _ctmOptimizeLevels[] = { 1, 3, 5, 7, 9 };
+#define _CTM_OPTIMIZE_LEVEL_COUNT (sizeof(_ctmOptimizeLevels) / sizeof(CTMuint))
+
+// Max number of trials (methods x levels)
+#define _CTM_OPTIMIZE_MAX_TRIALS (4 * _CTM_OPTIMIZE_LEVEL_COUNT)
+
+// Number of trials that are compressed in full after the sampled estimates
+// (smallest file target)
+#define _CTM_OPTIMIZE_FINALISTS 3
+
+// Number of times that each finalist is decoded (fastest decoding target)
+#define _CTM_OPTIMIZE_DECODE_RUNS 3
+
+// Number of attempts to find a vertex precision within the error budget, and
+// the precision reduction per attempt
+#define _CTM_OPTIMIZE_PRECISION_STEPS 16
+#define _CTM_OPTIMIZE_PRECISION_FACTOR 0.875f
+
+//-----------------------------------------------------------------------------
+// _CTMtrial - One combination of compression settings, and its result.
+//-----------------------------------------------------------------------------
+typedef struct {
+  CTMenum mMethod;              // Compression method
+  CTMuint mLevel;               // Compression level
+  CTMfloat mPrecision;          // Vertex precision (lossy methods)
+  size_t mSize;                 // (Estimated) file size
+  size_t mSectionSizes[_CTM_OUT_COUNT]; // Array sizes (_CTM_OUT_* slots)
+  CTMfloat mMaxError;           // Vertex errors (lossy methods, with the
+  CTMfloat mRMSError;           // grid that the trial actually used)
+  double mDecodeTime;           // Decoding time (in seconds)
+  CTMenum mError;               // Result of the trial
+} _CTMtrial;
+
+//-----------------------------------------------------------------------------
+// _CTMtrialjobs - Trials to run in parallel (see _ctmTrialJob()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMcontext * mContext;       // Context with the mesh and base settings
+  _CTMtrial ** mTrials;         // Trials to run
+  CTMenum mEstimate;            // Size estimation mode (CTM_ESTIMATE_*)
+} _CTMtrialjobs;
+
+//-----------------------------------------------------------------------------
+// _ctmInitTrialContext() - Set up a context for a trial. The trial context is
+// a shallow copy of the context, so it shares the (read only) mesh and all
+// settings, but it has a scratch arena of its own, which must be freed with
+// _ctmScratchFree().
+//-----------------------------------------------------------------------------
+static void _ctmInitTrialContext(_CTMcontext * aTrialContext,
+  const _CTMcontext * self, const _CTMtrial * aTrial)
+{
+  *aTrialContext = *self;
+  memset(&aTrialContext->mScratch, 0, sizeof(_CTMscratch));
+  aTrialContext->mError = CTM_NONE;
+  aTrialContext->mMethod = aTrial->mMethod;
+  aTrialContext->mCompressionLevel = aTrial->mLevel;
+  if((aTrial->mMethod == CTM_METHOD_MG2) || (aTrial->mMethod == CTM_METHOD_MG3))
+    aTrialContext->mVertexPrecision = aTrial->mPrecision;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTrialJob() - Job function for estimating the file size of a trial.
+// The trials run in parallel, so each trial packs its sections serially.
+//-----------------------------------------------------------------------------
+static void _ctmTrialJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMtrialjobs * jobs = (_CTMtrialjobs *) aUserData;
+  _CTMtrial * trial = jobs->mTrials[aJob];
+  _CTMcontext context;
+  (void) aWorker;
+
+  _ctmInitTrialContext(&context, jobs->mContext, trial);
+  context.mEncodeThreads = 1;
+  trial->mSize = ctmEstimateSize((CTMcontext) &context, jobs->mEstimate);
+  trial->mMaxError = context.mSavedMaxError;
+  trial->mRMSError = context.mSavedRMSError;
+  trial->mError = context.mError;
+  memcpy(trial->mSectionSizes, context.mSectionSizes,
+         sizeof(trial->mSectionSizes));
+  _ctmScratchFree(&context);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRunTrials() - Estimate the file sizes of aCount trials, in parallel
+// (using up to mEncodeThreads threads).
+//-----------------------------------------------------------------------------
+static int _ctmRunTrials(_CTMcontext * self, _CTMtrial ** aTrials,
+  CTMuint aCount, CTMenum aEstimate)
+{
+  _CTMtrialjobs jobs;
+  CTMuint i;
+
+  jobs.mContext = self;
+  jobs.mTrials = aTrials;
+  jobs.mEstimate = aEstimate;
+  _ctmRunJobs(&self->mAllocator, self->mEncodeThreads, aCount, _ctmTrialJob,
+              (void *) &jobs);
+
+  // Report the first error
+  for(i = 0; i < aCount; ++ i)
+  {
+    if(aTrials[i]->mError != CTM_NONE)
+    {
+      self->mError = aTrials[i]->mError;
+      return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMbufwriter - Stream for saving a trial to a fixed size buffer.
+//-----------------------------------------------------------------------------
+typedef struct {
+  unsigned char * mBuf;
+  size_t mSize;
+  size_t mPos;
+} _CTMbufwriter;
+
+static CTMuint CTMCALL _ctmBufWriterWrite(const void * aBuf, CTMuint aCount,
+  void * aUserData)
+{
+  _CTMbufwriter * writer = (_CTMbufwriter *) aUserData;
+  if(aCount > writer->mSize - writer->mPos)
+    aCount = (CTMuint) (writer->mSize - writer->mPos);
+  memcpy(&writer->mBuf[writer->mPos], aBuf, aCount);
+  writer->mPos += aCount;
+  return aCount;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTimeDecode() - Save a trial to memory, and measure how long it takes
+// to load it (the best of _CTM_OPTIMIZE_DECODE_RUNS loads). The decoder uses
+// as many threads as the encoder (the decoding threads can not be set for an
+// export context). The file size of the trial must be known.
+//-----------------------------------------------------------------------------
+static int _ctmTimeDecode(_CTMcontext * self, _CTMtrial * aTrial)
+{
+  _CTMcontext context;
+  _CTMbufwriter writer;
+  CTMcontext loader;
+  CTMenum error;
+  CTMuint i;
+  double t;
+
+  // Save the trial
+  writer.mBuf = (unsigned char *) _ctmAlloc(&self->mAllocator, aTrial->mSize);
+  writer.mSize = aTrial->mSize;
+  writer.mPos = 0;
+  if(!writer.mBuf)
+  {
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+  _ctmInitTrialContext(&context, self, aTrial);
+  ctmSaveCustom((CTMcontext) &context, _ctmBufWriterWrite, (void *) &writer);
+  error = context.mError;
+  _ctmScratchFree(&context);
+  if((error == CTM_NONE) && (writer.mPos != writer.mSize))
+    error = CTM_INTERNAL_ERROR;
+
+  // Load it
+  loader = (CTMcontext) 0;
+  if(error == CTM_NONE)
+  {
+    loader = ctmNewContext(CTM_IMPORT);
+    if(!loader)
+      error = CTM_OUT_OF_MEMORY;
+  }
+  if(error == CTM_NONE)
+  {
+    ctmSetAllocator(loader, self->mAllocator.mAllocFn,
+                    self->mAllocator.mFreeFn, self->mAllocator.mUserData);
+    ctmDecodeThreads(loader, self->mEncodeThreads);
+    for(i = 0; (i < _CTM_OPTIMIZE_DECODE_RUNS) && (error == CTM_NONE); ++ i)
+    {
+      t = _ctmTime();
+      ctmLoadFromMemory(loader, writer.mBuf, writer.mSize);
+      t = _ctmTime() - t;
+      error = ctmGetError(loader);
+      if((i == 0) || (t < aTrial->mDecodeTime))
+        aTrial->mDecodeTime = t;
+    }
+  }
+  if(loader)
+    ctmFreeContext(loader);
+  _ctmFree(&self->mAllocator, writer.mBuf);
+
+  if(error != CTM_NONE)
+  {
+    self->mError = error;
+    return CTM_FALSE;
+  }
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPrecisionForError() - Find a vertex precision for the lossy methods
+// that keeps the vertex error within aMaxError. The first guess is the
+// largest precision for which the quantization error can not exceed the
+// budget (or, for the RMS metric, for which the expected error equals the
+// budget), and the precision is then reduced until the measured error is
+// within the budget. The error is measured with the default grid (the grids
+// of the trials are checked by _ctmCheckTrialErrors()). Returns zero if no
+// precision was found.
+//-----------------------------------------------------------------------------
+static CTMfloat _ctmPrecisionForError(_CTMcontext * self,
+  CTMenum aErrorMetric, CTMfloat aMaxError)
+{
+  CTMfloat precision, maxError, rmsError;
+  CTMuint i;
+
+  // Each coordinate is off by at most half the precision (and by precision /
+  // sqrt(12) on average)
+  if(aErrorMetric == CTM_ERROR_MAX)
+    precision = 2.0f * aMaxError / sqrtf(3.0f);
+  else
+    precision = 2.0f * aMaxError;
+
+  for(i = 0; i < _CTM_OPTIMIZE_PRECISION_STEPS; ++ i)
+  {
+    _ctmVertexError_MG2(self, precision, &maxError, &rmsError);
+    if(((aErrorMetric == CTM_ERROR_MAX) ? maxError : rmsError) <= aMaxError)
+      return precision;
+    precision *= _CTM_OPTIMIZE_PRECISION_FACTOR;
+  }
+
+  return 0.0f;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTrialError() - Get the vertex error of a trial (aErrorMetric).
+//-----------------------------------------------------------------------------
+static CTMfloat _ctmTrialError(const _CTMtrial * aTrial, CTMenum aErrorMetric)
+{
+  return (aErrorMetric == CTM_ERROR_MAX) ? aTrial->mMaxError :
+                                           aTrial->mRMSError;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmCheckTrialErrors() - Make sure that the errors of aCount fully
+// compressed trials are within aMaxError. The vertex precision is found with
+// the default grid (see _ctmPrecisionForError()), but the grid search of
+// high compression levels can pick another grid, which gives other errors
+// (for the RMS metric, the error can then exceed the budget). The precision
+// of each trial that is over the budget is reduced, and the trial is run
+// again, until it is within the budget.
+//-----------------------------------------------------------------------------
+static int _ctmCheckTrialErrors(_CTMcontext * self, _CTMtrial ** aTrials,
+  CTMuint aCount, CTMenum aErrorMetric, CTMfloat aMaxError)
+{
+  _CTMtrial * over[_CTM_OPTIMIZE_MAX_TRIALS];
+  CTMuint i, j, overCount;
+
+  for(i = 0; i < _CTM_OPTIMIZE_PRECISION_STEPS; ++ i)
+  {
+    overCount = 0;
+    for(j = 0; j < aCount; ++ j)
+    {
+      if((aTrials[j]->mPrecision > 0.0f) &&
+         (_ctmTrialError(aTrials[j], aErrorMetric) > aMaxError))
+      {
+        aTrials[j]->mPrecision *= _CTM_OPTIMIZE_PRECISION_FACTOR;
+        over[overCount ++] = aTrials[j];
+      }
+    }
+    if(overCount == 0)
+      return CTM_TRUE;
+    if(!_ctmRunTrials(self, over, overCount, CTM_ESTIMATE_EXACT))
+      return CTM_FALSE;
+  }
+
+  // The default grid was within the budget with a much larger precision, so
+  // this should never happen
+  self->mError = CTM_INTERNAL_ERROR;
+  return CTM_FALSE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmOptimize() - Search for the compression method, level and vertex
+// precision that give the smallest file (CTM_OPTIMIZE_SIZE) or the fastest
+// decoding (CTM_OPTIMIZE_DECODE), with a vertex error (aErrorMetric) of at
+// most aMaxError. All combinations are first estimated from samples (see
+// CTM_ESTIMATE_SAMPLED). For the smallest file, the best few are then
+// compressed in full. For the fastest decoding, the smallest combination of
+// each method is saved and timed. The chosen settings are stored in the
+// context, and the file size is returned (zero on failure).
+//-----------------------------------------------------------------------------
+size_t _ctmOptimize(_CTMcontext * self, CTMenum aTarget,
+  CTMenum aErrorMetric, CTMfloat aMaxError)
+{
+  _CTMtrial trials[_CTM_OPTIMIZE_MAX_TRIALS], * order[_CTM_OPTIMIZE_MAX_TRIALS];
+  _CTMtrial * best, * tmp;
+  CTMenum methods[4];
+  CTMuint i, j, k, methodCount, levelCount, trialCount, finalists;
+  CTMfloat precision;
+
+  // Find the vertex precision for the lossy methods (if any error is allowed)
+  precision = 0.0f;
+  if(aMaxError > 0.0f)
+    precision = _ctmPrecisionForError(self, aErrorMetric, aMaxError);
+
+  // Which methods to try? RAW is never the smallest, and MG3 only decodes
+  // faster than MG2 when its blocks can be decoded in parallel
+  methodCount = 0;
+  if(aTarget == CTM_OPTIMIZE_DECODE)
+    methods[methodCount ++] = CTM_METHOD_RAW;
+  methods[methodCount ++] = CTM_METHOD_MG1;
+  if(precision > 0.0f)
+  {
+    methods[methodCount ++] = CTM_METHOD_MG2;
+    if((aTarget == CTM_OPTIMIZE_DECODE) && (self->mEncodeThreads >= 2) &&
+       (self->mVertexCount > _CTM_MG3_BLOCK_SIZE))
+      methods[methodCount ++] = CTM_METHOD_MG3;
+  }
+
+  // Set up the trials (the level makes no difference for the stored
+  // backend, nor for the RAW method)
+  levelCount = (self->mBackend == CTM_BACKEND_STORED) ? 1 :
+               (CTMuint) _CTM_OPTIMIZE_LEVEL_COUNT;
+  trialCount = 0;
+  for(i = 0; i < methodCount; ++ i)
+  {
+    for(j = 0; j < ((methods[i] == CTM_METHOD_RAW) ? 1 : levelCount); ++ j)
+    {
+      memset(&trials[trialCount], 0, sizeof(_CTMtrial));
+      trials[trialCount].mMethod = methods[i];
+      trials[trialCount].mLevel = (levelCount > 1) ? _ctmOptimizeLevels[j] :
+                                  self->mCompressionLevel;
+      if((methods[i] == CTM_METHOD_MG2) || (methods[i] == CTM_METHOD_MG3))
+        trials[trialCount].mPrecision = precision;
+      order[trialCount] = &trials[trialCount];
+      ++ trialCount;
+    }
+  }
+
+  // Estimate all trials from samples
+  if(!_ctmRunTrials(self, order, trialCount, CTM_ESTIMATE_SAMPLED))
+    return 0;
+
+  // Sort the trials by size (smallest first; insertion sort keeps the order
+  // of equal sizes, so lower levels win ties)
+  for(i = 1; i < trialCount; ++ i)
+  {
+    tmp = order[i];
+    for(j = i; (j > 0) && (order[j - 1]->mSize > tmp->mSize); -- j)
+      order[j] = order[j - 1];
+    order[j] = tmp;
+  }
+
+  if(aTarget == CTM_OPTIMIZE_SIZE)
+  {
+    // Compress the smallest few in full, and pick the smallest
+    finalists = trialCount < _CTM_OPTIMIZE_FINALISTS ? trialCount :
+                _CTM_OPTIMIZE_FINALISTS;
+    if(!_ctmRunTrials(self, order, finalists, CTM_ESTIMATE_EXACT) ||
+       !_ctmCheckTrialErrors(self, order, finalists, aErrorMetric, aMaxError))
+      return 0;
+    best = order[0];
+    for(i = 1; i < finalists; ++ i)
+    {
+      if(order[i]->mSize < best->mSize)
+        best = order[i];
+    }
+  }
+  else
+  {
+    // Keep the smallest trial of each method (the first one in size order)
+    finalists = 0;
+    for(i = 0; i < trialCount; ++ i)
+    {
+      for(k = 0; (k < finalists) && (order[k]->mMethod != order[i]->mMethod); ++ k);
+      if(k == finalists)
+        order[finalists ++] = order[i];
+    }
+
+    // Get their exact sizes, and time their decoding (one at a time, so
+    // that the timings do not disturb each other)
+    if(!_ctmRunTrials(self, order, finalists, CTM_ESTIMATE_EXACT) ||
+       !_ctmCheckTrialErrors(self, order, finalists, aErrorMetric, aMaxError))
+      return 0;
+    best = order[0];
+    for(i = 0; i < finalists; ++ i)
+    {
+      if(!_ctmTimeDecode(self, order[i]))
+        return 0;
+      if(order[i]->mDecodeTime < best->mDecodeTime)
+        best = order[i];
+    }
+  }
+
+  // Use the best settings
+  self->mMethod = best->mMethod;
+  self->mCompressionLevel = best->mLevel;
+  if((best->mMethod == CTM_METHOD_MG2) || (best->mMethod == CTM_METHOD_MG3))
+  {
+    self->mVertexPrecision = best->mPrecision;
+    self->mVertexError = _ctmTrialError(best, aErrorMetric);
+  }
+  else
+    self->mVertexError = 0.0f;
+  memcpy(self->mSectionSizes, best->mSectionSizes, sizeof(self->mSectionSizes));
+
+  return best->mSize;
+}
@@ -0,0 +1,265 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        sort.c
+// Description: Stable radix sorting of fixed size records, and ordering of
+//              vertices and triangles before compression.
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+#include <string.h>
+#include "openctm.h"
+#include "internal.h"
+
+
+//-----------------------------------------------------------------------------
+// Radix sort parameters
+//-----------------------------------------------------------------------------
+// Number of key bits per pass (three passes per 32-bit key)
+#define _CTM_RADIX_BITS      11
+#define _CTM_RADIX_SIZE      (1 << _CTM_RADIX_BITS)
+#define _CTM_RADIX_MASK      (_CTM_RADIX_SIZE - 1)
+
+// Smallest number of records per thread (smaller arrays are sorted with fewer
+// threads, since the threads would mostly be waiting for each other)
+#define _CTM_SORT_MIN_CHUNK  0x00010000
+
+//-----------------------------------------------------------------------------
+// _CTMradixpass - One pass of the radix sort, with the records split into one
+// chunk per job. Each chunk has a histogram of its own, which is turned into
+// the output positions of the chunk before the records are scattered.
+//-----------------------------------------------------------------------------
+typedef struct {
+  const CTMuint * mSrc;         // Source records
+  CTMuint * mDst;               // Destination records
+  CTMuint mCount;               // Number of records
+  CTMuint mRecordWords;         // Size of a record (in words)
+  CTMuint mKeyWord;             // Which word of the record is the key
+  CTMuint mShift;               // Which bits of the key (the digit) to use
+  CTMuint mChunkCount;          // Number of chunks (jobs)
+  CTMuint * mHistograms;        // _CTM_RADIX_SIZE counters per chunk
+} _CTMradixpass;
+
+//-----------------------------------------------------------------------------
+// _ctmChunkStart() - First record of a chunk.
+//-----------------------------------------------------------------------------
+static CTMuint _ctmChunkStart(const _CTMradixpass * aPass, CTMuint aChunk)
+{
+  return (CTMuint) (((size_t) aPass->mCount * aChunk) / aPass->mChunkCount);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRadixCountJob() - Job function for counting the digits of a chunk.
+//-----------------------------------------------------------------------------
+static void _ctmRadixCountJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMradixpass * pass = (_CTMradixpass *) aUserData;
+  CTMuint * histogram = &pass->mHistograms[aJob * _CTM_RADIX_SIZE];
+  const CTMuint * key;
+  CTMuint i, end;
+  (void) aWorker;
+
+  memset(histogram, 0, sizeof(CTMuint) * _CTM_RADIX_SIZE);
+  end = _ctmChunkStart(pass, aJob + 1);
+  key = &pass->mSrc[_ctmChunkStart(pass, aJob) * pass->mRecordWords + pass->mKeyWord];
+  for(i = _ctmChunkStart(pass, aJob); i < end; ++ i)
+  {
+    ++ histogram[(*key >> pass->mShift) & _CTM_RADIX_MASK];
+    key += pass->mRecordWords;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmRadixScatterJob() - Job function for moving the records of a chunk to
+// their positions in the destination array (in order, which keeps the sort
+// stable).
+//-----------------------------------------------------------------------------
+static void _ctmRadixScatterJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMradixpass * pass = (_CTMradixpass *) aUserData;
+  CTMuint * position = &pass->mHistograms[aJob * _CTM_RADIX_SIZE];
+  const CTMuint * src;
+  CTMuint * dst;
+  CTMuint i, j, end, words;
+  (void) aWorker;
+
+  words = pass->mRecordWords;
+  end = _ctmChunkStart(pass, aJob + 1);
+  src = &pass->mSrc[_ctmChunkStart(pass, aJob) * words];
+  for(i = _ctmChunkStart(pass, aJob); i < end; ++ i)
+  {
+    dst = &pass->mDst[(size_t) position[(src[pass->mKeyWord] >> pass->mShift) & _CTM_RADIX_MASK] ++ * words];
+    for(j = 0; j < words; ++ j)
+      dst[j] = src[j];
+    src += words;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSortRecords() - Sort aCount records of aRecordWords words each, by the
+// unsigned integer in word aMajorKey of each record, and for equal major keys
+// by the unsigned integer in word aMinorKey. The sort is stable (records with
+// equal keys keep their order). This is an LSD radix sort, so the time is
+// linear in the number of records. Passes where all records have the same
+// digit are skipped, which makes small key ranges cheap. Large arrays are
+// sorted with up to mEncodeThreads threads.
+//-----------------------------------------------------------------------------
+int _ctmSortRecords(_CTMcontext * self, CTMuint * aRecords, CTMuint aCount,
+  CTMuint aRecordWords, CTMuint aMajorKey, CTMuint aMinorKey)
+{
+  _CTMradixpass pass;
+  CTMuint * tmp, * src, * dst, * histogram;
+  CTMuint key, shift, digit, chunk, start, sum, count;
+  size_t mark;
+  int trivial;
+
+  if(aCount < 2)
+    return CTM_TRUE;
+
+  // Use one chunk per thread
+  pass.mChunkCount = aCount / _CTM_SORT_MIN_CHUNK;
+  if(pass.mChunkCount > self->mEncodeThreads)
+    pass.mChunkCount = self->mEncodeThreads;
+  if(pass.mChunkCount < 1)
+    pass.mChunkCount = 1;
+
+  // Allocate the second record array and the histograms
+  mark = _ctmScratchMark(self);
+  tmp = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * aRecordWords * aCount);
+  pass.mHistograms = (CTMuint *) _ctmScratchAlloc(self, sizeof(CTMuint) * _CTM_RADIX_SIZE * pass.mChunkCount);
+  if(!tmp || !pass.mHistograms)
+  {
+    _ctmScratchRelease(self, mark);
+    self->mError = CTM_OUT_OF_MEMORY;
+    return CTM_FALSE;
+  }
+
+  src = aRecords;
+  dst = tmp;
+  pass.mSrc = src;
+  pass.mDst = dst;
+  pass.mCount = aCount;
+  pass.mRecordWords = aRecordWords;
+
+  // Sort by the minor key first, then by the major key (from the least to
+  // the most significant digit)
+  for(key = 0; key < 2; ++ key)
+  {
+    pass.mKeyWord = key == 0 ? aMinorKey : aMajorKey;
+    for(shift = 0; shift < 32; shift += _CTM_RADIX_BITS)
+    {
+      pass.mShift = shift;
+      _ctmRunJobs(&self->mAllocator, pass.mChunkCount, pass.mChunkCount,
+                  _ctmRadixCountJob, (void *) &pass);
+
+      // Convert the counts to output positions (digit by digit, and chunk by
+      // chunk within each digit). Nothing needs to be moved if all records
+      // have the same digit.
+      sum = 0;
+      trivial = CTM_FALSE;
+      for(digit = 0; (digit < _CTM_RADIX_SIZE) && (sum < aCount); ++ digit)
+      {
+        start = sum;
+        histogram = &pass.mHistograms[digit];
+        for(chunk = 0; chunk < pass.mChunkCount; ++ chunk)
+        {
+          count = histogram[chunk * _CTM_RADIX_SIZE];
+          histogram[chunk * _CTM_RADIX_SIZE] = sum;
+          sum += count;
+        }
+        trivial = (start == 0) && (sum == aCount);
+      }
+      if(trivial)
+        continue;
+
+      _ctmRunJobs(&self->mAllocator, pass.mChunkCount, pass.mChunkCount,
+                  _ctmRadixScatterJob, (void *) &pass);
+
+      // The sorted records are the source of the next pass
+      src = dst;
+      dst = src == tmp ? aRecords : tmp;
+      pass.mSrc = src;
+      pass.mDst = dst;
+    }
+  }
+
+  // The result must end up in the caller's array
+  if(src != aRecords)
+    memcpy(aRecords, src, sizeof(CTMuint) * aRecordWords * aCount);
+
+  _ctmScratchRelease(self, mark);
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmFloatSortKey() - Convert a floating point value to an unsigned integer
+// with the same order (for _ctmSortRecords()). Negative and positive zero
+// give the same key, since they compare equal.
+//-----------------------------------------------------------------------------
+CTMuint _ctmFloatSortKey(CTMfloat aValue)
+{
+  union {
+    CTMfloat f;
+    CTMuint  i;
+  } u;
+  u.f = aValue;
+  if(aValue == 0.0f)
+    return 0x80000000;
+  return (u.i & 0x80000000) ? ~u.i : (u.i | 0x80000000);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmReArrangeTriangles() - Re-arrange aTriangleCount triangles for optimal
+// compression (MG1 and MG2, and the fallback triangles of MG4).
+//-----------------------------------------------------------------------------
+int _ctmReArrangeTriangles(_CTMcontext * self, CTMuint * aIndices,
+  CTMuint aTriangleCount)
+{
+  CTMuint * tri, tmp, i;
+
+  // Step 1: Make sure that the first index of each triangle is the smallest
+  // one (rotate triangle nodes if necessary)
+  for(i = 0; i < aTriangleCount; ++ i)
+  {
+    tri = &aIndices[i * 3];
+    if((tri[1] < tri[0]) && (tri[1] < tri[2]))
+    {
+      tmp = tri[0];
+      tri[0] = tri[1];
+      tri[1] = tri[2];
+      tri[2] = tmp;
+    }
+    else if((tri[2] < tri[0]) && (tri[2] < tri[1]))
+    {
+      tmp = tri[0];
+      tri[0] = tri[2];
+      tri[2] = tri[1];
+      tri[1] = tmp;
+    }
+  }
+
+  // Step 2: Sort the triangles based on the first triangle index, and
+  // secondly on the second triangle index (triangles with the same first and
+  // second index keep their order)
+  return _ctmSortRecords(self, aIndices, aTriangleCount, 3, 0, 1);
+}
@@ -27,7 +27,16 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <LzmaLib.h>
+#include <limits.h>
+#include <LzmaEnc.h>
+#include <LzmaDec.h>
+#ifdef OPENCTM_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef OPENCTM_WITH_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
 #include "openctm.h"
 #include "internal.h"
 
@@ -35,26 +44,186 @@
 #include <stdio.h>
 #endif
 
+
+//-----------------------------------------------------------------------------
+// _CTMlzmaalloc - LZMA allocator interface that allocates memory using the
+// allocation functions of a context.
+//-----------------------------------------------------------------------------
+typedef struct {
+  ISzAlloc mFuncs;                  // LZMA allocator interface (must be first)
+  const _CTMallocator * mAllocator; // Context allocator
+} _CTMlzmaalloc;
+
+static void * _ctmLzmaAlloc(void * p, size_t size)
+{
+  if(size == 0)
+    return (void *) 0;
+  return _ctmAlloc(((_CTMlzmaalloc *) p)->mAllocator, size);
+}
+
+static void _ctmLzmaFree(void * p, void * address)
+{
+  _ctmFree(((_CTMlzmaalloc *) p)->mAllocator, address);
+}
+
+static void _ctmInitLzmaAlloc(_CTMlzmaalloc * aAlloc,
+  const _CTMallocator * aAllocator)
+{
+  aAlloc->mFuncs.Alloc = _ctmLzmaAlloc;
+  aAlloc->mFuncs.Free = _ctmLzmaFree;
+  aAlloc->mAllocator = aAllocator;
+}
+
+//-----------------------------------------------------------------------------
+// Entropy backend tags. A packed section starts with five LZMA props bytes,
+// where the first byte is always less than 225. Sections that are coded with
+// another backend store a tag of 0xF0 or above in the first props byte
+// instead (and zeros in the other four bytes).
+//-----------------------------------------------------------------------------
+#define _CTM_TAG_FIRST  0xF0
+#define _CTM_TAG_STORED 0xF0
+#define _CTM_TAG_ZSTD   0xF1
+#define _CTM_TAG_LZ4    0xF2
+
+//-----------------------------------------------------------------------------
+// _ctmHaveBackend() - Check if an entropy backend is supported by this build.
+//-----------------------------------------------------------------------------
+int _ctmHaveBackend(CTMenum aBackend)
+{
+  switch(aBackend)
+  {
+    case CTM_BACKEND_LZMA:
+    case CTM_BACKEND_STORED:
+#ifdef OPENCTM_WITH_ZSTD
+    case CTM_BACKEND_ZSTD:
+#endif
+#ifdef OPENCTM_WITH_LZ4
+    case CTM_BACKEND_LZ4:
+#endif
+      return CTM_TRUE;
+    default:
+      return CTM_FALSE;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSectionBackend() - Get the entropy backend of a packed section from its
+// props (CTM_NONE if the tag is unknown).
+//-----------------------------------------------------------------------------
+static CTMenum _ctmSectionBackend(const unsigned char * aProps)
+{
+  if(aProps[0] < _CTM_TAG_FIRST)
+    return CTM_BACKEND_LZMA;
+  switch(aProps[0])
+  {
+    case _CTM_TAG_STORED:
+      return CTM_BACKEND_STORED;
+    case _CTM_TAG_ZSTD:
+      return CTM_BACKEND_ZSTD;
+    case _CTM_TAG_LZ4:
+      return CTM_BACKEND_LZ4;
+    default:
+      return CTM_NONE;
+  }
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamRead() - Read data from a stream.
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamRead(_CTMcontext * self, void * aBuf, CTMuint aCount)
 {
+  // Read from memory?
+  if(self->mInBuf)
+  {
+    if(aCount > self->mInBufSize - self->mInBufPos)
+      aCount = (CTMuint) (self->mInBufSize - self->mInBufPos);
+    memcpy(aBuf, &self->mInBuf[self->mInBufPos], aCount);
+    self->mInBufPos += aCount;
+    return aCount;
+  }
+
   if(!self->mUserData || !self->mReadFn)
     return 0;
 
   return self->mReadFn(aBuf, aCount, self->mUserData);
 }
 
+//-----------------------------------------------------------------------------
+// _ctmStreamReadDirect() - Get a pointer to the next aCount bytes of an
+// in-memory input stream, and skip past them. No data is copied. The function
+// returns NULL if the stream is not an in-memory stream, or if there are less
+// than aCount bytes left in the stream.
+//-----------------------------------------------------------------------------
+const unsigned char * _ctmStreamReadDirect(_CTMcontext * self, CTMuint aCount)
+{
+  const unsigned char * ptr;
+
+  if(!self->mInBuf || (aCount > self->mInBufSize - self->mInBufPos))
+    return (const unsigned char *) 0;
+
+  ptr = &self->mInBuf[self->mInBufPos];
+  self->mInBufPos += aCount;
+  return ptr;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamSkip() - Skip aCount bytes of an input stream. In-memory and
+// seekable streams are skipped without reading any data, while other streams
+// are read and the data is discarded. The function returns CTM_FALSE if the
+// end of the stream was reached before all bytes were skipped.
+//-----------------------------------------------------------------------------
+int _ctmStreamSkip(_CTMcontext * self, size_t aCount)
+{
+  unsigned char buf[1024];
+  CTMuint count;
+
+  // In-memory stream?
+  if(self->mInBuf)
+  {
+    if(aCount > self->mInBufSize - self->mInBufPos)
+    {
+      self->mInBufPos = self->mInBufSize;
+      return CTM_FALSE;
+    }
+    self->mInBufPos += aCount;
+    return CTM_TRUE;
+  }
+
+  while(aCount > 0)
+  {
+    if(self->mSkipFn)
+    {
+      // Seekable stream
+      count = aCount > 0x40000000 ? 0x40000000 : (CTMuint) aCount;
+      if(!self->mSkipFn(count, self->mUserData))
+        return CTM_FALSE;
+    }
+    else
+    {
+      // Read and discard the data
+      count = aCount > sizeof(buf) ? (CTMuint) sizeof(buf) : (CTMuint) aCount;
+      if(_ctmStreamRead(self, (void *) buf, count) != count)
+        return CTM_FALSE;
+    }
+    aCount -= count;
+  }
+
+  return CTM_TRUE;
+}
+
 //-----------------------------------------------------------------------------
 // _ctmStreamWrite() - Write data to a stream.
 //-----------------------------------------------------------------------------
 CTMuint _ctmStreamWrite(_CTMcontext * self, void * aBuf, CTMuint aCount)
 {
+  CTMuint count;
+
   if(!self->mUserData || !self->mWriteFn)
     return 0;
 
-  return self->mWriteFn(aBuf, aCount, self->mUserData);
+  count = self->mWriteFn(aBuf, aCount, self->mUserData);
+  self->mWritePos += count;
+  return count;
 }
 
 //-----------------------------------------------------------------------------
@@ -125,7 +294,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Clear the old string
   if(*aValue)
   {
-    free(*aValue);
+    _ctmFree(&self->mAllocator, *aValue);
     *aValue = (char *) 0;
   }
 
@@ -135,7 +304,7 @@ void _ctmStreamReadSTRING(_CTMcontext * self, char ** aValue)
   // Read string
   if(len > 0)
   {
-    *aValue = (char *) malloc(len + 1);
+    *aValue = (char *) _ctmAlloc(&self->mAllocator, len + 1);
     if(*aValue)
     {
       _ctmStreamRead(self, (void *) *aValue, len);
@@ -168,345 +337,1521 @@ void _ctmStreamWriteSTRING(_CTMcontext * self, const char * aValue)
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedInts() - Read an compressed binary integer data array
-// from a stream, and uncompress it.
+// _ctmInitPackedSection() - Initialize a packed section descriptor.
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static void _ctmInitPackedSection(_CTMpackedsection * aSection, void * aData,
+  CTMuint aCount, CTMuint aSize, CTMuint aStride, int aType, int aParams)
 {
-  size_t packedSize, unpackedSize;
-  CTMuint i, k, x;
-  CTMint value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
-  int lzmaRes;
+  memset(aSection, 0, sizeof(_CTMpackedsection));
+  aSection->mData = aData;
+  aSection->mCount = aCount;
+  aSection->mSize = aSize;
+  aSection->mStride = aStride;
+  aSection->mType = aType & ~_CTM_PACKED_NO_INTERLEAVE;
+  aSection->mInterleaved = (aType & _CTM_PACKED_NO_INTERLEAVE) ? CTM_FALSE : CTM_TRUE;
+  aSection->mParams = aParams;
+  aSection->mError = CTM_NONE;
+}
+
+//-----------------------------------------------------------------------------
+// Number of words that are converted at a time by _ctmSectionToPlanes() and
+// _ctmPlanesToSection(), when they have to go through a temporary buffer.
+//-----------------------------------------------------------------------------
+#define _CTM_PLANE_CHUNK 1024
 
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
+//-----------------------------------------------------------------------------
+// _ctmSectionToPlanes() - Convert the integers or floats of a section to four
+// byte planes (aTmp, which holds mCount * mSize * 4 bytes). With interleaving,
+// the words are ordered component by component (all x, all y, ...), otherwise
+// element by element. Words that are not contiguous in mData, or that need
+// signed magnitude conversion, are gathered into a small buffer first.
+//-----------------------------------------------------------------------------
+static void _ctmSectionToPlanes(const _CTMpackedsection * aSection,
+  unsigned char * aTmp, const _CTMplanekernels * aKernels)
+{
+  CTMuint buf[_CTM_PLANE_CHUNK];
+  const unsigned char * data = (const unsigned char *) aSection->mData;
+  size_t words, runs, run, runLength, pos, n, i, j, src;
+  CTMuint size, stride;
+  int contiguous, isSigned;
+
+  size = aSection->mSize;
+  stride = aSection->mStride;
+  words = (size_t) aSection->mCount * size;
+  runs = aSection->mInterleaved ? size : 1;
+  runLength = aSection->mInterleaved ? aSection->mCount : words;
+  contiguous = (runs == 1) && (stride == size);
+  isSigned = (aSection->mType == _CTM_PACKED_SIGNED_INTS);
+
+  for(run = 0; run < runs; ++ run)
+  {
+    for(pos = 0; pos < runLength; pos += n)
+    {
+      n = runLength - pos;
+      if(n > _CTM_PLANE_CHUNK)
+        n = _CTM_PLANE_CHUNK;
+
+      // Split directly from the source array?
+      if(contiguous && !isSigned)
+      {
+        aKernels->mSplit(&data[pos * 4], n, &aTmp[pos], words);
+        continue;
+      }
 
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
+      // Gather the words
+      if(contiguous)
+        memcpy(buf, &data[pos * 4], n * 4);
+      else if(runs > 1)
+      {
+        for(i = 0, src = pos * stride + run; i < n; ++ i, src += stride)
+          memcpy(&buf[i], &data[src * 4], 4);
+      }
+      else
+      {
+        for(i = 0; i < n; ++ i)
+        {
+          j = pos + i;
+          src = (j / size) * stride + j % size;
+          memcpy(&buf[i], &data[src * 4], 4);
+        }
+      }
+
+      // Convert two's complement to signed magnitude?
+      if(isSigned)
+        aKernels->mToSignedMagnitude(buf, n);
 
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
+      aKernels->mSplit(buf, n, &aTmp[run * runLength + pos], words);
+    }
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPlanesToSection() - Convert four byte planes (aTmp) to the integers or
+// floats of a section (the opposite of _ctmSectionToPlanes()).
+//-----------------------------------------------------------------------------
+static void _ctmPlanesToSection(_CTMpackedsection * aSection,
+  const unsigned char * aTmp, const _CTMplanekernels * aKernels)
+{
+  CTMuint buf[_CTM_PLANE_CHUNK];
+  unsigned char * data = (unsigned char *) aSection->mData;
+  size_t words, runs, run, runLength, pos, n, i, j, dst;
+  CTMuint size, stride;
+  int contiguous, isSigned;
+
+  size = aSection->mSize;
+  stride = aSection->mStride;
+  words = (size_t) aSection->mCount * size;
+  runs = aSection->mInterleaved ? size : 1;
+  runLength = aSection->mInterleaved ? aSection->mCount : words;
+  contiguous = (runs == 1) && (stride == size);
+  isSigned = (aSection->mType == _CTM_PACKED_SIGNED_INTS);
+
+  for(run = 0; run < runs; ++ run)
   {
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    for(pos = 0; pos < runLength; pos += n)
+    {
+      n = runLength - pos;
+      if(n > _CTM_PLANE_CHUNK)
+        n = _CTM_PLANE_CHUNK;
+
+      // Join directly into the destination array?
+      if(contiguous && !isSigned)
+      {
+        aKernels->mJoin(&aTmp[pos], words, &data[pos * 4], n);
+        continue;
+      }
+
+      aKernels->mJoin(&aTmp[run * runLength + pos], words, buf, n);
+
+      // Convert signed magnitude to two's complement?
+      if(isSigned)
+        aKernels->mFromSignedMagnitude(buf, n);
+
+      // Scatter the words
+      if(contiguous)
+        memcpy(&data[pos * 4], buf, n * 4);
+      else if(runs > 1)
+      {
+        for(i = 0, dst = pos * stride + run; i < n; ++ i, dst += stride)
+          memcpy(&data[dst * 4], &buf[i], 4);
+      }
+      else
+      {
+        for(i = 0; i < n; ++ i)
+        {
+          j = pos + i;
+          dst = (j / size) * stride + j % size;
+          memcpy(&data[dst * 4], &buf[i], 4);
+        }
+      }
+    }
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
+}
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+//-----------------------------------------------------------------------------
+// _CTMwordcursor - Position of a word of a section in byte plane order (see
+// _ctmSectionToPlanes()), and its index in mData. A run is a stretch of words
+// with a constant distance in mData: with interleaving, it is one component
+// of all elements, otherwise it is all components of one element (or all
+// words, if the elements are tightly packed).
+//-----------------------------------------------------------------------------
+typedef struct {
+  size_t mRunLength; // Number of words in a run
+  size_t mRunStride; // Distance between the first words of two runs in mData
+  size_t mStep;      // Distance between two words of a run in mData
+  size_t mRun;       // Current run
+  size_t mPos;       // Current position in the run
+  size_t mIndex;     // Index of the current word in mData
+} _CTMwordcursor;
+
+static void _ctmInitWordCursor(_CTMwordcursor * aCursor,
+  const _CTMpackedsection * aSection, size_t aWord)
+{
+  if(aSection->mInterleaved)
   {
-    free(packed);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    aCursor->mRunLength = aSection->mCount;
+    aCursor->mRunStride = 1;
+    aCursor->mStep = aSection->mStride;
+  }
+  else if(aSection->mStride == aSection->mSize)
+  {
+    aCursor->mRunLength = (size_t) aSection->mCount * aSection->mSize;
+    aCursor->mRunStride = aCursor->mRunLength;
+    aCursor->mStep = 1;
   }
+  else
+  {
+    aCursor->mRunLength = aSection->mSize;
+    aCursor->mRunStride = aSection->mStride;
+    aCursor->mStep = 1;
+  }
+  aCursor->mRun = aWord / aCursor->mRunLength;
+  aCursor->mPos = aWord % aCursor->mRunLength;
+  aCursor->mIndex = aCursor->mRun * aCursor->mRunStride +
+                    aCursor->mPos * aCursor->mStep;
+}
 
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
+static void _ctmSkipWords(_CTMwordcursor * aCursor, size_t aCount)
+{
+  aCursor->mPos += aCount;
+  aCursor->mRun += aCursor->mPos / aCursor->mRunLength;
+  aCursor->mPos %= aCursor->mRunLength;
+  aCursor->mIndex = aCursor->mRun * aCursor->mRunStride +
+                    aCursor->mPos * aCursor->mStep;
+}
+
+static void _ctmNextWord(_CTMwordcursor * aCursor)
+{
+  if(++ aCursor->mPos == aCursor->mRunLength)
+  {
+    aCursor->mPos = 0;
+    ++ aCursor->mRun;
+    aCursor->mIndex = aCursor->mRun * aCursor->mRunStride;
+  }
+  else
+    aCursor->mIndex += aCursor->mStep;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPlaneByteOffset() - Get the memory offset of the byte of byte plane
+// aPlane (0 = most significant) in a 32-bit word, for this machine.
+//-----------------------------------------------------------------------------
+static size_t _ctmPlaneByteOffset(unsigned int aPlane)
+{
+  const CTMuint one = 1;
+  return *((const unsigned char *) &one) ? 3 - aPlane : aPlane;
+}
 
-  // Free the packed array
-  free(packed);
+//-----------------------------------------------------------------------------
+// _ctmCopySectionWords() - Copy aCount words of a section, starting at word
+// aFirst in byte plane order, from mData to aWords (or from aWords to mData,
+// if aToSection is CTM_TRUE).
+//-----------------------------------------------------------------------------
+static void _ctmCopySectionWords(const _CTMpackedsection * aSection,
+  size_t aFirst, CTMuint * aWords, size_t aCount, int aToSection)
+{
+  unsigned char * data = (unsigned char *) aSection->mData;
+  _CTMwordcursor cursor;
+  size_t i;
 
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  _ctmInitWordCursor(&cursor, aSection, aFirst);
+  for(i = 0; i < aCount; ++ i, _ctmNextWord(&cursor))
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
-    return CTM_FALSE;
+    if(aToSection)
+      memcpy(&data[cursor.mIndex * 4], &aWords[i], 4);
+    else
+      memcpy(&aWords[i], &data[cursor.mIndex * 4], 4);
   }
+}
 
-  // Convert interleaved array to integers
-  for(i = 0; i < aCount; ++ i)
+//-----------------------------------------------------------------------------
+// _ctmGetPlaneBytes() - Get aCount bytes of the byte planes of a section (as
+// produced by _ctmSectionToPlanes()), starting at byte aOffset, directly from
+// the integers or floats of the section.
+//-----------------------------------------------------------------------------
+static void _ctmGetPlaneBytes(const _CTMpackedsection * aSection,
+  size_t aOffset, unsigned char * aBytes, size_t aCount,
+  const _CTMplanekernels * aKernels)
+{
+  CTMuint buf[_CTM_PLANE_CHUNK];
+  const unsigned char * data = (const unsigned char *) aSection->mData;
+  const unsigned char * src;
+  _CTMwordcursor cursor;
+  size_t words, word, n, i, j, m, step, byteOffset;
+  unsigned int plane;
+
+  words = (size_t) aSection->mCount * aSection->mSize;
+  while(aCount > 0)
   {
-    for(k = 0; k < aSize; ++ k)
+    word = aOffset % words;
+    plane = (unsigned int) (aOffset / words);
+    n = words - word;
+    if(n > aCount)
+      n = aCount;
+
+    if(aSection->mType == _CTM_PACKED_SIGNED_INTS)
     {
-      value = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-              (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-              (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-              (((CTMint) tmp[i + k * aCount]) << 24);
-      // Convert signed magnitude to two's complement?
-      if(aSignedInts)
+      // Signed magnitude conversion needs whole words
+      if(n > _CTM_PLANE_CHUNK)
+        n = _CTM_PLANE_CHUNK;
+      _ctmCopySectionWords(aSection, word, buf, n, CTM_FALSE);
+      aKernels->mToSignedMagnitude(buf, n);
+      for(i = 0; i < n; ++ i)
+        aBytes[i] = (unsigned char) (buf[i] >> (24 - 8 * plane));
+    }
+    else
+    {
+      // Get the bytes run by run
+      byteOffset = _ctmPlaneByteOffset(plane);
+      _ctmInitWordCursor(&cursor, aSection, word);
+      step = cursor.mStep * 4;
+      for(i = 0; i < n; i += m)
       {
-        x = (CTMuint) value;
-        value = (x & 1) ? -(CTMint)((x + 1) >> 1) : (CTMint)(x >> 1);
+        m = cursor.mRunLength - cursor.mPos;
+        if(m > n - i)
+          m = n - i;
+        src = &data[cursor.mIndex * 4 + byteOffset];
+        for(j = 0; j < m; ++ j)
+          aBytes[i + j] = src[j * step];
+        _ctmSkipWords(&cursor, m);
       }
-      aData[i * aSize + k] = value;
     }
+
+    aBytes += n;
+    aOffset += n;
+    aCount -= n;
   }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSetPlaneBytes() - Store aCount bytes of the byte planes of a section,
+// starting at byte aOffset, directly in the integers or floats of the section
+// (the opposite of _ctmGetPlaneBytes()). Signed integers are converted from
+// signed magnitude when their last byte plane is stored, so the planes must
+// be stored in order.
+//-----------------------------------------------------------------------------
+static void _ctmSetPlaneBytes(_CTMpackedsection * aSection, size_t aOffset,
+  const unsigned char * aBytes, size_t aCount,
+  const _CTMplanekernels * aKernels)
+{
+  CTMuint buf[_CTM_PLANE_CHUNK];
+  unsigned char * data = (unsigned char *) aSection->mData;
+  unsigned char * dst;
+  _CTMwordcursor cursor;
+  size_t words, word, n, i, j, m, step, byteOffset;
+  unsigned int plane;
+
+  words = (size_t) aSection->mCount * aSection->mSize;
+  while(aCount > 0)
+  {
+    word = aOffset % words;
+    plane = (unsigned int) (aOffset / words);
+    n = words - word;
+    if(n > aCount)
+      n = aCount;
+
+    // Store the bytes run by run
+    byteOffset = _ctmPlaneByteOffset(plane);
+    _ctmInitWordCursor(&cursor, aSection, word);
+    step = cursor.mStep * 4;
+    for(i = 0; i < n; i += m)
+    {
+      m = cursor.mRunLength - cursor.mPos;
+      if(m > n - i)
+        m = n - i;
+      dst = &data[cursor.mIndex * 4 + byteOffset];
+      for(j = 0; j < m; ++ j)
+        dst[j * step] = aBytes[i + j];
+      _ctmSkipWords(&cursor, m);
+    }
 
-  // Free the interleaved array
-  free(tmp);
+    // Convert signed magnitude to two's complement?
+    if((plane == 3) && (aSection->mType == _CTM_PACKED_SIGNED_INTS))
+    {
+      for(j = 0; j < n; j += m)
+      {
+        m = n - j;
+        if(m > _CTM_PLANE_CHUNK)
+          m = _CTM_PLANE_CHUNK;
+        _ctmCopySectionWords(aSection, word + j, buf, m, CTM_FALSE);
+        aKernels->mFromSignedMagnitude(buf, m);
+        _ctmCopySectionWords(aSection, word + j, buf, m, CTM_TRUE);
+      }
+    }
 
-  return CTM_TRUE;
+    aBytes += n;
+    aOffset += n;
+    aCount -= n;
+  }
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedInts() - Compress a binary integer data array, and
-// write it to a stream.
+// _ctmUnpackSection() - Uncompress a packed section that has been read from a
+// stream, and convert it to integers or floats. aTmp is a buffer of (at least)
+// mCount * mSize * 4 bytes for the interleaved array. This function does not
+// touch the context (only its allocator and byte plane kernels), so it is safe
+// to call from several threads at once (for different sections and buffers).
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedInts(_CTMcontext * self, CTMint * aData,
-  CTMuint aCount, CTMuint aSize, CTMint aSignedInts)
+static void _ctmUnpackSection(_CTMpackedsection * aSection,
+  unsigned char * aTmp, const _CTMplanekernels * aKernels,
+  const _CTMallocator * aAllocator)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  CTMint value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
-#ifdef __DEBUG_
-  CTMuint negCount = 0;  
+  size_t packedSize, unpackedSize;
+  const unsigned char * planes = aTmp;
+  _CTMlzmaalloc lzmaAlloc;
+  ELzmaStatus lzmaStatus;
+  CTMenum error = CTM_NONE;
+  int lzmaRes;
+#ifdef OPENCTM_WITH_ZSTD
+  size_t zstdRes;
+#endif
+#ifdef OPENCTM_WITH_LZ4
+  int lz4Res;
 #endif
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+  // Uncompress
+  packedSize = aSection->mPackedSize;
+  unpackedSize = (size_t) aSection->mCount * aSection->mSize * 4;
+  switch(_ctmSectionBackend(aSection->mProps))
   {
-    self->mError = CTM_OUT_OF_MEMORY;
+    case CTM_BACKEND_LZMA:
+      _ctmInitLzmaAlloc(&lzmaAlloc, aAllocator);
+      lzmaRes = LzmaDecode(aTmp, &unpackedSize, aSection->mPacked, &packedSize,
+                           aSection->mProps, 5, LZMA_FINISH_ANY, &lzmaStatus,
+                           &lzmaAlloc.mFuncs);
+      if((lzmaRes != SZ_OK) ||
+         (unpackedSize != (size_t) aSection->mCount * aSection->mSize * 4))
+        error = CTM_LZMA_ERROR;
+      break;
+
+    case CTM_BACKEND_STORED:
+      // The byte planes are used as is (no copy)
+      if(packedSize != unpackedSize)
+        error = CTM_BAD_FORMAT;
+      planes = aSection->mPacked;
+      break;
+
+#ifdef OPENCTM_WITH_ZSTD
+    case CTM_BACKEND_ZSTD:
+      zstdRes = ZSTD_decompress(aTmp, unpackedSize, aSection->mPacked,
+                                packedSize);
+      if(ZSTD_isError(zstdRes) || (zstdRes != unpackedSize))
+        error = CTM_LZMA_ERROR;
+      break;
+#endif
+
+#ifdef OPENCTM_WITH_LZ4
+    case CTM_BACKEND_LZ4:
+      lz4Res = LZ4_decompress_safe((const char *) aSection->mPacked,
+                                   (char *) aTmp, (int) packedSize,
+                                   (int) unpackedSize);
+      if((lz4Res < 0) || ((size_t) lz4Res != unpackedSize))
+        error = CTM_LZMA_ERROR;
+      break;
+#endif
+
+    default:
+      error = CTM_UNSUPPORTED_BACKEND;
+  }
+
+  // Convert interleaved array to integers or floats
+  if(error == CTM_NONE)
+    _ctmPlanesToSection(aSection, planes, aKernels);
+  aSection->mPacked = (const unsigned char *) 0;
+  aSection->mError = error;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmBlockCount() - Get the number of blocks that an array of aCount
+// elements is split into, when each block holds aBlockSize elements (zero
+// means that the array is not split into blocks).
+//-----------------------------------------------------------------------------
+CTMuint _ctmBlockCount(CTMuint aCount, CTMuint aBlockSize)
+{
+  if((aBlockSize == 0) || (aCount == 0))
+    return 1;
+  return (aCount - 1) / aBlockSize + 1;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmInitPackedSections() - Initialize the section descriptors for a packed
+// array. If aBlockSize is non-zero, the array is split into blocks of (at
+// most) aBlockSize elements, and each block is described by a section of its
+// own. The first section is *aSections, and *aSections is advanced past the
+// last section of the array. aStride is the distance between two elements in
+// aData (zero means aSize, i.e. tightly packed elements). aParams is the array
+// class (_CTM_PARAMS_*) that selects the LZMA tuning parameters for packing.
+//-----------------------------------------------------------------------------
+void _ctmInitPackedSections(_CTMpackedsection ** aSections, void * aData,
+  CTMuint aCount, CTMuint aSize, CTMuint aStride, int aType, int aParams,
+  CTMuint aBlockSize)
+{
+  CTMuint i, blockCount, count;
+  CTMint * data;
+
+  if(aStride == 0)
+    aStride = aSize;
+  blockCount = _ctmBlockCount(aCount, aBlockSize);
+  data = (CTMint *) aData;
+  for(i = 0; i < blockCount; ++ i)
+  {
+    count = (i < blockCount - 1) ? aBlockSize : aCount - i * aBlockSize;
+    _ctmInitPackedSection(*aSections, (void *) data, count, aSize, aStride, aType, aParams);
+    (*aSections)->mBlockCount = aBlockSize ? blockCount : 0;
+    data += (size_t) count * aStride;
+    ++ (*aSections);
+  }
+}
+
+//-----------------------------------------------------------------------------
+// Size of the input and output chunks for streamed packing and unpacking.
+//-----------------------------------------------------------------------------
+#define _CTM_STREAM_CHUNK (1 << 16)
+
+//-----------------------------------------------------------------------------
+// Largest section that is unpacked in one piece by _ctmStreamUnpackLZMA() (so
+// that its byte planes can be joined by the plane kernels). Larger sections
+// are unpacked through a ring buffer.
+//-----------------------------------------------------------------------------
+#define _CTM_STREAM_WHOLE (1 << 24)
+
+//-----------------------------------------------------------------------------
+// _ctmStreamUnpackLZMA() - Read and unpack an LZMA section from a stream,
+// straight into the integers or floats of the section. The packed data is
+// read in small chunks (or used in place for in-memory streams), and the
+// decoder writes to a ring buffer that is no larger than the LZMA dictionary,
+// so the temporary memory does not depend on the size of the section. Small
+// sections (see _CTM_STREAM_WHOLE) are unpacked in one piece instead, and
+// their byte planes are joined by the plane kernels, which is much faster
+// than storing the bytes one by one as they come.
+//-----------------------------------------------------------------------------
+static int _ctmStreamUnpackLZMA(_CTMcontext * self,
+  _CTMpackedsection * aSection)
+{
+  CLzmaDec lzmaDec;
+  _CTMlzmaalloc lzmaAlloc;
+  ELzmaStatus lzmaStatus;
+  const unsigned char * src;
+  unsigned char * buf;
+  size_t unpackedSize, unpacked, ringSize, srcSize, srcPos, srcLeft, dicStart,
+         dicLimit, srcLen, count;
+  CTMenum error = CTM_NONE;
+  int lzmaRes, whole;
+
+  unpackedSize = (size_t) aSection->mCount * aSection->mSize * 4;
+
+  // Set up the decoder (the ring buffer is only as large as the dictionary,
+  // or holds all the unpacked data if that is small)
+  _ctmInitLzmaAlloc(&lzmaAlloc, &self->mAllocator);
+  LzmaDec_Construct(&lzmaDec);
+  lzmaRes = LzmaDec_AllocateProbs(&lzmaDec, aSection->mProps, 5, &lzmaAlloc.mFuncs);
+  if(lzmaRes != SZ_OK)
+  {
+    self->mError = (lzmaRes == SZ_ERROR_MEM) ? CTM_OUT_OF_MEMORY : CTM_LZMA_ERROR;
     return CTM_FALSE;
   }
+  ringSize = lzmaDec.prop.dicSize;
+  if(ringSize < (1 << 12))
+    ringSize = 1 << 12;
+  if((ringSize > unpackedSize) || (unpackedSize <= _CTM_STREAM_WHOLE))
+    ringSize = unpackedSize;
+  whole = (ringSize == unpackedSize);
+  lzmaDec.dic = (Byte *) _ctmScratchAlloc(self, ringSize);
+  lzmaDec.dicBufSize = ringSize;
+  LzmaDec_Init(&lzmaDec);
+
+  // Get the packed data (in place, or through a chunk buffer)
+  buf = (unsigned char *) 0;
+  src = (const unsigned char *) 0;
+  srcSize = srcPos = srcLeft = 0;
+  if(self->mInBuf)
+  {
+    src = _ctmStreamReadDirect(self, (CTMuint) aSection->mPackedSize);
+    if(!src)
+      error = CTM_BAD_FORMAT;
+    srcSize = aSection->mPackedSize;
+  }
+  else
+  {
+    buf = (unsigned char *) _ctmScratchAlloc(self, _CTM_STREAM_CHUNK);
+    src = buf;
+    srcLeft = aSection->mPackedSize;
+  }
+  if(!lzmaDec.dic || (!self->mInBuf && !buf))
+    error = CTM_OUT_OF_MEMORY;
 
-  // Convert integers to an interleaved array
-  for(i = 0; i < aCount; ++ i)
+  // Decode, and move the unpacked bytes out of the ring buffer as they come
+  unpacked = 0;
+  while((error == CTM_NONE) && (unpacked < unpackedSize))
   {
-    for(k = 0; k < aSize; ++ k)
+    // Read the next chunk of packed data?
+    if((srcPos == srcSize) && (srcLeft > 0))
     {
-      value = aData[i * aSize + k];
-      // Convert two's complement to signed magnitude?
-      if(aSignedInts)
-        value = value < 0 ? -1 - (value << 1) : value << 1;
-#ifdef __DEBUG_
-      else if(value < 0)
-        ++ negCount;
-#endif
-      tmp[i + k * aCount + 3 * aCount * aSize] = value & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value >> 24) & 0x000000ff;
+      count = srcLeft < _CTM_STREAM_CHUNK ? srcLeft : _CTM_STREAM_CHUNK;
+      if(_ctmStreamRead(self, (void *) buf, (CTMuint) count) != count)
+      {
+        error = CTM_LZMA_ERROR;
+        break;
+      }
+      srcLeft -= count;
+      srcSize = count;
+      srcPos = 0;
     }
+
+    if(lzmaDec.dicPos == lzmaDec.dicBufSize)
+      lzmaDec.dicPos = 0;
+    dicStart = lzmaDec.dicPos;
+    dicLimit = lzmaDec.dicBufSize;
+    if(dicLimit - dicStart > unpackedSize - unpacked)
+      dicLimit = dicStart + (unpackedSize - unpacked);
+    srcLen = srcSize - srcPos;
+    lzmaRes = LzmaDec_DecodeToDic(&lzmaDec, dicLimit, src + srcPos, &srcLen,
+                                  LZMA_FINISH_ANY, &lzmaStatus);
+    srcPos += srcLen;
+    count = lzmaDec.dicPos - dicStart;
+    if(!whole)
+      _ctmSetPlaneBytes(aSection, unpacked, lzmaDec.dic + dicStart, count,
+                        self->mPlaneKernels);
+    unpacked += count;
+
+    // Stop on errors, and if the decoder gets stuck (the packed data ended
+    // before all the unpacked data was produced)
+    if((lzmaRes != SZ_OK) || ((count == 0) && (srcLen == 0)))
+      error = CTM_LZMA_ERROR;
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+  // Skip any packed data that was not needed
+  if((error == CTM_NONE) && (srcLeft > 0) && !_ctmStreamSkip(self, srcLeft))
+    error = CTM_LZMA_ERROR;
+
+  // Join the byte planes of a section that was unpacked in one piece
+  if((error == CTM_NONE) && whole)
+    _ctmPlanesToSection(aSection, lzmaDec.dic, self->mPlaneKernels);
+
+  LzmaDec_FreeProbs(&lzmaDec, &lzmaAlloc.mFuncs);
+  if(error != CTM_NONE)
   {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
+    self->mError = error;
     return CTM_FALSE;
   }
+  return CTM_TRUE;
+}
 
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
-
-  // Error?
-  if(lzmaRes != SZ_OK)
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedData() - Read the LZMA props (or backend tag) and the
+// packed data of a section from a stream. Without threaded decoding, LZMA
+// sections are unpacked as they are read (see _ctmStreamUnpackLZMA()). Other
+// sections are taken directly from in-memory streams (no copy), or read into
+// a scratch buffer. They are then unpacked immediately (and the scratch
+// buffer is released), unless threaded decoding is enabled, in which case
+// they are unpacked later by _ctmUnpackSections().
+//-----------------------------------------------------------------------------
+static int _ctmStreamReadPackedData(_CTMcontext * self,
+  _CTMpackedsection * aSection)
+{
+  unsigned char * buf;
+  size_t mark;
+  CTMenum backend;
+  int result;
+
+  mark = _ctmScratchMark(self);
+
+  // Read LZMA compression props (or backend tag) from the stream
+  if(_ctmStreamRead(self, (void *) aSection->mProps, 5) != 5)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
+    self->mError = CTM_BAD_FORMAT;
     return CTM_FALSE;
   }
+  backend = _ctmSectionBackend(aSection->mProps);
+  if(!_ctmHaveBackend(backend))
+  {
+    self->mError = CTM_UNSUPPORTED_BACKEND;
+    return CTM_FALSE;
+  }
+  self->mBackend = backend;
 
-#ifdef __DEBUG_
-  printf("%d->%d bytes (%d negative words)\n", aCount * aSize * 4, (int) bufSize, negCount);
-#endif
+  // Unpack LZMA sections as a stream now (unless they are unpacked in
+  // parallel later)?
+  if((backend == CTM_BACKEND_LZMA) && (self->mDecodeThreads < 2))
+  {
+    result = _ctmStreamUnpackLZMA(self, aSection);
+    _ctmScratchRelease(self, mark);
+    return result;
+  }
+
+  // Get the packed data from the stream
+  if(self->mInBuf)
+  {
+    // In-memory stream (zero copy)
+    aSection->mPacked = _ctmStreamReadDirect(self, (CTMuint) aSection->mPackedSize);
+    if(!aSection->mPacked)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+  }
+  else
+  {
+    // Read the packed data from the stream into a scratch buffer
+    buf = (unsigned char *) _ctmScratchAlloc(self, aSection->mPackedSize);
+    if(!buf)
+    {
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    if(_ctmStreamRead(self, (void *) buf, (CTMuint) aSection->mPackedSize) !=
+       aSection->mPackedSize)
+    {
+      self->mError = CTM_BAD_FORMAT;
+      _ctmScratchRelease(self, mark);
+      return CTM_FALSE;
+    }
+    aSection->mPacked = buf;
+  }
+
+  // Unpack now?
+  if(self->mDecodeThreads < 2)
+  {
+    result = _ctmUnpackSections(self, aSection, 1);
+    _ctmScratchRelease(self, mark);
+    return result;
+  }
+
+  return CTM_TRUE;
+}
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+//-----------------------------------------------------------------------------
+// _ctmStreamReadPackedArray() - Read a packed (compressed) integer or float
+// array from a stream. The array is described by one or more sections (see
+// _ctmInitPackedSections()), starting at *aSections. A blocked array (MG3)
+// starts with a table of the packed sizes of all the blocks, followed by the
+// LZMA props and packed data of each block. *aSections is advanced past the
+// last section of the array. If aData is NULL, the array is skipped (and no
+// sections are used).
+//-----------------------------------------------------------------------------
+int _ctmStreamReadPackedArray(_CTMcontext * self,
+  _CTMpackedsection ** aSections, void * aData, CTMuint aCount, CTMuint aSize,
+  CTMuint aStride, int aType, CTMuint aBlockSize)
+{
+  _CTMpackedsection * first;
+  CTMuint i, blockCount;
+  size_t skipSize;
+
+  // Skip the array (without unpacking it)?
+  if(!aData)
+  {
+    blockCount = _ctmBlockCount(aCount, aBlockSize);
+    skipSize = 0;
+    for(i = 0; i < blockCount; ++ i)
+      skipSize += 5 + (size_t) _ctmStreamReadUINT(self);
+    if(!_ctmStreamSkip(self, skipSize))
+    {
+      self->mError = CTM_BAD_FORMAT;
+      return CTM_FALSE;
+    }
+    return CTM_TRUE;
+  }
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+  first = *aSections;
+  _ctmInitPackedSections(aSections, aData, aCount, aSize, aStride, aType, 0, aBlockSize);
+  blockCount = (CTMuint) (*aSections - first);
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+  // Read the packed data size(s) from the stream
+  for(i = 0; i < blockCount; ++ i)
+    first[i].mPackedSize = (size_t) _ctmStreamReadUINT(self);
 
-  // Free the packed data
-  free(packed);
+  // Read the packed data
+  for(i = 0; i < blockCount; ++ i)
+  {
+    if(!_ctmStreamReadPackedData(self, &first[i]))
+      return CTM_FALSE;
+  }
 
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamReadPackedFloats() - Read an compressed binary float data array
-// from a stream, and uncompress it.
+// _ctmPackedBufSize() - Get the size of the output buffer for packing a
+// section with a given backend (worst case).
 //-----------------------------------------------------------------------------
-int _ctmStreamReadPackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+static size_t _ctmPackedBufSize(const _CTMpackedsection * aSection,
+  CTMenum aBackend)
+{
+  size_t size = (size_t) aSection->mCount * aSection->mSize * 4;
+  switch(aBackend)
+  {
+    case CTM_BACKEND_STORED:
+      return size;
+#ifdef OPENCTM_WITH_ZSTD
+    case CTM_BACKEND_ZSTD:
+      return ZSTD_compressBound(size);
+#endif
+#ifdef OPENCTM_WITH_LZ4
+    case CTM_BACKEND_LZ4:
+      return size + size / 255 + 16;
+#endif
+    default:
+      return 1000 + size;
+  }
+}
+
+#ifdef OPENCTM_WITH_LZ4
+//-----------------------------------------------------------------------------
+// _ctmPackLZ4() - Compress a buffer with LZ4 (the fast coder at level 0,
+// otherwise the HC coder). The coder state is allocated with the context
+// allocator. Returns the packed size, or zero on failure.
+//-----------------------------------------------------------------------------
+static size_t _ctmPackLZ4(const unsigned char * aSrc, size_t aSrcSize,
+  unsigned char * aDst, size_t aDstSize, CTMuint aLevel,
+  const _CTMallocator * aAllocator)
+{
+  void * state;
+  int res;
+
+  state = _ctmAlloc(aAllocator, aLevel < 1 ? (size_t) LZ4_sizeofState() :
+                                             (size_t) LZ4_sizeofStateHC());
+  if(!state)
+    return 0;
+  if(aLevel < 1)
+    res = LZ4_compress_fast_extState(state, (const char *) aSrc,
+                                     (char *) aDst, (int) aSrcSize,
+                                     (int) aDstSize, 1);
+  else
+    res = LZ4_compress_HC_extStateHC(state, (const char *) aSrc,
+                                     (char *) aDst, (int) aSrcSize,
+                                     (int) aDstSize, (int) aLevel + 3);
+  _ctmFree(aAllocator, state);
+  return res > 0 ? (size_t) res : 0;
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// _ctmSetLzmaProps() - Set the LZMA encoder props for packing aSize bytes,
+// from the compression level and the tuning parameters of the array class.
+// With an automatic dictionary size, the dictionary is no larger than the
+// data (but at least 4 KB, and no larger than the default for the level),
+// which saves a lot of encoder memory for small arrays at high levels.
+// aThreads is the number of threads for the match finder (1 or 2), which
+// only has an effect when liblzma is built with COMPRESS_MF_MT. If aFast is
+// CTM_TRUE, the fast algorithm is used regardless of the level.
+//-----------------------------------------------------------------------------
+static void _ctmSetLzmaProps(CLzmaEncProps * aProps, CTMuint aLevel,
+  const _CTMlzmaparams * aParams, int aThreads, int aFast, size_t aSize)
+{
+  UInt32 dictSize;
+
+  LzmaEncProps_Init(aProps);
+  aProps->level = (int) aLevel;          // Level (0-9)
+  aProps->algo = ((aLevel < 1) || aFast) ? 0 : 1; // Algorithm (0 = fast, 1 = normal)
+  aProps->lc = aParams->mLC;
+  aProps->lp = aParams->mLP;
+  aProps->pb = aParams->mPB;
+  aProps->fb = aParams->mFB;
+  aProps->numThreads = aThreads;
+  if(aParams->mDictSize > 0)
+    aProps->dictSize = (UInt32) aParams->mDictSize;
+  else if(aParams->mDictSize == 0)
+  {
+    // The remaining props get default values (set by the level)
+    LzmaEncProps_Normalize(aProps);
+    dictSize = 1 << 12;
+    while((dictSize < aProps->dictSize) && (dictSize < aSize))
+      dictSize <<= 1;
+    aProps->dictSize = dictSize;
+  }
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackSection() - Convert the integers or floats of a section to an
+// interleaved byte array, and compress it into mPackedBuf (which must hold
+// _ctmPackedBufSize() bytes) with the given backend, level, LZMA tuning
+// parameters and LZMA match finder threads. With aFast, the fastest coder of
+// the backend is used (for size estimation). aTmp is a buffer of (at
+// least) mCount * mSize * 4 bytes for the interleaved array. Like
+// _ctmUnpackSection(), this function does not touch the context (only its
+// allocator and byte plane kernels), so it is safe to call from several
+// threads at once (for different sections and buffers).
+//-----------------------------------------------------------------------------
+static void _ctmPackSection(_CTMpackedsection * aSection, CTMenum aBackend,
+  CTMuint aLevel, int aFast, const _CTMlzmaparams * aParams, int aLzmaThreads,
+  unsigned char * aTmp,
+  const _CTMplanekernels * aKernels, const _CTMallocator * aAllocator)
 {
-  CTMuint i, k;
-  size_t packedSize, unpackedSize;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  unsigned char * packed, * tmp;
-  unsigned char props[5];
   int lzmaRes;
+  size_t size, bufSize, outPropsSize;
+  CLzmaEncProps lzmaProps;
+  _CTMlzmaalloc lzmaAlloc;
+#ifdef OPENCTM_WITH_ZSTD
+  size_t zstdRes;
+#endif
 
-  // Read packed data size from the stream
-  packedSize = (size_t) _ctmStreamReadUINT(self);
+  size = (size_t) aSection->mCount * aSection->mSize * 4;
+  bufSize = _ctmPackedBufSize(aSection, aBackend);
+  memset(aSection->mProps, 0, 5);
 
-  // Read LZMA compression props from the stream
-  _ctmStreamRead(self, (void *) props, 5);
+  // The fastest zstd and LZ4 coders are used at level 0 (LZMA instead keeps
+  // the dictionary size of the level, see _ctmSetLzmaProps())
+  if(aFast && (aBackend != CTM_BACKEND_LZMA))
+    aLevel = 0;
 
-  // Allocate memory and read the packed data from the stream
-  packed = (unsigned char *) malloc(packedSize);
-  if(!packed)
+  switch(aBackend)
+  {
+    case CTM_BACKEND_STORED:
+      // Convert integers or floats directly into the output buffer
+      _ctmSectionToPlanes(aSection, aSection->mPackedBuf, aKernels);
+      aSection->mProps[0] = _CTM_TAG_STORED;
+      bufSize = size;
+      break;
+
+#ifdef OPENCTM_WITH_ZSTD
+    case CTM_BACKEND_ZSTD:
+      // Levels 0-9 are mapped to zstd levels 1-19
+      _ctmSectionToPlanes(aSection, aTmp, aKernels);
+      aSection->mProps[0] = _CTM_TAG_ZSTD;
+      zstdRes = ZSTD_compress(aSection->mPackedBuf, bufSize, aTmp, size,
+                              1 + 2 * (int) aLevel);
+      if(ZSTD_isError(zstdRes))
+      {
+        aSection->mError = CTM_LZMA_ERROR;
+        return;
+      }
+      bufSize = zstdRes;
+      break;
+#endif
+
+#ifdef OPENCTM_WITH_LZ4
+    case CTM_BACKEND_LZ4:
+      _ctmSectionToPlanes(aSection, aTmp, aKernels);
+      aSection->mProps[0] = _CTM_TAG_LZ4;
+      bufSize = _ctmPackLZ4(aTmp, size, aSection->mPackedBuf, bufSize, aLevel,
+                            aAllocator);
+      if(bufSize == 0)
+      {
+        aSection->mError = CTM_LZMA_ERROR;
+        return;
+      }
+      break;
+#endif
+
+    default:
+      // Convert integers or floats to an interleaved array
+      _ctmSectionToPlanes(aSection, aTmp, aKernels);
+
+      // Call LZMA to compress
+      _ctmSetLzmaProps(&lzmaProps, aLevel, aParams, aLzmaThreads, aFast,
+                       size);
+      outPropsSize = 5;
+      _ctmInitLzmaAlloc(&lzmaAlloc, aAllocator);
+      lzmaRes = LzmaEncode(aSection->mPackedBuf, &bufSize,
+                           (const unsigned char *) aTmp, size, &lzmaProps,
+                           aSection->mProps, &outPropsSize, 0,
+                           (ICompressProgress *) 0, &lzmaAlloc.mFuncs,
+                           &lzmaAlloc.mFuncs);
+      if(lzmaRes != SZ_OK)
+      {
+        aSection->mError = CTM_LZMA_ERROR;
+        return;
+      }
+  }
+
+  aSection->mPacked = aSection->mPackedBuf;
+  aSection->mPackedSize = bufSize;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmSectionJob() - Job function for packing or unpacking sections in
+// parallel. Each worker has its own interleave buffer.
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMpackedsection ** mSections;
+  const _CTMallocator * mAllocator;
+  const _CTMplanekernels * mKernels;
+  unsigned char * mTmp;
+  size_t mTmpSize;
+  CTMenum mBackend;
+  CTMuint mLevel;
+  int mFast;
+  const _CTMlzmaparams * mParams;
+  int mLzmaThreads;
+  int mPack;
+} _CTMsectionjobs;
+
+static void _ctmSectionJob(void * aUserData, CTMuint aJob, CTMuint aWorker)
+{
+  _CTMsectionjobs * jobs = (_CTMsectionjobs *) aUserData;
+  unsigned char * tmp = jobs->mTmp + aWorker * jobs->mTmpSize;
+  if(jobs->mPack)
+    _ctmPackSection(jobs->mSections[aJob], jobs->mBackend, jobs->mLevel,
+                    jobs->mFast, &jobs->mParams[jobs->mSections[aJob]->mParams],
+                    jobs->mLzmaThreads, tmp, jobs->mKernels,
+                    jobs->mAllocator);
+  else
+    _ctmUnpackSection(jobs->mSections[aJob], tmp, jobs->mKernels,
+                      jobs->mAllocator);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmProcessSections() - Pack all sections that have not yet been packed, or
+// unpack all sections that have been read but not yet unpacked, using up to
+// aThreadCount threads. The largest sections are started first. The output
+// buffers of packed sections are allocated from the scratch arena, and are
+// kept until the arena is released by the caller. All other temporary buffers
+// are released before returning.
+//-----------------------------------------------------------------------------
+static int _ctmProcessSections(_CTMcontext * self,
+  _CTMpackedsection * aSections, CTMuint aCount, CTMuint aThreadCount,
+  int aPack)
+{
+  _CTMpackedsection ** pending, * tmp;
+  _CTMsectionjobs jobs;
+  CTMuint i, j, n, workers;
+  size_t mark;
+
+  // Allocate the output buffers for packing
+  if(aPack)
+  {
+    for(i = 0; i < aCount; ++ i)
+    {
+      if(aSections[i].mPacked)
+        continue;
+      aSections[i].mPackedBuf = (unsigned char *) _ctmScratchAlloc(self, _ctmPackedBufSize(&aSections[i], self->mBackend));
+      if(!aSections[i].mPackedBuf)
+      {
+        self->mError = CTM_OUT_OF_MEMORY;
+        return CTM_FALSE;
+      }
+    }
+  }
+  mark = _ctmScratchMark(self);
+
+  // Build a list of sections to process
+  pending = (_CTMpackedsection **) _ctmScratchAlloc(self, sizeof(_CTMpackedsection *) * aCount);
+  if(!pending)
   {
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-  _ctmStreamRead(self, (void *) packed, packedSize);
+  n = 0;
+  for(i = 0; i < aCount; ++ i)
+  {
+    if((aSections[i].mPacked ? 1 : 0) != (aPack ? 1 : 0))
+    {
+      // Insertion sort (largest unpacked size first)
+      tmp = &aSections[i];
+      for(j = n; (j > 0) && (pending[j - 1]->mCount * pending[j - 1]->mSize <
+                             tmp->mCount * tmp->mSize); -- j)
+        pending[j] = pending[j - 1];
+      pending[j] = tmp;
+      ++ n;
+    }
+  }
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
+  // Process the sections (one interleave buffer per worker, large enough for
+  // the largest section)
+  if(n > 0)
+  {
+    workers = aThreadCount < n ? aThreadCount : n;
+    if(workers < 1)
+      workers = 1;
+    jobs.mSections = pending;
+    jobs.mAllocator = &self->mAllocator;
+    jobs.mKernels = self->mPlaneKernels;
+    jobs.mTmpSize = (size_t) pending[0]->mCount * pending[0]->mSize * 4;
+    jobs.mTmp = (unsigned char *) _ctmScratchAlloc(self, jobs.mTmpSize * workers);
+    jobs.mBackend = self->mBackend;
+    jobs.mLevel = self->mCompressionLevel;
+    jobs.mFast = (self->mEstimate == CTM_ESTIMATE_FAST);
+    jobs.mParams = self->mLzmaParams;
+    // Give each LZMA encoder a match finder thread of its own if there are
+    // at least two threads per worker
+    jobs.mLzmaThreads = (aThreadCount >= 2 * workers) ? 2 : 1;
+    jobs.mPack = aPack;
+    if(!jobs.mTmp)
+    {
+      _ctmScratchRelease(self, mark);
+      self->mError = CTM_OUT_OF_MEMORY;
+      return CTM_FALSE;
+    }
+    _ctmRunJobs(&self->mAllocator, workers, n, _ctmSectionJob, (void *) &jobs);
+  }
+  _ctmScratchRelease(self, mark);
+
+  // Report the first error (in stream order)
+  for(i = 0; i < aCount; ++ i)
+  {
+    if(aSections[i].mError != CTM_NONE)
+    {
+      self->mError = aSections[i].mError;
+      return CTM_FALSE;
+    }
+  }
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUnpackSections() - Unpack all sections (that have been read but not yet
+// unpacked). With threaded decoding, the sections are unpacked in parallel.
+//-----------------------------------------------------------------------------
+int _ctmUnpackSections(_CTMcontext * self, _CTMpackedsection * aSections,
+  CTMuint aCount)
+{
+  return _ctmProcessSections(self, aSections, aCount, self->mDecodeThreads,
+                             CTM_FALSE);
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackSections() - Pack (compress) all sections in parallel. Without
+// threaded encoding (or when estimating from samples) this does nothing, and
+// each section is instead packed by _ctmStreamWritePackedArray() when it is
+// written (which saves memory).
+//-----------------------------------------------------------------------------
+int _ctmPackSections(_CTMcontext * self, _CTMpackedsection * aSections,
+  CTMuint aCount)
+{
+  if((self->mEncodeThreads < 2) || (self->mEstimate == CTM_ESTIMATE_SAMPLED))
+    return CTM_TRUE;
+
+  return _ctmProcessSections(self, aSections, aCount, self->mEncodeThreads,
+                             CTM_TRUE);
+}
+
+//-----------------------------------------------------------------------------
+// _CTMplanereader - LZMA input stream that produces the byte planes of a
+// section on the fly (see _ctmGetPlaneBytes()).
+//-----------------------------------------------------------------------------
+typedef struct {
+  ISeqInStream mFuncs;                // LZMA input stream (must be first)
+  const _CTMpackedsection * mSection; // Section to read from
+  const _CTMplanekernels * mKernels;  // Byte plane kernels
+  size_t mPos;                        // Current position in the byte planes
+  size_t mSize;                       // Size of the byte planes
+} _CTMplanereader;
+
+static SRes _ctmPlaneReaderRead(void * p, void * buf, size_t * size)
+{
+  _CTMplanereader * reader = (_CTMplanereader *) p;
+  size_t n = reader->mSize - reader->mPos;
+  if(n > *size)
+    n = *size;
+  _ctmGetPlaneBytes(reader->mSection, reader->mPos, (unsigned char *) buf, n,
+                    reader->mKernels);
+  reader->mPos += n;
+  *size = n;
+  return SZ_OK;
+}
+
+//-----------------------------------------------------------------------------
+// _CTMchunkwriter - LZMA output stream that appends the packed data to a list
+// of scratch chunks (of _CTM_STREAM_CHUNK bytes each).
+//-----------------------------------------------------------------------------
+typedef struct {
+  ISeqOutStream mFuncs;       // LZMA output stream (must be first)
+  _CTMcontext * mContext;     // Context (for the scratch arena)
+  _CTMpackedchunk * mFirst;   // First chunk (or NULL)
+  _CTMpackedchunk * mLast;    // Last chunk (or NULL)
+  size_t mSize;               // Number of bytes written
+} _CTMchunkwriter;
+
+static size_t _ctmChunkWriterWrite(void * p, const void * buf, size_t size)
+{
+  _CTMchunkwriter * writer = (_CTMchunkwriter *) p;
+  _CTMpackedchunk * chunk;
+  size_t n, done;
+
+  for(done = 0; done < size; done += n)
+  {
+    // Start a new chunk?
+    chunk = writer->mLast;
+    if(!chunk || (chunk->mSize == _CTM_STREAM_CHUNK))
+    {
+      chunk = (_CTMpackedchunk *) _ctmScratchAlloc(writer->mContext,
+                sizeof(_CTMpackedchunk) + _CTM_STREAM_CHUNK);
+      if(!chunk)
+        break;
+      chunk->mNext = (_CTMpackedchunk *) 0;
+      chunk->mSize = 0;
+      if(writer->mLast)
+        writer->mLast->mNext = chunk;
+      else
+        writer->mFirst = chunk;
+      writer->mLast = chunk;
+    }
+
+    n = _CTM_STREAM_CHUNK - chunk->mSize;
+    if(n > size - done)
+      n = size - done;
+    memcpy(((unsigned char *) (chunk + 1)) + chunk->mSize,
+           ((const unsigned char *) buf) + done, n);
+    chunk->mSize += n;
+    writer->mSize += n;
+  }
+
+  return done;
+}
+
+static size_t _ctmCountWriterWrite(void * p, const void * buf, size_t size)
+{
+  _CTMchunkwriter * writer = (_CTMchunkwriter *) p;
+  (void) buf;
+  writer->mSize += size;
+  return size;
+}
+
+static size_t _ctmDirectWriterWrite(void * p, const void * buf, size_t size)
+{
+  _CTMchunkwriter * writer = (_CTMchunkwriter *) p;
+  size_t count;
+  count = _ctmStreamWrite(writer->mContext, (void *) buf, (CTMuint) size);
+  writer->mSize += count;
+  return count;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamPackLZMA() - Pack a section with LZMA as a stream: the byte planes
+// are produced from the integers or floats of the section as the encoder
+// needs them, and the packed data is collected in scratch chunks (mChunks).
+// The output is identical to that of _ctmPackSection(), but no buffers of the
+// size of the section are needed. When estimating, the packed data is only
+// counted (mChunks is left empty). If aDirect is CTM_TRUE, the LZMA props and
+// the packed data are written straight to the output stream instead.
+//-----------------------------------------------------------------------------
+static int _ctmStreamPackLZMA(_CTMcontext * self,
+  _CTMpackedsection * aSection, int aDirect)
+{
+  CLzmaEncProps lzmaProps;
+  CLzmaEncHandle lzmaEnc;
+  _CTMlzmaalloc lzmaAlloc;
+  _CTMplanereader reader;
+  _CTMchunkwriter writer;
+  SizeT propsSize = 5;
+  int lzmaRes;
+
+  reader.mFuncs.Read = _ctmPlaneReaderRead;
+  reader.mSection = aSection;
+  reader.mKernels = self->mPlaneKernels;
+  reader.mPos = 0;
+  reader.mSize = (size_t) aSection->mCount * aSection->mSize * 4;
+  if(self->mEstimate)
+    writer.mFuncs.Write = _ctmCountWriterWrite;
+  else
+    writer.mFuncs.Write = aDirect ? _ctmDirectWriterWrite :
+                                    _ctmChunkWriterWrite;
+  writer.mContext = self;
+  writer.mFirst = writer.mLast = (_CTMpackedchunk *) 0;
+  writer.mSize = 0;
+
+  _ctmSetLzmaProps(&lzmaProps, self->mCompressionLevel,
+                   &self->mLzmaParams[aSection->mParams], 1,
+                   self->mEstimate == CTM_ESTIMATE_FAST, reader.mSize);
+  _ctmInitLzmaAlloc(&lzmaAlloc, &self->mAllocator);
+  lzmaEnc = LzmaEnc_Create(&lzmaAlloc.mFuncs);
+  if(!lzmaEnc)
   {
-    free(packed);
     self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
+  lzmaRes = LzmaEnc_SetProps(lzmaEnc, &lzmaProps);
+  if(lzmaRes == SZ_OK)
+    lzmaRes = LzmaEnc_WriteProperties(lzmaEnc, aSection->mProps, &propsSize);
+  if((lzmaRes == SZ_OK) && aDirect &&
+     (_ctmStreamWrite(self, (void *) aSection->mProps, 5) != 5))
+    lzmaRes = SZ_ERROR_WRITE;
+  if(lzmaRes == SZ_OK)
+    lzmaRes = LzmaEnc_Encode(lzmaEnc, &writer.mFuncs, &reader.mFuncs,
+                             (ICompressProgress *) 0, &lzmaAlloc.mFuncs,
+                             &lzmaAlloc.mFuncs);
+  LzmaEnc_Destroy(lzmaEnc, &lzmaAlloc.mFuncs, &lzmaAlloc.mFuncs);
+  if(lzmaRes != SZ_OK)
+  {
+    // A write error means that a scratch chunk could not be allocated (or
+    // that the output stream failed)
+    if((lzmaRes == SZ_ERROR_WRITE) && aDirect)
+      self->mError = CTM_FILE_ERROR;
+    else if((lzmaRes == SZ_ERROR_MEM) || (lzmaRes == SZ_ERROR_WRITE))
+      self->mError = CTM_OUT_OF_MEMORY;
+    else
+      self->mError = CTM_LZMA_ERROR;
+    return CTM_FALSE;
+  }
 
-  // Uncompress
-  unpackedSize = aCount * aSize * 4;
-  lzmaRes = LzmaUncompress(tmp, &unpackedSize, packed,
-                           &packedSize, props, 5);
+  aSection->mChunks = writer.mFirst;
+  aSection->mPackedSize = writer.mSize;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmPackSample() - Pack a sample section for size estimation (see
+// _ctmEstimatePackedSize()).
+//-----------------------------------------------------------------------------
+static int _ctmPackSample(_CTMcontext * self, _CTMpackedsection * aSample)
+{
+  if(self->mBackend == CTM_BACKEND_LZMA)
+    return _ctmStreamPackLZMA(self, aSample, CTM_FALSE);
+  else
+    return _ctmProcessSections(self, aSample, 1, 1, CTM_TRUE);
+}
 
-  // Free the packed array
-  free(packed);
+//-----------------------------------------------------------------------------
+// _ctmEstimatePackedSize() - Estimate the packed size of a section from a
+// sample: _CTM_SAMPLE_RUNS evenly spaced runs of _CTM_SAMPLE_RUN elements
+// each are copied to a scratch buffer and packed as a section of their own.
+// The rest of the section is extrapolated from the packed size of the second
+// half of the sample (the difference between packing all of the sample and
+// only its first half), which leaves out the start-up cost of the coder.
+// Small sections are packed as a whole. Only mProps and mPackedSize of the
+// section are set. The sample is allocated from the scratch arena (the caller
+// releases it).
+//-----------------------------------------------------------------------------
+int _ctmEstimatePackedSize(_CTMcontext * self,
+  _CTMpackedsection * aSection)
+{
+  _CTMpackedsection sample, half;
+  const CTMint * src;
+  CTMint * dst;
+  CTMuint i, j, k, first;
+  double rate;
+
+  // Small section?
+  sample = *aSection;
+  if(aSection->mCount <= _CTM_SAMPLE_RUNS * _CTM_SAMPLE_RUN)
+  {
+    if(!_ctmPackSample(self, &sample))
+      return CTM_FALSE;
+    memcpy(aSection->mProps, sample.mProps, 5);
+    aSection->mPackedSize = sample.mPackedSize;
+    return CTM_TRUE;
+  }
 
-  // Error?
-  if((lzmaRes != SZ_OK) || (unpackedSize != aCount * aSize * 4))
+  dst = (CTMint *) _ctmScratchAlloc(self, sizeof(CTMint) * aSection->mSize *
+                                    _CTM_SAMPLE_RUNS * _CTM_SAMPLE_RUN);
+  if(!dst)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(tmp);
+    self->mError = CTM_OUT_OF_MEMORY;
     return CTM_FALSE;
   }
-
-  // Convert interleaved array to floats
-  for(i = 0; i < aCount; ++ i)
+  sample.mData = (void *) dst;
+  sample.mCount = _CTM_SAMPLE_RUNS * _CTM_SAMPLE_RUN;
+  sample.mStride = aSection->mSize;
+
+  // Copy the runs (the first run starts at the first element, and the last
+  // run ends at the last element)
+  src = (const CTMint *) aSection->mData;
+  for(i = 0; i < _CTM_SAMPLE_RUNS; ++ i)
   {
-    for(k = 0; k < aSize; ++ k)
+    first = (CTMuint) ((size_t) (aSection->mCount - _CTM_SAMPLE_RUN) * i /
+                       (_CTM_SAMPLE_RUNS - 1));
+    for(j = first; j < first + _CTM_SAMPLE_RUN; ++ j)
     {
-      value.i = (CTMint) tmp[i + k * aCount + 3 * aCount * aSize] |
-                (((CTMint) tmp[i + k * aCount + 2 * aCount * aSize]) << 8) |
-                (((CTMint) tmp[i + k * aCount + aCount * aSize]) << 16) |
-                (((CTMint) tmp[i + k * aCount]) << 24);
-      aData[i * aSize + k] = value.f;
+      for(k = 0; k < aSection->mSize; ++ k)
+        *dst ++ = src[(size_t) j * aSection->mStride + k];
     }
   }
 
-  // Free the interleaved array
-  free(tmp);
+  // Pack the first half of the sample, and then all of it
+  half = sample;
+  half.mCount = sample.mCount / 2;
+  if(!_ctmPackSample(self, &half) || !_ctmPackSample(self, &sample))
+    return CTM_FALSE;
 
+  // Extrapolate
+  rate = 0.0;
+  if(sample.mPackedSize > half.mPackedSize)
+    rate = (double) (sample.mPackedSize - half.mPackedSize) /
+           (double) (sample.mCount - half.mCount);
+  memcpy(aSection->mProps, sample.mProps, 5);
+  aSection->mPackedSize = sample.mPackedSize + (size_t) (rate *
+                          (aSection->mCount - sample.mCount) + 0.5);
   return CTM_TRUE;
 }
 
 //-----------------------------------------------------------------------------
-// _ctmStreamWritePackedFloats() - Compress a binary float data array, and
-// write it to a stream.
+// _ctmMeasurePackedSize() - Get the exact packed size of a section by packing
+// all of it (unlike _ctmEstimatePackedSize(), large sections are not
+// sampled). Only mProps and mPackedSize of the section are set. When
+// estimating, LZMA sections are only counted. Otherwise the packed data is
+// allocated from the scratch arena (the caller releases it).
 //-----------------------------------------------------------------------------
-int _ctmStreamWritePackedFloats(_CTMcontext * self, CTMfloat * aData,
-  CTMuint aCount, CTMuint aSize)
+int _ctmMeasurePackedSize(_CTMcontext * self,
+  _CTMpackedsection * aSection)
 {
-  int lzmaRes, lzmaAlgo;
-  CTMuint i, k;
-  union {
-    CTMfloat f;
-    CTMint i;
-  } value;
-  size_t bufSize, outPropsSize;
-  unsigned char * packed, outProps[5], *tmp;
+  _CTMpackedsection packed;
 
-  // Allocate memory for interleaved array
-  tmp = (unsigned char *) malloc(aCount * aSize * 4);
-  if(!tmp)
-  {
-    self->mError = CTM_OUT_OF_MEMORY;
+  packed = *aSection;
+  if(!_ctmPackSample(self, &packed))
     return CTM_FALSE;
+  memcpy(aSection->mProps, packed.mProps, 5);
+  aSection->mPackedSize = packed.mPackedSize;
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWriteDirectLZMA() - Pack aCount LZMA sections (the blocks of one
+// array) straight into a seekable output stream. The packed sizes are not
+// known until the sections have been packed, so they are written as zeros,
+// and are filled in afterwards. No packed data is kept in memory.
+//-----------------------------------------------------------------------------
+static int _ctmStreamWriteDirectLZMA(_CTMcontext * self,
+  _CTMpackedsection * aSections, CTMuint aCount)
+{
+  size_t sizesPos, endPos;
+  CTMuint i;
+
+  // Write placeholders for the packed data sizes
+  sizesPos = self->mWritePos;
+  for(i = 0; i < aCount; ++ i)
+    _ctmStreamWriteUINT(self, 0);
+
+  // Write the LZMA props and the packed data of each section
+  for(i = 0; i < aCount; ++ i)
+  {
+    if(!_ctmStreamPackLZMA(self, &aSections[i], CTM_TRUE))
+      return CTM_FALSE;
   }
 
-  // Convert floats to an interleaved array
+  // Go back and write the packed data sizes
+  endPos = self->mWritePos;
+  if((endPos - sizesPos > (size_t) LONG_MAX) ||
+     !self->mSeekFn(-(long) (endPos - sizesPos), self->mUserData))
+  {
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  self->mWritePos = sizesPos;
   for(i = 0; i < aCount; ++ i)
+    _ctmStreamWriteUINT(self, (CTMuint) aSections[i].mPackedSize);
+  if(!self->mSeekFn((long) (endPos - self->mWritePos), self->mUserData))
   {
-    for(k = 0; k < aSize; ++ k)
+    self->mError = CTM_FILE_ERROR;
+    return CTM_FALSE;
+  }
+  self->mWritePos = endPos;
+
+  return CTM_TRUE;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmStreamWritePackedArray() - Write a packed (compressed) integer or float
+// array to a stream. The array is described by one or more sections (see
+// _ctmInitPackedSections()), starting at *aSections. Sections that have not
+// already been packed are packed first (LZMA sections as a stream, see
+// _ctmStreamPackLZMA()), and their packed data is released once it has been
+// written. With a seekable output stream, LZMA sections are instead packed
+// straight into the stream (see _ctmStreamWriteDirectLZMA()). When
+// estimating, the packed data is only counted (and with CTM_ESTIMATE_SAMPLED,
+// the sections are not packed in full, see _ctmEstimatePackedSize()).
+// *aSections is advanced past the last section of the array.
+//-----------------------------------------------------------------------------
+int _ctmStreamWritePackedArray(_CTMcontext * self,
+  _CTMpackedsection ** aSections)
+{
+  _CTMpackedsection * first;
+  _CTMpackedchunk * chunk;
+  CTMuint i, blockCount;
+  size_t mark;
+  int direct;
+  int result = CTM_TRUE;
+
+  first = *aSections;
+  blockCount = first->mBlockCount ? first->mBlockCount : 1;
+  *aSections += blockCount;
+
+  // Pack straight into a seekable output stream (unless some sections have
+  // already been packed)?
+  if(self->mSeekFn && !self->mEstimate &&
+     (self->mBackend == CTM_BACKEND_LZMA))
+  {
+    direct = CTM_TRUE;
+    for(i = 0; i < blockCount; ++ i)
+    {
+      if(first[i].mPacked)
+        direct = CTM_FALSE;
+    }
+    if(direct)
     {
-      value.f = aData[i * aSize + k];
-      tmp[i + k * aCount + 3 * aCount * aSize] = value.i & 0x000000ff;
-      tmp[i + k * aCount + 2 * aCount * aSize] = (value.i >> 8) & 0x000000ff;
-      tmp[i + k * aCount + aCount * aSize] = (value.i >> 16) & 0x000000ff;
-      tmp[i + k * aCount] = (value.i >> 24) & 0x000000ff;
+      mark = _ctmScratchMark(self);
+      result = _ctmStreamWriteDirectLZMA(self, first, blockCount);
+      _ctmScratchRelease(self, mark);
+      return result;
     }
   }
 
-  // Allocate memory for the packed data
-  bufSize = 1000 + aCount * aSize * 4;
-  packed = (unsigned char *) malloc(bufSize);
-  if(!packed)
+  // Pack now (if not already packed)? LZMA sections are packed as a stream
+  mark = _ctmScratchMark(self);
+  if(self->mEstimate == CTM_ESTIMATE_SAMPLED)
   {
-    free(tmp);
-    self->mError = CTM_OUT_OF_MEMORY;
-    return CTM_FALSE;
+    for(i = 0; (i < blockCount) && result; ++ i)
+      result = _ctmEstimatePackedSize(self, &first[i]);
   }
-
-  // Call LZMA to compress
-  outPropsSize = 5;
-  lzmaAlgo = (self->mCompressionLevel < 1 ? 0 : 1);
-  lzmaRes = LzmaCompress(packed,
-                         &bufSize,
-                         (const unsigned char *) tmp,
-                         aCount * aSize * 4,
-                         outProps,
-                         &outPropsSize,
-                         self->mCompressionLevel, // Level (0-9)
-                         0, -1, -1, -1, -1, -1,   // Default values (set by level)
-                         lzmaAlgo                 // Algorithm (0 = fast, 1 = normal)
-                        );
-
-  // Free temporary array
-  free(tmp);
-
-  // Error?
-  if(lzmaRes != SZ_OK)
+  else if(self->mBackend == CTM_BACKEND_LZMA)
   {
-    self->mError = CTM_LZMA_ERROR;
-    free(packed);
+    for(i = 0; (i < blockCount) && result; ++ i)
+    {
+      if(!first[i].mPacked)
+        result = _ctmStreamPackLZMA(self, &first[i], CTM_FALSE);
+    }
+  }
+  else
+    result = _ctmProcessSections(self, first, blockCount, 1, CTM_TRUE);
+  if(!result)
+  {
+    _ctmScratchRelease(self, mark);
     return CTM_FALSE;
   }
-
 #ifdef __DEBUG_
-  printf("%d->%d bytes\n", aCount * aSize * 4, (int) bufSize);
+  for(i = 0; i < blockCount; ++ i)
+    printf("%d->%d bytes\n", first[i].mCount * first[i].mSize * 4, (int) first[i].mPackedSize);
 #endif
 
-  // Write packed data size to the stream
-  _ctmStreamWriteUINT(self, (CTMuint) bufSize);
+  // Write packed data size(s) to the stream
+  for(i = 0; i < blockCount; ++ i)
+    _ctmStreamWriteUINT(self, (CTMuint) first[i].mPackedSize);
 
-  // Write LZMA compression props to the stream
-  _ctmStreamWrite(self, (void *) outProps, 5);
+  for(i = 0; i < blockCount; ++ i)
+  {
+    // Write LZMA compression props (or backend tag) to the stream
+    _ctmStreamWrite(self, (void *) first[i].mProps, 5);
 
-  // Write the packed data to the stream
-  _ctmStreamWrite(self, (void *) packed, (CTMuint) bufSize);
+    // Write the packed data to the stream
+    if(self->mEstimate)
+    {
+      self->mWritePos += first[i].mPackedSize;
+      continue;
+    }
+    if(first[i].mPacked)
+      _ctmStreamWrite(self, (void *) first[i].mPacked, (CTMuint) first[i].mPackedSize);
+    for(chunk = first[i].mChunks; chunk; chunk = chunk->mNext)
+      _ctmStreamWrite(self, (void *) (chunk + 1), (CTMuint) chunk->mSize);
+  }
 
-  // Free the packed data
-  free(packed);
+  // Release the packed data
+  for(i = 0; i < blockCount; ++ i)
+  {
+    first[i].mPackedBuf = (unsigned char *) 0;
+    first[i].mPacked = (const unsigned char *) 0;
+    first[i].mChunks = (_CTMpackedchunk *) 0;
+  }
+  _ctmScratchRelease(self, mark);
 
   return CTM_TRUE;
 }
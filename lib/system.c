@@ -0,0 +1,356 @@
+//-----------------------------------------------------------------------------
+// Product:     OpenCTM
+// File:        system.c
+// Description: Platform specific functions (memory mapped files and
+//              threads).
+//-----------------------------------------------------------------------------
+// Copyright (c) 2009-2010 Marcus Geelnard
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+//     1. The origin of this software must not be misrepresented; you must not
+//     claim that you wrote the original software. If you use this software
+//     in a product, an acknowledgment in the product documentation would be
+//     appreciated but is not required.
+//
+//     2. Altered source versions must be plainly marked as such, and must not
+//     be misrepresented as being the original software.
+//
+//     3. This notice may not be removed or altered from any source
+//     distribution.
+//-----------------------------------------------------------------------------
+
+// We need POSIX declarations (mmap etc) even in strict C99 mode
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+  #define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <time.h>
+#include "openctm.h"
+#include "internal.h"
+
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+  #define _CTM_HAVE_MMAP
+  #if !defined(OPENCTM_NO_THREADS)
+    #define _CTM_HAVE_THREADS
+  #endif
+#elif defined(__unix__) || defined(__unix) || (defined(__APPLE__) && defined(__MACH__))
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+  #define _CTM_HAVE_MMAP
+  #if !defined(OPENCTM_NO_THREADS)
+    #include <pthread.h>
+    #define _CTM_HAVE_THREADS
+  #endif
+#endif
+
+
+//-----------------------------------------------------------------------------
+// _ctmMapFile() - Map a file into memory (read only).
+//-----------------------------------------------------------------------------
+int _ctmMapFile(const char * aFileName, _CTMmappedfile * aMap)
+{
+  aMap->mData = (const unsigned char *) 0;
+  aMap->mSize = 0;
+  aMap->mHandle[0] = aMap->mHandle[1] = (void *) 0;
+
+#if defined(_WIN32)
+  {
+    HANDLE file, mapping;
+    LARGE_INTEGER size;
+
+    file = CreateFileA(aFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+      return CTM_FALSE;
+    if(!GetFileSizeEx(file, &size) || (size.HighPart != 0))
+    {
+      CloseHandle(file);
+      return CTM_FALSE;
+    }
+
+    // Empty files can not be mapped, but are valid (if useless) input
+    if(size.LowPart == 0)
+    {
+      CloseHandle(file);
+      return CTM_TRUE;
+    }
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mapping)
+    {
+      CloseHandle(file);
+      return CTM_FALSE;
+    }
+    aMap->mData = (const unsigned char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!aMap->mData)
+    {
+      CloseHandle(mapping);
+      CloseHandle(file);
+      return CTM_FALSE;
+    }
+    aMap->mSize = (size_t) size.LowPart;
+    aMap->mHandle[0] = (void *) file;
+    aMap->mHandle[1] = (void *) mapping;
+    return CTM_TRUE;
+  }
+#elif defined(_CTM_HAVE_MMAP)
+  {
+    int fd;
+    struct stat st;
+    void * data;
+
+    fd = open(aFileName, O_RDONLY);
+    if(fd < 0)
+      return CTM_FALSE;
+    if(fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return CTM_FALSE;
+    }
+
+    // Empty files can not be mapped, but are valid (if useless) input
+    if(st.st_size == 0)
+    {
+      close(fd);
+      return CTM_TRUE;
+    }
+
+    data = mmap((void *) 0, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED)
+      return CTM_FALSE;
+
+    // The file is read (more or less) from start to end
+    posix_madvise(data, (size_t) st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    aMap->mData = (const unsigned char *) data;
+    aMap->mSize = (size_t) st.st_size;
+    return CTM_TRUE;
+  }
+#else
+  (void) aFileName;
+  return CTM_FALSE;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmUnmapFile() - Release a file mapping that was created by _ctmMapFile().
+//-----------------------------------------------------------------------------
+void _ctmUnmapFile(_CTMmappedfile * aMap)
+{
+#if defined(_WIN32)
+  if(aMap->mData)
+    UnmapViewOfFile((LPCVOID) aMap->mData);
+  if(aMap->mHandle[1])
+    CloseHandle((HANDLE) aMap->mHandle[1]);
+  if(aMap->mHandle[0])
+    CloseHandle((HANDLE) aMap->mHandle[0]);
+#elif defined(_CTM_HAVE_MMAP)
+  if(aMap->mData)
+    munmap((void *) aMap->mData, aMap->mSize);
+#endif
+  aMap->mData = (const unsigned char *) 0;
+  aMap->mSize = 0;
+  aMap->mHandle[0] = aMap->mHandle[1] = (void *) 0;
+}
+
+//-----------------------------------------------------------------------------
+// _ctmProcessorCount() - Get the number of processors (cores) in the system.
+//-----------------------------------------------------------------------------
+CTMuint _ctmProcessorCount(void)
+{
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (CTMuint) info.dwNumberOfProcessors : 1;
+#elif defined(_CTM_HAVE_MMAP) && defined(_SC_NPROCESSORS_ONLN)
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (CTMuint) count : 1;
+#else
+  return 1;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _ctmTime() - Get the time of a monotonic clock (in seconds), for measuring
+// time intervals.
+//-----------------------------------------------------------------------------
+double _ctmTime(void)
+{
+#if defined(_WIN32)
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (double) count.QuadPart / (double) frequency.QuadPart;
+#elif defined(_CTM_HAVE_MMAP) && defined(CLOCK_MONOTONIC)
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double) t.tv_sec + 1e-9 * (double) t.tv_nsec;
+#else
+  return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// _CTMjobqueue - Shared state for the worker threads of _ctmRunJobs().
+//-----------------------------------------------------------------------------
+typedef struct {
+  _CTMjobfn mJobFn;     // Job function
+  void * mUserData;     // User data for the job function
+  CTMuint mJobCount;    // Total number of jobs
+#if defined(_WIN32) && defined(_CTM_HAVE_THREADS)
+  volatile LONG mNextJob;
+  volatile LONG mNextWorker;
+#elif defined(_CTM_HAVE_THREADS)
+  pthread_mutex_t mMutex;
+  CTMuint mNextJob;
+  CTMuint mNextWorker;
+#endif
+} _CTMjobqueue;
+
+#if defined(_CTM_HAVE_THREADS)
+
+//-----------------------------------------------------------------------------
+// _ctmWorker() - Worker thread: run jobs until the queue is empty.
+//-----------------------------------------------------------------------------
+static void _ctmWorker(_CTMjobqueue * aQueue)
+{
+  CTMuint job, worker;
+
+  // Get a unique worker index
+#if defined(_WIN32)
+  worker = (CTMuint) InterlockedIncrement(&aQueue->mNextWorker) - 1;
+#else
+  pthread_mutex_lock(&aQueue->mMutex);
+  worker = aQueue->mNextWorker ++;
+  pthread_mutex_unlock(&aQueue->mMutex);
+#endif
+
+  while(1)
+  {
+#if defined(_WIN32)
+    job = (CTMuint) InterlockedIncrement(&aQueue->mNextJob) - 1;
+#else
+    pthread_mutex_lock(&aQueue->mMutex);
+    job = aQueue->mNextJob ++;
+    pthread_mutex_unlock(&aQueue->mMutex);
+#endif
+    if(job >= aQueue->mJobCount)
+      break;
+    aQueue->mJobFn(aQueue->mUserData, job, worker);
+  }
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI _ctmWorkerThread(LPVOID aArg)
+{
+  _ctmWorker((_CTMjobqueue *) aArg);
+  return 0;
+}
+#else
+static void * _ctmWorkerThread(void * aArg)
+{
+  _ctmWorker((_CTMjobqueue *) aArg);
+  return (void *) 0;
+}
+#endif
+
+#endif // _CTM_HAVE_THREADS
+
+//-----------------------------------------------------------------------------
+// _ctmRunJobs() - Run aJobCount independent jobs (aJobFn(aUserData, job,
+// worker), with job = 0..aJobCount-1) using up to aThreadCount threads,
+// including the calling thread. Each thread has its own worker index (0 to
+// aThreadCount-1), so jobs can use per-worker buffers. Jobs are started in
+// order. The function returns when all jobs have finished. If threads are not
+// supported (or can not be created), the jobs are run on the calling thread.
+// Any memory that is needed for the threads is allocated with aAllocator.
+//-----------------------------------------------------------------------------
+void _ctmRunJobs(const _CTMallocator * aAllocator, CTMuint aThreadCount,
+  CTMuint aJobCount, _CTMjobfn aJobFn, void * aUserData)
+{
+  CTMuint i;
+#if defined(_CTM_HAVE_THREADS)
+  _CTMjobqueue queue;
+  CTMuint threadCount;
+#if defined(_WIN32)
+  HANDLE * threads;
+#else
+  pthread_t * threads;
+#endif
+
+  // Never use more threads than there are jobs
+  threadCount = aThreadCount < aJobCount ? aThreadCount : aJobCount;
+  if(threadCount > 1)
+  {
+    queue.mJobFn = aJobFn;
+    queue.mUserData = aUserData;
+    queue.mJobCount = aJobCount;
+    queue.mNextJob = 0;
+    queue.mNextWorker = 0;
+#if defined(_WIN32)
+    threads = (HANDLE *) _ctmAlloc(aAllocator, sizeof(HANDLE) * (threadCount - 1));
+#else
+    threads = (pthread_t *) _ctmAlloc(aAllocator, sizeof(pthread_t) * (threadCount - 1));
+    if(threads && (pthread_mutex_init(&queue.mMutex, NULL) != 0))
+    {
+      _ctmFree(aAllocator, threads);
+      threads = NULL;
+    }
+#endif
+    if(threads)
+    {
+      // Start the worker threads (the calling thread is one of the workers)
+      for(i = 0; i < threadCount - 1; ++ i)
+      {
+#if defined(_WIN32)
+        threads[i] = CreateThread(NULL, 0, _ctmWorkerThread, (LPVOID) &queue, 0, NULL);
+        if(!threads[i])
+          break;
+#else
+        if(pthread_create(&threads[i], NULL, _ctmWorkerThread, (void *) &queue) != 0)
+          break;
+#endif
+      }
+
+      // Do our share of the work, and wait for the other threads to finish
+      _ctmWorker(&queue);
+      threadCount = i;
+      for(i = 0; i < threadCount; ++ i)
+      {
+#if defined(_WIN32)
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+      }
+#if !defined(_WIN32)
+      pthread_mutex_destroy(&queue.mMutex);
+#endif
+      _ctmFree(aAllocator, threads);
+      return;
+    }
+  }
+#else
+  (void) aAllocator;
+  (void) aThreadCount;
+#endif
+
+  // Single threaded operation
+  for(i = 0; i < aJobCount; ++ i)
+    aJobFn(aUserData, i, 0);
+}
@@ -47,9 +47,13 @@ Options::Options()
 
   mMethod = CTM_METHOD_MG2;
   mLevel = 1;
+  mBackend = CTM_BACKEND_LZMA;
+  mMaxError = -1.0f;
+  mOptimizeTarget = CTM_OPTIMIZE_SIZE;
   mVertexPrecision = 0.0f;
   mVertexPrecisionRel = 0.01f;
   mNormalPrecision = 1.0f / 256.0f;
+  mNormalMode = CTM_NORMALS_SPHERICAL;
   mTexMapPrecision = 1.0f / 4096.0f;
   mColorPrecision = 1.0f / 256.0f;
   mComment = string("");
@@ -138,8 +142,12 @@ void Options::GetFromArgs(int argc, char **argv, int aStartIdx)
         mMethod = CTM_METHOD_MG1;
       else if(method == string("MG2"))
         mMethod = CTM_METHOD_MG2;
+      else if(method == string("MG3"))
+        mMethod = CTM_METHOD_MG3;
+      else if(method == string("MG4"))
+        mMethod = CTM_METHOD_MG4;
       else
-        throw runtime_error("Invalid method (use RAW, MG1 or MG2).");
+        throw runtime_error("Invalid method (use RAW, MG1, MG2, MG3 or MG4).");
     }
     else if((cmd == string("--level")) && (i < (argc - 1)))
     {
@@ -149,6 +157,39 @@ void Options::GetFromArgs(int argc, char **argv, int aStartIdx)
       mLevel = CTMuint(val);
       ++ i;
     }
+    else if((cmd == string("--backend")) && (i < (argc - 1)))
+    {
+      string backend(argv[i + 1]);
+      ++ i;
+      if(backend == string("LZMA"))
+        mBackend = CTM_BACKEND_LZMA;
+      else if(backend == string("STORED"))
+        mBackend = CTM_BACKEND_STORED;
+      else if(backend == string("ZSTD"))
+        mBackend = CTM_BACKEND_ZSTD;
+      else if(backend == string("LZ4"))
+        mBackend = CTM_BACKEND_LZ4;
+      else
+        throw runtime_error("Invalid backend (use LZMA, STORED, ZSTD or LZ4).");
+    }
+    else if((cmd == string("--maxerror")) && (i < (argc - 1)))
+    {
+      mMaxError = GetFloatArg(argv[i + 1]);
+      if(mMaxError < 0.0f)
+        throw runtime_error("Invalid max error (it must not be negative).");
+      ++ i;
+    }
+    else if((cmd == string("--optimize")) && (i < (argc - 1)))
+    {
+      string target(argv[i + 1]);
+      ++ i;
+      if(target == string("SIZE"))
+        mOptimizeTarget = CTM_OPTIMIZE_SIZE;
+      else if(target == string("DECODE"))
+        mOptimizeTarget = CTM_OPTIMIZE_DECODE;
+      else
+        throw runtime_error("Invalid optimization target (use SIZE or DECODE).");
+    }
     else if((cmd == string("--vprec")) && (i < (argc - 1)))
     {
       mVertexPrecision = GetFloatArg(argv[i + 1]);
@@ -164,6 +205,17 @@ void Options::GetFromArgs(int argc, char **argv, int aStartIdx)
       mNormalPrecision = GetFloatArg(argv[i + 1]);
       ++ i;
     }
+    else if((cmd == string("--nmode")) && (i < (argc - 1)))
+    {
+      string mode(argv[i + 1]);
+      ++ i;
+      if(mode == string("SPHERICAL"))
+        mNormalMode = CTM_NORMALS_SPHERICAL;
+      else if(mode == string("OCTAHEDRAL"))
+        mNormalMode = CTM_NORMALS_OCTAHEDRAL;
+      else
+        throw runtime_error("Invalid normal mode (use SPHERICAL or OCTAHEDRAL).");
+    }
     else if((cmd == string("--tprec")) && (i < (argc - 1)))
     {
       mTexMapPrecision = GetFloatArg(argv[i + 1]);
@@ -54,10 +54,15 @@ class Options {
 
     CTMenum mMethod;
     CTMuint mLevel;
+    CTMenum mBackend;
+
+    CTMfloat mMaxError;
+    CTMenum mOptimizeTarget;
 
     CTMfloat mVertexPrecision;
     CTMfloat mVertexPrecisionRel;
     CTMfloat mNormalPrecision;
+    CTMenum mNormalMode;
     CTMfloat mTexMapPrecision;
     CTMfloat mColorPrecision;
 
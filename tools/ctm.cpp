@@ -41,55 +41,40 @@ void Import_CTM(const char * aFileName, Mesh * aMesh)
   // Load the file using the OpenCTM API
   CTMimporter ctm;
 
-  // Load the file
+  // Probe the file (header only), so that the mesh arrays can be sized
+  ctm.LoadHeader(CTM_TRUE);
   ctm.Load(aFileName);
+  ctm.LoadHeader(CTM_FALSE);
 
   // Extract file comment
   const char * comment = ctm.GetString(CTM_FILE_COMMENT);
   if(comment)
     aMesh->mComment = string(comment);
 
-  // Extract indices
+  // Let OpenCTM decode the indices and vertices straight into the mesh
   CTMuint numTriangles = ctm.GetInteger(CTM_TRIANGLE_COUNT);
-  aMesh->mIndices.resize(numTriangles * 3);
-  const CTMuint * indices = ctm.GetIntegerArray(CTM_INDICES);
-  for(CTMuint i = 0; i < numTriangles * 3; ++ i)
-    aMesh->mIndices[i] = indices[i];
-
-  // Extract vertices
   CTMuint numVertices = ctm.GetInteger(CTM_VERTEX_COUNT);
+  aMesh->mIndices.resize(numTriangles * 3);
+  ctm.LoadBuffer(CTM_INDICES, &aMesh->mIndices[0],
+                 aMesh->mIndices.size() * sizeof(CTMuint));
   aMesh->mVertices.resize(numVertices);
-  const CTMfloat * vertices = ctm.GetFloatArray(CTM_VERTICES);
-  for(CTMuint i = 0; i < numVertices; ++ i)
-  {
-    aMesh->mVertices[i].x = vertices[i * 3];
-    aMesh->mVertices[i].y = vertices[i * 3 + 1];
-    aMesh->mVertices[i].z = vertices[i * 3 + 2];
-  }
+  ctm.LoadBuffer(CTM_VERTICES, &aMesh->mVertices[0].x,
+                 aMesh->mVertices.size() * sizeof(Vector3), sizeof(Vector3));
 
-  // Extract normals
+  // Normals
   if(ctm.GetInteger(CTM_HAS_NORMALS) == CTM_TRUE)
   {
     aMesh->mNormals.resize(numVertices);
-    const CTMfloat * normals = ctm.GetFloatArray(CTM_NORMALS);
-    for(CTMuint i = 0; i < numVertices; ++ i)
-    {
-      aMesh->mNormals[i].x = normals[i * 3];
-      aMesh->mNormals[i].y = normals[i * 3 + 1];
-      aMesh->mNormals[i].z = normals[i * 3 + 2];
-    }
+    ctm.LoadBuffer(CTM_NORMALS, &aMesh->mNormals[0].x,
+                   aMesh->mNormals.size() * sizeof(Vector3), sizeof(Vector3));
   }
 
-  // Extract texture coordinates
+  // Texture coordinates
   if(ctm.GetInteger(CTM_UV_MAP_COUNT) > 0)
   {
     aMesh->mTexCoords.resize(numVertices);
-    const CTMfloat * texCoords = ctm.GetFloatArray(CTM_UV_MAP_1);
-    for(CTMuint i = 0; i < numVertices; ++ i)
-    {
-      aMesh->mTexCoords[i].u = texCoords[i * 2];
-      aMesh->mTexCoords[i].v = texCoords[i * 2 + 1];
-    }
+    ctm.LoadBuffer(CTM_UV_MAP_1, &aMesh->mTexCoords[0].u,
+                   aMesh->mTexCoords.size() * sizeof(Vector2), sizeof(Vector2));
     const char * str = ctm.GetUVMapString(CTM_UV_MAP_1, CTM_FILE_NAME);
     if(str)
       aMesh->mTexFileName = string(str);
@@ -97,11 +82,22 @@ void Import_CTM(const char * aFileName, Mesh * aMesh)
       aMesh->mTexFileName = string("");
   }
 
-  // Extract colors
+  // Colors (output buffers can only be set for the first eight maps, later
+  // maps are copied from the context after loading)
   CTMenum colorAttrib = ctm.GetNamedAttribMap("Color");
   if(colorAttrib != CTM_NONE)
   {
     aMesh->mColors.resize(numVertices);
+    if(colorAttrib <= CTM_ATTRIB_MAP_8)
+      ctm.LoadBuffer(colorAttrib, &aMesh->mColors[0].x,
+                     aMesh->mColors.size() * sizeof(Vector4), sizeof(Vector4));
+  }
+
+  // Load the file
+  ctm.Load(aFileName);
+
+  if((colorAttrib != CTM_NONE) && (colorAttrib > CTM_ATTRIB_MAP_8))
+  {
     const CTMfloat * colors = ctm.GetFloatArray(colorAttrib);
     for(CTMuint i = 0; i < numVertices; ++ i)
     {
@@ -148,9 +144,10 @@ void Export_CTM(const char * aFileName, Mesh * aMesh, Options &aOptions)
   if(aMesh->mComment.size() > 0)
     ctm.FileComment(aMesh->mComment.c_str());
 
-  // Set compression method and level
+  // Set compression method, level and backend
   ctm.CompressionMethod(aOptions.mMethod);
   ctm.CompressionLevel(aOptions.mLevel);
+  ctm.CompressionBackend(aOptions.mBackend);
 
   // Set vertex precision
   if(aOptions.mVertexPrecision > 0.0f)
@@ -158,8 +155,13 @@ void Export_CTM(const char * aFileName, Mesh * aMesh, Options &aOptions)
   else
     ctm.VertexPrecisionRel(aOptions.mVertexPrecisionRel);
 
-  // Set normal precision
+  // Set normal precision and coding mode
   ctm.NormalPrecision(aOptions.mNormalPrecision);
+  ctm.NormalMode(aOptions.mNormalMode);
+
+  // Let the library pick the method, level and vertex precision?
+  if(aOptions.mMaxError >= 0.0f)
+    ctm.Optimize(aOptions.mOptimizeTarget, CTM_ERROR_MAX, aOptions.mMaxError);
 
   // Export file
   ctm.Save(aFileName);
@@ -165,12 +165,17 @@ int main(int argc, char ** argv)
     cout << "  --no-texcoords  Do not export texture coordinates." << endl;
     cout << "  --no-colors     Do not export vertex colors." << endl;
     cout << endl << " OpenCTM output" << endl;
-    cout << "  --method arg    Select compression method (RAW, MG1, MG2)" << endl;
+    cout << "  --method arg    Select compression method (RAW, MG1, MG2, MG3, MG4)" << endl;
     cout << "  --level arg     Set the compression level (0 - 9)" << endl;
-    cout << endl << " OpenCTM MG2 method" << endl;
+    cout << "  --backend arg   Select entropy backend (LZMA, STORED, ZSTD, LZ4)" << endl;
+    cout << "  --maxerror arg  Select method, level and vertex precision automatically," << endl;
+    cout << "                  allowing vertices to move at most this distance" << endl;
+    cout << "  --optimize arg  Optimize for (SIZE, DECODE) with --maxerror (default SIZE)" << endl;
+    cout << endl << " OpenCTM MG2/MG3/MG4 methods" << endl;
     cout << "  --vprec arg     Set vertex precision" << endl;
     cout << "  --vprecrel arg  Set vertex precision, relative method" << endl;
     cout << "  --nprec arg     Set normal precision" << endl;
+    cout << "  --nmode arg     Select normal coding (SPHERICAL, OCTAHEDRAL)" << endl;
     cout << "  --tprec arg     Set texture map precision" << endl;
     cout << "  --cprec arg     Set color precision" << endl;
     cout << endl << " Miscellaneous" << endl;